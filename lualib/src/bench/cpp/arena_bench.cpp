@@ -0,0 +1,94 @@
+//per-request states: each request creates a state, builds a heap of tables,
+//strings and closures, and closes the state. prints the time spent running
+//and the time spent closing for states using malloc, SlabAllocator and
+//ArenaAllocator (closed with LUA_GCBULKCLOSE). built by the host CMake
+//build (see CMakeLists.txt in this directory), run as
+//  ./arena_bench [requests] [objects per request]
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include "lua/lua.hpp"
+#include "luaslab.h"
+#include "luaarena.h"
+
+using namespace std;
+
+static const char* kRequest =
+    "local n = ...\n"
+    "local mt = {__gc = function() finalized() end}\n"
+    "local heap = {}\n"
+    "for i = 1, n do\n"
+    "  local name = 'item' .. i\n"
+    "  heap[i] = {id = i, name = name, tags = {i, i * 2},\n"
+    "             get = function() return name end}\n"
+    "  if i % 100 == 0 then setmetatable(heap[i], mt) end\n"
+    "end\n"
+    "keep = heap\n";
+
+static long finalized_count = 0;
+
+static int finalized(lua_State*)
+{
+    finalized_count++;
+    return 0;
+}
+
+struct Times
+{
+    double run;
+    double close;
+};
+
+static void runRequest(lua_State* L, int objects)
+{
+    luaL_openlibs(L);
+    lua_register(L, "finalized", finalized);
+    if (luaL_loadstring(L, kRequest) || (lua_pushinteger(L, objects), lua_pcall(L, 1, 0, 0)))
+        fprintf(stderr, "request: %s\n", lua_tostring(L, -1));
+}
+
+static Times runRequests(int kind, int requests, int objects)
+{
+    typedef chrono::steady_clock Clock;
+    Times times = {0, 0};
+    SlabAllocator slab;
+    ArenaAllocator arena;
+    for (int i = 0; i < requests; i++)
+    {
+        Clock::time_point start = Clock::now();
+        lua_State* L;
+        if (1 == kind)
+            L = lua_newstate(SlabAllocator::alloc, &slab);
+        else if (2 == kind)
+            L = lua_newstate(ArenaAllocator::alloc, &arena);
+        else
+            L = luaL_newstate();
+        if (2 == kind)
+            lua_gc(L, LUA_GCBULKCLOSE, 1);
+        runRequest(L, objects);
+        Clock::time_point ran = Clock::now();
+        lua_close(L);
+        if (2 == kind)
+            arena.release();
+        times.run += chrono::duration<double>(ran - start).count();
+        times.close += chrono::duration<double>(Clock::now() - ran).count();
+    }
+    return times;
+}
+
+int main(int argc, char* argv[])
+{
+    int requests = argc > 1 ? atoi(argv[1]) : 200;
+    int objects = argc > 2 ? atoi(argv[2]) : 20000;
+    const char* names[] = {"malloc", "slab", "arena"};
+    for (int kind = 0; kind < 3; kind++)
+    {
+        finalized_count = 0;
+        Times times = runRequests(kind, requests, objects);
+        if (finalized_count != static_cast<long>(requests) * (objects / 100))
+            fprintf(stderr, "%s: %ld finalizers called\n", names[kind], finalized_count);
+        printf("%-7s run %8.3f s  close %8.3f s  (%d requests of %d objects)\n",
+               names[kind], times.run, times.close, requests, objects);
+    }
+    return 0;
+}
@@ -0,0 +1,330 @@
+//runs the classic benchmark programs of bench/lua/classic through
+//LuaState::parseFile and prints, as JSON on stdout, for each program: the
+//wall time of each run, the number of VM instructions, the peak memory
+//seen by the allocator, the number of collections and a hash of the
+//output (which changes if a change breaks a program). the instruction
+//count, peak memory and collections come from one extra run with a count
+//hook and a counting allocator, so that they do not slow the timed runs.
+//built by the host CMake build, run as
+//  classic_bench [--runs N] [--dir DIR] [--allocator malloc|slab|arena] [program[=arg] ...]
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "luastate.h"
+
+using namespace std;
+
+#ifndef CLASSIC_DIR
+#define CLASSIC_DIR "bench/lua/classic"
+#endif
+
+struct Program
+{
+    string name;
+    string arg;
+};
+
+//programs and their default arguments, sized for about a second each
+static const char* const kPrograms[][2] = {
+    {"binarytrees", "14"},
+    {"nbody", "250000"},
+    {"spectralnorm", "400"},
+    {"fannkuchredux", "9"},
+    {"fasta", "250000"},
+    {"knucleotide", "50000"},
+    {"richards", "100"},
+    {"json", "10"},
+};
+
+//instructions between two calls of the count hook
+static const int kHookCount = 1000;
+
+struct Output
+{
+    unsigned long long hash;  //FNV-1a of everything written
+    size_t bytes;
+};
+
+struct Metrics
+{
+    unsigned long long instructions;
+    size_t peak_bytes;
+    int gc_cycles;
+    Output output;
+};
+
+struct Result
+{
+    Program program;
+    vector<double> times;
+    Metrics metrics;
+    string error;
+};
+
+//counting allocator put in front of the allocator of the state
+struct Counter
+{
+    lua_Alloc alloc;
+    void* ud;
+    size_t bytes;
+    size_t peak;
+};
+
+static unsigned long long instruction_count = 0;
+
+static void countHook(lua_State*, lua_Debug*)
+{
+    instruction_count += kHookCount;
+}
+
+static void* countingAlloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+    Counter* counter = static_cast<Counter*>(ud);
+    void* block = counter->alloc(counter->ud, ptr, osize, nsize);
+    if (block || 0 == nsize)
+    {
+        counter->bytes += nsize;
+        counter->bytes -= ptr ? osize : 0;
+        counter->peak = max(counter->peak, counter->bytes);
+    }
+    return block;
+}
+
+static void addOutput(Output* output, const char* s, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        output->hash ^= static_cast<unsigned char>(s[i]);
+        output->hash *= 1099511628211ULL;
+    }
+    output->bytes += len;
+}
+
+//print and io.write replacements, which only hash what they are given
+static int outputPrint(lua_State* L)
+{
+    Output* output = static_cast<Output*>(lua_touserdata(L, lua_upvalueindex(1)));
+    int n = lua_gettop(L);
+    for (int i = 1; i <= n; i++)
+    {
+        size_t len;
+        const char* s = luaL_tolstring(L, i, &len);
+        if (i > 1)
+            addOutput(output, "\t", 1);
+        addOutput(output, s, len);
+        lua_pop(L, 1);
+    }
+    addOutput(output, "\n", 1);
+    return 0;
+}
+
+static int outputWrite(lua_State* L)
+{
+    Output* output = static_cast<Output*>(lua_touserdata(L, lua_upvalueindex(1)));
+    int n = lua_gettop(L);
+    for (int i = 1; i <= n; i++)
+    {
+        size_t len;
+        const char* s = luaL_checklstring(L, i, &len);
+        addOutput(output, s, len);
+    }
+    return 0;
+}
+
+static void captureOutput(lua_State* L, Output* output)
+{
+    output->hash = 14695981039346656037ULL;
+    output->bytes = 0;
+    lua_pushlightuserdata(L, output);
+    lua_pushcclosure(L, outputPrint, 1);
+    lua_setglobal(L, "print");
+    lua_getglobal(L, "io");
+    lua_pushlightuserdata(L, output);
+    lua_pushcclosure(L, outputWrite, 1);
+    lua_setfield(L, -2, "write");
+    lua_pop(L, 1);
+}
+
+static void setArg(lua_State* L, const string& file, const string& arg)
+{
+    lua_createtable(L, 1, 1);
+    lua_pushstring(L, file.c_str());
+    lua_rawseti(L, -2, 0);
+    lua_pushstring(L, arg.c_str());
+    lua_rawseti(L, -2, 1);
+    lua_setglobal(L, "arg");
+}
+
+//runs the program once; with 'metrics', also counts instructions, memory and collections
+static bool runProgram(const string& file, const Program& program, LuaState::Allocator allocator,
+                       double* time, Metrics* metrics, string* error)
+{
+    typedef chrono::steady_clock Clock;
+    LuaState state(allocator);
+    lua_State* L = state.getState();
+    Output output;
+    captureOutput(L, &output);
+    setArg(L, file, program.arg);
+
+    Counter counter;
+    if (metrics)
+    {
+        counter.alloc = lua_getallocf(L, &counter.ud);
+        counter.bytes = counter.peak = luaGetMemory(L);
+        lua_setallocf(L, countingAlloc, &counter);
+        instruction_count = 0;
+        lua_sethook(L, countHook, LUA_MASKCOUNT, kHookCount);
+    }
+
+    Clock::time_point start = Clock::now();
+    int err = state.parseFile(file);
+    *time = chrono::duration<double>(Clock::now() - start).count();
+    if (0 != err)
+    {
+        *error = state.getError();
+        return false;
+    }
+
+    if (metrics)
+    {
+        lua_sethook(L, 0, 0, 0);
+        metrics->instructions = instruction_count;
+        metrics->peak_bytes = counter.peak;
+        metrics->gc_cycles = lua_gc(L, LUA_GCCYCLES, 0);
+        metrics->output = output;
+        //close through the original allocator, as 'counter' goes away first
+        lua_setallocf(L, counter.alloc, counter.ud);
+    }
+    return true;
+}
+
+static Result runBenchmark(const string& dir, const Program& program, int runs, LuaState::Allocator allocator)
+{
+    Result result;
+    result.program = program;
+    string file = dir + "/" + program.name + ".lua";
+    double time;
+    if (!runProgram(file, program, allocator, &time, &result.metrics, &result.error))
+        return result;
+    for (int i = 0; i < runs; i++)
+    {
+        if (!runProgram(file, program, allocator, &time, 0, &result.error))
+            return result;
+        result.times.push_back(time);
+    }
+    return result;
+}
+
+static void printJson(const vector<Result>& results, int runs, const char* allocator)
+{
+    printf("{\n");
+    printf("  \"lua\": \"%s\",\n", LUA_RELEASE);
+    printf("  \"allocator\": \"%s\",\n", allocator);
+    printf("  \"runs\": %d,\n", runs);
+    printf("  \"programs\": [");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& r = results[i];
+        printf("%s\n    {\"name\": \"%s\", \"arg\": \"%s\"", i > 0 ? "," : "",
+               r.program.name.c_str(), r.program.arg.c_str());
+        if (!r.error.empty())
+        {
+            string error;
+            for (size_t k = 0; k < r.error.size(); k++)
+            {
+                char c = r.error[k];
+                if ('"' == c || '\\' == c)
+                    error += '\\';
+                error += static_cast<unsigned char>(c) < 0x20 ? ' ' : c;
+            }
+            printf(", \"error\": \"%s\"}", error.c_str());
+            continue;
+        }
+        vector<double> sorted(r.times);
+        sort(sorted.begin(), sorted.end());
+        printf(", \"wall_min_s\": %.6f, \"wall_median_s\": %.6f, \"times_s\": [",
+               sorted[0], sorted[sorted.size() / 2]);
+        for (size_t k = 0; k < r.times.size(); k++)
+            printf("%s%.6f", k > 0 ? ", " : "", r.times[k]);
+        printf("], \"instructions\": %llu, \"peak_bytes\": %zu, \"gc_cycles\": %d, "
+               "\"output_bytes\": %zu, \"output_hash\": \"%016llx\"}",
+               r.metrics.instructions, r.metrics.peak_bytes, r.metrics.gc_cycles,
+               r.metrics.output.bytes, r.metrics.output.hash);
+    }
+    printf("\n  ]\n}\n");
+}
+
+int main(int argc, char* argv[])
+{
+    int runs = 3;
+    string dir = CLASSIC_DIR;
+    LuaState::Allocator allocator = LuaState::kMalloc;
+    const char* allocator_name = "malloc";
+    vector<Program> programs;
+    for (int i = 1; i < argc; i++)
+    {
+        string opt(argv[i]);
+        if ("--runs" == opt && i + 1 < argc)
+            runs = max(1, atoi(argv[++i]));
+        else if ("--dir" == opt && i + 1 < argc)
+            dir = argv[++i];
+        else if ("--allocator" == opt && i + 1 < argc)
+        {
+            allocator_name = argv[++i];
+            if (0 == strcmp(allocator_name, "slab"))
+                allocator = LuaState::kSlab;
+            else if (0 == strcmp(allocator_name, "arena"))
+                allocator = LuaState::kArena;
+            else
+                allocator_name = "malloc";
+        }
+        else
+        {
+            //program or program=arg
+            Program program;
+            size_t eq = opt.find('=');
+            program.name = opt.substr(0, eq);
+            for (size_t k = 0; k < sizeof(kPrograms) / sizeof(kPrograms[0]); k++)
+                if (program.name == kPrograms[k][0])
+                    program.arg = kPrograms[k][1];
+            if (string::npos != eq)
+                program.arg = opt.substr(eq + 1);
+            programs.push_back(program);
+        }
+    }
+    if (programs.empty())
+    {
+        for (size_t k = 0; k < sizeof(kPrograms) / sizeof(kPrograms[0]); k++)
+        {
+            Program program;
+            program.name = kPrograms[k][0];
+            program.arg = kPrograms[k][1];
+            programs.push_back(program);
+        }
+    }
+
+    vector<Result> results;
+    int failed = 0;
+    for (size_t i = 0; i < programs.size(); i++)
+    {
+        results.push_back(runBenchmark(dir, programs[i], runs, allocator));
+        const Result& r = results.back();
+        if (!r.error.empty())
+        {
+            failed++;
+            fprintf(stderr, "%-14s %s\n", r.program.name.c_str(), r.error.c_str());
+        }
+        else
+        {
+            fprintf(stderr, "%-14s %8.3f s  %12llu instructions  %8zu KB peak  %5d collections\n",
+                    r.program.name.c_str(), *min_element(r.times.begin(), r.times.end()),
+                    r.metrics.instructions, r.metrics.peak_bytes / 1024, r.metrics.gc_cycles);
+        }
+    }
+    printJson(results, runs, allocator_name);
+    return failed > 0 ? 1 : 0;
+}
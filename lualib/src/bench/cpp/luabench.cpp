@@ -0,0 +1,385 @@
+//host benchmark of the VM: runs each benchmark in a LuaState and prints the
+//results as JSON on stdout (a summary goes to stderr), so that runs can be
+//compared to find regressions. built by the host CMake build, run as
+//  luabench [--runs N] [--scale X] [--filter TEXT] [--allocator malloc|slab|arena]
+//each benchmark defines bench(n), called once to warm up and then --runs
+//times, each time after a full collection; n is the benchmark size times
+//--scale. when the core is built with LUA_VMSTATS, each result also gets
+//the most executed opcodes and opcode pairs and the slow-path fallbacks of
+//all its calls of bench(n).
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "luastate.h"
+
+using namespace std;
+
+struct Benchmark
+{
+    const char* name;
+    int n;
+    const char* code;
+};
+
+static const Benchmark kBenchmarks[] = {
+    //VM dispatch
+    {"vm.arith", 20000000,
+        "function bench(n)\n"
+        "  local s, f = 0, 0.5\n"
+        "  for i = 1, n do s = s + i * 3 - (i // 7); f = f * 1.0000001 + 0.25 end\n"
+        "  return s, f\n"
+        "end\n"},
+    {"vm.calls", 10000000,
+        "local function add(a, b) return a + b end\n"
+        "function bench(n)\n"
+        "  local s = 0\n"
+        "  for i = 1, n do s = add(s, i) end\n"
+        "  return s\n"
+        "end\n"},
+    {"vm.closures", 2000000,
+        "function bench(n)\n"
+        "  local f\n"
+        "  for i = 1, n do f = function() return i end end\n"
+        "  return f()\n"
+        "end\n"},
+    {"vm.upvalues", 10000000,
+        "local count = 0\n"
+        "local function inc() count = count + 1 end\n"
+        "function bench(n) for i = 1, n do inc() end return count end\n"},
+    {"vm.method_calls", 5000000,
+        "local Point = {}\n"
+        "Point.__index = Point\n"
+        "function Point:len2() return self.x * self.x + self.y * self.y end\n"
+        "local p = setmetatable({x = 3, y = 4}, Point)\n"
+        "function bench(n)\n"
+        "  local s = 0\n"
+        "  for i = 1, n do s = s + p:len2() end\n"
+        "  return s\n"
+        "end\n"},
+    //tables
+    {"table.array_append", 5000000,
+        "function bench(n)\n"
+        "  local t = {}\n"
+        "  for i = 1, n do t[#t + 1] = i end\n"
+        "  return #t\n"
+        "end\n"},
+    {"table.array_read", 20000000,
+        "local t = {}\n"
+        "for i = 1, 1000 do t[i] = i end\n"
+        "function bench(n)\n"
+        "  local s = 0\n"
+        "  for i = 1, n do s = s + t[i % 1000 + 1] end\n"
+        "  return s\n"
+        "end\n"},
+    {"table.hash_insert", 2000000,
+        "function bench(n)\n"
+        "  local t = {}\n"
+        "  for i = 1, n do t[i * 7 + 0.5] = i end\n"
+        "  return t[7.5]\n"
+        "end\n"},
+    {"table.string_keys", 2000000,
+        "local keys = {}\n"
+        "for i = 1, 1000 do keys[i] = 'key' .. i end\n"
+        "function bench(n)\n"
+        "  local t, s = {}, 0\n"
+        "  for i = 1, n do local k = keys[i % 1000 + 1]; t[k] = i; s = s + t[k] end\n"
+        "  return s\n"
+        "end\n"},
+    {"table.fields", 10000000,
+        "function bench(n)\n"
+        "  local o = {x = 1, y = 2, z = 3}\n"
+        "  for i = 1, n do o.x = o.y + o.z; o.y = o.x - i end\n"
+        "  return o.x\n"
+        "end\n"},
+    {"table.pairs", 200,
+        "local t = {}\n"
+        "for i = 1, 10000 do t['k' .. i] = i; t[i] = i end\n"
+        "function bench(n)\n"
+        "  local s = 0\n"
+        "  for r = 1, n do for k, v in pairs(t) do s = s + v end end\n"
+        "  return s\n"
+        "end\n"},
+    {"table.insert_remove", 2000000,
+        "local insert, remove = table.insert, table.remove\n"
+        "function bench(n)\n"
+        "  local t = {}\n"
+        "  for i = 1, n do insert(t, i); if i % 3 == 0 then remove(t) end end\n"
+        "  return #t\n"
+        "end\n"},
+    //string interning
+    {"string.intern_new", 2000000,
+        "function bench(n)\n"
+        "  local s\n"
+        "  for i = 1, n do s = 'str' .. i end\n"
+        "  return s\n"
+        "end\n"},
+    {"string.intern_existing", 2000000,
+        "local keep = {}\n"
+        "for i = 1, 1000 do keep[i] = 'str' .. i end\n"
+        "function bench(n)\n"
+        "  local s\n"
+        "  for i = 1, n do s = 'str' .. (i % 1000 + 1) end\n"
+        "  return s\n"
+        "end\n"},
+    {"string.concat", 200000,
+        "function bench(n)\n"
+        "  local parts = {}\n"
+        "  for i = 1, n do parts[#parts + 1] = 'item' .. i .. ';' end\n"
+        "  return #table.concat(parts)\n"
+        "end\n"},
+    //garbage collection
+    {"gc.churn", 5000000,
+        "function bench(n)\n"
+        "  local t\n"
+        "  for i = 1, n do t = {i, i} end\n"
+        "  return t[1]\n"
+        "end\n"},
+    {"gc.full_collect", 20,
+        "heap = {}\n"
+        "for i = 1, 200000 do heap[i] = {id = i, name = 'n' .. i, list = {i}} end\n"
+        "function bench(n) for i = 1, n do collectgarbage() end end\n"},
+    {"gc.retained_churn", 1000000,
+        "function bench(n)\n"
+        "  local ring = {}\n"
+        "  for i = 1, n do ring[i % 50000 + 1] = {i, tostring(i)} end\n"
+        "  return #ring\n"
+        "end\n"},
+    //pattern matching
+    {"pattern.find", 200000,
+        "local text = string.rep('abc def ghi ', 10) .. 'key=value'\n"
+        "function bench(n)\n"
+        "  local c = 0\n"
+        "  for i = 1, n do if text:find('(%w+)=(%w+)') then c = c + 1 end end\n"
+        "  return c\n"
+        "end\n"},
+    {"pattern.gmatch", 200000,
+        "local text = string.rep('word1 word2 word3 ', 10)\n"
+        "function bench(n)\n"
+        "  local c = 0\n"
+        "  for i = 1, n do for w in text:gmatch('%a+%d') do c = c + 1 end end\n"
+        "  return c\n"
+        "end\n"},
+    {"pattern.gsub", 200000,
+        "local text = string.rep('hello world ', 10)\n"
+        "function bench(n)\n"
+        "  local s\n"
+        "  for i = 1, n do s = text:gsub('o', '0') end\n"
+        "  return s\n"
+        "end\n"},
+    //string.format
+    {"format.mixed", 1000000,
+        "local format = string.format\n"
+        "function bench(n)\n"
+        "  local s\n"
+        "  for i = 1, n do s = format('%d: %s = %.3f', i, 'value', i / 7) end\n"
+        "  return s\n"
+        "end\n"},
+    {"format.integers", 2000000,
+        "local format = string.format\n"
+        "function bench(n)\n"
+        "  local s\n"
+        "  for i = 1, n do s = format('%d', i) end\n"
+        "  return s\n"
+        "end\n"},
+};
+
+//opcodes and opcode pairs listed per benchmark
+static const size_t kTopVmCounts = 12;
+
+struct Result
+{
+    string name;
+    long n;
+    vector<double> times;
+    string error;
+    bool has_vm_stats;
+    LuaCounts opcodes;
+    LuaCounts pairs;
+    LuaCounts slow_paths;
+};
+
+struct Options
+{
+    int runs;
+    double scale;
+    string filter;
+    LuaState::Allocator allocator;
+    const char* allocator_name;
+};
+
+static bool parseOptions(int argc, char* argv[], Options& options)
+{
+    options.runs = 5;
+    options.scale = 1.0;
+    options.allocator = LuaState::kMalloc;
+    options.allocator_name = "malloc";
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+            return false;
+        string opt(argv[i]);
+        const char* value = argv[++i];
+        if ("--runs" == opt)
+            options.runs = max(1, atoi(value));
+        else if ("--scale" == opt)
+            options.scale = atof(value);
+        else if ("--filter" == opt)
+            options.filter = value;
+        else if ("--allocator" == opt)
+        {
+            options.allocator_name = value;
+            if (0 == strcmp(value, "malloc"))
+                options.allocator = LuaState::kMalloc;
+            else if (0 == strcmp(value, "slab"))
+                options.allocator = LuaState::kSlab;
+            else if (0 == strcmp(value, "arena"))
+                options.allocator = LuaState::kArena;
+            else
+                return false;
+        }
+        else
+            return false;
+    }
+    return true;
+}
+
+static Result runBenchmark(const Benchmark& benchmark, const Options& options)
+{
+    typedef chrono::steady_clock Clock;
+    Result result;
+    result.name = benchmark.name;
+    result.n = max(1L, static_cast<long>(benchmark.n * options.scale));
+    result.has_vm_stats = false;
+
+    LuaState state(options.allocator);
+    if (0 != state.parseLine(benchmark.code))
+    {
+        result.error = state.getError();
+        return result;
+    }
+    lua_State* L = state.getState();
+    state.resetVmStats();
+    for (int run = -1; run < options.runs; run++)  //run -1 warms up
+    {
+        lua_gc(L, LUA_GCCOLLECT, 0);
+        state.getGlobal("bench");
+        lua_pushinteger(L, result.n);
+        Clock::time_point start = Clock::now();
+        int err = luaCallFunc(L, 1, 0);
+        double time = chrono::duration<double>(Clock::now() - start).count();
+        if (0 != err)
+        {
+            result.error = luaGetError(L, err);
+            return result;
+        }
+        if (run >= 0)
+            result.times.push_back(time);
+    }
+    result.has_vm_stats = state.getVmStats(LUA_VMOPCODES, result.opcodes);
+    state.getVmStats(LUA_VMPAIRS, result.pairs);
+    state.getVmStats(LUA_VMSLOWPATHS, result.slow_paths);
+    result.opcodes.resize(min(result.opcodes.size(), kTopVmCounts));
+    result.pairs.resize(min(result.pairs.size(), kTopVmCounts));
+    return result;
+}
+
+static string jsonString(const string& str)
+{
+    string out("\"");
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        char c = str[i];
+        if ('"' == c || '\\' == c)
+            out += string("\\") + c;
+        else if (static_cast<unsigned char>(c) < 0x20)
+            out += strFormat("\\u%04x", c);
+        else
+            out += c;
+    }
+    return out + "\"";
+}
+
+static string jsonCounts(const LuaCounts& counts)
+{
+    string out("{");
+    for (size_t i = 0; i < counts.size(); i++)
+        out += strFormat("%s%s: %lld", i > 0 ? ", " : "", jsonString(counts[i].first).c_str(), counts[i].second);
+    return out + "}";
+}
+
+static void printJson(const vector<Result>& results, const Options& options)
+{
+    printf("{\n");
+    printf("  \"lua\": %s,\n", jsonString(LUA_RELEASE).c_str());
+    printf("  \"allocator\": %s,\n", jsonString(options.allocator_name).c_str());
+    printf("  \"runs\": %d,\n", options.runs);
+    printf("  \"scale\": %g,\n", options.scale);
+    printf("  \"benchmarks\": [");
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const Result& result = results[i];
+        printf("%s\n    {\"name\": %s, \"n\": %ld", i > 0 ? "," : "", jsonString(result.name).c_str(), result.n);
+        if (!result.error.empty())
+        {
+            printf(", \"error\": %s}", jsonString(result.error).c_str());
+            continue;
+        }
+        vector<double> sorted(result.times);
+        sort(sorted.begin(), sorted.end());
+        double sum = 0;
+        for (size_t k = 0; k < sorted.size(); k++)
+            sum += sorted[k];
+        double median = sorted.size() % 2 ? sorted[sorted.size() / 2] :
+                (sorted[sorted.size() / 2 - 1] + sorted[sorted.size() / 2]) / 2;
+        printf(", \"min_s\": %.6f, \"median_s\": %.6f, \"mean_s\": %.6f, \"ns_per_op\": %.3f, \"times_s\": [",
+               sorted[0], median, sum / sorted.size(), sorted[0] * 1e9 / result.n);
+        for (size_t k = 0; k < result.times.size(); k++)
+            printf("%s%.6f", k > 0 ? ", " : "", result.times[k]);
+        printf("]");
+        if (result.has_vm_stats)
+        {
+            printf(",\n     \"vm\": {\"opcodes\": %s,\n            \"pairs\": %s,\n            \"slow_paths\": %s}",
+                   jsonCounts(result.opcodes).c_str(), jsonCounts(result.pairs).c_str(),
+                   jsonCounts(result.slow_paths).c_str());
+        }
+        printf("}");
+    }
+    printf("\n  ]\n}\n");
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parseOptions(argc, argv, options))
+    {
+        fprintf(stderr, "usage: %s [--runs N] [--scale X] [--filter TEXT] [--allocator malloc|slab|arena]\n", argv[0]);
+        return 2;
+    }
+
+    vector<Result> results;
+    int failed = 0;
+    for (size_t i = 0; i < sizeof(kBenchmarks) / sizeof(kBenchmarks[0]); i++)
+    {
+        const Benchmark& benchmark = kBenchmarks[i];
+        if (!options.filter.empty() && !strstr(benchmark.name, options.filter.c_str()))
+            continue;
+        results.push_back(runBenchmark(benchmark, options));
+        const Result& result = results.back();
+        if (!result.error.empty())
+        {
+            failed++;
+            fprintf(stderr, "%-24s %s\n", result.name.c_str(), result.error.c_str());
+        }
+        else
+        {
+            fprintf(stderr, "%-24s %9.4f s (min of %d)\n", result.name.c_str(),
+                    *min_element(result.times.begin(), result.times.end()), options.runs);
+        }
+    }
+    printJson(results, options);
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,109 @@
+//runs a Lua script, then takes a LuaHeap snapshot of the state it leaves:
+//the census by type and size class and the objects retaining most memory
+//go to stdout, the time of the walk and of the analysis to stderr, and with
+//--snapshot the object graph is written as a .heapsnapshot file (Chrome
+//DevTools, Memory tab). with --sites N, every allocation of the script is
+//charged to the line of Lua code running (LuaState::setAllocSites) and the
+//N sites that allocated most bytes are printed too. built by the host
+//CMake build, run as
+//  luaheap [--top N] [--snapshot FILE] [--sites N] script.lua [arg ...]
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <chrono>
+#include "luastate.h"
+#include "luaheap.h"
+
+using namespace std;
+
+static void setArg(lua_State* L, char* argv[], int script, int argc)
+{
+    lua_createtable(L, argc - script - 1, 1);
+    for (int i = script; i < argc; i++)
+    {
+        lua_pushstring(L, argv[i]);
+        lua_rawseti(L, -2, i - script);
+    }
+    lua_setglobal(L, "arg");
+}
+
+int main(int argc, char* argv[])
+{
+    typedef chrono::steady_clock Clock;
+    int top = 20;
+    int sites = 0;
+    string snapshot;
+    int script = 1;
+    for (; script + 1 < argc && '-' == argv[script][0]; script += 2)
+    {
+        string opt(argv[script]);
+        if ("--top" == opt)
+            top = atoi(argv[script + 1]);
+        else if ("--snapshot" == opt)
+            snapshot = argv[script + 1];
+        else if ("--sites" == opt)
+            sites = atoi(argv[script + 1]);
+        else
+            break;
+    }
+    if (script >= argc || '-' == argv[script][0])
+    {
+        fprintf(stderr, "usage: %s [--top N] [--snapshot FILE] [--sites N] script.lua [arg ...]\n", argv[0]);
+        return 2;
+    }
+
+    LuaState state;
+    setArg(state.getState(), argv, script, argc);
+    if (sites > 0)
+        state.setAllocSites(true);
+    Clock::time_point start = Clock::now();
+    int err = state.parseFile(argv[script]);
+    double run = chrono::duration<double>(Clock::now() - start).count();
+    if (0 != err)
+    {
+        fprintf(stderr, "%s\n", state.getError().c_str());
+        return 1;
+    }
+    fprintf(stderr, "script ran in %.3f s\n", run);
+
+    if (sites > 0)
+    {
+        vector<lua_AllocSite> allocs;
+        state.getAllocSites(sites, allocs);
+        state.setAllocSites(false);
+        printf("%12s %10s site\n", "bytes", "count");
+        for (size_t i = 0; i < allocs.size(); i++)
+            printf("%12lld %10lld %s\n", static_cast<long long>(allocs[i].bytes),
+                   static_cast<long long>(allocs[i].count), luaAllocSiteName(allocs[i]).c_str());
+        printf("\n");
+    }
+
+    LuaHeap heap;
+    start = Clock::now();
+    heap.capture(state.getState());
+    double capture = chrono::duration<double>(Clock::now() - start).count();
+    fprintf(stderr, "%zu objects, %zu references, %zu bytes (%zu reachable), %zu bytes in use; captured in %.3f s\n",
+            heap.getObjects(), heap.getReferences(), heap.getTotalSize(), heap.getReachableSize(),
+            state.getMemory(), capture);
+
+    printf("%-8s %10s %10s %12s %10s\n", "type", "class", "objects", "bytes", "unreachable");
+    fputs(heap.getCensus().c_str(), stdout);
+    printf("\n%12s %10s object path\n", "retained", "self");
+    fputs(heap.getRetainers(top).c_str(), stdout);
+
+    if (!snapshot.empty())
+    {
+        string json = heap.getHeapSnapshot();
+        FILE* file = fopen(snapshot.c_str(), "wb");
+        if (!file || fwrite(json.data(), 1, json.size(), file) != json.size())
+        {
+            fprintf(stderr, "cannot write %s\n", snapshot.c_str());
+            if (file)
+                fclose(file);
+            return 1;
+        }
+        fclose(file);
+    }
+    return 0;
+}
@@ -0,0 +1,456 @@
+//checks that the bytecode optimizer (LuaState::setOptimize, lua/lopt.c)
+//does not change what programs do: every case runs in a state that loads
+//it as compiled and in one that optimizes it, and both must write the
+//same output (print and io.write) and raise the same error, traceback
+//included (so with the same lines and the same variable names). the
+//built-in cases go after what the passes change: constants in locals,
+//folding limits, dead branches, upvalues, moves, jumps, constants in
+//loops, coroutines and error messages; the classic programs of
+//bench/lua/classic are run too, or the scripts given. for each case it prints the size of the stripped
+//bytecode (string.dump), the VM instructions run and the best time of
+//both, and it exits with 1 if any case differs. built by the host CMake
+//build, run as
+//  luaopt_check [--runs N] [--dir DIR] [script.lua[=arg] | program[=arg] ...]
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include "luastate.h"
+
+using namespace std;
+
+#ifndef CLASSIC_DIR
+#define CLASSIC_DIR "bench/lua/classic"
+#endif
+
+struct Case
+{
+    string name;
+    string source;  //chunk, or empty to load 'file'
+    string file;
+    string arg;
+};
+
+static const char* const kCases[][2] = {
+    {"constants",
+     "local a, b = 6, 7\n"
+     "local c = a * b\n"
+     "local d = -a\n"
+     "print(c, d, a / 4, a // 4, a % 4, a ^ 2, -a // 4, a - 0.5)\n"
+     "print(a & 3, a | 8, a ~ 5, a << 2, a >> 1, ~a)\n"
+     "local t = {}\n"
+     "t[a] = b; t[b] = a * 2\n"
+     "print(t[6], t[7], t[a], a == 6, a < b, a <= 5, b > a)\n"
+     "local big = math.maxinteger\n"
+     "print(big + 1 == math.mininteger, big * 2, 2^63, 1e308 * 10)\n"},
+    {"folding limits",
+     "local zero, fzero, half = 0, 0.0, 0.5\n"
+     "print(-fzero, 1 / -fzero, 0.0 * -1, fzero / fzero ~= fzero / fzero)\n"
+     "print(pcall(function() local z = 0; return 1 // z end))\n"
+     "print(pcall(function() local z = 0; return 1 % z end))\n"
+     "print(1 / zero, -1 // fzero, 3 % -fzero ~= 3 % -fzero)\n"
+     "print(pcall(function() local h = 1.5; return h | 1 end))\n"
+     "print(pcall(function() local h = 2.0; return h | 1, 3 << h end))\n"
+     "print(pcall(function() local s = '10'; return s + 1, s * half end))\n"
+     "print(pcall(function() local s = 'x'; local n = 3; return n + s end))\n"
+     "print(pcall(function() local n = 1; return n < 'x' end))\n"
+     "print(pcall(function() local n = 2; local f = 1.5; return n & f end))\n"},
+    {"dead branches",
+     "local DEBUG, NOTHING, count = false, nil, 0\n"
+     "if DEBUG then print('debug') else print('release') end\n"
+     "if NOTHING then print('nothing') end\n"
+     "if not DEBUG then count = count + 1 end\n"
+     "local on = true\n"
+     "if on and count > 0 then print('on', count) end\n"
+     "while DEBUG do print('never') end\n"
+     "repeat count = count + 1 until true\n"
+     "local n = 0\n"
+     "if n then print('zero is true') end\n"
+     "do return print('returned', count) end\n"},
+    {"upvalues",
+     "local x = 1\n"
+     "local function bump() x = x + 10 end\n"
+     "bump()\n"
+     "print(x + 1, x * 2)\n"
+     "local fs = {}\n"
+     "for i = 1, 3 do local k = i * 2; fs[i] = function() k = k + 1; return k end end\n"
+     "print(fs[1](), fs[1](), fs[2](), fs[3]())\n"
+     "local y = 5\n"
+     "local t = setmetatable({}, {__index = function() y = 100; return 0 end})\n"
+     "local z = t.any + y\n"
+     "print(z, y)\n"},
+    {"moves",
+     "local t = {x = 1, y = {z = 2}}\n"
+     "local a, b, c\n"
+     "a = t.x\n"
+     "b, c = t.y.z, t.x + 1\n"
+     "a, b = b, a\n"
+     "print(a, b, c)\n"
+     "local s = a .. '-' .. b .. '-' .. c\n"
+     "local len = #s\n"
+     "print(s, len, not a, -c)\n"
+     "local function pair() return 1, 2 end\n"
+     "local p, q = pair()\n"
+     "p, q = q, p\n"
+     "print(p, q)\n"},
+    {"jumps",
+     "local out = {}\n"
+     "for i = 1, 10 do\n"
+     "  if i % 2 == 0 then\n"
+     "    if i > 6 then break end\n"
+     "  elseif i == 3 then\n"
+     "    goto continue\n"
+     "  else\n"
+     "    out[#out + 1] = i\n"
+     "  end\n"
+     "  out[#out + 1] = -i\n"
+     "  ::continue::\n"
+     "end\n"
+     "print(table.concat(out, ' '))\n"
+     "local v = nil\n"
+     "local w = v or 5\n"
+     "local f = false\n"
+     "print(w, f and 1 or 2, v and v.x, (w > 3) and 'big' or 'small')\n"
+     "local i = 0\n"
+     "while true do i = i + 1; if i >= 3 then break end end\n"
+     "repeat local j = i; i = i - 1 until j <= 1\n"
+     "for k, val in ipairs({'a', 'b'}) do print(k, val) end\n"
+     "for k = 1, 2, 0.5 do io.write(k, ' ') end\n"
+     "print()\n"},
+    {"loop constants",
+     "local DEBUG, scale, step = false, 4, 0.5\n"
+     "local sum, n = 0, 0\n"
+     "for i = 1, 20000 do\n"
+     "  if DEBUG then print('never', i) end\n"
+     "  sum = sum + i * scale + step\n"
+     "end\n"
+     "print(sum)\n"
+     "local k = 1\n"
+     "for i = 1, 5 do io.write(k * 2, ' '); k = k + i end\n"
+     "print()\n"
+     "local m, acc = 3, 0\n"
+     "while acc < 20 do\n"
+     "  acc = acc + m\n"
+     "  if acc > 10 then m = 1 end\n"
+     "end\n"
+     "print(acc, m)\n"
+     "local x = 2\n"
+     "::again::\n"
+     "n = n + x\n"
+     "if n < 10 then x = x + 1; goto again end\n"
+     "print(n, x)\n"
+     "for j = 1, 3 do\n"
+     "  local c = 10\n"
+     "  for q = 1, 2 do c = c + j * q end\n"
+     "  io.write(c, ' ')\n"
+     "end\n"
+     "print()\n"},
+    {"varargs",
+     "local function f(...) local n = select('#', ...); return n, ... end\n"
+     "print(f(1, nil, 3))\n"
+     "local function g(a, ...) local t = {...}; return a, #t, ... end\n"
+     "print(g(1, 2, 3))\n"
+     "print(string.format('%d %s', f(7)))\n"},
+    {"coroutines",
+     "local mt = {}\n"
+     "mt.__index = function(t, k) coroutine.yield(k); return k .. '!' end\n"
+     "mt.__add = function(a, b) coroutine.yield('add'); return 42 end\n"
+     "local co = coroutine.wrap(function()\n"
+     "  local o = setmetatable({}, mt)\n"
+     "  local x, y\n"
+     "  x, y = o.foo, o + 1\n"
+     "  local z = o.bar\n"
+     "  print(x, y, z)\n"
+     "end)\n"
+     "print(co()); print(co()); print(co()); co()\n"},
+    {"debug",
+     "local function f(a)\n"
+     "  local b = 10\n"
+     "  local unused = a * 2\n"
+     "  local names = {}\n"
+     "  for i = 1, 10 do\n"
+     "    local name, value = debug.getlocal(1, i)\n"
+     "    if not name then break end\n"
+     "    names[#names + 1] = name .. '=' .. (type(value) == 'table' and 'table' or tostring(value))\n"
+     "  end\n"
+     "  return table.concat(names, ' '), debug.getinfo(1, 'l').currentline\n"
+     "end\n"
+     "print(f(3))\n"
+     "local dumped = load(string.dump(function(n) local k = 4; return n * k + 1 end))\n"
+     "print(dumped(5))\n"},
+    {"error in field",
+     "local t = {}\n"
+     "local k = 1\n"
+     "print(t[k])\n"
+     "t.x.y = k\n"},
+    {"error in call",
+     "local limit = 3\n"
+     "local function check(n)\n"
+     "  local bad\n"
+     "  if n > limit then\n"
+     "    bad = n + 1\n"
+     "    bad()\n"
+     "  end\n"
+     "  return check(n + 1)\n"
+     "end\n"
+     "check(1)\n"},
+    {"error in arithmetic",
+     "local scale = 2\n"
+     "local function area(w, h)\n"
+     "  local s = scale\n"
+     "  return w * s * h\n"
+     "end\n"
+     "print(area(2, 3))\n"
+     "print(area(2, nil))\n"},
+};
+
+//programs of bench/lua/classic and their arguments, sized for about a second each
+static const char* const kPrograms[][2] = {
+    {"binarytrees", "14"},
+    {"nbody", "250000"},
+    {"spectralnorm", "400"},
+    {"fannkuchredux", "9"},
+    {"fasta", "250000"},
+    {"knucleotide", "50000"},
+    {"richards", "100"},
+    {"json", "10"},
+};
+
+//instructions between two calls of the count hook
+static const int kHookCount = 100;
+
+struct Output
+{
+    unsigned long long hash;  //FNV-1a of everything written
+    size_t bytes;
+};
+
+struct Run
+{
+    Output output;
+    string error;
+    size_t dump_bytes;
+    unsigned long long instructions;
+    double time;
+};
+
+static unsigned long long instruction_count = 0;
+
+static void countHook(lua_State*, lua_Debug*)
+{
+    instruction_count += kHookCount;
+}
+
+static void addOutput(Output* output, const char* s, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        output->hash ^= static_cast<unsigned char>(s[i]);
+        output->hash *= 1099511628211ULL;
+    }
+    output->bytes += len;
+}
+
+//print and io.write replacements, which only hash what they are given
+static int outputPrint(lua_State* L)
+{
+    Output* output = static_cast<Output*>(lua_touserdata(L, lua_upvalueindex(1)));
+    int n = lua_gettop(L);
+    for (int i = 1; i <= n; i++)
+    {
+        size_t len;
+        const char* s = luaL_tolstring(L, i, &len);
+        if (i > 1)
+            addOutput(output, "\t", 1);
+        addOutput(output, s, len);
+        lua_pop(L, 1);
+    }
+    addOutput(output, "\n", 1);
+    return 0;
+}
+
+static int outputWrite(lua_State* L)
+{
+    Output* output = static_cast<Output*>(lua_touserdata(L, lua_upvalueindex(1)));
+    int n = lua_gettop(L);
+    for (int i = 1; i <= n; i++)
+    {
+        size_t len;
+        const char* s = luaL_checklstring(L, i, &len);
+        addOutput(output, s, len);
+    }
+    return 0;
+}
+
+static void captureOutput(lua_State* L, Output* output)
+{
+    output->hash = 14695981039346656037ULL;
+    output->bytes = 0;
+    lua_pushlightuserdata(L, output);
+    lua_pushcclosure(L, outputPrint, 1);
+    lua_setglobal(L, "print");
+    lua_getglobal(L, "io");
+    lua_pushlightuserdata(L, output);
+    lua_pushcclosure(L, outputWrite, 1);
+    lua_setfield(L, -2, "write");
+    lua_pop(L, 1);
+}
+
+static int countBytes(lua_State*, const void*, size_t size, void* ud)
+{
+    *static_cast<size_t*>(ud) += size;
+    return 0;
+}
+
+//loads and runs the case once, with the optimizer on or off; with 'count', under a count hook
+static void runCase(const Case& c, bool optimize, bool count, Run* run)
+{
+    typedef chrono::steady_clock Clock;
+    LuaState state;
+    lua_State* L = state.getState();
+    state.setOptimize(optimize);
+    captureOutput(L, &run->output);
+    lua_createtable(L, 1, 1);
+    lua_pushstring(L, c.file.c_str());
+    lua_rawseti(L, -2, 0);
+    lua_pushstring(L, c.arg.c_str());
+    lua_rawseti(L, -2, 1);
+    lua_setglobal(L, "arg");
+
+    lua_getglobal(L, "debug");
+    lua_getfield(L, -1, "traceback");
+    lua_remove(L, -2);
+    int err = c.source.empty() ? luaL_loadfile(L, c.file.c_str())
+                               : luaL_loadbuffer(L, c.source.data(), c.source.size(), ("=" + c.name).c_str());
+    run->error.clear();
+    run->dump_bytes = 0;
+    run->instructions = 0;
+    run->time = 0;
+    if (0 != err)
+    {
+        run->error = luaToString(L, -1);
+        return;
+    }
+    lua_dump(L, countBytes, &run->dump_bytes, 1);
+    if (count)
+    {
+        instruction_count = 0;
+        lua_sethook(L, countHook, LUA_MASKCOUNT, kHookCount);
+    }
+    Clock::time_point start = Clock::now();
+    if (0 != lua_pcall(L, 0, 0, -2))
+        run->error = luaToString(L, -1);
+    run->time = chrono::duration<double>(Clock::now() - start).count();
+    run->instructions = instruction_count;
+    lua_sethook(L, 0, 0, 0);
+}
+
+//runs the case both ways, the first time with a count hook; returns false if they differ
+static bool checkCase(const Case& c, int runs)
+{
+    Run plain, optimized;
+    runCase(c, false, true, &plain);
+    runCase(c, true, true, &optimized);
+    double plain_time = plain.time;
+    double optimized_time = optimized.time;
+    for (int i = 0; i < runs; i++)
+    {
+        Run run;
+        runCase(c, false, false, &run);
+        plain_time = i > 0 ? min(plain_time, run.time) : run.time;
+        runCase(c, true, false, &run);
+        optimized_time = i > 0 ? min(optimized_time, run.time) : run.time;
+    }
+
+    bool same = plain.output.hash == optimized.output.hash && plain.output.bytes == optimized.output.bytes &&
+                plain.error == optimized.error;
+    printf("%-4s %-20s %8zu %8zu %12llu %12llu %9.4f %9.4f\n", same ? "ok" : "FAIL", c.name.c_str(),
+           plain.dump_bytes, optimized.dump_bytes, plain.instructions, optimized.instructions,
+           plain_time, optimized_time);
+    if (!same)
+    {
+        printf("  output: %zu bytes %016llx, optimized %zu bytes %016llx\n", plain.output.bytes,
+               plain.output.hash, optimized.output.bytes, optimized.output.hash);
+        printf("  error:\n%s\n  optimized error:\n%s\n", plain.error.c_str(), optimized.error.c_str());
+    }
+    return same;
+}
+
+//a chunk with more constants than RK operands can name
+static string manyConstants()
+{
+    string source = "local sum, t = 0, {}\n";
+    for (int i = 0; i < 300; i++)
+        source += strFormat("do local k = %d.5; sum = sum + k * 2; t[k] = i end\n", i);
+    source += "print(sum, #t)\nlocal last = 299.5\nprint(t[last] == nil, last + 0.5)\n";
+    return source;
+}
+
+int main(int argc, char* argv[])
+{
+    int runs = 1;
+    string dir = CLASSIC_DIR;
+    vector<Case> cases;
+    for (int i = 1; i < argc; i++)
+    {
+        string opt(argv[i]);
+        if ("--runs" == opt && i + 1 < argc)
+            runs = max(1, atoi(argv[++i]));
+        else if ("--dir" == opt && i + 1 < argc)
+            dir = argv[++i];
+        else
+        {
+            //script.lua[=arg] or program[=arg]
+            Case c;
+            size_t eq = opt.find('=');
+            c.name = opt.substr(0, eq);
+            c.file = c.name;
+            for (size_t k = 0; k < sizeof(kPrograms) / sizeof(kPrograms[0]); k++)
+            {
+                if (c.name == kPrograms[k][0])
+                {
+                    c.file = dir + "/" + c.name + ".lua";
+                    c.arg = kPrograms[k][1];
+                }
+            }
+            if (string::npos != eq)
+                c.arg = opt.substr(eq + 1);
+            cases.push_back(c);
+        }
+    }
+    if (cases.empty())
+    {
+        for (size_t k = 0; k < sizeof(kCases) / sizeof(kCases[0]); k++)
+        {
+            Case c;
+            c.name = kCases[k][0];
+            c.source = kCases[k][1];
+            cases.push_back(c);
+        }
+        Case many;
+        many.name = "many constants";
+        many.source = manyConstants();
+        cases.push_back(many);
+        for (size_t k = 0; k < sizeof(kPrograms) / sizeof(kPrograms[0]); k++)
+        {
+            Case c;
+            c.name = kPrograms[k][0];
+            c.file = dir + "/" + c.name + ".lua";
+            c.arg = kPrograms[k][1];
+            cases.push_back(c);
+        }
+    }
+
+    printf("%-4s %-20s %8s %8s %12s %12s %9s %9s\n", "", "case", "bytes", "opt", "instructions", "opt",
+           "time (s)", "opt");
+    int failed = 0;
+    for (size_t i = 0; i < cases.size(); i++)
+    {
+        if (!checkCase(cases[i], runs))
+            failed++;
+    }
+    printf("%d of %zu cases differ\n", failed, cases.size());
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,105 @@
+//profiles a Lua script with LuaState::startProfiler: the output stacks go
+//to stdout (the input of flamegraph.pl or speedscope), the most sampled
+//lines and the time with and without the profiler to stderr. with --trace,
+//the script runs under LuaState::startTracer instead, keeping the last N
+//calls and returns, and stdout gets Chrome trace-event JSON. built by the
+//host CMake build, run as
+//  luaprof [--instructions N | --timer US] [--top N] script.lua [arg ...] > out.folded
+//  luaprof --trace N script.lua [arg ...] > trace.json
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <chrono>
+#include "luastate.h"
+
+using namespace std;
+
+static void setArg(lua_State* L, char* argv[], int script, int argc)
+{
+    lua_createtable(L, argc - script - 1, 1);
+    for (int i = script; i < argc; i++)
+    {
+        lua_pushstring(L, argv[i]);
+        lua_rawseti(L, -2, i - script);
+    }
+    lua_setglobal(L, "arg");
+}
+
+//traced instead of profiled
+static const int kTrace = -1;
+
+//runs the script in a new state, profiled if 'period' > 0; returns the time or -1
+static double run(char* argv[], int script, int argc, int mode, int period, string* output, string* lines, int top)
+{
+    typedef chrono::steady_clock Clock;
+    LuaState state;
+    setArg(state.getState(), argv, script, argc);
+    if (period > 0 && kTrace == mode)
+        state.startTracer(period);
+    else if (period > 0)
+        state.startProfiler(mode, period);
+    Clock::time_point start = Clock::now();
+    int err = state.parseFile(argv[script]);
+    double time = chrono::duration<double>(Clock::now() - start).count();
+    if (period > 0 && kTrace == mode)
+    {
+        *output = state.stopTracer();
+        fprintf(stderr, "%zu events, %zu dropped\n", state.getTracer()->getEvents(), state.getTracer()->getDropped());
+    }
+    else if (period > 0)
+    {
+        *output = state.stopProfiler();
+        *lines = state.getProfiler()->getLines(top);
+        fprintf(stderr, "%zu samples\n", state.getProfiler()->getSamples());
+    }
+    if (0 != err)
+    {
+        fprintf(stderr, "%s\n", state.getError().c_str());
+        return -1;
+    }
+    return time;
+}
+
+int main(int argc, char* argv[])
+{
+    int mode = LuaProfiler::kInstructions;
+    int period = 10000;
+    int top = 20;
+    int script = 1;
+    for (; script + 1 < argc && '-' == argv[script][0]; script += 2)
+    {
+        string opt(argv[script]);
+        if ("--instructions" == opt)
+            mode = LuaProfiler::kInstructions;
+        else if ("--timer" == opt)
+            mode = LuaProfiler::kTimer;
+        else if ("--trace" == opt)
+            mode = kTrace;
+        else if ("--top" == opt)
+        {
+            top = atoi(argv[script + 1]);
+            continue;
+        }
+        else
+            break;
+        period = atoi(argv[script + 1]);
+    }
+    if (script >= argc || '-' == argv[script][0] || period <= 0)
+    {
+        fprintf(stderr, "usage: %s [--instructions N | --timer US | --trace N] [--top N] script.lua [arg ...]\n", argv[0]);
+        return 2;
+    }
+
+    string output, lines;
+    double base = run(argv, script, argc, mode, 0, 0, 0, 0);
+    double profiled = run(argv, script, argc, mode, period, &output, &lines, top);
+    if (base < 0 || profiled < 0)
+        return 1;
+
+    fputs(lines.c_str(), stderr);
+    const char* tool = kTrace == mode ? "tracer" : "profiler";
+    fprintf(stderr, "%.3f s without the %s, %.3f s with it (%+.1f%%)\n",
+            base, tool, profiled, (profiled / base - 1) * 100);
+    fputs(output.c_str(), stdout);
+    return 0;
+}
@@ -0,0 +1,89 @@
+//closing states on the caller thread (lua_close) and through LuaReaper:
+//each state builds a heap of tables and closures, some with finalizers,
+//then is closed. prints the time the caller spends closing and, for the
+//reaper, the time until all queued states are closed. built by the host CMake
+//build (see CMakeLists.txt in this directory), run as
+//  ./reaper_bench [states] [objects per state]
+#include <cstdio>
+#include <cstdlib>
+#include <atomic>
+#include <chrono>
+#include "lua/lua.hpp"
+#include "luareaper.h"
+
+using namespace std;
+
+static const char* kHeap =
+    "local n = ...\n"
+    "local mt = {__gc = function() finalized() end}\n"
+    "heap = {}\n"
+    "for i = 1, n do\n"
+    "  local name = 'item' .. i\n"
+    "  heap[i] = {id = i, name = name, get = function() return name end}\n"
+    "  if i % 100 == 0 then setmetatable(heap[i], mt) end\n"
+    "end\n";
+
+static atomic<long> finalized_count(0);
+
+static int finalized(lua_State*)
+{
+    finalized_count++;
+    return 0;
+}
+
+static lua_State* newHeap(int objects)
+{
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    lua_register(L, "finalized", finalized);
+    if (luaL_loadstring(L, kHeap) || (lua_pushinteger(L, objects), lua_pcall(L, 1, 0, 0)))
+        fprintf(stderr, "heap: %s\n", lua_tostring(L, -1));
+    return L;
+}
+
+static void closeState(void* L)
+{
+    lua_close(static_cast<lua_State*>(L));
+}
+
+int main(int argc, char* argv[])
+{
+    typedef chrono::steady_clock Clock;
+    int states = argc > 1 ? atoi(argv[1]) : 20;
+    int objects = argc > 2 ? atoi(argv[2]) : 200000;
+    long expected = static_cast<long>(states) * (objects / 100);
+
+    double closing = 0;
+    for (int i = 0; i < states; i++)
+    {
+        lua_State* L = newHeap(objects);
+        Clock::time_point start = Clock::now();
+        lua_close(L);
+        closing += chrono::duration<double>(Clock::now() - start).count();
+    }
+    printf("lua_close  caller %8.3f s\n", closing);
+
+    LuaReaper& reaper = LuaReaper::instance();
+    size_t max_pending = 0;
+    closing = 0;
+    finalized_count = 0;
+    for (int i = 0; i < states; i++)
+    {
+        lua_State* L = newHeap(objects);
+        size_t bytes = lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+        Clock::time_point start = Clock::now();
+        reaper.reap(L, closeState, bytes);
+        closing += chrono::duration<double>(Clock::now() - start).count();
+        if (reaper.getPendingBytes() > max_pending)
+            max_pending = reaper.getPendingBytes();
+    }
+    Clock::time_point start = Clock::now();
+    reaper.drain();
+    double draining = chrono::duration<double>(Clock::now() - start).count();
+    printf("reaper     caller %8.3f s  drain %8.3f s  max pending %zu KB\n",
+           closing, draining, max_pending / 1024);
+    if (finalized_count != expected || reaper.getPendingBytes() != 0)
+        fprintf(stderr, "reaper: %ld of %ld finalizers called, %zu bytes pending\n",
+                finalized_count.load(), expected, reaper.getPendingBytes());
+    return 0;
+}
@@ -0,0 +1,61 @@
+//runs Lua benchmark scripts in a state using malloc (luaL_newstate) and in a
+//state using SlabAllocator, printing the time of each run and, for the slab
+//state, the blocks allocated by kind. built by the host CMake
+//build (see CMakeLists.txt in this directory), run as
+//  ./slab_bench bench/lua/table.lua bench/lua/strings.lua ...
+#include <cstdio>
+#include <chrono>
+#include "lua/lua.hpp"
+#include "luaslab.h"
+
+using namespace std;
+
+static const int kRuns = 3;
+
+static double runScript(lua_State* L, const char* file)
+{
+    luaL_openlibs(L);
+    lua_newtable(L);
+    lua_setglobal(L, "arg");  //no arguments: scripts use their defaults
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    if (luaL_dofile(L, file))
+        fprintf(stderr, "%s: %s\n", file, lua_tostring(L, -1));
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static void printStats(const SlabAllocator& slab)
+{
+    printf("  %-10s %12s %10s %12s\n", "kind", "allocs", "live", "live bytes");
+    for (int k = 0; k < SlabAllocator::kKinds; k++)
+    {
+        const SlabAllocator::KindStats& s = slab.getStats(k);
+        if (s.allocs > 0)
+            printf("  %-10s %12zu %10zu %12zu\n", SlabAllocator::kindName(k), s.allocs, s.count, s.bytes);
+    }
+    printf("  pages %zu KB, large blocks %zu KB\n", slab.getPageBytes() / 1024, slab.getLargeBytes() / 1024);
+}
+
+int main(int argc, char** argv)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        double tmalloc = 0, tslab = 0;
+        for (int r = 0; r < kRuns; r++)
+        {
+            lua_State* L = luaL_newstate();
+            tmalloc += runScript(L, argv[i]);
+            lua_close(L);
+
+            SlabAllocator slab;
+            L = lua_newstate(SlabAllocator::alloc, &slab);
+            tslab += runScript(L, argv[i]);
+            if (r == kRuns - 1)
+            {
+                printf("%s: malloc %.3f s, slab %.3f s\n", argv[i], tmalloc / kRuns, tslab / kRuns);
+                printStats(slab);
+            }
+            lua_close(L);
+        }
+    }
+    return 0;
+}
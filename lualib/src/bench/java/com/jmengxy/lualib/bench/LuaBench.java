@@ -0,0 +1,195 @@
+package com.jmengxy.lualib.bench;
+
+import com.jmengxy.lualib.Lua;
+
+import java.lang.management.ManagementFactory;
+import java.util.ArrayList;
+import java.util.List;
+import java.util.Locale;
+
+//JMH-style benchmark of the Lua.java <-> luax JNI bridge on a desktop JVM.
+//each benchmark runs warmup iterations, then measured iterations of a fixed
+//time, and reports the time per operation (mean and standard deviation over
+//the iterations) and the Java heap bytes allocated per operation. results
+//go to stdout as JSON, a summary to stderr. arguments:
+//  [--warmup N] [--iterations N] [--time MS] [--filter TEXT]
+public final class LuaBench {
+
+    private interface Op {
+        void run(Lua lua, int i);
+    }
+
+    private static final class Benchmark {
+        final String name;
+        final String setup;
+        final Op op;
+
+        Benchmark(String name, String setup, Op op) {
+            this.name = name;
+            this.setup = setup;
+            this.op = op;
+        }
+    }
+
+    private static final class Result {
+        String name;
+        double nsPerOp;
+        double nsError;
+        double bytesPerOp;
+        long ops;
+    }
+
+    //results are stored here so that the JIT cannot drop the operations
+    private static volatile Object sink;
+    private static volatile long sinkLong;
+
+    private static final String SETUP =
+            "s = 'hello world'\n" +
+            "n = 42\n" +
+            "d = 3.25\n" +
+            "b = true\n";
+
+    private static List<Benchmark> benchmarks() {
+        List<Benchmark> list = new ArrayList<Benchmark>();
+        //a static native call without arguments: the floor of a JNI transition
+        list.add(new Benchmark("jni.emptyCall", SETUP, (lua, i) -> sinkLong = Lua.getPendingCloseBytes()));
+        list.add(new Benchmark("parseLine.assign", SETUP, (lua, i) -> sink = lua.parseLine("x = 1")));
+        list.add(new Benchmark("parseLine.error", SETUP, (lua, i) -> sink = lua.parseLine("error('failed')")));
+        list.add(new Benchmark("getType", SETUP, (lua, i) -> sinkLong = lua.getType("n")));
+        list.add(new Benchmark("getString", SETUP, (lua, i) -> sink = lua.getString("s", null)));
+        list.add(new Benchmark("getInteger", SETUP, (lua, i) -> sinkLong = lua.getInteger("n", 0)));
+        list.add(new Benchmark("getDouble", SETUP, (lua, i) -> sinkLong = (long) lua.getDouble("d", 0)));
+        list.add(new Benchmark("getBoolean", SETUP, (lua, i) -> sinkLong = lua.getBoolean("b", false) ? 1 : 0));
+        list.add(new Benchmark("setString", SETUP, (lua, i) -> lua.setString("s", "value")));
+        list.add(new Benchmark("setInteger", SETUP, (lua, i) -> lua.setInteger("n", i)));
+        list.add(new Benchmark("setDouble", SETUP, (lua, i) -> lua.setDouble("d", i * 0.5)));
+        list.add(new Benchmark("newTable", SETUP, (lua, i) -> lua.newTable("t", 4, 4)));
+        list.add(new Benchmark("close", SETUP, (lua, i) -> {
+            Lua state = new Lua();
+            state.close();
+        }));
+        list.add(new Benchmark("closeAsync", SETUP, (lua, i) -> {
+            Lua state = new Lua();
+            state.closeAsync();
+        }));
+        list.add(new Benchmark("close.arena", SETUP, (lua, i) -> {
+            Lua state = new Lua(Lua.ALLOCATOR_ARENA);
+            state.close();
+        }));
+        return list;
+    }
+
+    private static long allocatedBytes() {
+        java.lang.management.ThreadMXBean bean = ManagementFactory.getThreadMXBean();
+        if (bean instanceof com.sun.management.ThreadMXBean) {
+            return ((com.sun.management.ThreadMXBean) bean).getThreadAllocatedBytes(Thread.currentThread().getId());
+        }
+        return -1;
+    }
+
+    //runs 'op' for about 'timeMs' milliseconds, returns {ops, nanoseconds, bytes}
+    private static long[] iteration(Lua lua, Op op, long timeMs) {
+        long deadline = System.nanoTime() + timeMs * 1000000L;
+        long ops = 0;
+        long bytes = allocatedBytes();
+        long start = System.nanoTime();
+        long now;
+        do {
+            for (int i = 0; i < 100; i++) {
+                op.run(lua, i);
+            }
+            ops += 100;
+            now = System.nanoTime();
+        } while (now < deadline);
+        long allocated = allocatedBytes();
+        return new long[]{ops, now - start, bytes < 0 || allocated < 0 ? -1 : allocated - bytes};
+    }
+
+    private static Result run(Benchmark benchmark, int warmup, int iterations, long timeMs) {
+        Lua lua = new Lua();
+        lua.parseLine(benchmark.setup);
+        for (int i = 0; i < warmup; i++) {
+            iteration(lua, benchmark.op, timeMs);
+        }
+
+        double[] nsPerOp = new double[iterations];
+        long ops = 0;
+        long bytes = 0;
+        for (int i = 0; i < iterations; i++) {
+            System.gc();
+            long[] it = iteration(lua, benchmark.op, timeMs);
+            nsPerOp[i] = (double) it[1] / it[0];
+            ops += it[0];
+            bytes = bytes < 0 || it[2] < 0 ? -1 : bytes + it[2];
+        }
+        lua.close();
+
+        double mean = 0;
+        for (double ns : nsPerOp) {
+            mean += ns;
+        }
+        mean /= iterations;
+        double variance = 0;
+        for (double ns : nsPerOp) {
+            variance += (ns - mean) * (ns - mean);
+        }
+
+        Result result = new Result();
+        result.name = benchmark.name;
+        result.nsPerOp = mean;
+        result.nsError = iterations > 1 ? Math.sqrt(variance / (iterations - 1)) : 0;
+        result.bytesPerOp = bytes < 0 ? -1 : (double) bytes / ops;
+        result.ops = ops;
+        return result;
+    }
+
+    private static void printJson(List<Result> results, int warmup, int iterations, long timeMs) {
+        StringBuilder json = new StringBuilder();
+        json.append("{\n");
+        json.append(String.format(Locale.US, "  \"jvm\": \"%s %s\",\n",
+                System.getProperty("java.vm.name"), System.getProperty("java.version")));
+        json.append(String.format(Locale.US, "  \"warmup\": %d,\n  \"iterations\": %d,\n  \"time_ms\": %d,\n",
+                warmup, iterations, timeMs));
+        json.append("  \"benchmarks\": [");
+        for (int i = 0; i < results.size(); i++) {
+            Result r = results.get(i);
+            json.append(i > 0 ? "," : "").append("\n    ");
+            json.append(String.format(Locale.US,
+                    "{\"name\": \"%s\", \"ns_per_op\": %.3f, \"ns_error\": %.3f, \"bytes_per_op\": %.2f, \"ops\": %d}",
+                    r.name, r.nsPerOp, r.nsError, r.bytesPerOp, r.ops));
+        }
+        json.append("\n  ]\n}");
+        System.out.println(json);
+    }
+
+    public static void main(String[] args) {
+        int warmup = 3;
+        int iterations = 5;
+        long timeMs = 500;
+        String filter = null;
+        for (int i = 0; i + 1 < args.length; i += 2) {
+            if ("--warmup".equals(args[i])) {
+                warmup = Integer.parseInt(args[i + 1]);
+            } else if ("--iterations".equals(args[i])) {
+                iterations = Math.max(1, Integer.parseInt(args[i + 1]));
+            } else if ("--time".equals(args[i])) {
+                timeMs = Long.parseLong(args[i + 1]);
+            } else if ("--filter".equals(args[i])) {
+                filter = args[i + 1];
+            }
+        }
+
+        List<Result> results = new ArrayList<Result>();
+        System.err.println(String.format(Locale.US, "%-20s %14s %10s", "benchmark", "ns/op", "B/op"));
+        for (Benchmark benchmark : benchmarks()) {
+            if (filter != null && !benchmark.name.contains(filter)) {
+                continue;
+            }
+            Result r = run(benchmark, warmup, iterations, timeMs);
+            results.add(r);
+            System.err.println(String.format(Locale.US, "%-20s %8.1f ±%5.1f %10.1f",
+                    r.name, r.nsPerOp, r.nsError, r.bytesPerOp));
+        }
+        printJson(results, warmup, iterations, timeMs);
+    }
+}
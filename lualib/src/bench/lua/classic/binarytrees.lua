@@ -0,0 +1,46 @@
+-- binary-trees: allocation of many short-lived complete binary trees and
+-- one long-lived tree (collector throughput).
+--   lua binarytrees.lua [maxdepth]
+
+local function bottomup(depth)
+  if depth > 0 then
+    depth = depth - 1
+    local left, right = bottomup(depth), bottomup(depth)
+    return {left, right}
+  else
+    return {}
+  end
+end
+
+local function check(tree)
+  if tree[1] then
+    return 1 + check(tree[1]) + check(tree[2])
+  else
+    return 1
+  end
+end
+
+local N = tonumber(arg and arg[1]) or 15
+local mindepth = 4
+local maxdepth = math.max(mindepth + 2, N)
+
+do
+  local stretchdepth = maxdepth + 1
+  io.write(string.format("stretch tree of depth %d\t check: %d\n",
+                         stretchdepth, check(bottomup(stretchdepth))))
+end
+
+local longlived = bottomup(maxdepth)
+
+for depth = mindepth, maxdepth, 2 do
+  local iterations = 1 << (maxdepth - depth + mindepth)
+  local sum = 0
+  for i = 1, iterations do
+    sum = sum + check(bottomup(depth))
+  end
+  io.write(string.format("%d\t trees of depth %d\t check: %d\n",
+                         iterations, depth, sum))
+end
+
+io.write(string.format("long lived tree of depth %d\t check: %d\n",
+                       maxdepth, check(longlived)))
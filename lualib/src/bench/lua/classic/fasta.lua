@@ -0,0 +1,74 @@
+-- fasta: DNA sequences from a repeated string and from weighted random
+-- selection (string building, buffered output, a linear congruential
+-- generator).
+--   lua fasta.lua [n]
+
+local IM, IA, IC = 139968, 3877, 29573
+local last = 42
+
+local function random(max)
+  last = (last * IA + IC) % IM
+  return max * last / IM
+end
+
+local alu =
+  "GGCCGGGCGCGGTGGCTCACGCCTGTAATCCCAGCACTTTGG" ..
+  "GAGGCCGAGGCGGGCGGATCACCTGAGGTCAGGAGTTCGAGA" ..
+  "CCAGCCTGGCCAACATGGTGAAACCCCGTCTCTACTAAAAAT" ..
+  "ACAAAAATTAGCCGGGCGTGGTGGCGCGCGCCTGTAATCCCA" ..
+  "GCTACTCGGGAGGCTGAGGCAGGAGAATCGCTTGAACCCGGG" ..
+  "AGGCGGAGGTTGCAGTGAGCCGAGATCGCGCCACTGCACTCC" ..
+  "AGCCTGGGCGACAGAGCGAGACTCCGTCTCAAAAA"
+
+local iub = {
+  {"a", 0.27}, {"c", 0.12}, {"g", 0.12}, {"t", 0.27},
+  {"B", 0.02}, {"D", 0.02}, {"H", 0.02}, {"K", 0.02},
+  {"M", 0.02}, {"N", 0.02}, {"R", 0.02}, {"S", 0.02},
+  {"V", 0.02}, {"W", 0.02}, {"Y", 0.02},
+}
+
+local homosapiens = {
+  {"a", 0.3029549426680}, {"c", 0.1979883004921},
+  {"g", 0.1975473066391}, {"t", 0.3015094502008},
+}
+
+local WIDTH = 60
+
+local function repeatfasta(id, desc, s, n)
+  io.write(">", id, " ", desc, "\n")
+  local len = #s
+  local s2 = s .. s .. string.sub(s, 1, WIDTH)
+  local p = 1
+  for i = 1, n, WIDTH do
+    local m = math.min(WIDTH, n - i + 1)
+    io.write(string.sub(s2, p, p + m - 1), "\n")
+    p = p + m
+    if p > len then p = p - len end
+  end
+end
+
+local function randomfasta(id, desc, freqs, n)
+  io.write(">", id, " ", desc, "\n")
+  local chars, probs = {}, {}
+  local acc = 0
+  for i, entry in ipairs(freqs) do
+    acc = acc + entry[2]
+    chars[i], probs[i] = entry[1], acc
+  end
+  local line = {}
+  for i = 1, n, WIDTH do
+    local m = math.min(WIDTH, n - i + 1)
+    for k = 1, m do
+      local r = random(1)
+      local c = 1
+      while probs[c] < r do c = c + 1 end
+      line[k] = chars[c]
+    end
+    io.write(table.concat(line, "", 1, m), "\n")
+  end
+end
+
+local N = tonumber(arg and arg[1]) or 1000
+repeatfasta("ONE", "Homo sapiens alu", alu, N * 2)
+randomfasta("TWO", "IUB ambiguity codes", iub, N * 3)
+randomfasta("THREE", "Homo sapiens frequency", homosapiens, N * 5)
@@ -0,0 +1,179 @@
+-- json: round trips of a document of records through a JSON encoder and
+-- decoder written in Lua (string building, patterns, string.format,
+-- recursion and many short-lived tables and strings).
+--   lua json.lua [iterations]
+
+local byte, char, find, format, sub = string.byte, string.char,
+                                      string.find, string.format, string.sub
+local concat, sort = table.concat, table.sort
+
+local escapes = {
+  ['"'] = '\\"', ["\\"] = "\\\\", ["\b"] = "\\b", ["\f"] = "\\f",
+  ["\n"] = "\\n", ["\r"] = "\\r", ["\t"] = "\\t",
+}
+
+local function escape(c)
+  return escapes[c] or format("\\u%04x", byte(c))
+end
+
+local encodevalue
+
+local function encodetable(t, out)
+  local n = #t
+  if n > 0 or next(t) == nil then  -- array
+    out[#out + 1] = "["
+    for i = 1, n do
+      if i > 1 then out[#out + 1] = "," end
+      encodevalue(t[i], out)
+    end
+    out[#out + 1] = "]"
+  else  -- object, with its keys sorted to get a stable encoding
+    local keys = {}
+    for k in pairs(t) do keys[#keys + 1] = k end
+    sort(keys)
+    out[#out + 1] = "{"
+    for i, k in ipairs(keys) do
+      if i > 1 then out[#out + 1] = "," end
+      out[#out + 1] = '"' .. k:gsub('[%c"\\]', escape) .. '":'
+      encodevalue(t[k], out)
+    end
+    out[#out + 1] = "}"
+  end
+end
+
+function encodevalue(v, out)
+  local tv = type(v)
+  if tv == "table" then
+    encodetable(v, out)
+  elseif tv == "string" then
+    out[#out + 1] = '"' .. v:gsub('[%c"\\]', escape) .. '"'
+  elseif tv == "number" then
+    out[#out + 1] = math.type(v) == "integer" and format("%d", v)
+                                               or format("%.14g", v)
+  elseif tv == "boolean" then
+    out[#out + 1] = tostring(v)
+  else
+    error("cannot encode a " .. tv)
+  end
+end
+
+local function encode(v)
+  local out = {}
+  encodevalue(v, out)
+  return concat(out)
+end
+
+
+local decodevalue
+
+local function skip(s, i)
+  return find(s, "[^ \t\r\n]", i) or #s + 1
+end
+
+local unescapes = {
+  ['"'] = '"', ["\\"] = "\\", ["/"] = "/", b = "\b", f = "\f",
+  n = "\n", r = "\r", t = "\t",
+}
+
+local function decodestring(s, i)
+  local parts = {}
+  local j = i + 1
+  while true do
+    local k = find(s, '["\\]', j)
+    if not k then error("unfinished string at " .. i) end
+    parts[#parts + 1] = sub(s, j, k - 1)
+    if byte(s, k) == 34 then  -- '"'
+      return concat(parts), k + 1
+    end
+    local e = sub(s, k + 1, k + 1)
+    if e == "u" then
+      parts[#parts + 1] = utf8.char(tonumber(sub(s, k + 2, k + 5), 16))
+      j = k + 6
+    else
+      parts[#parts + 1] = unescapes[e] or error("bad escape at " .. k)
+      j = k + 2
+    end
+  end
+end
+
+local function decodearray(s, i)
+  local t = {}
+  i = skip(s, i + 1)
+  if byte(s, i) == 93 then return t, i + 1 end  -- ']'
+  while true do
+    t[#t + 1], i = decodevalue(s, i)
+    i = skip(s, i)
+    local c = byte(s, i)
+    if c == 93 then return t, i + 1 end
+    if c ~= 44 then error("',' expected at " .. i) end
+    i = skip(s, i + 1)
+  end
+end
+
+local function decodeobject(s, i)
+  local t = {}
+  i = skip(s, i + 1)
+  if byte(s, i) == 125 then return t, i + 1 end  -- '}'
+  while true do
+    local k
+    k, i = decodestring(s, i)
+    i = skip(s, i)
+    if byte(s, i) ~= 58 then error("':' expected at " .. i) end
+    t[k], i = decodevalue(s, skip(s, i + 1))
+    i = skip(s, i)
+    local c = byte(s, i)
+    if c == 125 then return t, i + 1 end
+    if c ~= 44 then error("',' expected at " .. i) end
+    i = skip(s, i + 1)
+  end
+end
+
+function decodevalue(s, i)
+  local c = byte(s, i)
+  if c == 123 then return decodeobject(s, i)      -- '{'
+  elseif c == 91 then return decodearray(s, i)    -- '['
+  elseif c == 34 then return decodestring(s, i)   -- '"'
+  elseif find(s, "^true", i) then return true, i + 4
+  elseif find(s, "^false", i) then return false, i + 5
+  else
+    local _, e = find(s, "^-?%d+%.?%d*[eE]?[-+]?%d*", i)
+    if not e then error("unexpected character at " .. i) end
+    return math.tointeger(tonumber(sub(s, i, e))) or tonumber(sub(s, i, e)),
+           e + 1
+  end
+end
+
+local function decode(s)
+  local v, i = decodevalue(s, skip(s, 1))
+  if skip(s, i) <= #s then error("trailing characters at " .. i) end
+  return v
+end
+
+
+local function document(n)
+  local records = {}
+  for i = 1, n do
+    records[i] = {
+      id = i,
+      name = "record " .. i,
+      note = 'line "' .. i .. '"\n\ttab\\slash',
+      score = i * 0.125 + 1 / 3,
+      active = i % 3 == 0,
+      tags = {"tag" .. i % 7, "tag" .. i % 11, "common"},
+      position = {x = i % 100, y = -(i % 37), z = i / 8},
+      history = {i, i * 2, i * 3, {i % 5, {}}},
+    }
+  end
+  return {version = 1, title = "json round trip", records = records}
+end
+
+local N = tonumber(arg and arg[1]) or 20
+local doc = document(1000)
+local text = encode(doc)
+for i = 1, N do
+  local copy = decode(text)
+  local again = encode(copy)
+  assert(again == text, "round trip changed the document")
+  text = again
+end
+io.write(string.format("%d round trips of %d bytes\n", N, #text))
@@ -0,0 +1,88 @@
+-- k-nucleotide: frequencies of the k-length substrings of a DNA sequence
+-- (string.sub, short-string interning and string-keyed tables). The
+-- sequence is the "THREE" section of fasta.lua with the same n.
+--   lua knucleotide.lua [n]
+
+local IM, IA, IC = 139968, 3877, 29573
+local last = 42
+
+local function random(max)
+  last = (last * IA + IC) % IM
+  return max * last / IM
+end
+
+local function randomsequence(freqs, n)
+  local chars, probs = {}, {}
+  local acc = 0
+  for i, entry in ipairs(freqs) do
+    acc = acc + entry[2]
+    chars[i], probs[i] = entry[1], acc
+  end
+  local seq = {}
+  for i = 1, n do
+    local r = random(1)
+    local c = 1
+    while probs[c] < r do c = c + 1 end
+    seq[i] = chars[c]
+  end
+  return table.concat(seq)
+end
+
+local iub = {
+  {"a", 0.27}, {"c", 0.12}, {"g", 0.12}, {"t", 0.27},
+  {"B", 0.02}, {"D", 0.02}, {"H", 0.02}, {"K", 0.02},
+  {"M", 0.02}, {"N", 0.02}, {"R", 0.02}, {"S", 0.02},
+  {"V", 0.02}, {"W", 0.02}, {"Y", 0.02},
+}
+
+local homosapiens = {
+  {"a", 0.3029549426680}, {"c", 0.1979883004921},
+  {"g", 0.1975473066391}, {"t", 0.3015094502008},
+}
+
+local function kfrequency(seq, freq, k, frame)
+  local sub = string.sub
+  local k1 = k - 1
+  for i = frame, #seq - k1, k do
+    local c = sub(seq, i, i + k1)
+    freq[c] = (freq[c] or 0) + 1
+  end
+end
+
+local function count(seq, frag)
+  local k = #frag
+  local freq = {}
+  for frame = 1, k do kfrequency(seq, freq, k, frame) end
+  io.write(freq[frag] or 0, "\t", frag, "\n")
+end
+
+local function frequency(seq, k)
+  local freq = {}
+  for frame = 1, k do kfrequency(seq, freq, k, frame) end
+  local sfreq, sn, sum = {}, 1, 0
+  for c, v in pairs(freq) do
+    sfreq[sn] = c
+    sn = sn + 1
+    sum = sum + v
+  end
+  table.sort(sfreq, function(a, b)
+    local fa, fb = freq[a], freq[b]
+    return fa == fb and a > b or fa > fb
+  end)
+  for _, c in ipairs(sfreq) do
+    io.write(string.format("%s %0.3f\n", c, (freq[c] * 100) / sum))
+  end
+  io.write("\n")
+end
+
+local N = tonumber(arg and arg[1]) or 1000
+for i = 1, N * 3 do random(1) end  -- skip "TWO", as fasta.lua generates it
+local seq = string.upper(randomsequence(homosapiens, N * 5))
+
+frequency(seq, 1)
+frequency(seq, 2)
+count(seq, "GGT")
+count(seq, "GGTA")
+count(seq, "GGTATT")
+count(seq, "GGTATTTTAATT")
+count(seq, "GGTATTTTAATTTATAGT")
@@ -0,0 +1,306 @@
+-- richards: Martin Richards' simulation of an operating system task
+-- scheduler (method calls, object fields, linked lists).
+--   lua richards.lua [iterations]
+
+local ID_IDLE = 1
+local ID_WORKER = 2
+local ID_HANDLER_A = 3
+local ID_HANDLER_B = 4
+local ID_DEVICE_A = 5
+local ID_DEVICE_B = 6
+
+local KIND_DEVICE = 0
+local KIND_WORK = 1
+
+local COUNT = 1000
+local EXPECTED_QUEUE_COUNT = 2322
+local EXPECTED_HOLD_COUNT = 928
+
+local DATA_SIZE = 4
+
+local STATE_RUNNING = 0
+local STATE_RUNNABLE = 1
+local STATE_SUSPENDED = 2
+local STATE_HELD = 4
+local STATE_SUSPENDED_RUNNABLE = STATE_SUSPENDED | STATE_RUNNABLE
+local STATE_NOT_HELD = ~STATE_HELD
+
+
+local Packet = {}
+Packet.__index = Packet
+
+function Packet.new(link, id, kind)
+  return setmetatable({link = link, id = id, kind = kind, a1 = 0,
+                       a2 = {0, 0, 0, 0}}, Packet)
+end
+
+function Packet:addto(queue)
+  self.link = nil
+  if not queue then return self end
+  local peek, nxt = queue, queue.link
+  while nxt do
+    peek = nxt
+    nxt = peek.link
+  end
+  peek.link = self
+  return queue
+end
+
+
+local TaskControlBlock = {}
+TaskControlBlock.__index = TaskControlBlock
+
+function TaskControlBlock.new(link, id, priority, queue, task)
+  return setmetatable({
+    link = link, id = id, priority = priority, queue = queue, task = task,
+    state = queue and STATE_SUSPENDED_RUNNABLE or STATE_SUSPENDED,
+  }, TaskControlBlock)
+end
+
+function TaskControlBlock:setrunning()
+  self.state = STATE_RUNNING
+end
+
+function TaskControlBlock:markasnotheld()
+  self.state = self.state & STATE_NOT_HELD
+end
+
+function TaskControlBlock:markasheld()
+  self.state = self.state | STATE_HELD
+end
+
+function TaskControlBlock:isheldorsuspended()
+  return (self.state & STATE_HELD) ~= 0 or self.state == STATE_SUSPENDED
+end
+
+function TaskControlBlock:markassuspended()
+  self.state = self.state | STATE_SUSPENDED
+end
+
+function TaskControlBlock:markasrunnable()
+  self.state = self.state | STATE_RUNNABLE
+end
+
+function TaskControlBlock:run()
+  local packet
+  if self.state == STATE_SUSPENDED_RUNNABLE then
+    packet = self.queue
+    self.queue = packet.link
+    self.state = self.queue and STATE_RUNNABLE or STATE_RUNNING
+  end
+  return self.task:run(packet)
+end
+
+function TaskControlBlock:checkpriorityadd(task, packet)
+  if not self.queue then
+    self.queue = packet
+    self:markasrunnable()
+    if self.priority > task.priority then return self end
+  else
+    self.queue = packet:addto(self.queue)
+  end
+  return task
+end
+
+
+local Scheduler = {}
+Scheduler.__index = Scheduler
+
+function Scheduler.new()
+  return setmetatable({queuecount = 0, holdcount = 0, blocks = {},
+                       list = nil, currenttcb = nil, currentid = nil},
+                      Scheduler)
+end
+
+function Scheduler:addtask(id, priority, queue, task)
+  self.currenttcb = TaskControlBlock.new(self.list, id, priority, queue, task)
+  self.list = self.currenttcb
+  self.blocks[id] = self.currenttcb
+end
+
+function Scheduler:addrunningtask(id, priority, queue, task)
+  self:addtask(id, priority, queue, task)
+  self.currenttcb:setrunning()
+end
+
+function Scheduler:schedule()
+  self.currenttcb = self.list
+  while self.currenttcb do
+    if self.currenttcb:isheldorsuspended() then
+      self.currenttcb = self.currenttcb.link
+    else
+      self.currentid = self.currenttcb.id
+      self.currenttcb = self.currenttcb:run()
+    end
+  end
+end
+
+function Scheduler:release(id)
+  local tcb = self.blocks[id]
+  if not tcb then return tcb end
+  tcb:markasnotheld()
+  if tcb.priority > self.currenttcb.priority then
+    return tcb
+  else
+    return self.currenttcb
+  end
+end
+
+function Scheduler:holdcurrent()
+  self.holdcount = self.holdcount + 1
+  self.currenttcb:markasheld()
+  return self.currenttcb.link
+end
+
+function Scheduler:suspendcurrent()
+  self.currenttcb:markassuspended()
+  return self.currenttcb
+end
+
+function Scheduler:queue(packet)
+  local t = self.blocks[packet.id]
+  if not t then return t end
+  self.queuecount = self.queuecount + 1
+  packet.link = nil
+  packet.id = self.currentid
+  return t:checkpriorityadd(self.currenttcb, packet)
+end
+
+
+local IdleTask = {}
+IdleTask.__index = IdleTask
+
+function IdleTask.new(scheduler, v1, count)
+  return setmetatable({scheduler = scheduler, v1 = v1, count = count},
+                      IdleTask)
+end
+
+function IdleTask:run(packet)
+  self.count = self.count - 1
+  if self.count == 0 then return self.scheduler:holdcurrent() end
+  if (self.v1 & 1) == 0 then
+    self.v1 = self.v1 >> 1
+    return self.scheduler:release(ID_DEVICE_A)
+  else
+    self.v1 = (self.v1 >> 1) ~ 0xD008
+    return self.scheduler:release(ID_DEVICE_B)
+  end
+end
+
+
+local DeviceTask = {}
+DeviceTask.__index = DeviceTask
+
+function DeviceTask.new(scheduler)
+  return setmetatable({scheduler = scheduler, v1 = nil}, DeviceTask)
+end
+
+function DeviceTask:run(packet)
+  if not packet then
+    if not self.v1 then return self.scheduler:suspendcurrent() end
+    local v = self.v1
+    self.v1 = nil
+    return self.scheduler:queue(v)
+  else
+    self.v1 = packet
+    return self.scheduler:holdcurrent()
+  end
+end
+
+
+local WorkerTask = {}
+WorkerTask.__index = WorkerTask
+
+function WorkerTask.new(scheduler, v1, v2)
+  return setmetatable({scheduler = scheduler, v1 = v1, v2 = v2}, WorkerTask)
+end
+
+function WorkerTask:run(packet)
+  if not packet then return self.scheduler:suspendcurrent() end
+  if self.v1 == ID_HANDLER_A then
+    self.v1 = ID_HANDLER_B
+  else
+    self.v1 = ID_HANDLER_A
+  end
+  packet.id = self.v1
+  packet.a1 = 0
+  for i = 1, DATA_SIZE do
+    self.v2 = self.v2 + 1
+    if self.v2 > 26 then self.v2 = 1 end
+    packet.a2[i] = self.v2
+  end
+  return self.scheduler:queue(packet)
+end
+
+
+local HandlerTask = {}
+HandlerTask.__index = HandlerTask
+
+function HandlerTask.new(scheduler)
+  return setmetatable({scheduler = scheduler, v1 = nil, v2 = nil},
+                      HandlerTask)
+end
+
+function HandlerTask:run(packet)
+  if packet then
+    if packet.kind == KIND_WORK then
+      self.v1 = packet:addto(self.v1)
+    else
+      self.v2 = packet:addto(self.v2)
+    end
+  end
+  if self.v1 then
+    local count = self.v1.a1
+    if count < DATA_SIZE then
+      if self.v2 then
+        local v = self.v2
+        self.v2 = self.v2.link
+        v.a1 = self.v1.a2[count + 1]
+        self.v1.a1 = count + 1
+        return self.scheduler:queue(v)
+      end
+    else
+      local v = self.v1
+      self.v1 = self.v1.link
+      return self.scheduler:queue(v)
+    end
+  end
+  return self.scheduler:suspendcurrent()
+end
+
+
+local function runrichards()
+  local scheduler = Scheduler.new()
+  scheduler:addrunningtask(ID_IDLE, 0, nil, IdleTask.new(scheduler, 1, COUNT))
+
+  local queue = Packet.new(nil, ID_WORKER, KIND_WORK)
+  queue = Packet.new(queue, ID_WORKER, KIND_WORK)
+  scheduler:addtask(ID_WORKER, 1000, queue,
+                    WorkerTask.new(scheduler, ID_HANDLER_A, 0))
+
+  queue = Packet.new(nil, ID_DEVICE_A, KIND_DEVICE)
+  queue = Packet.new(queue, ID_DEVICE_A, KIND_DEVICE)
+  queue = Packet.new(queue, ID_DEVICE_A, KIND_DEVICE)
+  scheduler:addtask(ID_HANDLER_A, 2000, queue, HandlerTask.new(scheduler))
+
+  queue = Packet.new(nil, ID_DEVICE_B, KIND_DEVICE)
+  queue = Packet.new(queue, ID_DEVICE_B, KIND_DEVICE)
+  queue = Packet.new(queue, ID_DEVICE_B, KIND_DEVICE)
+  scheduler:addtask(ID_HANDLER_B, 3000, queue, HandlerTask.new(scheduler))
+
+  scheduler:addtask(ID_DEVICE_A, 4000, nil, DeviceTask.new(scheduler))
+  scheduler:addtask(ID_DEVICE_B, 5000, nil, DeviceTask.new(scheduler))
+
+  scheduler:schedule()
+
+  assert(scheduler.queuecount == EXPECTED_QUEUE_COUNT and
+         scheduler.holdcount == EXPECTED_HOLD_COUNT,
+         string.format("wrong result: queue count %d, hold count %d",
+                       scheduler.queuecount, scheduler.holdcount))
+  return scheduler.queuecount, scheduler.holdcount
+end
+
+local N = tonumber(arg and arg[1]) or 10
+local q, h
+for i = 1, N do q, h = runrichards() end
+io.write(string.format("queue count %d, hold count %d\n", q, h))
@@ -0,0 +1,61 @@
+-- Report-building workloads for string concatenation.
+-- Each case builds the same text in a different way; 'table.concat'
+-- is the reference that does not depend on how '..' is implemented.
+
+local N = tonumber(arg and arg[1]) or 100000
+
+local function bench(name, f)
+  collectgarbage()
+  local t0 = os.clock()
+  local s = f()
+  print(string.format("%-16s %10d bytes %8.3f s", name, #s, os.clock() - t0))
+  return s
+end
+
+local lines = bench("append-lines", function()
+  local s = ""
+  for i = 1, N do
+    s = s .. "line " .. i .. "\n"
+  end
+  return s
+end)
+
+local csv = bench("csv-rows", function()
+  local s = "id,name,value\n"
+  for i = 1, N do
+    s = s .. i .. ",item" .. i .. "," .. (i * 0.5) .. "\n"
+  end
+  return s
+end)
+
+bench("html-table", function()
+  local s = "<table>"
+  for i = 1, N // 10 do
+    local row = "<tr>"
+    for j = 1, 10 do
+      row = row .. "<td>" .. (i * j) .. "</td>"
+    end
+    s = s .. row .. "</tr>\n"
+  end
+  return s .. "</table>"
+end)
+
+bench("append-and-len", function()
+  local s, total = "", 0
+  for i = 1, N do
+    s = s .. "x" .. i
+    total = total + #s
+  end
+  return s
+end)
+
+local ref = bench("table.concat", function()
+  local t = {}
+  for i = 1, N do
+    t[#t + 1] = "line " .. i .. "\n"
+  end
+  return table.concat(t)
+end)
+
+assert(lines == ref)
+assert(#csv > 0)
@@ -0,0 +1,59 @@
+-- Collector workloads: many short-lived tables per event over a large
+-- long-lived heap, run in incremental and in generational mode. For each
+-- mode, prints the total time and the latency of single events, where
+-- collection work done during an event shows up as a slow event. In
+-- "steptime" mode the collector is stopped and driven by time-budgeted
+-- steps between events, as an application would do in its idle time.
+
+local N = tonumber(arg and arg[1]) or 200000  -- objects in long-lived heap
+local E = 20000  -- number of events
+local T = 50  -- temporary tables per event
+local BUDGET = 200  -- microseconds of collection between events
+
+local function run(mode)
+  collectgarbage()
+  local idle = (mode == "steptime")
+  collectgarbage(idle and "incremental" or mode)
+  local heap = {}
+  for i = 1, N do heap[i] = {id = i, name = "obj" .. i, tags = {i % 7}} end
+  collectgarbage()
+  if idle then collectgarbage("stop") end
+  local times, maxstep = {}, 0
+  local left, limit = 0, collectgarbage("count") * 2  -- next cycle at 'limit'
+  local t0 = os.clock()
+  for e = 1, E do
+    local s = os.clock()
+    local acc = 0
+    for i = 1, T do
+      local msg = {kind = "event", seq = e, data = {i, e}}
+      acc = acc + msg.data[1]
+    end
+    heap[e % N + 1].last = {e}  -- some young objects go into old ones
+    times[e] = os.clock() - s
+    if idle and (left > 0 or collectgarbage("count") > limit) then
+      s = os.clock()
+      left = collectgarbage("steptime", BUDGET)
+      maxstep = math.max(maxstep, os.clock() - s)
+      if left == 0 then limit = collectgarbage("count") * 2 end
+    end
+  end
+  local total = os.clock() - t0
+  table.sort(times)
+  local function pct(p) return times[math.ceil(#times * p)] * 1e6 end
+  print(string.format("%-13s total %7.3f s  p50 %5.0f us  p99 %6.0f us  " ..
+                      "max %7.0f us  heap %6.0f KB", mode, total, pct(0.5),
+                      pct(0.99), times[#times] * 1e6, collectgarbage("count")))
+  if idle then
+    print(string.format("%-13s max step %5.0f us (budget %d us)", "", maxstep * 1e6,
+                        BUDGET))
+    collectgarbage("restart")
+  end
+  heap = nil
+end
+
+run("incremental")
+run("generational")
+run("incremental")
+run("generational")
+run("steptime")
+collectgarbage("incremental")
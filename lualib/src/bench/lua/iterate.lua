@@ -0,0 +1,90 @@
+-- Iteration-heavy workloads for generic 'for' loops. 'pairs' and
+-- 'ipairs' loops over plain tables run inline in the VM; the closure
+-- and '__index' cases still go through the regular iterator call.
+
+local N = tonumber(arg and arg[1]) or 100000
+local R = 50
+
+local function bench(name, f)
+  collectgarbage()
+  local t0 = os.clock()
+  local r = f()
+  print(string.format("%-16s %14d %8.3f s", name, r, os.clock() - t0))
+  return r
+end
+
+local array, hash, mixed = {}, {}, {}
+for i = 1, N do
+  array[i] = i
+  hash["k" .. i] = i
+  mixed[i] = i
+  mixed["k" .. i] = i
+end
+
+bench("ipairs-array", function()
+  local s = 0
+  for r = 1, R do
+    for i, v in ipairs(array) do s = s + v end
+  end
+  return s
+end)
+
+bench("pairs-array", function()
+  local s = 0
+  for r = 1, R do
+    for k, v in pairs(array) do s = s + v end
+  end
+  return s
+end)
+
+bench("pairs-hash", function()
+  local s = 0
+  for r = 1, R do
+    for k, v in pairs(hash) do s = s + v end
+  end
+  return s
+end)
+
+bench("pairs-mixed", function()
+  local s = 0
+  for r = 1, R do
+    for k, v in pairs(mixed) do s = s + v end
+  end
+  return s
+end)
+
+bench("next-loop", function()
+  local s = 0
+  for r = 1, R do
+    for k, v in next, hash do s = s + v end
+  end
+  return s
+end)
+
+bench("small-tables", function()
+  -- many short loops, as in code walking records
+  local rec = {x = 1, y = 2, z = 3, w = 4}
+  local s = 0
+  for r = 1, R * N // 20 do
+    for k, v in pairs(rec) do s = s + v end
+  end
+  return s
+end)
+
+bench("closure-iter", function()
+  local s = 0
+  for r = 1, R do
+    local i = 0
+    for v in function() i = i + 1; return array[i] end do s = s + v end
+  end
+  return s
+end)
+
+bench("ipairs-index", function()
+  local proxy = setmetatable({}, {__index = array})
+  local s = 0
+  for r = 1, R // 10 do
+    for i, v in ipairs(proxy) do s = s + v end
+  end
+  return s
+end)
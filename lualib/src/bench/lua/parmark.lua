@@ -0,0 +1,74 @@
+-- Parallel marking: full and generational collections over a large
+-- synthetic heap (tables, closures, prototypes, strings, weak tables and
+-- coroutines) with 1 to 8 marking threads, checking the heap after each
+-- collection. 'os.clock' counts the time of all threads, so for scaling
+-- compare the wall time of runs with a fixed number of threads:
+--   time lua parmark.lua 500000 4
+
+local N = tonumber(arg and arg[1]) or 500000
+local THREADS = tonumber(arg and arg[2])
+
+local function build(n)
+  local heap = {}
+  for i = 1, n do
+    local name = "node" .. i
+    heap[i] = {
+      id = i, name = name, list = {i, i + 1, {i}},
+      get = function() return name end,  -- closure sharing a prototype
+    }
+  end
+  local weak = setmetatable({}, {__mode = "k"})
+  for i = 1, n, 10 do weak[heap[i]] = {i} end  -- ephemeron entries
+  local cos = {}
+  for i = 1, 100 do  -- threads whose stacks hold part of the heap
+    cos[i] = coroutine.wrap(function(t) coroutine.yield(t) return t end)
+    cos[i](heap[i])
+  end
+  return {heap = heap, weak = weak, cos = cos}
+end
+
+local function check(root, n)
+  local heap = root.heap
+  for i = 1, n, 97 do
+    local o = heap[i]
+    assert(o.id == i and o.list[3][1] == i and o.get() == "node" .. i)
+    if i % 10 == 1 then assert(root.weak[o][1] == i) end
+  end
+end
+
+local function run(threads)
+  collectgarbage("parmark", threads)
+  local base = collectgarbage("count")
+  local root = build(N)
+  local t0 = os.clock()
+  for r = 1, 5 do
+    local dead = build(N // 10)  -- garbage to be collected
+    dead = nil
+    collectgarbage()
+    check(root, N)
+  end
+  local full = os.clock() - t0
+  collectgarbage("generational")
+  t0 = os.clock()
+  for r = 1, 5 do
+    local dead = build(N // 10)
+    dead = nil
+    collectgarbage("step")  -- a minor collection
+    check(root, N)
+  end
+  local gen = os.clock() - t0
+  collectgarbage("incremental")
+  local before = collectgarbage("count")
+  root = nil
+  collectgarbage()
+  assert(collectgarbage("count") - base < (before - base) / 4)
+  print(string.format("%d thread(s)  full %7.3f s  generational %7.3f s",
+                      threads, full, gen))
+end
+
+if THREADS then
+  run(THREADS)
+else
+  for _, t in ipairs({1, 2, 4, 8}) do run(t) end
+end
+collectgarbage("parmark", 1)
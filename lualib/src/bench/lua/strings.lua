@@ -0,0 +1,97 @@
+-- String hashing workloads: interning of short strings and tables keyed
+-- by strings, including long keys that share a prefix and a suffix.
+
+local N = tonumber(arg and arg[1]) or 100000
+
+local function bench(name, f)
+  collectgarbage()
+  local t0 = os.clock()
+  local r = f()
+  print(string.format("%-16s %12d %8.3f s", name, r, os.clock() - t0))
+  return r
+end
+
+bench("intern-concat", function()
+  -- new short strings, each one hashed and looked up in the string table
+  local n = 0
+  for r = 1, 10 do
+    for i = 1, N do
+      local s = "name_" .. i
+      n = n + #s
+    end
+  end
+  return n
+end)
+
+bench("intern-sub", function()
+  local text = string.rep("the quick brown fox jumps over the lazy dog ", 100)
+  local n = 0
+  for r = 1, N // 500 do
+    for i = 1, #text - 20, 3 do
+      n = n + #text:sub(i, i + (i % 20))
+    end
+  end
+  return n
+end)
+
+bench("intern-format", function()
+  local n = 0
+  for i = 1, N do
+    n = n + #string.format("%d:%s:%.2f", i, "id", i / 3)
+  end
+  return n
+end)
+
+bench("words-count", function()
+  -- typical word counting: many repeated short strings as keys
+  local text = {}
+  for i = 1, N do text[i] = "w" .. (i * 7919 % 5000) end
+  text = table.concat(text, " ")
+  local counts, n = {}, 0
+  for r = 1, 5 do
+    for w in text:gmatch("%S+") do
+      counts[w] = (counts[w] or 0) + 1
+    end
+  end
+  for _ in pairs(counts) do n = n + 1 end
+  return n
+end)
+
+bench("long-keys", function()
+  -- keys differing only in the middle
+  local pre, suf = string.rep("p", 100), string.rep("s", 100)
+  local t, s = {}, 0
+  for i = 1, N // 5 do t[pre .. i .. suf] = i end
+  for i = 1, N // 5 do s = s + t[pre .. i .. suf] end
+  return s
+end)
+
+bench("path-keys", function()
+  -- long keys sharing a long prefix, such as file paths
+  local t, s = {}, 0
+  local base = "/data/user/0/com.example.app/files/scripts/modules/"
+  for i = 1, N do t[base .. "module" .. i .. ".lua"] = i end
+  for i = 1, N do s = s + t[base .. "module" .. i .. ".lua"] end
+  return s
+end)
+
+do
+  -- bulk ingestion: latency of batches of new strings, where a resize
+  -- of the string table shows up as a slow batch
+  local B = 1000
+  local times, keep = {}, {}
+  collectgarbage()
+  collectgarbage("stop")  -- measure interning, not collection
+  for b = 1, N * 10 // B do
+    local t0 = os.clock()
+    for i = 1, B do
+      keep[#keep + 1] = "rec:" .. b .. ":" .. i
+    end
+    times[#times + 1] = os.clock() - t0
+  end
+  collectgarbage("restart")
+  table.sort(times)
+  local function pct(p) return times[math.ceil(#times * p)] * 1e6 end
+  print(string.format("%-16s p50 %6.0f us  p99 %6.0f us  max %6.0f us",
+                      "ingest-batches", pct(0.5), pct(0.99), times[#times] * 1e6))
+end
@@ -0,0 +1,76 @@
+-- Sweep workloads: many dead objects collected with their blocks freed by
+-- the collector itself ("inline", default) or by a helper thread
+-- ("bgfree"), followed by a stress run that checks finalizers, weak
+-- tables and resurrection while blocks are freed in background.
+-- 'os.clock' also counts the time of the helper thread, so compare the
+-- wall time of whole runs:  time lua sweep.lua 200000 inline|bgfree
+
+local N = tonumber(arg and arg[1]) or 200000
+local BG = (arg and arg[2]) == "bgfree"
+
+local function garbage(n)
+  local t = {}
+  for i = 1, n do
+    local s = "key" .. i
+    t[i] = {s, {i}, function() return s end, s .. string.rep("x", i % 64)}
+  end
+  return t
+end
+
+do
+  collectgarbage("bgfree", BG and 1 or 0)
+  local t0 = os.clock()
+  for r = 1, 5 do
+    local t = garbage(N)
+    t = nil
+    collectgarbage()  -- whole cycle, sweeping all the garbage
+    t = garbage(N)
+    t = nil
+    repeat until collectgarbage("step")  -- same with incremental steps
+  end
+  print(string.format("%-8s cpu %7.3f s", BG and "bgfree" or "inline", os.clock() - t0))
+end
+
+
+-- stress: objects with finalizers, resurrected objects and weak tables
+-- among many dead objects, in both collector modes
+local function stress(mode)
+  collectgarbage(mode)
+  collectgarbage("bgfree", 1)
+  local finalized, created = 0, 0
+  local resurrected = {}
+  local weak = setmetatable({}, {__mode = "v"})
+  local mt = {__gc = function(o)
+    finalized = finalized + 1
+    if o.id % 10 == 0 then resurrected[#resurrected + 1] = o end
+  end}
+  for r = 1, 20 do
+    local live = {}
+    for i = 1, N // 20 do
+      local o = setmetatable({id = created, name = "obj" .. created}, mt)
+      created = created + 1
+      weak[#weak + 1] = {o}
+      if i % 3 == 0 then live[#live + 1] = o end
+      local co = coroutine.wrap(function(a) local b = {a} coroutine.yield(b) end)
+      co(i)  -- suspended thread with its own stack
+    end
+    if r % 4 == 0 then collectgarbage("bgfree", 0) end
+    if r % 4 == 2 then collectgarbage("bgfree", 1) end
+    collectgarbage("steptime", 1000)
+    live = nil
+  end
+  collectgarbage()
+  collectgarbage()
+  for _, o in ipairs(resurrected) do
+    assert(o.id % 10 == 0 and o.name == "obj" .. o.id)
+  end
+  resurrected = nil
+  collectgarbage()
+  assert(finalized == created, "missing finalizers")
+  assert(next(weak) == nil, "weak table not cleared")
+  print(string.format("%-13s %d objects finalized", mode, finalized))
+end
+
+stress("incremental")
+stress("generational")
+collectgarbage("incremental")
@@ -0,0 +1,100 @@
+-- Hash-part workloads for tables: string-keyed records and mixed keys.
+-- Run the same script on builds with and without LUAI_SWISSTABLE to
+-- compare the two hash-part engines.
+
+local N = tonumber(arg and arg[1]) or 200000
+
+local function bench(name, f)
+  collectgarbage()
+  local t0 = os.clock()
+  local r = f()
+  print(string.format("%-16s %12d %8.3f s", name, r, os.clock() - t0))
+  return r
+end
+
+local names = {}
+for i = 1, N do names[i] = "key" .. i end
+
+local mixed = {}
+for i = 1, N do
+  local k = i % 4
+  if k == 0 then mixed[i] = names[i]
+  elseif k == 1 then mixed[i] = i * 7919
+  elseif k == 2 then mixed[i] = i + 0.5
+  else mixed[i] = {} end
+end
+
+bench("string-insert", function()
+  local t = {}
+  for i = 1, N do t[names[i]] = i end
+  return N
+end)
+
+local strtab = {}
+for i = 1, N do strtab[names[i]] = i end
+
+bench("string-hit", function()
+  local s = 0
+  for r = 1, 10 do
+    for i = 1, N do s = s + strtab[names[i]] end
+  end
+  return s
+end)
+
+bench("string-miss", function()
+  local s = 0
+  for r = 1, 10 do
+    for i = 1, N do
+      if strtab[names[i] .. ""] == nil then s = s + 1 end
+      if strtab[r] then s = s + 1 end
+    end
+  end
+  return s
+end)
+
+bench("records", function()
+  -- many small tables with a few string fields (objects)
+  local s = 0
+  for i = 1, N do
+    local o = {x = i, y = i * 2, name = names[i], alive = true}
+    s = s + o.x + o.y
+  end
+  return s
+end)
+
+bench("mixed-insert", function()
+  local t = {}
+  for i = 1, N do t[mixed[i]] = i end
+  return N
+end)
+
+local mixtab = {}
+for i = 1, N do mixtab[mixed[i]] = i end
+
+bench("mixed-hit", function()
+  local s = 0
+  for r = 1, 10 do
+    for i = 1, N do s = s + mixtab[mixed[i]] end
+  end
+  return s
+end)
+
+bench("mixed-churn", function()
+  -- insert and remove keys so that the table is rehashed often
+  local t, n = {}, 0
+  for r = 1, 4 do
+    for i = 1, N do t[mixed[i]] = i end
+    for i = 1, N, 2 do t[mixed[i]] = nil end
+    for _ in pairs(t) do n = n + 1 end
+  end
+  return n
+end)
+
+bench("sparse-int", function()
+  local t, s = {}, 0
+  for i = 1, N do t[i * 1024] = i end
+  for r = 1, 10 do
+    for i = 1, N do s = s + t[i * 1024] end
+  end
+  return s
+end)
@@ -18,10 +18,12 @@
 #include "lapi.h"
 #include "ldebug.h"
 #include "ldo.h"
+#include "lfreeq.h"
 #include "lfunc.h"
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
+#include "lopcodes.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -276,7 +278,7 @@ LUA_API int lua_isinteger (lua_State *L, int idx) {
 LUA_API int lua_isnumber (lua_State *L, int idx) {
   lua_Number n;
   const TValue *o = index2addr(L, idx);
-  return tonumber(o, &n);
+  return tonumber(L, o, &n);
 }
 
 
@@ -345,7 +347,7 @@ LUA_API size_t lua_stringtonumber (lua_State *L, const char *s) {
 LUA_API lua_Number lua_tonumberx (lua_State *L, int idx, int *pisnum) {
   lua_Number n;
   const TValue *o = index2addr(L, idx);
-  int isnum = tonumber(o, &n);
+  int isnum = tonumber(L, o, &n);
   if (!isnum)
     n = 0;  /* call to 'tonumber' may change 'n' even if it fails */
   if (pisnum) *pisnum = isnum;
@@ -356,7 +358,7 @@ LUA_API lua_Number lua_tonumberx (lua_State *L, int idx, int *pisnum) {
 LUA_API lua_Integer lua_tointegerx (lua_State *L, int idx, int *pisnum) {
   lua_Integer res;
   const TValue *o = index2addr(L, idx);
-  int isnum = tointeger(o, &res);
+  int isnum = tointeger(L, o, &res);
   if (!isnum)
     res = 0;  /* call to 'tointeger' may change 'n' even if it fails */
   if (pisnum) *pisnum = isnum;
@@ -383,6 +385,11 @@ LUA_API const char *lua_tolstring (lua_State *L, int idx, size_t *len) {
     o = index2addr(L, idx);  /* previous call may reallocate the stack */
     lua_unlock(L);
   }
+  else if (!isflat(tsvalue(o))) {
+    lua_lock(L);  /* flattening a rope allocates its contents */
+    luaS_flatten(L, tsvalue(o));
+    lua_unlock(L);
+  }
   if (len != NULL)
     *len = vslen(o);
   return svalue(o);
@@ -693,6 +700,19 @@ LUA_API void lua_createtable (lua_State *L, int narray, int nrec) {
 }
 
 
+/*
+** remove all entries of a table, keeping its allocated space
+*/
+LUA_API void lua_cleartable (lua_State *L, int idx) {
+  StkId t;
+  lua_lock(L);
+  t = index2addr(L, idx);
+  api_check(L, ttistable(t), "table expected");
+  luaH_clear(hvalue(t));
+  lua_unlock(L);
+}
+
+
 LUA_API int lua_getmetatable (lua_State *L, int objindex) {
   const TValue *obj;
   Table *mt;
@@ -1078,10 +1098,53 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
         luaC_checkGC(L);
       }
       g->gcrunning = oldrunning;  /* restore previous state */
-      if (debt > 0 && g->gcstate == GCSpause)  /* end of cycle? */
+      if (debt > 0 &&  /* end of cycle? (each step in generational mode) */
+          (g->gcstate == GCSpause || isgenerational(g)))
         res = 1;  /* signal it */
       break;
     }
+    case LUA_GCSTEPTIME: {
+      if (data < 0) data = 0;
+      res = luaC_steptime(L, data);  /* part of the cycle still to be done */
+      break;
+    }
+    case LUA_GCBGFREE: {
+      res = luaQ_enable(L, data);  /* whether it is on */
+      break;
+    }
+    case LUA_GCPARMARK: {
+      res = luaC_parmark(L, data);  /* previous number of threads */
+      break;
+    }
+    case LUA_GCBULKCLOSE: {
+      res = g->bulkclose;
+      g->bulkclose = (data != 0);
+      break;
+    }
+    case LUA_GCCYCLES: {
+      res = cast_int(g->GCcycles & INT_MAX);  /* (wraps around) */
+      break;
+    }
+    case LUA_GCSTATS: {
+      res = luaC_gcstats(L, data);  /* whether it was on */
+      break;
+    }
+    case LUA_GCALLOCSITES: {
+      res = luaM_allocsites(L, data);  /* whether it was on */
+      break;
+    }
+    case LUA_GCOPTIMIZE: {
+      res = g->optimize;
+      g->optimize = (data != 0);
+      break;
+    }
+    case LUA_GCTHREADSAFE: {
+      res = g->threadsafe;
+      g->threadsafe = (data != 0);
+      if (!g->threadsafe)
+        luaQ_enable(L, 0);  /* its helper thread would call the allocator */
+      break;
+    }
     case LUA_GCSETPAUSE: {
       res = g->gcpause;
       g->gcpause = data;
@@ -1093,10 +1156,23 @@ LUA_API int lua_gc (lua_State *L, int what, int data) {
       g->gcstepmul = data;
       break;
     }
+    case LUA_GCSETMAJORINC: {
+      res = g->gcmajorinc;
+      if (data < 110) data = 110;  /* keep some room for young objects */
+      g->gcmajorinc = data;
+      break;
+    }
     case LUA_GCISRUNNING: {
       res = g->gcrunning;
       break;
     }
+    case LUA_GCGEN: case LUA_GCINC: {
+      res = isgenerational(g) ? LUA_GCGEN : LUA_GCINC;  /* old mode */
+      if (what == LUA_GCGEN && data > 0)
+        g->gcminormul = data;
+      luaC_changemode(L, (what == LUA_GCGEN) ? KGC_GEN : KGC_NORMAL);
+      break;
+    }
     default: res = -1;  /* invalid option */
   }
   lua_unlock(L);
@@ -1136,6 +1212,109 @@ LUA_API int lua_next (lua_State *L, int idx) {
 }
 
 
+/*
+** Register 'f' as the standard iterator 'what', so that generic 'for'
+** loops over tables using it may run without calling it. 'f' must do
+** exactly what 'next' (LUA_ITERNEXT) or the iterator returned by
+** 'ipairs' (LUA_ITERIPAIRS) does in the base library.
+*/
+LUA_API void lua_setiterator (lua_State *L, int what, lua_CFunction f) {
+  lua_lock(L);
+  api_check(L, what == LUA_ITERNEXT || what == LUA_ITERIPAIRS,
+               "invalid iterator");
+  G(L)->stditer[what] = f;
+  lua_unlock(L);
+}
+
+
+/*
+** Get the telemetry of the 'n'-th most recent finished collection cycle
+** (0 is the last one). Returns 0 if there is no such cycle (telemetry off
+** or not kept that long).
+*/
+LUA_API int lua_gccycle (lua_State *L, int n, lua_GCCycle *c) {
+  int res;
+  lua_lock(L);
+  res = luaC_getcycle(L, n, c);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Fill 'sites' with the 'n' sites that allocated most bytes since
+** lua_gc(L, LUA_GCALLOCSITES, 1). Returns the number of sites filled.
+*/
+LUA_API int lua_allocsites (lua_State *L, lua_AllocSite *sites, int n) {
+  int res;
+  lua_lock(L);
+  res = luaM_getsites(L, sites, n);
+  lua_unlock(L);
+  return res;
+}
+
+
+/*
+** Read the VM execution counters (see LUA_VM* in lua.h). Returns -1
+** when the core is built without LUAI_VMSTATS or for an invalid 'a'/'b'.
+*/
+LUA_API lua_Integer lua_vmstat (lua_State *L, int what, int a, int b) {
+#if defined(LUAI_VMSTATS)
+  global_State *g = G(L);
+  lua_Integer res = -1;
+  lua_lock(L);
+  switch (what) {
+    case LUA_VMOPCODES: {
+      if (0 <= a && a < NUM_OPCODES)
+        res = cast(lua_Integer, g->vmops[a]);
+      break;
+    }
+    case LUA_VMPAIRS: {
+      if (0 <= a && a < NUM_OPCODES && 0 <= b && b < NUM_OPCODES)
+        res = cast(lua_Integer, g->vmpairs[a][b]);
+      break;
+    }
+    case LUA_VMSLOWPATHS: {
+      if (0 <= a && a < LUA_NUMVMSLOW)
+        res = cast(lua_Integer, g->vmslow[a]);
+      break;
+    }
+    case LUA_VMRESET: {
+      memset(g->vmops, 0, sizeof(g->vmops));
+      memset(g->vmpairs, 0, sizeof(g->vmpairs));
+      memset(g->vmslow, 0, sizeof(g->vmslow));
+      res = 0;
+      break;
+    }
+    default: api_check(L, 0, "invalid option");
+  }
+  lua_unlock(L);
+  return res;
+#else
+  UNUSED(L); UNUSED(what); UNUSED(a); UNUSED(b);
+  return -1;
+#endif
+}
+
+
+/*
+** Name of opcode 'a' (LUA_VMOPCODES) or of fallback kind 'a'
+** (LUA_VMSLOWPATHS); NULL when 'a' is out of range.
+*/
+LUA_API const char *lua_vmname (int what, int a) {
+  static const char *const slownames[LUA_NUMVMSLOW] = {
+    "finishget", "finishset", "bintm", "ordertm", "eqtm", "calltm",
+    "str2num", "num2str"
+  };
+  if (what == LUA_VMOPCODES && 0 <= a && a < NUM_OPCODES)
+    return luaP_opnames[a];
+  else if (what == LUA_VMSLOWPATHS && 0 <= a && a < LUA_NUMVMSLOW)
+    return slownames[a];
+  else
+    return NULL;
+}
+
+
 LUA_API void lua_concat (lua_State *L, int n) {
   lua_lock(L);
   api_checknelems(L, n);
@@ -1174,6 +1353,8 @@ LUA_API lua_Alloc lua_getallocf (lua_State *L, void **ud) {
 
 LUA_API void lua_setallocf (lua_State *L, lua_Alloc f, void *ud) {
   lua_lock(L);
+  if (G(L)->freeq != NULL)
+    luaQ_sync(G(L));  /* queued blocks go to the old allocator */
   G(L)->ud = ud;
   G(L)->frealloc = f;
   lua_unlock(L);
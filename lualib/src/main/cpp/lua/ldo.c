@@ -24,6 +24,7 @@
 #include "lmem.h"
 #include "lobject.h"
 #include "lopcodes.h"
+#include "lopt.h"
 #include "lparser.h"
 #include "lstate.h"
 #include "lstring.h"
@@ -317,6 +318,7 @@ static void tryfuncTM (lua_State *L, StkId func) {
   StkId p;
   if (!ttisfunction(tm))
     luaG_typeerror(L, func, "call");
+  luaE_vmslow(L, LUA_VMSLOW_CALLTM);
   /* Open a hole inside the stack at 'func' */
   for (p = L->top; p > func; p--)
     setobjs2s(L, p, p-1);
@@ -774,6 +776,8 @@ static void f_parser (lua_State *L, void *ud) {
   else {
     checkmode(L, p->mode, "text");
     cl = luaY_parser(L, p->z, &p->buff, &p->dyd, p->name, c);
+    if (G(L)->optimize)
+      luaR_optimize(L, cl->p, &p->buff);
   }
   lua_assert(cl->nupvalues == cl->p->sizeupvalues);
   luaF_initupvals(L, cl);
@@ -0,0 +1,228 @@
+/*
+** $Id: lfreeq.c $
+** Background freeing of dead objects
+** See Copyright Notice in lua.h
+*/
+
+#define lfreeq_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <stddef.h>
+
+#include "lua.h"
+
+#include "lfreeq.h"
+#include "lgc.h"
+#include "lmem.h"
+#include "lstate.h"
+
+
+/*
+** The helper thread needs POSIX threads; without them, 'luaQ_enable'
+** fails and the collector frees all blocks itself.
+*/
+#if !defined(LUAI_FREEQTHREADS)
+#if defined(__unix__) || defined(__APPLE__)
+#define LUAI_FREEQTHREADS	1
+#else
+#define LUAI_FREEQTHREADS	0
+#endif
+#endif
+
+
+#if LUAI_FREEQTHREADS
+
+#include <pthread.h>
+
+
+typedef struct FreeBatch {
+  struct FreeBatch *next;
+  int n;  /* number of blocks in the batch */
+  struct {
+    void *block;
+    size_t size;
+  } b[LUAI_FREEBATCH];
+} FreeBatch;
+
+
+/*
+** 'cur' belongs to the collector; all other fields are protected by
+** 'lock'. The helper thread reads 'frealloc' and 'ud' from the global
+** state only after taking a batch, so a change of allocator (done after
+** 'luaQ_sync') is seen by it.
+*/
+typedef struct FreeQueue {
+  global_State *g;
+  FreeBatch *cur;  /* batch being filled by the collector */
+  FreeBatch *full;  /* batches waiting for the helper thread */
+  FreeBatch *empty;  /* batches ready to be filled */
+  int busy;  /* true while the helper thread frees a batch */
+  int stop;  /* true to make the helper thread finish */
+  pthread_mutex_t lock;
+  pthread_cond_t work;  /* signals the helper thread: new batch or stop */
+  pthread_cond_t done;  /* signals the collector: a batch was freed */
+  pthread_t thread;
+  FreeBatch batches[LUAI_FREEBATCHES];
+} FreeQueue;
+
+
+static void *helper (void *ud) {
+  FreeQueue *q = (FreeQueue *)ud;
+  pthread_mutex_lock(&q->lock);
+  for (;;) {
+    FreeBatch *fb;
+    int i;
+    while (q->full == NULL && !q->stop)
+      pthread_cond_wait(&q->work, &q->lock);
+    if (q->full == NULL)  /* stopped and nothing left? */
+      break;
+    fb = q->full;
+    q->full = fb->next;
+    q->busy = 1;
+    pthread_mutex_unlock(&q->lock);
+    for (i = 0; i < fb->n; i++)
+      (*q->g->frealloc)(q->g->ud, fb->b[i].block, fb->b[i].size, 0);
+    fb->n = 0;
+    pthread_mutex_lock(&q->lock);
+    fb->next = q->empty;
+    q->empty = fb;
+    q->busy = 0;
+    pthread_cond_signal(&q->done);
+  }
+  pthread_mutex_unlock(&q->lock);
+  return NULL;
+}
+
+
+/*
+** Hand batch 'cur' to the helper thread.
+*/
+void luaQ_flush (global_State *g) {
+  FreeQueue *q = g->freeq;
+  if (q->cur != NULL) {
+    pthread_mutex_lock(&q->lock);
+    q->cur->next = q->full;
+    q->full = q->cur;
+    pthread_cond_signal(&q->work);
+    pthread_mutex_unlock(&q->lock);
+    q->cur = NULL;
+  }
+}
+
+
+/*
+** Wait until all queued blocks have been freed.
+*/
+void luaQ_sync (global_State *g) {
+  FreeQueue *q = g->freeq;
+  luaQ_flush(g);
+  pthread_mutex_lock(&q->lock);
+  while (q->full != NULL || q->busy)
+    pthread_cond_wait(&q->done, &q->lock);
+  pthread_mutex_unlock(&q->lock);
+}
+
+
+/*
+** Queue 'block' to be freed by the helper thread. Returns false when
+** the caller must free it: outside the sweep phases (where the memory
+** is probably reused soon), in emergency collections (where the memory
+** is needed now), or when all batches are busy.
+*/
+int luaQ_defer (global_State *g, void *block, size_t osize) {
+  FreeQueue *q = g->freeq;
+  FreeBatch *fb = q->cur;
+  if (!issweepphase(g) || g->gckind == KGC_EMERGENCY)
+    return 0;
+  if (fb == NULL) {  /* get an empty batch */
+    pthread_mutex_lock(&q->lock);
+    fb = q->empty;
+    if (fb != NULL)
+      q->empty = fb->next;
+    pthread_mutex_unlock(&q->lock);
+    if (fb == NULL)  /* helper thread is behind? */
+      return 0;
+    q->cur = fb;
+  }
+  fb->b[fb->n].block = block;
+  fb->b[fb->n].size = osize;
+  if (++fb->n == LUAI_FREEBATCH)
+    luaQ_flush(g);
+  return 1;
+}
+
+
+static void stop (lua_State *L, FreeQueue *q) {
+  pthread_mutex_lock(&q->lock);
+  q->stop = 1;
+  pthread_cond_signal(&q->work);
+  pthread_mutex_unlock(&q->lock);
+  pthread_join(q->thread, NULL);
+  pthread_cond_destroy(&q->done);
+  pthread_cond_destroy(&q->work);
+  pthread_mutex_destroy(&q->lock);
+  luaM_free(L, q);
+}
+
+
+/*
+** Start ('on') or stop background freeing. Returns whether it is on:
+** it does not start when the allocator cannot be called by another
+** thread ('threadsafe' cleared with LUA_GCTHREADSAFE).
+*/
+int luaQ_enable (lua_State *L, int on) {
+  global_State *g = G(L);
+  FreeQueue *q = g->freeq;
+  if (!on && q != NULL) {
+    luaQ_sync(g);
+    g->freeq = NULL;  /* free the queue itself here */
+    stop(L, q);
+  }
+  else if (on && q == NULL && g->threadsafe) {
+    int i;
+    q = luaM_new(L, FreeQueue);
+    q->g = g;
+    q->cur = q->full = q->empty = NULL;
+    q->busy = q->stop = 0;
+    for (i = 0; i < LUAI_FREEBATCHES; i++) {
+      q->batches[i].n = 0;
+      q->batches[i].next = q->empty;
+      q->empty = &q->batches[i];
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->work, NULL);
+    pthread_cond_init(&q->done, NULL);
+    if (pthread_create(&q->thread, NULL, helper, q) != 0) {
+      pthread_cond_destroy(&q->done);
+      pthread_cond_destroy(&q->work);
+      pthread_mutex_destroy(&q->lock);
+      luaM_free(L, q);
+      return 0;
+    }
+    g->freeq = q;
+  }
+  return (g->freeq != NULL);
+}
+
+#else
+
+/* no threads: background freeing cannot be turned on */
+
+int luaQ_enable (lua_State *L, int on) {
+  UNUSED(L); UNUSED(on);
+  return 0;
+}
+
+int luaQ_defer (global_State *g, void *block, size_t osize) {
+  UNUSED(g); UNUSED(block); UNUSED(osize);
+  return 0;
+}
+
+void luaQ_flush (global_State *g) { UNUSED(g); }
+
+void luaQ_sync (global_State *g) { UNUSED(g); }
+
+#endif
@@ -0,0 +1,39 @@
+/*
+** $Id: lfreeq.h $
+** Background freeing of dead objects
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lfreeq_h
+#define lfreeq_h
+
+
+#include "lstate.h"
+
+
+/*
+** During the sweep phases, the collector unlinks dead objects as usual,
+** but the blocks they release are collected in batches that a helper
+** thread gives back to the allocator. Memory accounting ('GCdebt') is
+** done when a block is queued, so the collector pacing does not change.
+** The allocator must accept being called from the helper thread while
+** the state runs ('realloc'/'free' do).
+*/
+
+/* number of blocks handed to the helper thread at once */
+#if !defined(LUAI_FREEBATCH)
+#define LUAI_FREEBATCH		512
+#endif
+
+/* number of batches per state (when all are busy, blocks are freed here) */
+#if !defined(LUAI_FREEBATCHES)
+#define LUAI_FREEBATCHES	4
+#endif
+
+
+LUAI_FUNC int luaQ_enable (lua_State *L, int on);
+LUAI_FUNC int luaQ_defer (global_State *g, void *block, size_t osize);
+LUAI_FUNC void luaQ_flush (global_State *g);
+LUAI_FUNC void luaQ_sync (global_State *g);
+
+#endif
@@ -16,6 +16,7 @@
 
 #include "ldebug.h"
 #include "ldo.h"
+#include "lfreeq.h"
 #include "lfunc.h"
 #include "lgc.h"
 #include "lmem.h"
@@ -60,10 +61,43 @@
 
 
 /*
-** 'makewhite' erases all color bits then sets only the current white
-** bit
+** 'luai_nsec' gives a monotonic time in nanoseconds, used by the cycle
+** telemetry (LUA_GCSTATS), and 'luai_usec' the same time in
+** microseconds, used by steps with a time budget (only differences
+** between two times matter; a budget running across a wrap-around of
+** 'luai_usec' just ends early). Without a POSIX monotonic clock, they
+** fall back to 'clock', which measures processor time.
 */
-#define maskcolors	(~(bitmask(BLACKBIT) | WHITEBITS))
+#if !defined(luai_nsec)
+
+#include <time.h>
+
+#if defined(CLOCK_MONOTONIC)
+static lu_mem luai_nsec (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return cast(lu_mem, ts.tv_sec) * 1000000000 + cast(lu_mem, ts.tv_nsec);
+}
+#else
+#define luai_nsec()	cast(lu_mem, (double)clock() * 1e9 / CLOCKS_PER_SEC)
+#endif
+
+#endif
+
+#define luai_usec()	(luai_nsec() / 1000)
+
+
+/* number of finished cycles whose telemetry is kept */
+#if !defined(LUAI_GCHISTORY)
+#define LUAI_GCHISTORY	64
+#endif
+
+
+/*
+** 'makewhite' erases all color bits (and the old bit) then sets only
+** the current white bit
+*/
+#define maskcolors	(~(bit2mask(BLACKBIT, OLDBIT) | WHITEBITS))
 #define makewhite(g,x)	\
  (x->marked = cast_byte((x->marked & maskcolors) | luaC_white(g)))
 
@@ -94,6 +128,23 @@
 static void reallymarkobject (global_State *g, GCObject *o);
 
 
+/*
+** Parallel marking needs POSIX threads and atomic operations on bytes.
+*/
+#if !defined(LUAI_PARMARK)
+#if (defined(__unix__) || defined(__APPLE__)) && defined(__GNUC__)
+#define LUAI_PARMARK	1
+#else
+#define LUAI_PARMARK	0
+#endif
+#endif
+
+#if LUAI_PARMARK
+static void parmark (GCObject *o);
+static void parpropagateall (global_State *g);
+#endif
+
+
 /*
 ** {======================================================
 ** Generic functions
@@ -150,7 +201,9 @@ static int iscleared (global_State *g, const TValue *o) {
 ** barrier that moves collector forward, that is, mark the white object
 ** being pointed by a black object. (If in sweep phase, clear the black
 ** object to white [sweep it] to avoid other barrier calls for this
-** same object.)
+** same object.) In generational mode, this is how a young object
+** stored into an old one is kept: it is marked now and traversed by
+** the next collection.
 */
 void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v) {
   global_State *g = G(L);
@@ -166,7 +219,9 @@ void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v) {
 
 /*
 ** barrier that moves collector backward, that is, mark the black object
-** pointing to a white object as gray again.
+** pointing to a white object as gray again. (In generational mode, an
+** old table stays in 'grayagain' until the next collection traverses
+** it; as it is gray, no other barrier will link it again.)
 */
 void luaC_barrierback_ (lua_State *L, Table *t) {
   global_State *g = G(L);
@@ -233,6 +288,12 @@ GCObject *luaC_newobj (lua_State *L, int tt, size_t sz) {
 ** upvalues are already linked in 'headuv' list.)
 */
 static void reallymarkobject (global_State *g, GCObject *o) {
+#if LUAI_PARMARK
+  if (g->gcparallel) {  /* called by a marking thread? */
+    parmark(o);
+    return;
+  }
+#endif
  reentry:
   white2gray(o);
   switch (o->tt) {
@@ -242,8 +303,16 @@ static void reallymarkobject (global_State *g, GCObject *o) {
       break;
     }
     case LUA_TLNGSTR: {
-      gray2black(o);
-      g->GCmemtrav += sizelstring(gco2ts(o)->u.lnglen);
+      TString *ts = gco2ts(o);
+      for (;;) {  /* ropes chain through 'left'; mark them iteratively */
+        gray2black(ts);
+        g->GCmemtrav += sizelngstr(ts);
+        if (isflat(ts)) break;
+        markobject(g, ts2rope(ts)->right);  /* a flat string */
+        ts = ts2rope(ts)->left;
+        if (!iswhite(ts)) break;  /* rest of chain already marked? */
+        white2gray(ts);
+      }
       break;
     }
     case LUA_TUSERDATA: {
@@ -356,7 +425,8 @@ static void restartcollection (global_State *g) {
 ** Traverse a table with weak values and link it to proper list. During
 ** propagate phase, keep it in 'grayagain' list, to be revisited in the
 ** atomic phase. In the atomic phase, if table has any white value,
-** put it in 'weak' list, to be cleared.
+** put it in 'weak' list, to be cleared. (In generational mode, a weak
+** table left out of all lists must be black; see 'blackenweak'.)
 */
 static void traverseweakvalue (global_State *g, Table *h) {
   Node *n, *limit = gnodelast(h);
@@ -378,6 +448,8 @@ static void traverseweakvalue (global_State *g, Table *h) {
     linkgclist(h, g->grayagain);  /* must retraverse it in atomic phase */
   else if (hasclears)
     linkgclist(h, g->weak);  /* has to be cleared later */
+  else if (isgenerational(g))
+    gray2black(h);  /* will not be traversed again */
 }
 
 
@@ -426,6 +498,8 @@ static int traverseephemeron (global_State *g, Table *h) {
     linkgclist(h, g->ephemeron);  /* have to propagate again */
   else if (hasclears)  /* table has white keys? */
     linkgclist(h, g->allweak);  /* may have to clean white keys */
+  else if (isgenerational(g))
+    gray2black(h);  /* will not be traversed again */
   return marked;
 }
 
@@ -448,13 +522,16 @@ static void traversestrongtable (global_State *g, Table *h) {
 }
 
 
+#define sizetable(h)	(sizeof(Table) + sizeof(TValue) * (h)->sizearray + \
+                         sizeof(Node) * cast(size_t, allocsizenode(h)))
+
 static lu_mem traversetable (global_State *g, Table *h) {
-  const char *weakkey, *weakvalue;
+  int weakkey, weakvalue;
   const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
   markobjectN(g, h->metatable);
   if (mode && ttisstring(mode) &&  /* is there a weak mode? */
-      ((weakkey = strchr(svalue(mode), 'k')),
-       (weakvalue = strchr(svalue(mode), 'v')),
+      ((weakkey = luaS_strchr(tsvalue(mode), 'k')),
+       (weakvalue = luaS_strchr(tsvalue(mode), 'v')),
        (weakkey || weakvalue))) {  /* is really weak? */
     black2gray(h);  /* keep table gray */
     if (!weakkey)  /* strong keys? */
@@ -466,8 +543,7 @@ static lu_mem traversetable (global_State *g, Table *h) {
   }
   else  /* not weak */
     traversestrongtable(g, h);
-  return sizeof(Table) + sizeof(TValue) * h->sizearray +
-                         sizeof(Node) * cast(size_t, allocsizenode(h));
+  return sizetable(h);
 }
 
 
@@ -600,7 +676,14 @@ static void propagatemark (global_State *g) {
 }
 
 
+
 static void propagateall (global_State *g) {
+#if LUAI_PARMARK
+  if (g->markers != NULL) {
+    parpropagateall(g);
+    return;
+  }
+#endif
   while (g->gray) propagatemark(g);
 }
 
@@ -625,6 +708,446 @@ static void convergeephemerons (global_State *g) {
 /* }====================================================== */
 
 
+/*
+** {======================================================
+** Parallel marking
+** =======================================================
+*/
+
+#if LUAI_PARMARK
+
+#include <pthread.h>
+
+/* maximum number of marking threads (including the collector's own) */
+#if !defined(LUAI_MAXMARKERS)
+#define LUAI_MAXMARKERS		16
+#endif
+
+/* size of the private stack of gray objects of each marking thread */
+#if !defined(LUAI_MARKSTACK)
+#define LUAI_MARKSTACK		4096
+#endif
+
+/* size of the shared pool of gray objects, and of each exchange */
+#define MARKPOOL	(LUAI_MARKSTACK * 4)
+#define MARKCHUNK	(LUAI_MARKSTACK / 16)
+
+
+/*
+** While marking in parallel ('gcparallel'), the collector thread and
+** 'n - 1' helper threads each traverse gray objects from a private
+** stack. A thread with plenty of work moves part of it to a shared pool
+** when others are idle, and an idle thread takes work from that pool.
+** An object turns from white to gray with a compare-and-swap, so that
+** only one thread traverses it. Tables, closures and prototypes are
+** traversed in parallel; threads and weak tables, whose traversal
+** changes collector lists, are left gray in 'overflow' (as are objects
+** that do not fit anywhere) and go back to 'gray' for the collector.
+** The private stacks and the pool are allocated when marking threads
+** are created, so marking never allocates memory.
+*/
+typedef struct Marker {
+  struct Markers *m;
+  lu_mem memtrav;  /* memory traversed by this thread */
+  int n;  /* number of objects in 'stack' */
+  pthread_t thread;
+  GCObject *stack[LUAI_MARKSTACK];
+} Marker;
+
+
+typedef struct Markers {
+  global_State *g;
+  int n;  /* number of marking threads, including the collector */
+  int size;  /* number of threads allocated in 'w' */
+  int idle;  /* threads waiting for work */
+  int running;  /* helper threads still in the current round */
+  int done;  /* true when the current round is over */
+  int stop;  /* true to make the helper threads finish */
+  unsigned int round;  /* number of the current round */
+  int npool;  /* number of objects in 'pool' */
+  GCObject *overflow;  /* objects left to the collector */
+  pthread_mutex_t lock;
+  pthread_cond_t start;  /* signals helpers: new round or stop */
+  pthread_cond_t more;  /* signals idle threads: work or end of round */
+  pthread_cond_t finished;  /* signals the collector: helpers are done */
+  Marker *w;  /* marking threads (allocated with this structure) */
+  GCObject *pool[MARKPOOL];
+} Markers;
+
+
+#define sizemarkers(n)	(sizeof(Markers) + (n) * sizeof(Marker))
+
+
+/* marking thread running in the current thread */
+static __thread Marker *curmarker;
+
+
+static GCObject **gclistof (GCObject *o) {
+  switch (o->tt) {
+    case LUA_TTABLE: return &gco2t(o)->gclist;
+    case LUA_TLCL: return &gco2lcl(o)->gclist;
+    case LUA_TCCL: return &gco2ccl(o)->gclist;
+    case LUA_TTHREAD: return &gco2th(o)->gclist;
+    case LUA_TPROTO: return &gco2p(o)->gclist;
+    default: lua_assert(0); return NULL;
+  }
+}
+
+
+/* leave gray object 'o' to the collector */
+static void leavegray (Markers *m, GCObject *o) {
+  pthread_mutex_lock(&m->lock);
+  *gclistof(o) = m->overflow;
+  m->overflow = o;
+  pthread_mutex_unlock(&m->lock);
+}
+
+
+/* move up to MARKCHUNK objects from the private stack to the pool */
+static void share (Markers *m, Marker *w) {
+  int k;
+  pthread_mutex_lock(&m->lock);
+  k = MARKPOOL - m->npool;
+  if (k > MARKCHUNK) k = MARKCHUNK;
+  if (k > w->n / 2) k = w->n / 2;
+  w->n -= k;
+  memcpy(m->pool + m->npool, w->stack + w->n, k * sizeof(GCObject *));
+  m->npool += k;
+  pthread_cond_broadcast(&m->more);
+  pthread_mutex_unlock(&m->lock);
+}
+
+
+static void pushgray (Marker *w, GCObject *o) {
+  if (w->n == LUAI_MARKSTACK) {  /* private stack full? */
+    share(w->m, w);
+    if (w->n == LUAI_MARKSTACK) {  /* pool full too? */
+      leavegray(w->m, o);
+      return;
+    }
+  }
+  w->stack[w->n++] = o;
+}
+
+
+/* turn 'o' from white to gray; returns false if already done */
+static int trygray (GCObject *o) {
+  lu_byte old = __atomic_load_n(&o->marked, __ATOMIC_RELAXED);
+  do {
+    if (!testbits(old, WHITEBITS)) return 0;
+  } while (!__atomic_compare_exchange_n(&o->marked, &old,
+             cast_byte(old & ~WHITEBITS), 1, __ATOMIC_RELAXED,
+             __ATOMIC_RELAXED));
+  return 1;
+}
+
+#define parblack(o)	__atomic_fetch_or(&(o)->marked, bitmask(BLACKBIT), \
+                                     __ATOMIC_RELAXED)
+
+#define parmarkobject(t)  { if (iswhite(t)) parmark(obj2gco(t)); }
+
+
+/*
+** Version of 'reallymarkobject' for marking threads.
+*/
+static void parmark (GCObject *o) {
+  Marker *w = curmarker;
+ reentry:
+  if (!trygray(o)) return;  /* another thread marked it */
+  switch (o->tt) {
+    case LUA_TSHRSTR: {
+      parblack(o);
+      w->memtrav += sizelstring(gco2ts(o)->shrlen);
+      break;
+    }
+    case LUA_TLNGSTR: {
+      TString *ts = gco2ts(o);
+      for (;;) {  /* ropes chain through 'left'; mark them iteratively */
+        parblack(ts);
+        w->memtrav += sizelngstr(ts);
+        if (isflat(ts)) break;
+        parmarkobject(ts2rope(ts)->right);  /* a flat string */
+        ts = ts2rope(ts)->left;
+        if (!trygray(obj2gco(ts))) break;  /* rest of chain marked? */
+      }
+      break;
+    }
+    case LUA_TUSERDATA: {
+      TValue uvalue;
+      Table *mt = gco2u(o)->metatable;
+      if (mt) parmarkobject(mt);
+      parblack(o);
+      w->memtrav += sizeudata(gco2u(o));
+      getuservalue(w->m->g->mainthread, gco2u(o), &uvalue);
+      if (valiswhite(&uvalue)) {
+        o = gcvalue(&uvalue);
+        goto reentry;
+      }
+      break;
+    }
+    case LUA_TTHREAD: {
+      leavegray(w->m, o);
+      break;
+    }
+    default: {  /* tables, closures and prototypes */
+      pushgray(w, o);
+      break;
+    }
+  }
+}
+
+
+/*
+** Whether table 'h' has a weak mode. (Unlike 'gfasttm', this does not
+** update the cache of absent metamethods in the metatable.)
+*/
+static int isweaktable (global_State *g, Table *h) {
+  const TValue *mode;
+  if (h->metatable == NULL || (h->metatable->flags & (1u << TM_MODE)))
+    return 0;
+  mode = luaH_getshortstr(h->metatable, g->tmname[TM_MODE]);
+  return (ttisstring(mode) && (luaS_strchr(tsvalue(mode), 'k') ||
+                               luaS_strchr(tsvalue(mode), 'v')));
+}
+
+
+/*
+** Traverse gray object 'o' in a marking thread. Weak tables stay gray,
+** for the collector.
+*/
+static void partraverse (global_State *g, Marker *w, GCObject *o) {
+  switch (o->tt) {
+    case LUA_TTABLE: {
+      Table *h = gco2t(o);
+      if (isweaktable(g, h))
+        leavegray(w->m, o);
+      else {  /* (not 'traversetable', which updates the tm cache) */
+        parblack(o);
+        if (h->metatable) parmarkobject(h->metatable);
+        traversestrongtable(g, h);
+        w->memtrav += sizetable(h);
+      }
+      break;
+    }
+    case LUA_TLCL: {
+      parblack(o);
+      w->memtrav += traverseLclosure(g, gco2lcl(o));
+      break;
+    }
+    case LUA_TCCL: {
+      parblack(o);
+      w->memtrav += traverseCclosure(g, gco2ccl(o));
+      break;
+    }
+    case LUA_TPROTO: {
+      parblack(o);
+      w->memtrav += traverseproto(g, gco2p(o));
+      break;
+    }
+    default: lua_assert(0);
+  }
+}
+
+
+/*
+** Traverse gray objects until all marking threads run out of them.
+*/
+static void markwork (Markers *m, Marker *w) {
+  global_State *g = m->g;
+  curmarker = w;
+  for (;;) {
+    while (w->n > 0) {
+      partraverse(g, w, w->stack[--w->n]);
+      if (w->n >= 2 * MARKCHUNK &&
+          __atomic_load_n(&m->idle, __ATOMIC_RELAXED) > 0)
+        share(m, w);  /* feed idle threads */
+    }
+    pthread_mutex_lock(&m->lock);
+    while (m->npool == 0 && !m->done) {
+      if (m->idle + 1 == m->n) {  /* all others idle too? */
+        m->done = 1;  /* no work left anywhere */
+        pthread_cond_broadcast(&m->more);
+      }
+      else {
+        /* ('idle' is also read above, without the lock) */
+        __atomic_add_fetch(&m->idle, 1, __ATOMIC_RELAXED);
+        pthread_cond_wait(&m->more, &m->lock);
+        __atomic_sub_fetch(&m->idle, 1, __ATOMIC_RELAXED);
+      }
+    }
+    if (m->npool > 0) {  /* take some work from the pool */
+      int k = (m->npool < MARKCHUNK) ? m->npool : MARKCHUNK;
+      m->npool -= k;
+      memcpy(w->stack, m->pool + m->npool, k * sizeof(GCObject *));
+      w->n = k;
+    }
+    pthread_mutex_unlock(&m->lock);
+    if (w->n == 0) break;  /* round is over */
+  }
+  curmarker = NULL;
+}
+
+
+static void *markhelper (void *ud) {
+  Marker *w = (Marker *)ud;
+  Markers *m = w->m;
+  unsigned int round = 0;
+  pthread_mutex_lock(&m->lock);
+  for (;;) {
+    while (m->round == round && !m->stop)
+      pthread_cond_wait(&m->start, &m->lock);
+    if (m->stop) break;
+    round = m->round;
+    pthread_mutex_unlock(&m->lock);
+    markwork(m, w);
+    pthread_mutex_lock(&m->lock);
+    if (--m->running == 0)
+      pthread_cond_signal(&m->finished);
+  }
+  pthread_mutex_unlock(&m->lock);
+  return NULL;
+}
+
+
+/*
+** One parallel round: the collector thread takes the objects in 'gray'
+** that can be traversed in parallel (leaving the others in 'gray') and
+** marks with the helper threads until there is no more work. Objects
+** left by the marking threads go back to 'gray'.
+*/
+static void markround (global_State *g) {
+  Markers *m = g->markers;
+  Marker *w = &m->w[0];
+  GCObject **p = &g->gray;
+  int i;
+  while (*p != NULL && w->n < LUAI_MARKSTACK) {
+    GCObject *o = *p;
+    if (o->tt == LUA_TTHREAD)
+      p = gclistof(o);  /* keep it in 'gray' */
+    else {
+      *p = *gclistof(o);  /* remove it from 'gray' */
+      w->stack[w->n++] = o;
+    }
+  }
+  pthread_mutex_lock(&m->lock);
+  m->idle = m->done = 0;
+  m->running = m->n - 1;
+  m->overflow = NULL;
+  m->round++;
+  g->gcparallel = 1;
+  pthread_cond_broadcast(&m->start);
+  pthread_mutex_unlock(&m->lock);
+  markwork(m, w);
+  pthread_mutex_lock(&m->lock);
+  while (m->running > 0)
+    pthread_cond_wait(&m->finished, &m->lock);
+  g->gcparallel = 0;
+  pthread_mutex_unlock(&m->lock);
+  for (i = 0; i < m->n; i++) {
+    g->GCmemtrav += m->w[i].memtrav;
+    m->w[i].memtrav = 0;
+  }
+  while (m->overflow != NULL) {  /* move objects left back to 'gray' */
+    GCObject *o = m->overflow;
+    m->overflow = *gclistof(o);
+    *gclistof(o) = g->gray;
+    g->gray = o;
+  }
+}
+
+
+/*
+** Propagate marks with the marking threads. The collector traverses
+** threads and weak tables itself; everything else is left to rounds
+** of parallel marking.
+*/
+static void parpropagateall (global_State *g) {
+  while (g->gray) {
+    GCObject *o = g->gray;
+    if (o->tt == LUA_TTHREAD ||
+        (o->tt == LUA_TTABLE && isweaktable(g, gco2t(o))))
+      propagatemark(g);
+    else
+      markround(g);
+  }
+}
+
+
+static void stopmarkers (lua_State *L, Markers *m) {
+  int i;
+  pthread_mutex_lock(&m->lock);
+  m->stop = 1;
+  pthread_cond_broadcast(&m->start);
+  pthread_mutex_unlock(&m->lock);
+  for (i = 1; i < m->n; i++)
+    pthread_join(m->w[i].thread, NULL);
+  pthread_cond_destroy(&m->finished);
+  pthread_cond_destroy(&m->more);
+  pthread_cond_destroy(&m->start);
+  pthread_mutex_destroy(&m->lock);
+  luaM_freemem(L, m, sizemarkers(m->size));
+}
+
+
+/*
+** Set the number of marking threads, including the collector's own
+** (1 means no parallel marking). Returns the previous number.
+*/
+int luaC_parmark (lua_State *L, int n) {
+  global_State *g = G(L);
+  Markers *m = g->markers;
+  int old = (m != NULL) ? m->n : 1;
+  if (n < 1) n = 1;
+  else if (n > LUAI_MAXMARKERS) n = LUAI_MAXMARKERS;
+  if (n == old) return old;
+  if (m != NULL) {
+    g->markers = NULL;
+    stopmarkers(L, m);
+  }
+  if (n > 1) {
+    int i;
+    m = cast(Markers *, luaM_malloc(L, sizemarkers(n)));
+    m->g = g;
+    m->w = cast(Marker *, m + 1);
+    m->size = n;
+    m->n = 1;
+    m->idle = m->running = m->done = m->stop = 0;
+    m->round = 0;
+    m->npool = 0;
+    m->overflow = NULL;
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_cond_init(&m->start, NULL);
+    pthread_cond_init(&m->more, NULL);
+    pthread_cond_init(&m->finished, NULL);
+    for (i = 0; i < n; i++) {
+      Marker *w = &m->w[i];
+      w->m = m;
+      w->memtrav = 0;
+      w->n = 0;
+      if (i > 0 && pthread_create(&w->thread, NULL, markhelper, w) != 0)
+        break;
+      m->n = i + 1;
+    }
+    if (m->n > 1)
+      g->markers = m;
+    else
+      stopmarkers(L, m);
+  }
+  return old;
+}
+
+#else
+
+int luaC_parmark (lua_State *L, int n) {
+  UNUSED(L); UNUSED(n);
+  return 1;  /* no parallel marking */
+}
+
+#endif
+
+/* }====================================================== */
+
+
 /*
 ** {======================================================
 ** Sweep Functions
@@ -693,6 +1216,139 @@ static void freeLclosure (lua_State *L, LClosure *cl) {
 }
 
 
+/*
+** {======================================================
+** Cycle telemetry
+** =======================================================
+** The clock is read when an outermost step (a call of 'luaC_step',
+** 'luaC_steptime', 'luaC_fullgc' or 'luaC_runtilstate') starts and
+** ends, when the collector changes phase and around each finalizer;
+** the time between two readings is charged to the phase at the first
+** one. So only the collector's own work is measured, at the cost of two
+** clock readings per step and per finalizer.
+*/
+
+typedef struct GCStats {
+  lua_GCCycle cur;  /* cycle in progress */
+  lua_GCCycle history[LUAI_GCHISTORY];  /* last finished cycles */
+  unsigned int nfinished;  /* number of finished cycles */
+  int open;  /* true if 'cur' has started */
+  int depth;  /* nesting of steps in progress */
+  lu_mem cycles;  /* 'GCcycles' when 'cur' started */
+  lu_mem stepstart;  /* time when the outermost step started */
+  lu_mem last;  /* time of the last clock reading */
+} GCStats;
+
+
+static lua_Integer *phasetime (lua_GCCycle *c, int state) {
+  switch (state) {
+    case GCSpause: case GCSpropagate: return &c->propagate;
+    case GCSatomic: return &c->atomic;
+    case GCScallfin: return &c->finalizers;
+    default: return &c->sweep;  /* GCSswp* */
+  }
+}
+
+
+/* read the clock and charge the time since the last reading to 'state' */
+static void chargetime (GCStats *s, int state) {
+  lu_mem now = luai_nsec();
+  *phasetime(&s->cur, state) += cast(lua_Integer, now - s->last);
+  s->last = now;
+}
+
+
+static void statsbegin (global_State *g) {
+  GCStats *s = g->gcstats;
+  if (s != NULL && s->depth++ == 0)
+    s->stepstart = s->last = luai_nsec();
+}
+
+
+static void statsend (global_State *g) {
+  GCStats *s = g->gcstats;
+  if (s != NULL && s->depth > 0 && --s->depth == 0) {
+    lua_Integer step;
+    chargetime(s, g->gcstate);
+    step = cast(lua_Integer, s->last - s->stepstart);
+    if (s->open && step > s->cur.maxstep)
+      s->cur.maxstep = step;
+  }
+}
+
+
+static void opencycle (global_State *g, GCStats *s) {
+  memset(&s->cur, 0, sizeof(s->cur));
+  s->cur.start = cast(lua_Integer, s->last);
+  s->cur.before = cast(lua_Integer, gettotalbytes(g));
+  s->cycles = g->GCcycles;
+  s->open = 1;
+}
+
+
+/* charge the work done outside 'singlestep' since the last reading */
+static void statsphase (global_State *g, int state) {
+  GCStats *s = g->gcstats;
+  if (s != NULL && s->depth > 0) {
+    if (!s->open)
+      opencycle(g, s);
+    chargetime(s, state);
+  }
+}
+
+
+/*
+** Finish the current cycle when the collector reaches the pause. A
+** pause reached without an atomic phase (the sweep back to white
+** before a major collection) does not end a cycle.
+*/
+static void closecycle (global_State *g, GCStats *s) {
+  lua_Integer step = cast(lua_Integer, s->last - s->stepstart);
+  if (g->GCcycles == s->cycles)
+    return;
+  s->cur.end = cast(lua_Integer, s->last);
+  s->cur.after = cast(lua_Integer, gettotalbytes(g));
+  if (step > s->cur.maxstep)
+    s->cur.maxstep = step;
+  s->cur.kind = g->gckind;
+  s->history[s->nfinished % LUAI_GCHISTORY] = s->cur;
+  s->nfinished++;
+  s->open = 0;
+}
+
+
+/*
+** Turn the telemetry on (keeping what it has) or off (dropping it).
+** Returns whether it was on.
+*/
+int luaC_gcstats (lua_State *L, int on) {
+  global_State *g = G(L);
+  int wason = (g->gcstats != NULL);
+  if (on && !wason) {
+    GCStats *s = luaM_new(L, GCStats);
+    memset(s, 0, sizeof(GCStats));
+    g->gcstats = s;
+  }
+  else if (!on && wason) {
+    luaM_free(L, g->gcstats);
+    g->gcstats = NULL;
+  }
+  return wason;
+}
+
+
+int luaC_getcycle (lua_State *L, int n, lua_GCCycle *c) {
+  GCStats *s = G(L)->gcstats;
+  if (s == NULL || n < 0 || n >= LUAI_GCHISTORY ||
+      cast(unsigned int, n) >= s->nfinished)
+    return 0;
+  *c = s->history[(s->nfinished - 1 - n) % LUAI_GCHISTORY];
+  return 1;
+}
+
+/* }====================================================== */
+
+
 static void freeobj (lua_State *L, GCObject *o) {
   switch (o->tt) {
     case LUA_TPROTO: luaF_freeproto(L, gco2p(o)); break;
@@ -712,7 +1368,14 @@ static void freeobj (lua_State *L, GCObject *o) {
       luaM_freemem(L, o, sizelstring(gco2ts(o)->shrlen));
       break;
     case LUA_TLNGSTR: {
-      luaM_freemem(L, o, sizelstring(gco2ts(o)->u.lnglen));
+      TString *ts = gco2ts(o);
+      if (!isrope(ts))
+        luaM_freemem(L, o, sizelstring(ts->u.lnglen));
+      else {
+        if (isflat(ts))
+          luaM_freearray(L, ts2rope(ts)->contents, ts->u.lnglen + 1);
+        luaM_freemem(L, o, sizeof(TRope));
+      }
       break;
     }
     default: lua_assert(0);
@@ -728,22 +1391,40 @@ static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count);
 ** sweep at most 'count' elements from a list of GCObjects erasing dead
 ** objects, where a dead object is one marked with the old (non current)
 ** white; change all non-dead objects back to white, preparing for next
-** collection cycle. Return where to continue the traversal or NULL if
+** collection cycle. In generational mode, non-dead objects keep their
+** marks and become old, and the sweep stops at the first object that
+** was already old. Return where to continue the traversal or NULL if
 ** list is finished.
 */
 static GCObject **sweeplist (lua_State *L, GCObject **p, lu_mem count) {
   global_State *g = G(L);
   int ow = otherwhite(g);
-  int white = luaC_white(g);  /* current white */
+  int toclear, toset;  /* bits to clear and to set in all live objects */
+  int tostop;  /* stop sweep when this is true */
+  if (isgenerational(g)) {
+    toclear = ~0;  /* clear nothing */
+    toset = bitmask(OLDBIT);  /* survivors become old */
+    tostop = bitmask(OLDBIT);  /* do not sweep old objects */
+  }
+  else {
+    toclear = maskcolors;  /* clear all color bits and old bit */
+    toset = luaC_white(g);  /* make object white */
+    tostop = 0;  /* do not stop */
+  }
   while (*p != NULL && count-- > 0) {
     GCObject *curr = *p;
     int marked = curr->marked;
     if (isdeadm(ow, marked)) {  /* is 'curr' dead? */
+      if (g->gcstats != NULL)
+        g->gcstats->cur.freed[novariant(curr->tt)]++;
       *p = curr->next;  /* remove 'curr' from list */
       freeobj(L, curr);  /* erase 'curr' */
     }
-    else {  /* change mark to 'white' */
-      curr->marked = cast_byte((marked & maskcolors) | white);
+    else {
+      if (testbits(marked, tostop))
+        return NULL;  /* rest of the list is old */
+      lua_assert(!isgenerational(g) || !iswhite(curr));
+      curr->marked = cast_byte((marked & toclear) | toset);
       p = &curr->next;  /* go to next element */
     }
   }
@@ -778,7 +1459,7 @@ static void checkSizes (lua_State *L, global_State *g) {
   if (g->gckind != KGC_EMERGENCY) {
     l_mem olddebt = g->GCdebt;
     if (g->strt.nuse < g->strt.size / 4)  /* string table too big? */
-      luaS_resize(L, g->strt.size / 2);  /* shrink it a little */
+      luaS_shrink(L);
     g->GCestimate += g->GCdebt - olddebt;  /* update estimate */
   }
 }
@@ -791,6 +1472,7 @@ static GCObject *udata2finalize (global_State *g) {
   o->next = g->allgc;  /* return it to 'allgc' list */
   g->allgc = o;
   resetbit(o->marked, FINALIZEDBIT);  /* object is "normal" again */
+  resetoldbit(o);  /* it is now before young objects */
   if (issweepphase(g))
     makewhite(g, o);  /* "sweep" object */
   return o;
@@ -807,6 +1489,7 @@ static void GCTM (lua_State *L, int propagateerrors) {
   global_State *g = G(L);
   const TValue *tm;
   TValue v;
+  statsphase(g, g->gcstate);  /* time before the finalizer */
   setgcovalue(L, &v, udata2finalize(g));
   tm = luaT_gettmbyobj(L, &v, TM_GC);
   if (tm != NULL && ttisfunction(tm)) {  /* is there a finalizer? */
@@ -823,14 +1506,19 @@ static void GCTM (lua_State *L, int propagateerrors) {
     L->ci->callstatus &= ~CIST_FIN;  /* not running a finalizer anymore */
     L->allowhook = oldah;  /* restore hooks */
     g->gcrunning = running;  /* restore state */
+    statsphase(g, GCScallfin);  /* time of the finalizer */
     if (status != LUA_OK && propagateerrors) {  /* error while running __gc? */
       if (status == LUA_ERRRUN) {  /* is there an error object? */
         const char *msg = (ttisstring(L->top - 1))
-                            ? svalue(L->top - 1)
+                            ? luaS_contents(L, tsvalue(L->top - 1))
                             : "no message";
         luaO_pushfstring(L, "error in __gc metamethod (%s)", msg);
         status = LUA_ERRGCMM;  /* error in __gc metamethod */
       }
+      if (g->gcstats != NULL && g->gcstats->depth > 0) {
+        g->gcstats->depth = 1;  /* the error leaves all steps in progress */
+        statsend(g);
+      }
       luaD_throw(L, status);  /* re-throw error */
     }
   }
@@ -916,6 +1604,7 @@ void luaC_checkfinalizer (lua_State *L, GCObject *o, Table *mt) {
     o->next = g->finobj;  /* link it in 'finobj' list */
     g->finobj = o;
     l_setbit(o->marked, FINALIZEDBIT);  /* mark it as such */
+    resetoldbit(o);  /* it is now before young objects */
   }
 }
 
@@ -965,10 +1654,15 @@ static void entersweep (lua_State *L) {
 
 void luaC_freeallobjects (lua_State *L) {
   global_State *g = G(L);
+  luaQ_enable(L, 0);  /* wait for queued blocks; free the rest here */
+  luaC_parmark(L, 1);  /* stop marking threads */
   separatetobefnz(g, 1);  /* separate all objects with finalizers */
   lua_assert(g->finobj == NULL);
   callallpendingfinalizers(L);
   lua_assert(g->tobefnz == NULL);
+  luaC_gcstats(L, 0);
+  if (g->bulkclose)  /* allocator will release all blocks at once? */
+    return;  /* no need to free objects one by one */
   g->currentwhite = WHITEBITS; /* this "white" makes all objects look dead */
   g->gckind = KGC_NORMAL;
   sweepwholelist(L, &g->finobj);
@@ -978,11 +1672,27 @@ void luaC_freeallobjects (lua_State *L) {
 }
 
 
+/*
+** In generational mode, weak tables would stay gray after a collection,
+** so that a barrier would not notice new (young) entries in old weak
+** tables and these entries would not be cleared. Make them black after
+** they are cleared, and empty their list.
+*/
+static void blackenweak (GCObject **l) {
+  while (*l != NULL) {
+    Table *h = gco2t(*l);
+    *l = h->gclist;
+    gray2black(h);
+  }
+}
+
+
 static l_mem atomic (lua_State *L) {
   global_State *g = G(L);
   l_mem work;
   GCObject *origweak, *origall;
   GCObject *grayagain = g->grayagain;  /* save original list */
+  g->grayagain = NULL;  /* (threads traversed below return to it) */
   lua_assert(g->ephemeron == NULL && g->weak == NULL);
   lua_assert(!iswhite(g->mainthread));
   g->gcstate = GCSinsideatomic;
@@ -1018,6 +1728,11 @@ static l_mem atomic (lua_State *L) {
   /* clear values from resurrected weak tables */
   clearvalues(g, g->weak, origweak);
   clearvalues(g, g->allweak, origall);
+  if (isgenerational(g)) {
+    blackenweak(&g->weak);
+    blackenweak(&g->allweak);
+    blackenweak(&g->ephemeron);
+  }
   luaS_clearcache(g);
   g->currentwhite = cast_byte(otherwhite(g));  /* flip current white */
   work += g->GCmemtrav;  /* complete counting */
@@ -1041,10 +1756,12 @@ static lu_mem sweepstep (lua_State *L, global_State *g,
 }
 
 
-static lu_mem singlestep (lua_State *L) {
+static lu_mem dostep (lua_State *L) {
   global_State *g = G(L);
   switch (g->gcstate) {
     case GCSpause: {
+      g->GClastwork = g->GCcyclework;  /* work done by the previous cycle */
+      g->GCcyclework = 0;
       g->GCmemtrav = g->strt.size * sizeof(GCObject*);
       restartcollection(g);
       g->gcstate = GCSpropagate;
@@ -1062,6 +1779,7 @@ static lu_mem singlestep (lua_State *L) {
       lu_mem work;
       propagateall(g);  /* make sure gray list is empty */
       work = atomic(L);  /* work is what was traversed by 'atomic' */
+      g->GCcycles++;
       entersweep(L);
       g->GCestimate = gettotalbytes(g);  /* first estimate */;
       return work;
@@ -1076,8 +1794,11 @@ static lu_mem singlestep (lua_State *L) {
       return sweepstep(L, g, GCSswpend, NULL);
     }
     case GCSswpend: {  /* finish sweeps */
-      makewhite(g, g->mainthread);  /* sweep main thread */
+      if (!isgenerational(g))  /* (else it stays marked, as old objects) */
+        makewhite(g, g->mainthread);  /* sweep main thread */
       checkSizes(L, g);
+      if (g->freeq != NULL)
+        luaQ_flush(g);  /* free last blocks of this cycle */
       g->gcstate = GCScallfin;
       return 0;
     }
@@ -1096,14 +1817,40 @@ static lu_mem singlestep (lua_State *L) {
 }
 
 
+/*
+** one step of the collector, with its telemetry when it is on (always
+** inside 'statsbegin'/'statsend')
+*/
+static lu_mem singlestep (lua_State *L) {
+  global_State *g = G(L);
+  GCStats *s = g->gcstats;
+  int state = g->gcstate;
+  lu_mem work;
+  if (s == NULL)
+    return dostep(L);
+  if (!s->open)
+    opencycle(g, s);
+  work = dostep(L);
+  s = g->gcstats;  /* (a finalizer may turn the telemetry off) */
+  if (s != NULL && g->gcstate != state) {  /* changed phase? */
+    chargetime(s, state);
+    if (g->gcstate == GCSpause)
+      closecycle(g, s);
+  }
+  return work;
+}
+
+
 /*
 ** advances the garbage collector until it reaches a state allowed
 ** by 'statemask'
 */
 void luaC_runtilstate (lua_State *L, int statesmask) {
   global_State *g = G(L);
+  statsbegin(g);
   while (!testbit(statesmask, g->gcstate))
-    singlestep(L);
+    g->GCcyclework += singlestep(L);
+  statsend(g);
 }
 
 
@@ -1122,6 +1869,98 @@ static l_mem getdebt (global_State *g) {
   }
 }
 
+/*
+** Set the debt for the next (minor) collection, after the heap grows
+** 'gcminormul'% of its current size.
+*/
+static void setminordebt (global_State *g) {
+  l_mem estimate = gettotalbytes(g) / 100;
+  l_mem growth = (g->gcminormul < MAX_LMEM / estimate)  /* overflow? */
+               ? estimate * g->gcminormul  /* no overflow */
+               : MAX_LMEM;  /* overflow; truncate to maximum */
+  luaE_setdebt(g, -growth);
+}
+
+
+/*
+** Run a whole collection in generational mode, from the propagate
+** phase back to it. Only objects marked since the last collection (by
+** the roots or barriers) are traversed, and only young objects are
+** swept. Gray lists other than 'grayagain' (kept with the threads, which
+** are always traversed) are not needed by the next collection. (A
+** finalizer may run a full collection, which ends in the propagate
+** phase.)
+*/
+static void gencollection (lua_State *L) {
+  global_State *g = G(L);
+  lua_assert(g->gcstate == GCSpropagate);
+  propagateall(g);
+  statsphase(g, GCSpropagate);
+  g->gcstate = GCSatomic;
+  luaC_runtilstate(L, bitmask(GCSpause) | bitmask(GCSpropagate));
+  g->gcstate = GCSpropagate;  /* skip restart; old objects stay marked */
+  lua_assert(g->gray == NULL);
+  g->weak = g->allweak = g->ephemeron = NULL;
+}
+
+
+/*
+** Major collection in generational mode: sweep all objects back to
+** white (nothing is collected, as white has not changed), then do a
+** generational collection from the roots, which collects all garbage
+** and makes all survivors old.
+*/
+static void genmajor (lua_State *L) {
+  global_State *g = G(L);
+  g->gckind = KGC_NORMAL;
+  entersweep(L);
+  luaC_runtilstate(L, bitmask(GCSpause));
+  g->gckind = KGC_GEN;
+  luaC_runtilstate(L, bitmask(GCSpropagate));  /* mark roots */
+  gencollection(L);
+  g->GClastmajor = g->GCestimate;
+}
+
+
+/*
+** A step in generational mode is a whole collection: a minor one,
+** unless memory in use after the last collection has grown over
+** 'gcmajorinc'% of its value after the last major collection.
+*/
+static void genstep (lua_State *L, global_State *g) {
+  if (g->GCestimate > (g->GClastmajor / 100) * g->gcmajorinc)
+    genmajor(L);
+  else
+    gencollection(L);
+  setminordebt(g);
+}
+
+
+/*
+** Change the collector mode. When entering generational mode, the
+** current cycle goes on until the propagate phase; its first collection
+** makes old all objects that survive it. When leaving it, all objects
+** are swept back to white.
+*/
+void luaC_changemode (lua_State *L, int mode) {
+  global_State *g = G(L);
+  if (mode == g->gckind) return;  /* nothing to change */
+  if (mode == KGC_GEN) {
+    luaC_runtilstate(L, bitmask(GCSpropagate));
+    g->gckind = KGC_GEN;
+    g->GClastmajor = gettotalbytes(g);
+    setminordebt(g);
+  }
+  else {
+    g->gckind = KGC_NORMAL;
+    g->GCcyclework = 0;  /* work of minor collections says nothing */
+    entersweep(L);
+    luaC_runtilstate(L, bitmask(GCSpause));
+    setpause(g);
+  }
+}
+
+
 /*
 ** performs a basic GC step when collector is running
 */
@@ -1132,8 +1971,15 @@ void luaC_step (lua_State *L) {
     luaE_setdebt(g, -GCSTEPSIZE * 10);  /* avoid being called too often */
     return;
   }
+  statsbegin(g);
+  if (isgenerational(g)) {
+    genstep(L, g);
+    statsend(g);
+    return;
+  }
   do {  /* repeat until pause or enough "credit" (negative debt) */
     lu_mem work = singlestep(L);  /* perform one single step */
+    g->GCcyclework += work;
     debt -= work;
   } while (debt > -GCSTEPSIZE && g->gcstate != GCSpause);
   if (g->gcstate == GCSpause)
@@ -1143,6 +1989,66 @@ void luaC_step (lua_State *L) {
     luaE_setdebt(g, debt);
     runafewfinalizers(L);
   }
+  statsend(g);
+}
+
+
+/*
+** Estimate the part (in percent) of the current cycle still to be done,
+** comparing the work done so far with the work of the previous cycle
+** (or with the memory in use, for the first one). A cycle in progress
+** is never reported as done.
+*/
+static int cycleleft (global_State *g) {
+  lu_mem total = (g->GClastwork > 0) ? g->GClastwork : gettotalbytes(g);
+  if (g->gcstate == GCSpause)
+    return 0;
+  else if (g->GCcyclework >= total)
+    return 1;
+  else {
+    int left = 100 - cast_int(g->GCcyclework / (total / 100 + 1));
+    return (left < 1) ? 1 : left;
+  }
+}
+
+
+/*
+** Performs incremental steps until 'usec' microseconds have passed or
+** the cycle ends, whether or not the collector is running. Returns an
+** estimate of the part of the cycle still to be done, in percent (0 when
+** the cycle is done). Work done here counts as credit against the debt of
+** the next automatic steps. The clock is checked only after about
+** GCSTEPSIZE units of work, and the atomic phase cannot be split, so the
+** budget may be exceeded. In generational mode, each step is a whole
+** collection, so it ignores the budget.
+*/
+int luaC_steptime (lua_State *L, int usec) {
+  global_State *g = G(L);
+  lu_mem start = luai_usec();
+  l_mem credit = 0;  /* work done in this step */
+  l_mem checked = 0;  /* work done when clock was last checked */
+  statsbegin(g);
+  if (isgenerational(g)) {
+    genstep(L, g);
+    statsend(g);
+    return 0;
+  }
+  do {
+    lu_mem work = singlestep(L);
+    g->GCcyclework += work;
+    credit += work;
+    if (credit - checked >= GCSTEPSIZE) {
+      if (luai_usec() - start >= cast(lu_mem, usec))
+        break;  /* budget used up */
+      checked = credit;
+    }
+  } while (g->gcstate != GCSpause);
+  if (g->gcstate == GCSpause)
+    setpause(g);  /* pause until next cycle */
+  else  /* convert 'work units' to Kb and pay them off the debt */
+    luaE_setdebt(g, g->GCdebt - (credit / g->gcstepmul) * STEPMULADJ);
+  statsend(g);
+  return cycleleft(g);
 }
 
 
@@ -1153,24 +2059,46 @@ void luaC_step (lua_State *L) {
 ** Before running the collection, check 'keepinvariant'; if it is true,
 ** there may be some objects marked as black, so the collector has
 ** to sweep all objects to turn them back to white (as white has not
-** changed, nothing will be collected).
+** changed, nothing will be collected). In generational mode, this is
+** a major collection; an emergency one runs as a regular cycle, after
+** which the collector goes back to the propagate phase.
 */
 void luaC_fullgc (lua_State *L, int isemergency) {
   global_State *g = G(L);
-  lua_assert(g->gckind == KGC_NORMAL);
+  lu_byte origkind = g->gckind;
+  lua_assert(origkind != KGC_EMERGENCY);
+  statsbegin(g);
   if (isemergency) g->gckind = KGC_EMERGENCY;  /* set flag */
+  else if (origkind == KGC_GEN) {
+    genmajor(L);
+    setminordebt(g);
+    statsend(g);
+    return;
+  }
   if (keepinvariant(g)) {  /* black objects? */
     entersweep(L); /* sweep everything to turn them back to white */
   }
   /* finish any pending sweep phase to start a new cycle */
   luaC_runtilstate(L, bitmask(GCSpause));
   luaC_runtilstate(L, ~bitmask(GCSpause));  /* start new collection */
+  if (g->markers != NULL) {  /* mark all at once, in parallel */
+    propagateall(g);
+    statsphase(g, GCSpropagate);
+    g->gcstate = GCSatomic;
+  }
   luaC_runtilstate(L, bitmask(GCScallfin));  /* run up to finalizers */
   /* estimate must be correct after a full GC cycle */
   lua_assert(g->GCestimate == gettotalbytes(g));
   luaC_runtilstate(L, bitmask(GCSpause));  /* finish collection */
-  g->gckind = KGC_NORMAL;
-  setpause(g);
+  g->gckind = origkind;
+  if (isgenerational(g)) {
+    luaC_runtilstate(L, bitmask(GCSpropagate));  /* where it must rest */
+    g->GClastmajor = g->GCestimate;
+    setminordebt(g);
+  }
+  else
+    setpause(g);
+  statsend(g);
 }
 
 /* }====================================================== */
@@ -46,6 +46,20 @@
 #define GCSpause	7
 
 
+/*
+** In generational mode, the collector rests in the propagate phase
+** between collections. Objects that survive a collection become old:
+** they keep their marks, and later (minor) collections neither
+** traverse them (unless a barrier makes them gray again) nor sweep
+** them, as new objects are always added to the head of the lists and
+** a sweep stops at the first old object. A major collection turns
+** all objects white (young) again. Objects moved to the head of a list
+** lose their old bit, so that sweeps still reach the young objects after
+** them.
+*/
+#define isgenerational(g)	((g)->gckind == KGC_GEN)
+
+
 #define issweepphase(g)  \
 	(GCSswpallgc <= (g)->gcstate && (g)->gcstate <= GCSswpend)
 
@@ -55,10 +69,11 @@
 ** ones) must be kept. During a collection, the sweep
 ** phase may break the invariant, as objects turned white may point to
 ** still-black objects. The invariant is restored when sweep ends and
-** all objects are white again.
+** all objects are white again. In generational mode, old objects stay
+** black between collections, so the invariant is always kept.
 */
 
-#define keepinvariant(g)	((g)->gcstate <= GCSatomic)
+#define keepinvariant(g)	(isgenerational(g) || (g)->gcstate <= GCSatomic)
 
 
 /*
@@ -79,6 +94,7 @@
 #define WHITE1BIT	1  /* object is white (type 1) */
 #define BLACKBIT	2  /* object is black */
 #define FINALIZEDBIT	3  /* object has been marked for finalization */
+#define OLDBIT		4  /* object is old (only in generational mode) */
 /* bit 7 is currently used by tests (luaL_checkmemory) */
 
 #define WHITEBITS	bit2mask(WHITE0BIT, WHITE1BIT)
@@ -91,6 +107,9 @@
 
 #define tofinalize(x)	testbit((x)->marked, FINALIZEDBIT)
 
+#define isold(x)	testbit((x)->marked, OLDBIT)
+#define resetoldbit(o)	resetbit((o)->marked, OLDBIT)
+
 #define otherwhite(g)	((g)->currentwhite ^ WHITEBITS)
 #define isdeadm(ow,m)	(!(((m) ^ WHITEBITS) & (ow)))
 #define isdead(g,v)	isdeadm(otherwhite(g), (v)->marked)
@@ -134,8 +153,13 @@
 LUAI_FUNC void luaC_fix (lua_State *L, GCObject *o);
 LUAI_FUNC void luaC_freeallobjects (lua_State *L);
 LUAI_FUNC void luaC_step (lua_State *L);
+LUAI_FUNC int luaC_steptime (lua_State *L, int usec);
+LUAI_FUNC int luaC_parmark (lua_State *L, int n);
 LUAI_FUNC void luaC_runtilstate (lua_State *L, int statesmask);
 LUAI_FUNC void luaC_fullgc (lua_State *L, int isemergency);
+LUAI_FUNC void luaC_changemode (lua_State *L, int mode);
+LUAI_FUNC int luaC_gcstats (lua_State *L, int on);
+LUAI_FUNC int luaC_getcycle (lua_State *L, int n, lua_GCCycle *c);
 LUAI_FUNC GCObject *luaC_newobj (lua_State *L, int tt, size_t sz);
 LUAI_FUNC void luaC_barrier_ (lua_State *L, GCObject *o, GCObject *v);
 LUAI_FUNC void luaC_barrierback_ (lua_State *L, Table *o);
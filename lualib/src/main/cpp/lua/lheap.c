@@ -0,0 +1,305 @@
+/*
+** $Id: lheap.c $
+** Heap walker (objects and the references between them)
+** See Copyright Notice in lua.h
+*/
+
+#define lheap_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "lfunc.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
+#include "ltm.h"
+
+
+/*
+** The walk reads the object lists and the objects themselves, so it
+** needs every object in them to be valid: during a sweep, a dead object
+** not yet swept may point to one already freed. So a walk started in a
+** sweep phase first finishes the sweep (never more than what is left of
+** the current cycle); it does not run finalizers. The walk itself does
+** not allocate, so the collector does not run while it goes on. Objects
+** that are garbage but not yet collected are reported too (and are not
+** reachable from the roots).
+*/
+
+
+typedef struct Walk {
+  lua_HeapWalker f;
+  void *ud;
+  const void *strt;  /* the string table */
+  lua_HeapItem item;
+} Walk;
+
+
+/* sizes of objects, as counted by the collector */
+#define sizetable(h)	(sizeof(Table) + sizeof(TValue) * (h)->sizearray + \
+                         sizeof(Node) * cast(size_t, allocsizenode(h)))
+
+#define sizeproto(f)	(sizeof(Proto) + \
+                         sizeof(Instruction) * (f)->sizecode + \
+                         sizeof(Proto *) * (f)->sizep + \
+                         sizeof(TValue) * (f)->sizek + \
+                         sizeof(int) * (f)->sizelineinfo + \
+                         sizeof(LocVar) * (f)->sizelocvars + \
+                         sizeof(Upvaldesc) * (f)->sizeupvalues)
+
+#define sizethread(th)	(sizeof(lua_State) + \
+                         sizeof(TValue) * (th)->stacksize + \
+                         sizeof(CallInfo) * (th)->nci)
+
+
+static void object (Walk *w, const void *p, int type, size_t size,
+                    const char *name, size_t len, lua_Integer index) {
+  lua_HeapItem *it = &w->item;
+  it->what = LUA_HEAPOBJECT;
+  it->type = type;
+  it->p = p;
+  it->q = NULL;
+  it->size = size;
+  it->name = name;
+  it->len = len;
+  it->index = index;
+  w->f(w->ud, it);
+}
+
+
+static void ref (Walk *w, const void *p, int kind, const void *q,
+                 const char *name, size_t len, lua_Integer index) {
+  lua_HeapItem *it = &w->item;
+  if (q == NULL)
+    return;
+  it->what = LUA_HEAPREF;
+  it->type = kind;
+  it->p = p;
+  it->q = q;
+  it->size = 0;
+  it->name = name;
+  it->len = len;
+  it->index = index;
+  w->f(w->ud, it);
+}
+
+
+static void refvalue (Walk *w, const void *p, int kind, const TValue *v,
+                      const char *name, size_t len, lua_Integer index) {
+  if (iscollectable(v))
+    ref(w, p, kind, gcvalue(v), name, len, index);
+}
+
+
+/* contents of a string when they are available without flattening it */
+static const char *strname (TString *ts, size_t *len) {
+  if (ts == NULL || !isflat(ts)) {
+    *len = 0;
+    return NULL;
+  }
+  *len = tsslen(ts);
+  return getstr(ts);
+}
+
+
+static void walktable (Walk *w, global_State *g, Table *h) {
+  int weakkey = 0, weakvalue = 0;
+  const TValue *mode = gfasttm(g, h->metatable, TM_MODE);
+  Node *n, *limit = gnode(h, cast(size_t, sizenode(h)));
+  unsigned int i;
+  if (mode && ttisstring(mode)) {
+    weakkey = luaS_strchr(tsvalue(mode), 'k') ? LUA_HEAPWEAK : 0;
+    weakvalue = luaS_strchr(tsvalue(mode), 'v') ? LUA_HEAPWEAK : 0;
+  }
+  ref(w, h, LUA_HEAPMETA, h->metatable, NULL, 0, 0);
+  for (i = 0; i < h->sizearray; i++)
+    refvalue(w, h, LUA_HEAPINDEX | weakvalue, &h->array[i], NULL, 0,
+             cast(lua_Integer, i) + 1);
+  for (n = gnode(h, 0); n < limit; n++) {
+    const TValue *k = gkey(n);
+    if (ttisnil(gval(n)))  /* empty entry? */
+      continue;
+    if (ttisstring(k)) {
+      size_t len;
+      const char *name = strname(tsvalue(k), &len);
+      refvalue(w, h, LUA_HEAPFIELD | weakvalue, gval(n), name, len, 0);
+    }
+    else if (ttisinteger(k))
+      refvalue(w, h, LUA_HEAPINDEX | weakvalue, gval(n), NULL, 0,
+               ivalue(k));
+    else
+      refvalue(w, h, LUA_HEAPVALUE | weakvalue, gval(n), NULL, 0, 0);
+    refvalue(w, h, LUA_HEAPKEY | weakkey, k, NULL, 0, 0);
+  }
+}
+
+
+static void walkproto (Walk *w, Proto *f) {
+  int i;
+  ref(w, f, LUA_HEAPINTERNAL, f->source, NULL, 0, 0);
+  ref(w, f, LUA_HEAPINTERNAL | LUA_HEAPWEAK, f->cache, NULL, 0, 0);
+  for (i = 0; i < f->sizek; i++)
+    refvalue(w, f, LUA_HEAPINTERNAL, &f->k[i], NULL, 0, i);
+  for (i = 0; i < f->sizeupvalues; i++)
+    ref(w, f, LUA_HEAPINTERNAL, f->upvalues[i].name, NULL, 0, i);
+  for (i = 0; i < f->sizep; i++)
+    ref(w, f, LUA_HEAPINTERNAL, f->p[i], NULL, 0, i);
+  for (i = 0; i < f->sizelocvars; i++)
+    ref(w, f, LUA_HEAPINTERNAL, f->locvars[i].varname, NULL, 0, i);
+}
+
+
+static void walkLclosure (Walk *w, LClosure *cl) {
+  int i;
+  ref(w, cl, LUA_HEAPINTERNAL, cl->p, NULL, 0, 0);
+  for (i = 0; i < cl->nupvalues; i++) {
+    UpVal *uv = cl->upvals[i];
+    TString *vname = (i < cl->p->sizeupvalues) ? cl->p->upvalues[i].name
+                                               : NULL;
+    size_t len;
+    const char *name = strname(vname, &len);
+    if (uv != NULL)
+      refvalue(w, cl, LUA_HEAPUPVAL, uv->v, name, len, i + 1);
+  }
+}
+
+
+static void walkthread (Walk *w, lua_State *th) {
+  StkId o;
+  if (th->stack == NULL)
+    return;  /* stack not completely built yet */
+  for (o = th->stack; o < th->top; o++)
+    refvalue(w, th, LUA_HEAPINTERNAL, o, NULL, 0, o - th->stack);
+}
+
+
+static void walkobject (Walk *w, global_State *g, GCObject *o) {
+  switch (o->tt) {
+    case LUA_TSHRSTR: {
+      TString *ts = gco2ts(o);
+      object(w, o, LUA_TSTRING, sizelstring(ts->shrlen),
+             getstr(ts), ts->shrlen, 0);
+      break;
+    }
+    case LUA_TLNGSTR: {
+      TString *ts = gco2ts(o);
+      size_t len;
+      const char *name = strname(ts, &len);
+      object(w, o, LUA_TSTRING, sizelngstr(ts), name, len, 0);
+      if (!isflat(ts)) {
+        ref(w, o, LUA_HEAPINTERNAL, ts2rope(ts)->left, NULL, 0, 0);
+        ref(w, o, LUA_HEAPINTERNAL, ts2rope(ts)->right, NULL, 0, 1);
+      }
+      break;
+    }
+    case LUA_TUSERDATA: {
+      Udata *u = gco2u(o);
+      TValue uvalue;
+      object(w, o, LUA_TUSERDATA, sizeudata(u), NULL, 0, 0);
+      ref(w, o, LUA_HEAPMETA, u->metatable, NULL, 0, 0);
+      getuservalue(g->mainthread, u, &uvalue);
+      refvalue(w, o, LUA_HEAPINTERNAL, &uvalue, NULL, 0, 0);
+      break;
+    }
+    case LUA_TTABLE: {
+      Table *h = gco2t(o);
+      object(w, o, LUA_TTABLE, sizetable(h), NULL, 0, 0);
+      walktable(w, g, h);
+      break;
+    }
+    case LUA_TLCL: {
+      LClosure *cl = gco2lcl(o);
+      size_t len;
+      const char *name = strname(cl->p->source, &len);
+      object(w, o, LUA_TFUNCTION, sizeLclosure(cl->nupvalues), name, len,
+             cl->p->linedefined);
+      walkLclosure(w, cl);
+      break;
+    }
+    case LUA_TCCL: {
+      CClosure *cl = gco2ccl(o);
+      int i;
+      object(w, o, LUA_TFUNCTION, sizeCclosure(cl->nupvalues), NULL, 0, -1);
+      for (i = 0; i < cl->nupvalues; i++)
+        refvalue(w, o, LUA_HEAPUPVAL, &cl->upvalue[i], NULL, 0, i + 1);
+      break;
+    }
+    case LUA_TTHREAD: {
+      lua_State *th = gco2th(o);
+      object(w, o, LUA_TTHREAD, sizethread(th), NULL, 0, 0);
+      walkthread(w, th);
+      break;
+    }
+    case LUA_TPROTO: {
+      Proto *f = gco2p(o);
+      size_t len;
+      const char *name = strname(f->source, &len);
+      object(w, o, LUA_HEAPPROTO, sizeproto(f), name, len, f->linedefined);
+      walkproto(w, f);
+      break;
+    }
+    default: lua_assert(0);
+  }
+}
+
+
+static void walklist (Walk *w, global_State *g, GCObject *o) {
+  for (; o != NULL; o = o->next)
+    walkobject(w, g, o);
+}
+
+
+/* interned strings are weak references of the string table */
+static void walkstring (void *ud, TString *ts) {
+  Walk *w = cast(Walk *, ud);
+  ref(w, w->strt, LUA_HEAPINTERNAL | LUA_HEAPWEAK, ts, NULL, 0, 0);
+}
+
+
+static void walkroots (Walk *w, global_State *g) {
+  GCObject *o;
+  int i;
+  ref(w, NULL, LUA_HEAPINTERNAL, gcvalue(&g->l_registry), "registry", 8, 0);
+  ref(w, NULL, LUA_HEAPINTERNAL, g->mainthread, "main thread", 11, 0);
+  for (i = 0; i < LUA_NUMTAGS; i++)
+    ref(w, NULL, LUA_HEAPMETA, g->mt[i], NULL, 0, i);
+  for (o = g->fixedgc; o != NULL; o = o->next)
+    ref(w, NULL, LUA_HEAPINTERNAL, o, "fixed", 5, 0);
+  for (o = g->tobefnz; o != NULL; o = o->next)
+    ref(w, NULL, LUA_HEAPINTERNAL, o, "to be finalized", 15, 0);
+  ref(w, NULL, LUA_HEAPINTERNAL, w->strt, "string table", 12, 0);
+}
+
+
+LUA_API void lua_heapwalk (lua_State *L, lua_HeapWalker f, void *ud) {
+  global_State *g = G(L);
+  stringtable *tb = &g->strt;
+  Walk w;
+  lua_lock(L);
+  if (issweepphase(g))  /* dead objects may point to freed ones? */
+    luaC_runtilstate(L, bitmask(GCScallfin) | bitmask(GCSpause));
+  w.f = f;
+  w.ud = ud;
+  w.strt = tb;
+  memset(&w.item, 0, sizeof(w.item));
+  object(&w, tb, LUA_HEAPSTRTAB,
+         sizestrtab(tb->size) + (tb->old ? sizestrtab(tb->oldsize) : 0),
+         NULL, 0, tb->nuse);
+  luaS_foreach(g, walkstring, &w);
+  walkroots(&w, g);
+  walkobject(&w, g, obj2gco(g->mainthread));  /* (not in any list) */
+  walklist(&w, g, g->allgc);
+  walklist(&w, g, g->finobj);
+  walklist(&w, g, g->tobefnz);
+  walklist(&w, g, g->fixedgc);
+  lua_unlock(L);
+}
+
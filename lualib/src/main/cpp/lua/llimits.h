@@ -178,6 +178,16 @@ typedef unsigned long Instruction;
 #endif
 
 
+/*
+** Minimum length for the result of a concatenation to be created as a
+** rope, which defers copying its first operand until its bytes are
+** needed. (Must be larger than LUAI_MAXSHORTLEN.)
+*/
+#if !defined(LUAI_MINROPELEN)
+#define LUAI_MINROPELEN		256
+#endif
+
+
 /*
 ** Initial size for the string table (must be power of 2).
 ** The Lua core alone registers ~50 strings (reserved words +
@@ -11,11 +11,14 @@
 
 
 #include <stddef.h>
+#include <string.h>
 
 #include "lua.h"
 
 #include "ldebug.h"
 #include "ldo.h"
+#include "lfreeq.h"
+#include "lfunc.h"
 #include "lgc.h"
 #include "lmem.h"
 #include "lobject.h"
@@ -71,6 +74,213 @@ l_noret luaM_toobig (lua_State *L) {
 
 
 
+/*
+** {======================================================
+** Allocation sites
+** =======================================================
+** When on, each allocation (a new block or the growth of one) is
+** charged to the line of Lua code running in the thread that asks for
+** it; allocations of C functions are charged to their closest Lua
+** caller. Sites live in an open-addressed table of fixed size, keyed by
+** prototype and line, and keep the names of their chunks in a small
+** pool, so they outlive their prototypes. (A prototype being freed
+** retires its sites, so that a new prototype at the same address does
+** not reuse them.) When the table or the pool is full, new sites are
+** charged to an overflow site.
+*/
+
+/* number of slots for sites (a power of 2, at most 3/4 used) */
+#if !defined(LUAI_ALLOCSITES)
+#define LUAI_ALLOCSITES		1024
+#endif
+
+/* number of distinct chunk names */
+#if !defined(LUAI_ALLOCSOURCES)
+#define LUAI_ALLOCSOURCES	64
+#endif
+
+/* 'source' of the sites outside Lua code and of the overflow site */
+#define SRCC		(-1)
+#define SRCOVERFLOW	(-2)
+
+typedef struct Site {
+  const Proto *p;  /* NULL in empty slots */
+  int line;
+  int linedefined;
+  int source;  /* index in 'sources', or SRCC/SRCOVERFLOW */
+  lu_mem count;
+  lu_mem bytes;
+} Site;
+
+typedef struct AllocSites {
+  Site site[LUAI_ALLOCSITES];
+  Site ccode;  /* allocations with no Lua code running */
+  Site overflow;
+  int nuse;  /* used slots of 'site' */
+  int nsources;
+  char sources[LUAI_ALLOCSOURCES][LUA_IDSIZE];
+} AllocSites;
+
+
+static char retiredmark;
+#define RETIRED		cast(const Proto *, &retiredmark)
+
+
+/* index in the pool of the name of the chunk of 'p' (-1 if full) */
+static int sourceof (AllocSites *s, const Proto *p) {
+  char buff[LUA_IDSIZE];
+  int i;
+  luaO_chunkid(buff, p->source ? getstr(p->source) : "=?", LUA_IDSIZE);
+  for (i = 0; i < s->nsources; i++) {
+    if (strcmp(s->sources[i], buff) == 0)
+      return i;
+  }
+  if (s->nsources == LUAI_ALLOCSOURCES)
+    return -1;
+  strcpy(s->sources[s->nsources], buff);
+  return s->nsources++;
+}
+
+
+static Site *findsite (AllocSites *s, const Proto *p, int line) {
+  unsigned int h = (point2uint(p) >> 3) +
+                   cast(unsigned int, line) * 0x9e3779b1u;  /* (Fibonacci) */
+  int i = cast_int((h ^ (h >> 15)) & (LUAI_ALLOCSITES - 1));
+  Site *site;
+  while (s->site[i].p != NULL) {
+    if (s->site[i].p == p && s->site[i].line == line)
+      return &s->site[i];
+    i = (i + 1) & (LUAI_ALLOCSITES - 1);
+  }
+  site = &s->site[i];
+  if (s->nuse >= LUAI_ALLOCSITES - LUAI_ALLOCSITES / 4 ||
+      (site->source = sourceof(s, p)) < 0)
+    return &s->overflow;  /* no room for a new site */
+  site->p = p;
+  site->line = line;
+  site->linedefined = p->linedefined;
+  s->nuse++;
+  return site;
+}
+
+
+/*
+** Called before the block is (re)allocated, as the block may be the
+** stack of 'L', whose call frames are walked here.
+*/
+static void attribute (lua_State *L, AllocSites *s, size_t n) {
+  CallInfo *ci = L->ci;
+  Site *site = &s->ccode;
+  for (; ci != &L->base_ci; ci = ci->previous) {
+    if (isLua(ci)) {
+      Proto *p = clLvalue(ci->func)->p;
+      int pc = pcRel(ci->u.l.savedpc, p);
+      site = findsite(s, p, getfuncline(p, (pc < 0) ? 0 : pc));
+      break;
+    }
+  }
+  site->count++;
+  site->bytes += n;
+}
+
+
+/*
+** Turn the attribution on (keeping the sites it has) or off (dropping
+** them). Returns whether it was on.
+*/
+int luaM_allocsites (lua_State *L, int on) {
+  global_State *g = G(L);
+  int wason = (g->allocsites != NULL);
+  if (on && !wason) {
+    AllocSites *s = luaM_new(L, AllocSites);
+    memset(s, 0, sizeof(AllocSites));
+    s->ccode.source = SRCC;
+    s->ccode.line = -1;
+    s->overflow.source = SRCOVERFLOW;
+    s->overflow.line = -1;
+    g->allocsites = s;
+  }
+  else if (!on && wason) {
+    AllocSites *s = g->allocsites;
+    g->allocsites = NULL;  /* (before it is freed) */
+    luaM_free(L, s);
+  }
+  return wason;
+}
+
+
+/* called when prototype 'p' is freed */
+void luaM_retiresites (lua_State *L, const Proto *p) {
+  AllocSites *s = G(L)->allocsites;
+  int i;
+  for (i = 0; i < LUAI_ALLOCSITES; i++) {
+    if (s->site[i].p == p)
+      s->site[i].p = RETIRED;
+  }
+}
+
+
+static int samesite (const Site *a, const Site *b) {
+  return (a->p != NULL && a->source == b->source && a->line == b->line &&
+          a->linedefined == b->linedefined);
+}
+
+
+/*
+** Fill 'sites' with the (at most 'n') sites that allocated most bytes,
+** in decreasing order. The sites of a line of code are merged (there is
+** one per prototype of a chunk loaded many times, and those of retired
+** prototypes). Returns the number of sites filled.
+*/
+int luaM_getsites (lua_State *L, lua_AllocSite *sites, int n) {
+  AllocSites *s = G(L)->allocsites;
+  int filled = 0;
+  int i, j;
+  if (s == NULL)
+    return 0;
+  for (i = -2; i < LUAI_ALLOCSITES; i++) {
+    const Site *site = (i == -2) ? &s->ccode
+                     : (i == -1) ? &s->overflow : &s->site[i];
+    lu_mem count = site->count, bytes = site->bytes;
+    int k;
+    if (bytes == 0)
+      continue;
+    if (i >= 0) {  /* merge the sites of the same line */
+      for (j = 0; j < i && !samesite(&s->site[j], site); j++) ;
+      if (j < i)
+        continue;  /* already merged with slot 'j' */
+      for (j = i + 1; j < LUAI_ALLOCSITES; j++) {
+        if (samesite(&s->site[j], site)) {
+          count += s->site[j].count;
+          bytes += s->site[j].bytes;
+        }
+      }
+    }
+    /* insert it in 'sites', sorted by decreasing 'bytes' */
+    for (k = filled; k > 0 && cast(lu_mem, sites[k - 1].bytes) < bytes; k--) {
+      if (k < n)
+        sites[k] = sites[k - 1];
+    }
+    if (k >= n)
+      continue;
+    if (filled < n)
+      filled++;
+    sites[k].count = cast(lua_Integer, count);
+    sites[k].bytes = cast(lua_Integer, bytes);
+    sites[k].line = site->line;
+    sites[k].linedefined = site->linedefined;
+    if (site->source >= 0)
+      strcpy(sites[k].source, s->sources[site->source]);
+    else
+      strcpy(sites[k].source, (site->source == SRCC) ? "[C]" : "(other)");
+  }
+  return filled;
+}
+
+/* }====================================================== */
+
+
+
 /*
 ** generic allocation routine.
 */
@@ -83,11 +293,19 @@ void *luaM_realloc_ (lua_State *L, void *block, size_t osize, size_t nsize) {
   if (nsize > realosize && g->gcrunning)
     luaC_fullgc(L, 1);  /* force a GC whenever possible */
 #endif
-  newblock = (*g->frealloc)(g->ud, block, osize, nsize);
+  if (g->allocsites != NULL && nsize > realosize)
+    attribute(L, g->allocsites, nsize - realosize);  /* (see 'attribute') */
+  if (nsize == 0 && block != NULL && g->freeq != NULL &&
+      luaQ_defer(g, block, osize))  /* freed in background? */
+    newblock = NULL;
+  else
+    newblock = (*g->frealloc)(g->ud, block, osize, nsize);
   if (newblock == NULL && nsize > 0) {
     lua_assert(nsize > realosize);  /* cannot fail when shrinking a block */
     if (g->version) {  /* is state fully built? */
       luaC_fullgc(L, 1);  /* try to free some memory... */
+      if (g->freeq != NULL)
+        luaQ_sync(g);  /* ...including memory still queued */
       newblock = (*g->frealloc)(g->ud, block, osize, nsize);  /* try again */
     }
     if (newblock == NULL)
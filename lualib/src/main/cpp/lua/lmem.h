@@ -14,6 +14,9 @@
 #include "lua.h"
 
 
+struct Proto;
+
+
 /*
 ** This macro reallocs a vector 'b' from 'on' to 'n' elements, where
 ** each element has size 'e'. In case of arithmetic overflow of the
@@ -65,5 +68,9 @@ LUAI_FUNC void *luaM_growaux_ (lua_State *L, void *block, int *size,
                                size_t size_elem, int limit,
                                const char *what);
 
+LUAI_FUNC int luaM_allocsites (lua_State *L, int on);
+LUAI_FUNC void luaM_retiresites (lua_State *L, const struct Proto *p);
+LUAI_FUNC int luaM_getsites (lua_State *L, lua_AllocSite *sites, int n);
+
 #endif
 
@@ -127,7 +127,7 @@ void luaO_arith (lua_State *L, int op, const TValue *p1, const TValue *p2,
     case LUA_OPSHL: case LUA_OPSHR:
     case LUA_OPBNOT: {  /* operate only on integers */
       lua_Integer i1; lua_Integer i2;
-      if (tointeger(p1, &i1) && tointeger(p2, &i2)) {
+      if (tointeger(L, p1, &i1) && tointeger(L, p2, &i2)) {
         setivalue(res, intarith(L, op, i1, i2));
         return;
       }
@@ -135,7 +135,7 @@ void luaO_arith (lua_State *L, int op, const TValue *p1, const TValue *p2,
     }
     case LUA_OPDIV: case LUA_OPPOW: {  /* operate only on floats */
       lua_Number n1; lua_Number n2;
-      if (tonumber(p1, &n1) && tonumber(p2, &n2)) {
+      if (tonumber(L, p1, &n1) && tonumber(L, p2, &n2)) {
         setfltvalue(res, numarith(L, op, n1, n2));
         return;
       }
@@ -147,7 +147,7 @@ void luaO_arith (lua_State *L, int op, const TValue *p1, const TValue *p2,
         setivalue(res, intarith(L, op, ivalue(p1), ivalue(p2)));
         return;
       }
-      else if (tonumber(p1, &n1) && tonumber(p2, &n2)) {
+      else if (tonumber(L, p1, &n1) && tonumber(L, p2, &n2)) {
         setfltvalue(res, numarith(L, op, n1, n2));
         return;
       }
@@ -460,7 +460,7 @@ const char *luaO_pushvfstring (lua_State *L, const char *fmt, va_list argp) {
   luaD_checkstack(L, 1);
   pushstr(L, fmt, strlen(fmt));
   if (n > 0) luaV_concat(L, n + 1);
-  return svalue(L->top - 1);
+  return luaS_contents(L, tsvalue(L->top - 1));
 }
 
 
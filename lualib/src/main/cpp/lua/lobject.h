@@ -302,12 +302,11 @@ typedef TValue *StkId;  /* index to stack elements */
 */
 typedef struct TString {
   CommonHeader;
-  lu_byte extra;  /* reserved words for short strings; "has hash" for longs */
+  lu_byte extra;  /* reserved words for short strings; flags for longs */
   lu_byte shrlen;  /* length for short strings */
   unsigned int hash;
   union {
     size_t lnglen;  /* length for long strings */
-    struct TString *hnext;  /* linked list for hash table */
   } u;
 } TString;
 
@@ -322,11 +321,39 @@ typedef union UTString {
 
 
 /*
-** Get the actual string (array of bytes) from a 'TString'.
+** Header for a rope, a long string created by a concatenation whose
+** bytes are copied only when needed. 'left' is a long string (maybe
+** another rope) and 'right' is a flat string. When the rope is
+** flattened, 'contents' gets its bytes and both parts are released.
+*/
+typedef struct TRope {
+  TString tsv;
+  struct TString *left;
+  struct TString *right;
+  char *contents;
+} TRope;
+
+
+/* bits in field 'extra' of long strings */
+#define LSTRHASH	1	/* string has its hash */
+#define LSTRROPE	2	/* string is a rope */
+
+#define isrope(ts)	((ts)->tt == LUA_TLNGSTR && ((ts)->extra & LSTRROPE))
+#define ts2rope(ts)	check_exp(isrope(ts), cast(TRope *, (ts)))
+
+/* test whether the bytes of a string are available */
+#define isflat(ts)	(!isrope(ts) || ts2rope(ts)->contents != NULL)
+
+
+/*
+** Get the actual string (array of bytes) from a 'TString'. Ropes must
+** be already flattened (see 'luaS_contents').
 ** (Access to 'extra' ensures that value is really a 'TString'.)
 */
 #define getstr(ts)  \
-  check_exp(sizeof((ts)->extra), cast(char *, (ts)) + sizeof(UTString))
+  check_exp(sizeof((ts)->extra), (!isrope(ts) \
+    ? cast(char *, (ts)) + sizeof(UTString) \
+    : check_exp(isflat(ts), ts2rope(ts)->contents)))
 
 
 /* get the actual string (array of bytes) from a Lua value */
@@ -499,9 +526,16 @@ typedef struct Table {
   lu_byte flags;  /* 1<<p means tagmethod(p) is not present */
   lu_byte lsizenode;  /* log2 of size of 'node' array */
   unsigned int sizearray;  /* size of 'array' array */
+  unsigned int lenhint;  /* last boundary found by 'luaH_getn' */
+  unsigned int nexthint;  /* index of last hash key given by 'luaH_next' */
   TValue *array;  /* array part */
   Node *node;
+#if !defined(LUAI_SWISSTABLE)
   Node *lastfree;  /* any free position is before this position */
+#else
+  lu_byte *ctrl;  /* control bytes of hash part (see 'ltable.c') */
+  unsigned int hfree;  /* number of free nodes that can still be used */
+#endif
   struct Table *metatable;
   GCObject *gclist;
 } Table;
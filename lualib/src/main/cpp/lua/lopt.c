@@ -0,0 +1,1076 @@
+/*
+** $Id: lopt.c $
+** Bytecode optimizer
+** See Copyright Notice in lua.h
+*/
+
+#define lopt_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+
+#include <limits.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lgc.h"
+#include "lmem.h"
+#include "lobject.h"
+#include "lopcodes.h"
+#include "lopt.h"
+#include "lstate.h"
+#include "lvm.h"
+
+
+/*
+** The code generator (lcode.c) sees one expression at a time; these
+** passes see a whole function:
+** - jump threading: a jump to an unconditional jump goes directly to
+**   where that one goes;
+** - constant propagation: numeric constants loaded into registers are
+**   used directly as RK operands, operations whose operands are then
+**   all constants are folded (with the rules of 'constfolding') and
+**   tests of registers with known values are resolved; values are
+**   followed across jumps, so a loop body sees the constants its
+**   locals hold before the loop when the loop does not change them,
+**   and a fold never leaves the function with more constants than it
+**   had;
+** - dead code: instructions no path reaches and jumps to the next
+**   instruction are removed;
+** - dead stores: loads into temporary registers that are never read are
+**   removed, and a value computed into a temporary only to be moved to
+**   a lower register is computed there directly;
+** - constants that no instruction uses any more are removed.
+** Instructions keep their lines, so error messages and tracebacks show
+** the same lines; they also name the same variables, as only numbers
+** an operation cannot complain about are put into its operands and
+** moves are only merged when 'getobjname' follows them anyway.
+** The passes assume that a function's registers change only through its
+** own instructions, which debug.setlocal breaks; registers captured as
+** upvalues (that closures can change during any call) are left alone,
+** and stores into named locals are never removed, so debug.getlocal
+** sees every local.
+*/
+
+
+/* passes are run again while they change something, at most this often */
+#define MAXROUNDS	8
+
+/* registers are 8-bit fields */
+#define NREGS		(MAXARG_A + 1)
+
+/* what is known of the value of a register */
+#define VUNKNOWN	(-1)
+#define VNIL		(-2)
+#define VFALSE		(-3)
+#define VTRUE		(-4)
+#define VNONE		(-5)  /* (no path reaches it yet) */
+/* (values >= 0 are indices of numeric constants) */
+
+/* values kept for the entries of labels, at most; beyond that, nothing
+   is known at labels */
+#define MAXENTRY	(1 << 20)
+
+/* flags of instructions */
+#define FLABEL		1  /* target of a jump or of a skip */
+#define FPINNED		2  /* must stay after the previous instruction */
+#define FREACH		4  /* reached from the entry */
+#define FDROP		8  /* to be removed */
+
+/* sets of registers */
+#define SETBITS		(sizeof(unsigned int) * CHAR_BIT)
+#define inset(s,r)	((s)[(r) / SETBITS] & (1u << ((r) % SETBITS)))
+#define addset(s,r)	((s)[(r) / SETBITS] |= (1u << ((r) % SETBITS)))
+#define delset(s,r)	((s)[(r) / SETBITS] &= ~(1u << ((r) % SETBITS)))
+
+
+typedef struct Opt {
+  lua_State *L;
+  Proto *f;
+  Mbuffer *buff;  /* memory for the arrays below */
+  lu_byte *flags;  /* flags of each instruction */
+  int *newpc;  /* position of each instruction once the code is compacted */
+  int *nactive;  /* number of named locals active at each instruction */
+  int maxactive;  /* maximum of 'nactive' */
+  int *kuses;  /* number of uses of each constant */
+  int klive;  /* number of constants in use */
+  int maxk;  /* number of constants before the passes */
+  int *entry;  /* register values at the entry of each label (or NULL) */
+  unsigned int *live;  /* registers live after each instruction */
+  unsigned int *set;  /* two more register sets, for 'liveness' */
+  int words;  /* size of a register set */
+  lu_byte captured[NREGS];  /* registers captured as upvalues */
+  int value[NREGS];  /* value of each register, for 'propagate' */
+} Opt;
+
+
+static int jumptarget (Instruction i, int pc) {
+  return pc + 1 + GETARG_sBx(i);
+}
+
+
+static int isjump (OpCode op) {
+  return (op == OP_JMP || op == OP_FORLOOP || op == OP_FORPREP ||
+          op == OP_TFORLOOP);
+}
+
+
+/*
+** Instructions that may run after the one at 'pc'; returns how many
+** (the next instruction of a test is its jump, which it may skip)
+*/
+static int successors (const Proto *f, int pc, int *s) {
+  Instruction i = f->code[pc];
+  OpCode op = GET_OPCODE(i);
+  switch (op) {
+    case OP_JMP: case OP_FORPREP:
+      s[0] = jumptarget(i, pc);
+      return 1;
+    case OP_FORLOOP: case OP_TFORLOOP:
+      s[0] = pc + 1;
+      s[1] = jumptarget(i, pc);
+      return 2;
+    case OP_RETURN: case OP_EXTRAARG:
+      return 0;
+    case OP_LOADBOOL:
+      s[0] = pc + 1 + (GETARG_C(i) != 0);
+      return 1;
+    case OP_LOADKX:
+      s[0] = pc + 2;
+      return 1;
+    case OP_SETLIST:
+      s[0] = pc + 1 + (GETARG_C(i) == 0);
+      return 1;
+    default:
+      s[0] = pc + 1;
+      if (!testTMode(op))
+        return 1;
+      s[1] = pc + 2;
+      return 2;
+  }
+}
+
+
+static int falls (const Proto *f, int pc) {
+  int s[2];
+  int n = successors(f, pc, s);
+  return (n > 0 && s[0] == pc + 1);
+}
+
+
+/*
+** {======================================================
+** Registers read and written
+** =======================================================
+*/
+
+static void addrange (Opt *o, unsigned int *s, int from, int to) {
+  if (to >= o->f->maxstacksize)
+    to = o->f->maxstacksize - 1;
+  for (; from <= to; from++)
+    addset(s, from);
+}
+
+
+static void addrk (Opt *o, unsigned int *s, int x) {
+  if (!ISK(x))
+    addrange(o, s, x, x);
+}
+
+
+/* add to 's' the registers read by the instruction at 'pc' */
+static void uses (Opt *o, int pc, unsigned int *s) {
+  Proto *f = o->f;
+  Instruction i = f->code[pc];
+  int a = GETARG_A(i);
+  int b = GETARG_B(i);
+  int c = GETARG_C(i);
+  int top = f->maxstacksize - 1;
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_UNM: case OP_BNOT: case OP_NOT: case OP_LEN:
+    case OP_TESTSET:
+      addrange(o, s, b, b);
+      break;
+    case OP_GETTABLE: case OP_SELF:
+      addrange(o, s, b, b);
+      addrk(o, s, c);
+      break;
+    case OP_GETTABUP:
+      addrk(o, s, c);
+      break;
+    case OP_SETTABLE:
+      addrange(o, s, a, a);
+      /* FALLTHROUGH */
+    case OP_SETTABUP:
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: case OP_EQ: case OP_LT: case OP_LE:
+      addrk(o, s, b);
+      addrk(o, s, c);
+      break;
+    case OP_SETUPVAL: case OP_TEST:
+      addrange(o, s, a, a);
+      break;
+    case OP_CONCAT:
+      addrange(o, s, b, c);
+      break;
+    case OP_CALL: case OP_TAILCALL:  /* (B == 0: up to 'top') */
+      addrange(o, s, a, b ? a + b - 1 : top);
+      break;
+    case OP_RETURN:
+      addrange(o, s, a, b ? a + b - 2 : top);
+      break;
+    case OP_SETLIST:
+      addrange(o, s, a, b ? a + b : top);
+      break;
+    case OP_FORLOOP: case OP_FORPREP: case OP_TFORCALL:
+      addrange(o, s, a, a + 2);
+      break;
+    case OP_TFORLOOP:
+      addrange(o, s, a + 1, a + 1);
+      break;
+    case OP_CLOSURE: {
+      Proto *p = f->p[GETARG_Bx(i)];
+      int j;
+      for (j = 0; j < p->sizeupvalues; j++) {
+        if (p->upvalues[j].instack)
+          addrange(o, s, p->upvalues[j].idx, p->upvalues[j].idx);
+      }
+      break;
+    }
+    default: break;  /* reads no registers */
+  }
+}
+
+
+/*
+** Registers that the instruction 'i' always writes: returns the first
+** one and puts the last one in 'last' (none if 'last' < first)
+*/
+static int kills (Instruction i, int *last) {
+  int a = GETARG_A(i);
+  switch (GET_OPCODE(i)) {
+    case OP_LOADNIL:
+      *last = a + GETARG_B(i);
+      break;
+    case OP_SELF:
+      *last = a + 1;
+      break;
+    case OP_CALL:
+      *last = a + GETARG_C(i) - 2;
+      break;
+    case OP_VARARG:
+      *last = a + GETARG_B(i) - 2;
+      break;
+    case OP_MOVE: case OP_LOADK: case OP_LOADKX: case OP_LOADBOOL:
+    case OP_GETUPVAL: case OP_GETTABUP: case OP_GETTABLE:
+    case OP_NEWTABLE:
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: case OP_UNM: case OP_BNOT: case OP_NOT:
+    case OP_LEN: case OP_CONCAT: case OP_CLOSURE:
+      *last = a;
+      break;
+    default:
+      *last = a - 1;
+      break;
+  }
+  return a;
+}
+
+
+/*
+** Registers that the instruction 'i' may change, including those a
+** call uses as the stack of the function it calls
+*/
+static int clobbers (const Proto *f, Instruction i, int *last) {
+  int a = GETARG_A(i);
+  switch (GET_OPCODE(i)) {
+    case OP_CALL: case OP_TAILCALL: case OP_VARARG:
+      *last = f->maxstacksize - 1;
+      return a;
+    case OP_TFORCALL:
+      *last = f->maxstacksize - 1;
+      return a + 3;
+    case OP_CONCAT: {  /* concatenates in place over B..C */
+      int b = GETARG_B(i);
+      int c = GETARG_C(i);
+      *last = (a > c) ? a : c;
+      return (a < b) ? a : b;
+    }
+    case OP_FORLOOP:
+      *last = a + 3;
+      return a;
+    case OP_FORPREP:
+      *last = a + 2;
+      return a;
+    case OP_TFORLOOP: case OP_TESTSET:
+      *last = a;
+      return a;
+    default:
+      return kills(i, last);
+  }
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Layout
+** =======================================================
+*/
+
+/* whether 'i' may go to an instruction other than the next one */
+static int makeslabel (Instruction i) {
+  OpCode op = GET_OPCODE(i);
+  return (isjump(op) || testTMode(op) ||
+          (op == OP_LOADBOOL && GETARG_C(i)) || op == OP_LOADKX ||
+          (op == OP_SETLIST && GETARG_C(i) == 0));
+}
+
+
+/*
+** Lay out the arrays for the current code in 'buff' and mark labels,
+** the instructions entered other than from the previous one
+*/
+static void prepare (Opt *o) {
+  Proto *f = o->f;
+  int n = f->sizecode;
+  int nlabels = 0;
+  int pc, i;
+  size_t nentry;
+  size_t size;
+  char *p;
+  o->words = (f->maxstacksize + SETBITS - 1) / SETBITS;
+  if (o->words == 0)
+    o->words = 1;
+  for (pc = 0; pc < n; pc++) {  /* (each makes at most one label) */
+    if (makeslabel(f->code[pc]))
+      nlabels++;
+  }
+  nentry = cast(size_t, nlabels) * f->maxstacksize;
+  if (nentry > MAXENTRY)
+    nentry = 0;
+  size = sizeof(int) * (2 * (n + 1) + (f->sizek + n) + nentry) +
+         sizeof(unsigned int) * o->words * (n + 2) + (n + 1);
+  if (luaZ_sizebuffer(o->buff) < size)
+    luaZ_resizebuffer(o->L, o->buff, size);
+  p = luaZ_buffer(o->buff);
+  o->newpc = cast(int *, p);
+  o->nactive = o->newpc + n + 1;
+  o->kuses = o->nactive + n + 1;  /* (room for a new constant per fold) */
+  o->entry = (nentry > 0) ? o->kuses + f->sizek + n : NULL;
+  o->live = cast(unsigned int *, o->kuses + f->sizek + n + nentry);
+  o->set = o->live + o->words * n;
+  o->flags = cast(lu_byte *, o->set + o->words * 2);
+  memset(o->flags, 0, n + 1);
+  memset(o->nactive, 0, sizeof(int) * (n + 1));
+  for (pc = 0; pc < n; pc++) {
+    Instruction ins = f->code[pc];
+    OpCode op = GET_OPCODE(ins);
+    if (isjump(op))
+      o->flags[jumptarget(ins, pc)] |= FLABEL;
+    if (testTMode(op) || (op == OP_LOADBOOL && GETARG_C(ins))) {
+      o->flags[pc + 1] |= FPINNED;  /* jump or instruction skipped */
+      o->flags[pc + 2] |= FLABEL;
+    }
+    else if (op == OP_LOADKX || (op == OP_SETLIST && GETARG_C(ins) == 0)) {
+      o->flags[pc + 1] |= FPINNED;  /* EXTRAARG, skipped */
+      o->flags[pc + 2] |= FLABEL;
+    }
+    else if (op == OP_TFORCALL)
+      o->flags[pc + 1] |= FPINNED;  /* TFORLOOP */
+  }
+  for (i = 0; i < f->sizelocvars; i++) {  /* count active locals */
+    o->nactive[f->locvars[i].startpc]++;
+    o->nactive[f->locvars[i].endpc]--;
+  }
+  o->maxactive = o->nactive[0];
+  for (pc = 1; pc <= n; pc++) {
+    o->nactive[pc] += o->nactive[pc - 1];
+    if (o->nactive[pc] > o->maxactive)
+      o->maxactive = o->nactive[pc];
+  }
+}
+
+
+/* remove the instructions marked FDROP and fix jumps and debug info */
+static int compact (Opt *o) {
+  Proto *f = o->f;
+  int n = f->sizecode;
+  int pc, j = 0;
+  for (pc = 0; pc < n; pc++) {
+    o->newpc[pc] = j;
+    if (!(o->flags[pc] & FDROP))
+      j++;
+  }
+  o->newpc[n] = j;
+  if (j == n)
+    return 0;
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    int to = o->newpc[pc];
+    if (o->flags[pc] & FDROP)
+      continue;
+    if (isjump(GET_OPCODE(i)))  /* (a removed target was a no-op) */
+      SETARG_sBx(i, o->newpc[jumptarget(i, pc)] - (to + 1));
+    f->code[to] = i;
+    if (f->lineinfo)
+      f->lineinfo[to] = f->lineinfo[pc];
+  }
+  for (pc = 0; pc < f->sizelocvars; pc++) {
+    f->locvars[pc].startpc = o->newpc[f->locvars[pc].startpc];
+    f->locvars[pc].endpc = o->newpc[f->locvars[pc].endpc];
+  }
+  luaM_reallocvector(o->L, f->code, n, j, Instruction);
+  if (f->lineinfo) {
+    luaM_reallocvector(o->L, f->lineinfo, f->sizelineinfo, j, int);
+    f->sizelineinfo = j;
+  }
+  f->sizecode = j;
+  return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Passes
+** =======================================================
+*/
+
+static int threadjumps (Opt *o) {
+  Proto *f = o->f;
+  int pc, changed = 0;
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    if (GET_OPCODE(i) == OP_JMP) {
+      int dest = jumptarget(i, pc);
+      int hops = 0;
+      while (hops++ < f->sizecode) {  /* (a cycle of jumps ends it) */
+        Instruction next = f->code[dest];
+        if (GET_OPCODE(next) != OP_JMP || GETARG_A(next) != 0 ||
+            jumptarget(next, dest) == dest)
+          break;  /* not a plain jump (that does not close upvalues) */
+        dest = jumptarget(next, dest);
+      }
+      if (dest != jumptarget(i, pc)) {
+        SETARG_sBx(f->code[pc], dest - (pc + 1));
+        changed = 1;
+      }
+    }
+  }
+  return changed;
+}
+
+
+/* set what is known of every register */
+static void setall (Opt *o, int v) {
+  int r;
+  for (r = 0; r < NREGS; r++)
+    o->value[r] = v;
+}
+
+
+static void setvalue (Opt *o, int r, int v) {
+  if (!o->captured[r])
+    o->value[r] = v;
+}
+
+
+/* add 'd' to the uses of constant 'k' */
+static void countk (Opt *o, int k, int d) {
+  int before = (o->kuses[k] > 0);
+  o->kuses[k] += d;
+  o->klive += (o->kuses[k] > 0) - before;
+}
+
+
+/* add 'd' to the uses of the constants of the instruction at 'pc' */
+static void usek (Opt *o, int pc, int d) {
+  Instruction i = o->f->code[pc];
+  OpCode op = GET_OPCODE(i);
+  if (op == OP_LOADK)
+    countk(o, GETARG_Bx(i), d);
+  else if (op == OP_LOADKX)
+    countk(o, GETARG_Ax(o->f->code[pc + 1]), d);
+  else {
+    if (getBMode(op) == OpArgK && ISK(GETARG_B(i)))
+      countk(o, INDEXK(GETARG_B(i)), d);
+    if (getCMode(op) == OpArgK && ISK(GETARG_C(i)))
+      countk(o, INDEXK(GETARG_C(i)), d);
+  }
+}
+
+
+static void countconstants (Opt *o) {
+  int pc;
+  memset(o->kuses, 0, sizeof(int) * o->f->sizek);
+  o->klive = 0;
+  for (pc = 0; pc < o->f->sizecode; pc++)
+    usek(o, pc, 1);
+}
+
+
+/*
+** RK operand 'x' of an 'op' instruction, with the constant its register
+** holds if there is one that 'op' cannot complain about: every number
+** for arithmetic (errors name the operand that is not a number) and
+** integers for bitwise operations (errors name the operand that has no
+** integer representation)
+*/
+static int rkvalue (Opt *o, OpCode op, int x) {
+  int v;
+  if (ISK(x))
+    return x;
+  v = o->value[x];
+  if (v < 0 || v > MAXINDEXRK)
+    return x;
+  if (OP_BAND <= op && op <= OP_SHR && !ttisinteger(&o->f->k[v]))
+    return x;
+  return RKASK(v);
+}
+
+
+/* numeric constant that the RK operand 'x' is known to be, if any */
+static const TValue *numvalue (Opt *o, int x) {
+  const TValue *k;
+  if (ISK(x))
+    k = &o->f->k[INDEXK(x)];
+  else if (o->value[x] >= 0)
+    k = &o->f->k[o->value[x]];
+  else
+    return NULL;
+  return ttisnumber(k) ? k : NULL;
+}
+
+
+/*
+** Index of a constant equal to 'v' (a number), added if needed; -1 if
+** the function would then use more constants than it had or a constant
+** that an RK operand cannot name
+*/
+static int constant (Opt *o, const TValue *v) {
+  Proto *f = o->f;
+  int i;
+  for (i = 0; i < f->sizek; i++) {
+    const TValue *k = &f->k[i];
+    if (ttisinteger(v) ? (ttisinteger(k) && ivalue(k) == ivalue(v))
+                       : (ttisfloat(k) &&
+                          luai_numeq(fltvalue(k), fltvalue(v))))
+      break;
+  }
+  if (i == f->sizek && i > MAXINDEXRK)
+    return -1;
+  if ((i == f->sizek || o->kuses[i] == 0) && o->klive >= o->maxk)
+    return -1;
+  if (i == f->sizek) {
+    luaM_reallocvector(o->L, f->k, f->sizek, f->sizek + 1, TValue);
+    setobj(o->L, &f->k[i], v);  /* (numbers need no barrier) */
+    o->kuses[i] = 0;  /* (counted with its instruction) */
+    f->sizek++;
+  }
+  return i;
+}
+
+
+/*
+** Replace the instruction at 'pc' by a load of the result of 'op' over
+** 'v1' and 'v2'; as 'constfolding' in lcode.c, does not fold operations
+** that raise errors nor results NaN and 0.0 (which may be -0.0)
+*/
+static int fold (Opt *o, int pc, int op, const TValue *v1,
+                 const TValue *v2) {
+  TValue res;
+  lua_Integer i;
+  int k;
+  switch (op) {
+    case LUA_OPBAND: case LUA_OPBOR: case LUA_OPBXOR:
+    case LUA_OPSHL: case LUA_OPSHR: case LUA_OPBNOT: {
+      if (!tointeger(o->L, v1, &i) || !tointeger(o->L, v2, &i))
+        return 0;
+      break;
+    }
+    case LUA_OPDIV: case LUA_OPIDIV: case LUA_OPMOD: {
+      if (nvalue(v2) == 0)
+        return 0;
+      break;
+    }
+    default: break;
+  }
+  luaO_arith(o->L, op, v1, v2, &res);
+  if (ttisfloat(&res) &&
+      (luai_numisnan(fltvalue(&res)) || fltvalue(&res) == 0))
+    return 0;
+  k = constant(o, &res);
+  if (k < 0 || k > MAXARG_Bx)
+    return 0;
+  o->f->code[pc] = CREATE_ABx(OP_LOADK, GETARG_A(o->f->code[pc]), k);
+  return 1;
+}
+
+
+/* values of the registers at the entry of the label at 'pc' */
+static int *entryof (Opt *o, int pc) {
+  return o->entry + cast(size_t, o->newpc[pc]) * o->f->maxstacksize;
+}
+
+
+/* merge what is known of the registers into the entry of label 'pc' */
+static int join (Opt *o, int pc) {
+  int *e = entryof(o, pc);
+  int r, changed = 0;
+  for (r = 0; r < o->f->maxstacksize; r++) {
+    int v = o->value[r];
+    if (v != VNONE && v != e[r] && e[r] != VUNKNOWN) {
+      e[r] = (e[r] == VNONE) ? v : VUNKNOWN;
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/* what is known of the registers after the instruction at 'pc' */
+static void transfer (Opt *o, int pc) {
+  Instruction i = o->f->code[pc];
+  OpCode op = GET_OPCODE(i);
+  int a = GETARG_A(i);
+  int v = (op == OP_MOVE) ? o->value[GETARG_B(i)] : VUNKNOWN;
+  int r, last;
+  for (r = clobbers(o->f, i, &last); r <= last; r++)
+    o->value[r] = VUNKNOWN;
+  switch (op) {
+    case OP_LOADK:
+      if (ttisnumber(&o->f->k[GETARG_Bx(i)]))
+        setvalue(o, a, GETARG_Bx(i));
+      break;
+    case OP_LOADBOOL:
+      setvalue(o, a, GETARG_B(i) ? VTRUE : VFALSE);
+      break;
+    case OP_LOADNIL:
+      for (r = a; r <= a + GETARG_B(i); r++)
+        setvalue(o, r, VNIL);
+      break;
+    case OP_MOVE:
+      setvalue(o, a, v);
+      break;
+    default: break;
+  }
+}
+
+
+/*
+** Use what is known of the registers to simplify the instruction at
+** 'pc'; returns 1 if it changed, 2 if the test there and its jump are
+** removed (the test always skips the jump)
+*/
+static int simplify (Opt *o, int pc) {
+  Proto *f = o->f;
+  Instruction old = f->code[pc];
+  Instruction i = old;
+  OpCode op = GET_OPCODE(i);
+  usek(o, pc, -1);
+  switch (op) {
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: {
+      const TValue *v1, *v2;
+      SETARG_B(i, rkvalue(o, op, GETARG_B(i)));
+      SETARG_C(i, rkvalue(o, op, GETARG_C(i)));
+      f->code[pc] = i;
+      v1 = numvalue(o, GETARG_B(i));
+      v2 = numvalue(o, GETARG_C(i));
+      if (v1 && v2)
+        fold(o, pc, cast_int(op - OP_ADD) + LUA_OPADD, v1, v2);
+      break;
+    }
+    case OP_UNM: case OP_BNOT: {
+      const TValue *v1 = numvalue(o, GETARG_B(i));
+      TValue zero;
+      setivalue(&zero, 0);  /* second operand, as in 'luaK_prefix' */
+      if (v1)
+        fold(o, pc, cast_int(op - OP_ADD) + LUA_OPADD, v1, &zero);
+      break;
+    }
+    case OP_EQ: case OP_LT: case OP_LE:
+    case OP_SETTABUP: case OP_SETTABLE:
+      SETARG_B(i, rkvalue(o, op, GETARG_B(i)));
+      /* FALLTHROUGH */
+    case OP_GETTABUP: case OP_GETTABLE: case OP_SELF:
+      SETARG_C(i, rkvalue(o, op, GETARG_C(i)));
+      f->code[pc] = i;
+      break;
+    case OP_TEST: {
+      int known = o->value[GETARG_A(i)];
+      if (known != VUNKNOWN) {
+        int truth = (known != VNIL && known != VFALSE);
+        if (truth == GETARG_C(i))  /* always jumps? */
+          o->flags[pc] |= FDROP;
+        else if (!(o->flags[pc + 1] & FLABEL)) {  /* always skips */
+          o->flags[pc] |= FDROP;
+          o->flags[pc + 1] |= FDROP;
+          return 2;
+        }
+      }
+      break;
+    }
+    default: break;
+  }
+  usek(o, pc, 1);
+  return (f->code[pc] != old || (o->flags[pc] & FDROP));
+}
+
+
+/*
+** One pass forward over the code, following what registers hold. With
+** 'rewrite', simplifies instructions with it and returns whether some
+** changed; otherwise merges it into the entries of labels and returns
+** whether some entry changed. Without entries, nothing is known at
+** labels.
+*/
+static int sweep (Opt *o, int rewrite) {
+  Proto *f = o->f;
+  int pc, changed = 0;
+  setall(o, VUNKNOWN);  /* nothing is known at the start */
+  for (pc = 0; pc < f->sizecode; pc++) {
+    int s[2], ns, j;
+    if (o->flags[pc] & FLABEL) {
+      if (o->entry == NULL)
+        setall(o, VUNKNOWN);
+      else {
+        int *e = entryof(o, pc);
+        if (!rewrite)
+          changed |= join(o, pc);  /* from the previous instruction */
+        for (j = 0; j < f->maxstacksize; j++)
+          o->value[j] = (rewrite && e[j] == VNONE) ? VUNKNOWN : e[j];
+      }
+    }
+    if (rewrite) {
+      int c = simplify(o, pc);
+      changed |= c;
+      if (c == 2) {  /* goes to the label after the jump */
+        pc++;
+        continue;
+      }
+    }
+    transfer(o, pc);
+    ns = successors(f, pc, s);
+    for (j = 0; j < ns; j++) {
+      if (!rewrite && o->entry != NULL && s[j] != pc + 1 &&
+          s[j] < f->sizecode)
+        changed |= join(o, s[j]);
+    }
+    if (!falls(f, pc))  /* next instruction, if any, is not reached */
+      setall(o, (rewrite || o->entry == NULL) ? VUNKNOWN : VNONE);
+  }
+  return changed;
+}
+
+
+/*
+** Forward over the code, following what registers hold; values known
+** at the entries of labels are found first, merging what each jump to
+** them brings until nothing changes
+*/
+static int propagate (Opt *o) {
+  Proto *f = o->f;
+  if (o->entry != NULL) {
+    int pc, nlabels = 0;
+    size_t j, nentry;
+    for (pc = 0; pc < f->sizecode; pc++) {  /* number the labels */
+      if (o->flags[pc] & FLABEL)
+        o->newpc[pc] = nlabels++;
+    }
+    nentry = cast(size_t, nlabels) * f->maxstacksize;
+    for (j = 0; j < nentry; j++)
+      o->entry[j] = VNONE;
+    while (sweep(o, 0))
+      ;
+  }
+  countconstants(o);
+  return sweep(o, 1);
+}
+
+
+static int removedead (Opt *o) {
+  Proto *f = o->f;
+  int n = f->sizecode;
+  int *stack = o->newpc;  /* (each instruction is pushed once) */
+  int top = 0, pc, changed = 0;
+  stack[top++] = 0;
+  o->flags[0] |= FREACH;
+  while (top > 0) {
+    int s[3], ns, j;
+    pc = stack[--top];
+    ns = successors(f, pc, s);
+    if (pc + 1 < n && (o->flags[pc + 1] & FPINNED))
+      s[ns++] = pc + 1;
+    for (j = 0; j < ns; j++) {
+      if (s[j] < n && !(o->flags[s[j]] & FREACH)) {
+        o->flags[s[j]] |= FREACH;
+        stack[top++] = s[j];
+      }
+    }
+  }
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    if (!(o->flags[pc] & FREACH) ||
+        (GET_OPCODE(i) == OP_JMP && GETARG_A(i) == 0 &&
+         GETARG_sBx(i) == 0 && !(o->flags[pc] & FPINNED))) {
+      o->flags[pc] |= FDROP;
+      changed = 1;
+    }
+  }
+  return changed;
+}
+
+
+/* registers live before the instruction at 'pc' */
+static void livein (Opt *o, int pc, unsigned int *s) {
+  int r, last;
+  memcpy(s, o->live + o->words * pc, sizeof(unsigned int) * o->words);
+  r = kills(o->f->code[pc], &last);
+  if (last >= o->f->maxstacksize)
+    last = o->f->maxstacksize - 1;
+  for (; r <= last; r++)
+    delset(s, r);
+  uses(o, pc, s);
+}
+
+
+/* backward over the code, until the registers live after each settle */
+static void liveness (Opt *o) {
+  Proto *f = o->f;
+  int n = f->sizecode;
+  size_t bytes = sizeof(unsigned int) * o->words;
+  unsigned int *out = o->set;
+  unsigned int *in = o->set + o->words;
+  int changed;
+  memset(o->live, 0, bytes * n);
+  do {
+    int pc;
+    changed = 0;
+    for (pc = n - 1; pc >= 0; pc--) {
+      int s[2], ns, j, w;
+      memset(out, 0, bytes);
+      ns = successors(f, pc, s);
+      for (j = 0; j < ns; j++) {
+        if (s[j] < n) {
+          livein(o, s[j], in);
+          for (w = 0; w < o->words; w++)
+            out[w] |= in[w];
+        }
+      }
+      if (memcmp(out, o->live + o->words * pc, bytes) != 0) {
+        memcpy(o->live + o->words * pc, out, bytes);
+        changed = 1;
+      }
+    }
+  } while (changed);
+}
+
+
+/*
+** Register 'r' is not captured and holds no named local from the
+** instruction at 'pc' until it is written again, so that debug.getlocal
+** cannot see what 'pc' stores in it (a store ahead of the start of a
+** local overwritten after it would be seen)
+*/
+static int istemp (Opt *o, int pc, int r) {
+  Proto *f = o->f;
+  if (o->captured[r])
+    return 0;
+  if (r >= o->maxactive)
+    return 1;
+  for (;;) {
+    int first, last;
+    if (r < o->nactive[pc])
+      return 0;
+    if (pc + 1 >= f->sizecode || !falls(f, pc) ||
+        (o->flags[pc + 1] & FLABEL))
+      return 0;  /* (not followed further) */
+    pc++;
+    first = kills(f->code[pc], &last);
+    if (first <= r && r <= last)
+      return (r >= o->nactive[pc]);
+  }
+}
+
+
+/* instructions whose only effect is to write their registers */
+static int isstore (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_LOADK: case OP_LOADNIL: case OP_GETUPVAL:
+    case OP_NEWTABLE:
+      return 1;
+    case OP_LOADBOOL:
+      return (GETARG_C(i) == 0);
+    default:
+      return 0;
+  }
+}
+
+
+/* instructions that can write their result to any register A */
+static int isretargetable (Instruction i) {
+  switch (GET_OPCODE(i)) {
+    case OP_MOVE: case OP_LOADK: case OP_GETUPVAL: case OP_GETTABUP:
+    case OP_GETTABLE: case OP_NEWTABLE:
+    case OP_ADD: case OP_SUB: case OP_MUL: case OP_MOD: case OP_POW:
+    case OP_DIV: case OP_IDIV: case OP_BAND: case OP_BOR: case OP_BXOR:
+    case OP_SHL: case OP_SHR: case OP_UNM: case OP_BNOT: case OP_NOT:
+    case OP_LEN: case OP_CONCAT: case OP_CLOSURE:
+      return 1;
+    case OP_LOADBOOL:
+      return (GETARG_C(i) == 0);
+    default:
+      return 0;
+  }
+}
+
+
+static int removestores (Opt *o) {
+  Proto *f = o->f;
+  int n = f->sizecode;
+  int pc, changed = 0;
+  liveness(o);
+  for (pc = 0; pc < n; pc++) {
+    Instruction i = f->code[pc];
+    int a = GETARG_A(i);
+    int r, last;
+    if (o->flags[pc] & FPINNED)
+      continue;
+    if (isstore(i)) {
+      if (GET_OPCODE(i) == OP_MOVE && GETARG_B(i) == a)
+        r = last = a - 1;  /* moves a register to itself */
+      else
+        r = kills(i, &last);
+      for (; r <= last; r++) {
+        if (inset(o->live + o->words * pc, r) || !istemp(o, pc, r))
+          break;
+      }
+      if (r > last) {  /* all registers written are dead? */
+        o->flags[pc] |= FDROP;
+        changed = 1;
+        continue;
+      }
+    }
+    if (isretargetable(i) && pc + 1 < n) {
+      /* 'A := ...; X := A' with A dead after it becomes 'X := ...' */
+      Instruction mv = f->code[pc + 1];
+      int x = GETARG_A(mv);
+      if (GET_OPCODE(mv) == OP_MOVE && GETARG_B(mv) == a && x < a &&
+          !(o->flags[pc + 1] & (FLABEL | FPINNED)) &&
+          istemp(o, pc, a) &&
+          !inset(o->live + o->words * (pc + 1), a) && !o->captured[x]) {
+        SETARG_A(i, x);
+        f->code[pc] = i;
+        o->flags[pc + 1] |= FDROP;
+        changed = 1;
+        pc++;
+      }
+    }
+  }
+  return changed;
+}
+
+/* remove the constants no instruction uses any more */
+static int removeconstants (Opt *o) {
+  Proto *f = o->f;
+  int *map = o->kuses;  /* (a constant's uses become its new index) */
+  int pc, i, n = 0;
+  countconstants(o);
+  if (o->klive == f->sizek)
+    return 0;
+  for (i = 0; i < f->sizek; i++) {
+    if (map[i] > 0) {
+      map[i] = n;
+      setobj(o->L, &f->k[n], &f->k[i]);
+      n++;
+    }
+  }
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction *ins = &f->code[pc];
+    OpCode op = GET_OPCODE(*ins);
+    if (op == OP_LOADK)
+      SETARG_Bx(*ins, map[GETARG_Bx(*ins)]);
+    else if (op == OP_LOADKX)
+      SETARG_Ax(f->code[pc + 1], map[GETARG_Ax(f->code[pc + 1])]);
+    else {
+      if (getBMode(op) == OpArgK && ISK(GETARG_B(*ins)))
+        SETARG_B(*ins, RKASK(map[INDEXK(GETARG_B(*ins))]));
+      if (getCMode(op) == OpArgK && ISK(GETARG_C(*ins)))
+        SETARG_C(*ins, RKASK(map[INDEXK(GETARG_C(*ins))]));
+    }
+  }
+  luaM_reallocvector(o->L, f->k, f->sizek, n, TValue);
+  f->sizek = n;
+  return 1;
+}
+
+/* }====================================================== */
+
+
+static void markcaptured (Opt *o) {
+  Proto *f = o->f;
+  int pc, j;
+  memset(o->captured, 0, sizeof(o->captured));
+  for (pc = 0; pc < f->sizecode; pc++) {
+    Instruction i = f->code[pc];
+    if (GET_OPCODE(i) == OP_CLOSURE) {
+      Proto *p = f->p[GETARG_Bx(i)];
+      for (j = 0; j < p->sizeupvalues; j++) {
+        if (p->upvalues[j].instack)
+          o->captured[p->upvalues[j].idx] = 1;
+      }
+    }
+  }
+}
+
+
+/* run 'pass' over the current code and remove what it dropped */
+static int run (Opt *o, int (*pass) (Opt *o)) {
+  int changed;
+  prepare(o);
+  changed = pass(o);
+  return compact(o) | changed;
+}
+
+
+static void optimize (lua_State *L, Proto *f, Mbuffer *buff) {
+  Opt o;
+  int round;
+  if (f->sizecode > LUAI_OPTMAXCODE)
+    return;
+  o.L = L;
+  o.f = f;
+  o.buff = buff;
+  o.maxk = f->sizek;
+  markcaptured(&o);
+  for (round = 0; round < MAXROUNDS; round++) {
+    int changed = run(&o, threadjumps);
+    changed |= run(&o, propagate);
+    changed |= run(&o, removedead);
+    changed |= run(&o, removestores);
+    changed |= run(&o, removeconstants);
+    if (!changed)
+      break;
+  }
+}
+
+
+/*
+** Optimize 'f' and the functions nested in it; 'buff' is scratch memory
+** freed by the caller (so that nothing leaks if an allocation fails)
+*/
+void luaR_optimize (lua_State *L, Proto *f, Mbuffer *buff) {
+  int i;
+  optimize(L, f, buff);
+  for (i = 0; i < f->sizep; i++)
+    luaR_optimize(L, f->p[i], buff);
+}
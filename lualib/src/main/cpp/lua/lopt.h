@@ -0,0 +1,34 @@
+/*
+** $Id: lopt.h $
+** Bytecode optimizer
+** See Copyright Notice in lua.h
+*/
+
+#ifndef lopt_h
+#define lopt_h
+
+
+#include "lobject.h"
+#include "lzio.h"
+
+
+/*
+** Chunks compiled from source by a state with 'optimize' set (see
+** LUA_GCOPTIMIZE) go through a few passes over each of their prototypes
+** before they run. Precompiled chunks are loaded as they are.
+*/
+
+/* whether new states optimize the chunks they compile */
+#if !defined(LUAI_OPTIMIZE)
+#define LUAI_OPTIMIZE		0
+#endif
+
+/* functions with more instructions are left as compiled */
+#if !defined(LUAI_OPTMAXCODE)
+#define LUAI_OPTMAXCODE		100000
+#endif
+
+
+LUAI_FUNC void luaR_optimize (lua_State *L, Proto *f, Mbuffer *buff);
+
+#endif
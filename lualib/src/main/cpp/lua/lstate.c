@@ -22,6 +22,7 @@
 #include "lgc.h"
 #include "llex.h"
 #include "lmem.h"
+#include "lopt.h"
 #include "lstate.h"
 #include "lstring.h"
 #include "ltable.h"
@@ -36,6 +37,14 @@
 #define LUAI_GCMUL	200 /* GC runs 'twice the speed' of memory allocation */
 #endif
 
+#if !defined(LUAI_GCMINOR)
+#define LUAI_GCMINOR	20  /* minor collection after heap grows 20% */
+#endif
+
+#if !defined(LUAI_GCMAJOR)
+#define LUAI_GCMAJOR	200  /* major collection when heap doubles */
+#endif
+
 
 /*
 ** a macro to help the creation of a unique random seed when a state is
@@ -106,7 +115,8 @@ void luaE_setdebt (global_State *g, l_mem debt) {
 
 
 CallInfo *luaE_extendCI (lua_State *L) {
-  CallInfo *ci = luaM_new(L, CallInfo);
+  CallInfo *ci = cast(CallInfo *,
+                      luaM_newobject(L, LUA_KCALLINFO, sizeof(CallInfo)));
   lua_assert(L->ci->next == NULL);
   L->ci->next = ci;
   ci->previous = L->ci;
@@ -151,7 +161,8 @@ void luaE_shrinkCI (lua_State *L) {
 static void stack_init (lua_State *L1, lua_State *L) {
   int i; CallInfo *ci;
   /* initialize stack array */
-  L1->stack = luaM_newvector(L, BASIC_STACK_SIZE, TValue);
+  L1->stack = cast(TValue *, luaM_newobject(L, LUA_KSTACK,
+                                  BASIC_STACK_SIZE * sizeof(TValue)));
   L1->stacksize = BASIC_STACK_SIZE;
   for (i = 0; i < BASIC_STACK_SIZE; i++)
     setnilvalue(L1->stack + i);  /* erase new stack */
@@ -242,12 +253,16 @@ static void preinit_thread (lua_State *L, global_State *g) {
 static void close_state (lua_State *L) {
   global_State *g = G(L);
   luaF_close(L, L->stack);  /* close all upvalues for this thread */
+  luaM_allocsites(L, 0);  /* (before prototypes are freed) */
   luaC_freeallobjects(L);  /* collect all objects */
   if (g->version)  /* closing a fully built state? */
     luai_userstateclose(L);
-  luaM_freearray(L, G(L)->strt.hash, G(L)->strt.size);
-  freestack(L);
-  lua_assert(gettotalbytes(g) == sizeof(LG));
+  if (!g->bulkclose) {
+    luaM_freemem(L, G(L)->strt.hash, sizestrtab(G(L)->strt.size));
+    luaM_freemem(L, G(L)->strt.old, sizestrtab(G(L)->strt.oldsize));
+    freestack(L);
+    lua_assert(gettotalbytes(g) == sizeof(LG));
+  }
   (*g->frealloc)(g->ud, fromstate(L), sizeof(LG), 0);  /* free main block */
 }
 
@@ -310,9 +325,18 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->mainthread = L;
   g->seed = makeseed(L);
   g->gcrunning = 0;  /* no GC while building state */
-  g->GCestimate = 0;
+  g->GCestimate = g->GClastmajor = 0;
+  g->GCcyclework = g->GClastwork = 0;
+  g->GCcycles = 0;
+#if defined(LUAI_VMSTATS)
+  memset(g->vmops, 0, sizeof(g->vmops));
+  memset(g->vmpairs, 0, sizeof(g->vmpairs));
+  memset(g->vmslow, 0, sizeof(g->vmslow));
+#endif
   g->strt.size = g->strt.nuse = 0;
-  g->strt.hash = NULL;
+  g->strt.hash = g->strt.old = NULL;
+  g->strt.tags = g->strt.oldtags = NULL;
+  g->strt.oldsize = g->strt.moved = 0;
   setnilvalue(&g->l_registry);
   g->panic = NULL;
   g->version = NULL;
@@ -323,12 +347,23 @@ LUA_API lua_State *lua_newstate (lua_Alloc f, void *ud) {
   g->gray = g->grayagain = NULL;
   g->weak = g->ephemeron = g->allweak = NULL;
   g->twups = NULL;
+  g->freeq = NULL;
+  g->markers = NULL;
+  g->gcstats = NULL;
+  g->allocsites = NULL;
+  g->gcparallel = 0;
+  g->bulkclose = 0;
+  g->optimize = LUAI_OPTIMIZE;
+  g->threadsafe = 1;
   g->totalbytes = sizeof(LG);
   g->GCdebt = 0;
   g->gcfinnum = 0;
   g->gcpause = LUAI_GCPAUSE;
   g->gcstepmul = LUAI_GCMUL;
+  g->gcminormul = LUAI_GCMINOR;
+  g->gcmajorinc = LUAI_GCMAJOR;
   for (i=0; i < LUA_NUMTAGS; i++) g->mt[i] = NULL;
+  g->stditer[LUA_ITERNEXT] = g->stditer[LUA_ITERIPAIRS] = NULL;
   if (luaD_rawrunprotected(L, f_luaopen, NULL) != LUA_OK) {
     /* memory allocation error: free partial state */
     close_state(L);
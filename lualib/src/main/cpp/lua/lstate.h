@@ -13,6 +13,10 @@
 #include "ltm.h"
 #include "lzio.h"
 
+#if defined(LUAI_VMSTATS)
+#include "lopcodes.h"
+#endif
+
 
 /*
 
@@ -53,12 +57,18 @@ struct lua_longjmp;  /* defined in ldo.c */
 /* kinds of Garbage Collection */
 #define KGC_NORMAL	0
 #define KGC_EMERGENCY	1	/* gc was forced by an allocation failure */
+#define KGC_GEN		2	/* generational collection */
 
 
 typedef struct stringtable {
   TString **hash;
+  unsigned int *tags;  /* hash tag of each slot in 'hash' (0 if empty) */
   int nuse;  /* number of elements */
   int size;
+  TString **old;  /* previous array, while resizing */
+  unsigned int *oldtags;
+  int oldsize;
+  int moved;  /* number of slots of 'old' already moved */
 } stringtable;
 
 
@@ -123,6 +133,10 @@ typedef struct global_State {
   l_mem GCdebt;  /* bytes allocated not yet compensated by the collector */
   lu_mem GCmemtrav;  /* memory traversed by the GC */
   lu_mem GCestimate;  /* an estimate of the non-garbage memory in use */
+  lu_mem GClastmajor;  /* memory in use after last major collection */
+  lu_mem GCcyclework;  /* work done by the GC in the current cycle */
+  lu_mem GClastwork;  /* work done by the GC in the previous cycle */
+  lu_mem GCcycles;  /* number of atomic phases (finished collections) */
   stringtable strt;  /* hash table for strings */
   TValue l_registry;
   unsigned int seed;  /* randomized seed for hashes */
@@ -130,6 +144,10 @@ typedef struct global_State {
   lu_byte gcstate;  /* state of garbage collector */
   lu_byte gckind;  /* kind of GC running */
   lu_byte gcrunning;  /* true if GC is running */
+  lu_byte gcparallel;  /* true while helper threads mark objects */
+  lu_byte bulkclose;  /* true if the allocator frees all blocks at close */
+  lu_byte optimize;  /* true if compiled chunks are optimized (lopt.c) */
+  lu_byte threadsafe;  /* true if helper threads may call the allocator */
   GCObject *allgc;  /* list of all collectable objects */
   GCObject **sweepgc;  /* current position of sweep in list */
   GCObject *finobj;  /* list of collectable objects with finalizers */
@@ -141,16 +159,28 @@ typedef struct global_State {
   GCObject *tobefnz;  /* list of userdata to be GC */
   GCObject *fixedgc;  /* list of objects not to be collected */
   struct lua_State *twups;  /* list of threads with open upvalues */
+  struct FreeQueue *freeq;  /* blocks freed in background (NULL if off) */
+  struct Markers *markers;  /* parallel marking threads (NULL if off) */
+  struct GCStats *gcstats;  /* per-cycle telemetry (NULL if off) */
+  struct AllocSites *allocsites;  /* allocations by site (NULL if off) */
   unsigned int gcfinnum;  /* number of finalizers to call in each GC step */
   int gcpause;  /* size of pause between successive GCs */
   int gcstepmul;  /* GC 'granularity' */
+  int gcminormul;  /* growth (%) between minor (generational) collections */
+  int gcmajorinc;  /* growth (%) that triggers a major collection */
   lua_CFunction panic;  /* to be called in unprotected errors */
   struct lua_State *mainthread;
   const lua_Number *version;  /* pointer to version number */
   TString *memerrmsg;  /* memory-error message */
   TString *tmname[TM_N];  /* array with tag-method names */
   struct Table *mt[LUA_NUMTAGS];  /* metatables for basic types */
+  lua_CFunction stditer[2];  /* iterators run inline by the VM */
   TString *strcache[STRCACHE_N][STRCACHE_M];  /* cache for strings in API */
+#if defined(LUAI_VMSTATS)
+  lu_mem vmops[NUM_OPCODES];  /* executions of each opcode */
+  lu_mem vmpairs[NUM_OPCODES][NUM_OPCODES];  /* opcode after opcode */
+  lu_mem vmslow[LUA_NUMVMSLOW];  /* fallbacks to slow paths */
+#endif
 } global_State;
 
 
@@ -216,6 +246,14 @@ union GCUnion {
 #define gco2th(o)  check_exp((o)->tt == LUA_TTHREAD, &((cast_u(o))->th))
 
 
+/* count a fallback of kind 'k' (LUA_VMSLOW_*) to a slow path */
+#if defined(LUAI_VMSTATS)
+#define luaE_vmslow(L,k)	(G(L)->vmslow[k]++)
+#else
+#define luaE_vmslow(L,k)	((void)0)
+#endif
+
+
 /* macro to convert a Lua object into a GCObject */
 #define obj2gco(v) \
 	check_exp(novariant((v)->tt) < LUA_TDEADKEY, (&(cast_u(v)->gc)))
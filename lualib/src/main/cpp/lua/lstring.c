@@ -10,6 +10,7 @@
 #include "lprefix.h"
 
 
+#include <stdint.h>
 #include <string.h>
 
 #include "lua.h"
@@ -26,12 +27,262 @@
 
 
 /*
-** Lua will use at most ~(2^LUAI_HASHLIMIT) bytes from a string to
-** compute its hash
+** {======================================================
+** Hashing
+** =======================================================
 */
-#if !defined(LUAI_HASHLIMIT)
-#define LUAI_HASHLIMIT		5
-#endif
+
+/*
+** Strings are hashed 8 bytes at a time, from their end to their start
+** (the order used by 'hashpieces' to walk ropes), with a final partial
+** word for the first 'l % 8' bytes. Every byte counts, so long keys
+** that share a prefix and a suffix do not collide as they did when
+** only some bytes were sampled. Each word is mixed as in MurmurHash3
+** and the state starts from the per-state seed, so collisions cannot
+** be predicted without it.
+*/
+
+#define HASHC1		0x87c37b91114253d5ULL
+#define HASHC2		0x4cf5ad432745937fULL
+
+#define rotl64(x,n)	(((x) << (n)) | ((x) >> (64 - (n))))
+
+
+/* read 'n' (up to 8) bytes as a word; 'memcpy' handles alignment */
+static uint64_t loadword (const char *s, size_t n) {
+  uint64_t w = 0;
+  memcpy(&w, s, n);
+  return w;
+}
+
+
+static uint64_t hashword (uint64_t h, uint64_t w) {
+  w *= HASHC1;
+  w = rotl64(w, 31);
+  w *= HASHC2;
+  h ^= w;
+  h = rotl64(h, 27);
+  return h * 5 + 0x52dce729;
+}
+
+
+#define hashstart(seed,l)  \
+	((cast(uint64_t, seed) << 32 | (seed)) ^ (cast(uint64_t, l) * HASHC2))
+
+
+/* final avalanche of all bits, folded to the size of a hash */
+static unsigned int hashfinal (uint64_t h) {
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return cast(unsigned int, h ^ (h >> 32));
+}
+
+
+unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
+  uint64_t h = hashstart(seed, l);
+  size_t n;
+  for (n = l; n >= 8; n -= 8)
+    h = hashword(h, loadword(str + n - 8, 8));
+  if (n > 0)
+    h = hashword(h, loadword(str, n));
+  return hashfinal(h);
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Ropes
+** =======================================================
+*/
+
+/*
+** Pieces of a long string, visited from last to first. A flat string
+** is a single piece; a rope yields its 'right' part and then the pieces
+** of its 'left' part. Walking a rope this way needs no allocation, so
+** it can be done where flattening is not possible (e.g., without a
+** 'lua_State' or during a collection).
+*/
+typedef struct Pieces {
+  TString *rest;  /* part still to be visited */
+  const char *s;  /* current piece */
+  size_t base;  /* position of current piece in the whole string */
+  size_t len;  /* length of current piece */
+} Pieces;
+
+
+static void nextpiece (Pieces *p) {
+  TString *ts = p->rest;
+  size_t end = p->base;  /* current piece ends where previous one starts */
+  if (isflat(ts)) {  /* last piece? */
+    p->s = getstr(ts);
+    p->rest = NULL;
+    p->base = 0;
+  }
+  else {
+    TRope *r = ts2rope(ts);
+    p->s = getstr(r->right);
+    p->rest = r->left;
+    p->base = r->left->u.lnglen;
+  }
+  p->len = end - p->base;
+}
+
+
+static void firstpiece (Pieces *p, TString *ts) {
+  lua_assert(ts->tt == LUA_TLNGSTR);
+  p->rest = ts;
+  p->base = ts->u.lnglen;
+  nextpiece(p);
+}
+
+
+/*
+** copy the bytes of a long string (that may be an unflattened rope)
+** to 'buff'
+*/
+void luaS_copyrope (TString *ts, char *buff) {
+  Pieces p;
+  firstpiece(&p, ts);
+  for (;;) {
+    memcpy(buff + p.base, p.s, p.len * sizeof(char));
+    if (p.rest == NULL) break;
+    nextpiece(&p);
+  }
+}
+
+
+/*
+** Build the contents of a rope. Both parts are released, so that
+** intermediate ropes from a chain of concatenations can be collected.
+*/
+char *luaS_flatten (lua_State *L, TString *ts) {
+  TRope *r = ts2rope(ts);
+  if (r->contents == NULL) {
+    size_t l = ts->u.lnglen;
+    char *buff = luaM_newvector(L, l + 1, char);
+    luaS_copyrope(ts, buff);
+    buff[l] = '\0';  /* ending 0 */
+    r->contents = buff;
+    r->left = r->right = NULL;
+  }
+  return r->contents;
+}
+
+
+/*
+** creates a rope for the concatenation of 'left' (a long string) and
+** 'right' (a flat string); no bytes are copied
+*/
+TString *luaS_newrope (lua_State *L, TString *left, TString *right) {
+  GCObject *o = luaC_newobj(L, LUA_TLNGSTR, sizeof(TRope));
+  TRope *r = cast(TRope *, gco2ts(o));
+  TString *ts = &r->tsv;
+  lua_assert(left->tt == LUA_TLNGSTR && isflat(right));
+  ts->hash = G(L)->seed;
+  ts->extra = LSTRROPE;
+  ts->u.lnglen = left->u.lnglen + tsslen(right);
+  r->left = left;
+  r->right = right;
+  r->contents = NULL;
+  return ts;
+}
+
+
+/*
+** equality for long strings where at least one is an unflattened rope;
+** compares pieces from the end, where strings being built usually differ
+*/
+static int eqpieces (TString *a, TString *b) {
+  Pieces pa, pb;
+  size_t la, lb;  /* bytes not yet compared in current pieces */
+  firstpiece(&pa, a);
+  firstpiece(&pb, b);
+  la = pa.len; lb = pb.len;
+  for (;;) {
+    size_t n = (la < lb) ? la : lb;
+    if (memcmp(pa.s + la - n, pb.s + lb - n, n * sizeof(char)) != 0)
+      return 0;
+    la -= n; lb -= n;
+    if (la == 0) {
+      if (pa.rest == NULL) return 1;  /* (same length, so 'b' is done too) */
+      nextpiece(&pa); la = pa.len;
+    }
+    if (lb == 0) {
+      nextpiece(&pb); lb = pb.len;
+    }
+  }
+}
+
+
+/*
+** copy bytes 'pos' to 'pos + n - 1' of the string walked by 'p' into
+** 'buff'; successive calls must ask for decreasing positions
+*/
+static void getbytes (Pieces *p, char *buff, size_t pos, size_t n) {
+  while (n > 0) {
+    size_t e = pos + n;  /* end of the bytes still missing */
+    size_t k;
+    while (e <= p->base)  /* they end before current piece? */
+      nextpiece(p);
+    k = e - p->base;  /* bytes of current piece before 'e' */
+    if (k > n) k = n;
+    memcpy(buff + n - k, p->s + (e - k - p->base), k * sizeof(char));
+    n -= k;
+  }
+}
+
+
+/*
+** same as 'luaS_hash', for a long string that may be a rope
+*/
+static unsigned int hashpieces (TString *ts, unsigned int seed) {
+  size_t l = ts->u.lnglen;
+  uint64_t h = hashstart(seed, l);
+  char buff[8];
+  size_t n;
+  Pieces p;
+  firstpiece(&p, ts);
+  for (n = l; n >= 8; n -= 8) {
+    getbytes(&p, buff, n - 8, 8);
+    h = hashword(h, loadword(buff, 8));
+  }
+  if (n > 0) {
+    getbytes(&p, buff, 0, n);
+    h = hashword(h, loadword(buff, n));
+  }
+  return hashfinal(h);
+}
+
+
+/*
+** Check whether character 'c' occurs in a string before its first
+** zero, as 'strchr' does for a flat string.
+*/
+int luaS_strchr (TString *ts, int c) {
+  if (isflat(ts))
+    return (strchr(getstr(ts), c) != NULL);
+  else {
+    size_t posc = MAX_SIZE, pos0 = MAX_SIZE;  /* first occurrences */
+    Pieces p;
+    firstpiece(&p, ts);
+    for (;;) {  /* earlier pieces override later ones */
+      const char *q = cast(const char *, memchr(p.s, c, p.len));
+      if (q) posc = p.base + (q - p.s);
+      q = cast(const char *, memchr(p.s, '\0', p.len));
+      if (q) pos0 = p.base + (q - p.s);
+      if (p.rest == NULL) break;
+      nextpiece(&p);
+    }
+    return (posc < pos0);
+  }
+}
+
+/* }====================================================== */
 
 
 /*
@@ -42,59 +293,212 @@ int luaS_eqlngstr (TString *a, TString *b) {
   lua_assert(a->tt == LUA_TLNGSTR && b->tt == LUA_TLNGSTR);
   return (a == b) ||  /* same instance or... */
     ((len == b->u.lnglen) &&  /* equal length and ... */
-     (memcmp(getstr(a), getstr(b), len) == 0));  /* equal contents */
-}
-
-
-unsigned int luaS_hash (const char *str, size_t l, unsigned int seed) {
-  unsigned int h = seed ^ cast(unsigned int, l);
-  size_t step = (l >> LUAI_HASHLIMIT) + 1;
-  for (; l >= step; l -= step)
-    h ^= ((h<<5) + (h>>2) + cast_byte(str[l - 1]));
-  return h;
+     ((isflat(a) && isflat(b))
+       ? (memcmp(getstr(a), getstr(b), len) == 0)  /* equal contents */
+       : eqpieces(a, b)));
 }
 
 
 unsigned int luaS_hashlongstr (TString *ts) {
   lua_assert(ts->tt == LUA_TLNGSTR);
-  if (ts->extra == 0) {  /* no hash? */
-    ts->hash = luaS_hash(getstr(ts), ts->u.lnglen, ts->hash);
-    ts->extra = 1;  /* now it has its hash */
+  if (!(ts->extra & LSTRHASH)) {  /* no hash? */
+    ts->hash = isflat(ts) ? luaS_hash(getstr(ts), ts->u.lnglen, ts->hash)
+                          : hashpieces(ts, ts->hash);
+    ts->extra |= LSTRHASH;  /* now it has its hash */
   }
   return ts->hash;
 }
 
 
 /*
-** resizes the string table
+** {======================================================
+** String table
+** =======================================================
+*/
+
+/*
+** The string table uses open addressing with linear probing, with at
+** most 3/4 of its slots in use. Each slot has a hash tag (the hash with
+** its highest bit set, so that 0 marks empty slots) kept in a separate
+** array, so that probes read only the tags. Removals shift the following
+** elements of a cluster back, so that a lookup stops at the first empty
+** slot. Resizing is incremental: 'luaS_resize' only allocates the new
+** array, and each call to 'internshrstr' moves a part of the previous
+** array ('old') to it, so that no single call rehashes the whole table.
+** The parts grow with 'old', so that a resize ends within
+** LUAI_STRMOVECALLS interns and slows down only the few that follow
+** it. Until it is freed, 'old' is also searched; its slots that were
+** moved or removed become tombstones (TOMB), keeping its clusters
+** searchable. (Strings whose initial position in 'old' was
+** already passed need not be searched there.) The collector shrinks the
+** table in place with 'luaS_shrink', as it cannot allocate a new array.
+*/
+
+/* empty slots passed at least in each step of a resize */
+#if !defined(LUAI_STRMOVESTEP)
+#define LUAI_STRMOVESTEP	16
+#endif
+
+/* a resize is completed in at most this many interns */
+#if !defined(LUAI_STRMOVECALLS)
+#define LUAI_STRMOVECALLS	1024
+#endif
+
+static char tombmark;
+#define TOMB		cast(TString *, &tombmark)
+
+#define strtag(h)	((h) | ~(~0u >> 1))
+
+/* maximum number of elements in an array with 'size' slots */
+#define maxload(size)	((size) - (size) / 4)
+
+
+static TString *findslot (TString **a, unsigned int *tags, int size,
+                          const char *str, size_t l, unsigned int tag) {
+  int i = lmod(tag, size);
+  for (; tags[i] != 0; i = (i + 1) & (size - 1)) {
+    TString *ts = a[i];
+    if (tags[i] == tag && ts != TOMB && ts->shrlen == l &&
+        memcmp(str, getstr(ts), l * sizeof(char)) == 0)
+      return ts;
+  }
+  return NULL;
+}
+
+
+static void insertslot (TString **a, unsigned int *tags, int size,
+                        TString *ts, unsigned int tag) {
+  int i = lmod(tag, size);
+  while (tags[i] != 0)  /* find first empty slot of the cluster */
+    i = (i + 1) & (size - 1);
+  a[i] = ts;
+  tags[i] = tag;
+}
+
+
+/*
+** empty slot 'i', moving back the following elements of its cluster
+** that may be there (those whose initial position is not between 'i'
+** and their current one)
+*/
+static void removeslot (TString **a, unsigned int *tags, int size, int i) {
+  int mask = size - 1;
+  int j = i;
+  for (;;) {
+    j = (j + 1) & mask;
+    if (tags[j] == 0) break;  /* end of cluster */
+    else if (((j - lmod(tags[j], size)) & mask) >= ((j - i) & mask)) {
+      a[i] = a[j];  /* element at 'j' can be found at 'i' */
+      tags[i] = tags[j];
+      i = j;
+    }
+  }
+  tags[i] = 0;
+}
+
+
+/*
+** move at least 'n' slots of the old array to the current one, stopping
+** after an empty slot; free the old array after all its slots are moved.
+** As clusters do not cross empty slots, all strings whose initial
+** position in 'old' is before 'moved' are then in the current array.
+*/
+static void movestrings (lua_State *L, stringtable *tb, int n) {
+  while (tb->moved < tb->oldsize) {
+    int i = tb->moved++;
+    if (tb->oldtags[i] == 0) {  /* empty slot? */
+      if (--n <= 0) break;  /* end of a cluster; can stop here */
+    }
+    else if (tb->old[i] != TOMB) {
+      insertslot(tb->hash, tb->tags, tb->size, tb->old[i], tb->oldtags[i]);
+      tb->old[i] = TOMB;  /* empty slots stay empty, ending searches */
+    }
+  }
+  if (tb->moved == tb->oldsize) {  /* done? */
+    luaM_freemem(L, tb->old, sizestrtab(tb->oldsize));
+    tb->old = NULL;
+    tb->oldtags = NULL;
+    tb->oldsize = tb->moved = 0;
+  }
+}
+
+
+/*
+** empty slots to pass in each step of a resize: a resize starts when
+** 1/4 of the slots of 'old' are empty, so that it is done in about
+** LUAI_STRMOVECALLS steps
+*/
+static int movestep (stringtable *tb) {
+  int n = tb->oldsize / (4 * LUAI_STRMOVECALLS);
+  return (n > LUAI_STRMOVESTEP) ? n : LUAI_STRMOVESTEP;
+}
+
+
+/*
+** Starts resizing the string table. (A previous resize is completed
+** first.) Its elements are moved to the new array by later insertions.
+** Only the tags of the new array need to be cleared.
 */
 void luaS_resize (lua_State *L, int newsize) {
-  int i;
   stringtable *tb = &G(L)->strt;
-  if (newsize > tb->size) {  /* grow table if needed */
-    luaM_reallocvector(L, tb->hash, tb->size, newsize, TString *);
-    for (i = tb->size; i < newsize; i++)
-      tb->hash[i] = NULL;
-  }
-  for (i = 0; i < tb->size; i++) {  /* rehash */
-    TString *p = tb->hash[i];
-    tb->hash[i] = NULL;
-    while (p) {  /* for each node in the list */
-      TString *hnext = p->u.hnext;  /* save next */
-      unsigned int h = lmod(p->hash, newsize);  /* new position */
-      p->u.hnext = tb->hash[h];  /* chain it */
-      tb->hash[h] = p;
-      p = hnext;
-    }
+  TString **a;
+  if (tb->old != NULL)  /* still resizing? */
+    movestrings(L, tb, tb->oldsize);  /* finish it */
+  lua_assert(tb->nuse <= maxload(newsize));
+  a = cast(TString **, luaM_malloc(L, sizestrtab(newsize)));
+  if (tb->size > 0) {  /* there are elements to move? */
+    tb->old = tb->hash;
+    tb->oldtags = tb->tags;
+    tb->oldsize = tb->size;
+    tb->moved = 0;
   }
-  if (newsize < tb->size) {  /* shrink table if needed */
-    /* vanishing slice should be empty */
-    lua_assert(tb->hash[newsize] == NULL && tb->hash[tb->size - 1] == NULL);
-    luaM_reallocvector(L, tb->hash, tb->size, newsize, TString *);
+  tb->hash = a;
+  tb->tags = cast(unsigned int *, a + newsize);  /* tags follow strings */
+  memset(tb->tags, 0, newsize * sizeof(unsigned int));
+  tb->size = newsize;
+}
+
+
+/*
+** Shrinks the string table in place, without allocating, to the smallest
+** size at least 1/4 full: the strings and their tags are packed in parts
+** of the block not used by the smaller array, and then inserted in it.
+** (A pending resize is completed first, so that the previous array is
+** freed.) The table must be less than 1/4 full.
+*/
+void luaS_shrink (lua_State *L) {
+  stringtable *tb = &G(L)->strt;
+  int size = tb->size;
+  int newsize = size / 2;
+  unsigned int *newtags;
+  TString **strs;
+  int i, n = 0;
+  lua_assert(tb->nuse < size / 4);
+  if (tb->old != NULL)  /* still resizing? */
+    movestrings(L, tb, tb->oldsize);  /* finish it */
+  while (newsize > MINSTRTABSIZE && tb->nuse < newsize / 4)
+    newsize /= 2;
+  for (i = 0; i < size; i++) {  /* pack elements at the start */
+    if (tb->tags[i] != 0) {
+      tb->hash[n] = tb->hash[i];
+      tb->tags[n++] = tb->tags[i];
+    }
   }
+  lua_assert(n == tb->nuse);
+  newtags = cast(unsigned int *, tb->hash + newsize);
+  strs = tb->hash + newsize + newsize / 2;  /* after the new tags */
+  memmove(strs, tb->hash, n * sizeof(TString *));
+  memset(newtags, 0, newsize * sizeof(unsigned int));
+  for (i = 0; i < n; i++)  /* (tags are still at the old place) */
+    insertslot(tb->hash, newtags, newsize, strs[i], tb->tags[i]);
+  tb->hash = cast(TString **, luaM_realloc_(L, tb->hash, sizestrtab(size),
+                                                         sizestrtab(newsize)));
+  tb->tags = cast(unsigned int *, tb->hash + newsize);
   tb->size = newsize;
 }
 
+/* }====================================================== */
+
 
 /*
 ** Clear API string cache. (Entries cannot be empty, so fill them with
@@ -110,6 +514,25 @@ void luaS_clearcache (global_State *g) {
 }
 
 
+/*
+** Call 'f' for each string in the string table (both arrays while it
+** is being resized).
+*/
+void luaS_foreach (global_State *g, void (*f) (void *ud, TString *ts),
+                   void *ud) {
+  stringtable *tb = &g->strt;
+  int i;
+  for (i = 0; i < tb->size; i++) {
+    if (tb->tags[i] != 0)
+      f(ud, tb->hash[i]);
+  }
+  for (i = 0; tb->old != NULL && i < tb->oldsize; i++) {
+    if (tb->oldtags[i] != 0 && tb->old[i] != TOMB)
+      f(ud, tb->old[i]);
+  }
+}
+
+
 /*
 ** Initialize the string table and the string cache
 */
@@ -153,11 +576,23 @@ TString *luaS_createlngstrobj (lua_State *L, size_t l) {
 
 void luaS_remove (lua_State *L, TString *ts) {
   stringtable *tb = &G(L)->strt;
-  TString **p = &tb->hash[lmod(ts->hash, tb->size)];
-  while (*p != ts)  /* find previous element */
-    p = &(*p)->u.hnext;
-  *p = (*p)->u.hnext;  /* remove element from its list */
+  unsigned int tag = strtag(ts->hash);
+  int i = lmod(tag, tb->size);
   tb->nuse--;
+  for (; tb->tags[i] != 0; i = (i + 1) & (tb->size - 1)) {
+    if (tb->hash[i] == ts) {
+      removeslot(tb->hash, tb->tags, tb->size, i);
+      return;
+    }
+  }
+  /* not in the current array; it must be in the old one */
+  lua_assert(tb->old != NULL);
+  i = lmod(tag, tb->oldsize);
+  while (tb->old[i] != ts) {
+    lua_assert(tb->oldtags[i] != 0);
+    i = (i + 1) & (tb->oldsize - 1);
+  }
+  tb->old[i] = TOMB;
 }
 
 
@@ -167,28 +602,27 @@ void luaS_remove (lua_State *L, TString *ts) {
 static TString *internshrstr (lua_State *L, const char *str, size_t l) {
   TString *ts;
   global_State *g = G(L);
+  stringtable *tb = &g->strt;
   unsigned int h = luaS_hash(str, l, g->seed);
-  TString **list = &g->strt.hash[lmod(h, g->strt.size)];
   lua_assert(str != NULL);  /* otherwise 'memcmp'/'memcpy' are undefined */
-  for (ts = *list; ts != NULL; ts = ts->u.hnext) {
-    if (l == ts->shrlen &&
-        (memcmp(str, getstr(ts), l * sizeof(char)) == 0)) {
-      /* found! */
-      if (isdead(g, ts))  /* dead (but not collected yet)? */
-        changewhite(ts);  /* resurrect it */
-      return ts;
-    }
-  }
-  if (g->strt.nuse >= g->strt.size && g->strt.size <= MAX_INT/2) {
-    luaS_resize(L, g->strt.size * 2);
-    list = &g->strt.hash[lmod(h, g->strt.size)];  /* recompute with new size */
+  if (tb->old != NULL)  /* resizing? */
+    movestrings(L, tb, movestep(tb));  /* do a part of it */
+  ts = findslot(tb->hash, tb->tags, tb->size, str, l, strtag(h));
+  if (ts == NULL && tb->old != NULL &&
+      lmod(strtag(h), tb->oldsize) >= tb->moved)  /* may be in 'old'? */
+    ts = findslot(tb->old, tb->oldtags, tb->oldsize, str, l, strtag(h));
+  if (ts != NULL) {  /* found? */
+    if (isdead(g, ts))  /* dead (but not collected yet)? */
+      changewhite(ts);  /* resurrect it */
+    return ts;
   }
+  if (tb->nuse >= maxload(tb->size) && tb->size <= MAX_INT/2)
+    luaS_resize(L, tb->size * 2);
   ts = createstrobj(L, l, LUA_TSHRSTR, h);
   memcpy(getstr(ts), str, l * sizeof(char));
   ts->shrlen = cast_byte(l);
-  ts->u.hnext = *list;
-  *list = ts;
-  g->strt.nuse++;
+  insertslot(tb->hash, tb->tags, tb->size, ts, strtag(h));
+  tb->nuse++;
   return ts;
 }
 
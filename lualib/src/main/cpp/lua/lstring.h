@@ -14,6 +14,16 @@
 
 #define sizelstring(l)  (sizeof(union UTString) + ((l) + 1) * sizeof(char))
 
+#define sizerope(ts)  \
+	(sizeof(TRope) + (isflat(ts) ? ((ts)->u.lnglen + 1) * sizeof(char) : 0))
+
+/* size of a long string object (plain or rope) */
+#define sizelngstr(ts)  \
+	(isrope(ts) ? sizerope(ts) : sizelstring((ts)->u.lnglen))
+
+/* size of the block with 'n' slots (strings and tags) of string table */
+#define sizestrtab(n)	((n) * (sizeof(TString *) + sizeof(unsigned int)))
+
 #define sizeludata(l)	(sizeof(union UUdata) + (l))
 #define sizeudata(u)	sizeludata((u)->len)
 
@@ -33,17 +43,30 @@
 #define eqshrstr(a,b)	check_exp((a)->tt == LUA_TSHRSTR, (a) == (b))
 
 
+/*
+** get the bytes of a string, flattening it first if it is a rope
+*/
+#define luaS_contents(L,ts)	(isflat(ts) ? getstr(ts) : luaS_flatten(L, ts))
+
+
 LUAI_FUNC unsigned int luaS_hash (const char *str, size_t l, unsigned int seed);
 LUAI_FUNC unsigned int luaS_hashlongstr (TString *ts);
 LUAI_FUNC int luaS_eqlngstr (TString *a, TString *b);
 LUAI_FUNC void luaS_resize (lua_State *L, int newsize);
+LUAI_FUNC void luaS_shrink (lua_State *L);
 LUAI_FUNC void luaS_clearcache (global_State *g);
+LUAI_FUNC void luaS_foreach (global_State *g,
+                           void (*f) (void *ud, TString *ts), void *ud);
 LUAI_FUNC void luaS_init (lua_State *L);
 LUAI_FUNC void luaS_remove (lua_State *L, TString *ts);
 LUAI_FUNC Udata *luaS_newudata (lua_State *L, size_t s);
 LUAI_FUNC TString *luaS_newlstr (lua_State *L, const char *str, size_t l);
 LUAI_FUNC TString *luaS_new (lua_State *L, const char *str);
 LUAI_FUNC TString *luaS_createlngstrobj (lua_State *L, size_t l);
+LUAI_FUNC TString *luaS_newrope (lua_State *L, TString *left, TString *right);
+LUAI_FUNC char *luaS_flatten (lua_State *L, TString *ts);
+LUAI_FUNC void luaS_copyrope (TString *ts, char *buff);
+LUAI_FUNC int luaS_strchr (TString *ts, int c);
 
 
 #endif
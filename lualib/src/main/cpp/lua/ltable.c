@@ -21,9 +21,12 @@
 ** in its main position (i.e. the 'original' position that its hash gives
 ** to it), then the colliding element is in its own main position.
 ** Hence even when the load factor reaches 100%, performance remains good.
+** When LUAI_SWISSTABLE is defined, the hash part uses open addressing
+** with groups of control bytes instead (see 'Open-addressing hash part').
 */
 
 #include <math.h>
+#include <string.h>
 #include <limits.h>
 
 #include "lua.h"
@@ -55,6 +58,8 @@
 #define MAXHBITS	(MAXABITS - 1)
 
 
+#if !defined(LUAI_SWISSTABLE)
+
 #define hashpow2(t,n)		(gnode(t, lmod((n), sizenode(t))))
 
 #define hashstr(t,str)		hashpow2(t, (str)->hash)
@@ -71,6 +76,8 @@
 
 #define hashpointer(t,p)	hashmod(t, point2uint(p))
 
+#endif
+
 
 #define dummynode		(&dummynode_)
 
@@ -110,6 +117,225 @@ static int l_hashfloat (lua_Number n) {
 #endif
 
 
+#if defined(LUAI_SWISSTABLE)
+/*
+** {=============================================================
+** Open-addressing hash part
+** ==============================================================
+*/
+
+/*
+** Besides its nodes, the hash part keeps one control byte per node:
+** CTRL_EMPTY for a free node or 7 bits of the key's hash for a used
+** one. A lookup compares a whole group of control bytes at once (using
+** SSE2 or NEON when available) and only visits the nodes whose control
+** byte matches; an unsuccessful lookup stops at the first group with a
+** free node. Groups can start at any node; when the hash part is larger
+** than a group, its first GROUPSIZE control bytes are repeated after
+** the last one, so that a group never wraps around. Smaller hash parts
+** are a single group, padded with CTRL_PAD bytes. Groups are probed in
+** a triangular sequence, which visits all nodes.
+** As in the chained version, keys are never removed: a key whose value
+** becomes nil keeps its node until the next rehash ('next' relies on
+** that). The load is kept under 7/8 to keep probe sequences short.
+*/
+
+#include <stdint.h>
+
+#define CTRL_EMPTY	0x80
+#define CTRL_PAD	0xFF
+
+#if defined(__SSE2__) || defined(_M_X64)
+
+#include <emmintrin.h>
+
+#define GROUPSIZE	16
+#define MASKSHIFT	0	/* one bit per control byte */
+
+typedef unsigned int GroupMask;
+
+static GroupMask matchbyte (const lu_byte *g, lu_byte b) {
+  __m128i ctrl = _mm_loadu_si128(cast(const __m128i *, g));
+  __m128i eq = _mm_cmpeq_epi8(ctrl, _mm_set1_epi8(cast(char, b)));
+  return cast(GroupMask, _mm_movemask_epi8(eq));
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+#include <arm_neon.h>
+
+#define GROUPSIZE	8
+#define MASKSHIFT	3	/* one bit (the highest) per byte */
+
+typedef uint64_t GroupMask;
+
+static GroupMask matchbyte (const lu_byte *g, lu_byte b) {
+  uint8x8_t eq = vceq_u8(vld1_u8(g), vdup_n_u8(b));
+  return vget_lane_u64(vreinterpret_u64_u8(eq), 0) & 0x8080808080808080ULL;
+}
+
+#else
+
+#define GROUPSIZE	8
+#define MASKSHIFT	3	/* one bit (the highest) per byte */
+
+typedef uint64_t GroupMask;
+
+/* compare the 8 bytes of a group at once, inside a 64-bit word */
+static GroupMask matchbyte (const lu_byte *g, lu_byte b) {
+  const GroupMask low7 = 0x7F7F7F7F7F7F7F7FULL;
+  GroupMask w = 0;
+  int i;
+  for (i = GROUPSIZE - 1; i >= 0; i--)  /* byte 'i' goes to bits 8i-8i+7 */
+    w = (w << 8) | g[i];
+  w ^= 0x0101010101010101ULL * b;  /* bytes equal to 'b' become 0 */
+  return ~(((w & low7) + low7) | w | low7);  /* high bit of 0 bytes */
+}
+
+#endif
+
+
+/* index in the group of the first control byte matched in 'm' */
+static int firstmatch (GroupMask m) {
+  int i = 0;
+  lua_assert(m != 0);
+#if defined(__GNUC__)
+  i = __builtin_ctzll(m);
+#else
+  while (!(m & 1)) { m >>= 1; i++; }
+#endif
+  return i >> MASKSHIFT;
+}
+
+
+/*
+** Mix the bits of a hash, as hashes of integers and pointers keep
+** most of their information in a few bits. (It is the finalizer of
+** MurmurHash3.) The result gives the first node of the probe sequence
+** (H1) and the control byte for the key (H2).
+*/
+static unsigned int mixhash (unsigned int h) {
+  h ^= h >> 16;
+  h *= 0x85ebca6bu;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35u;
+  h ^= h >> 16;
+  return h;
+}
+
+#define H1(h)		((h) >> 7)
+#define H2(h)		cast_byte((h) & 0x7F)
+
+#define hashinteger(i)	mixhash(cast(unsigned int, l_castS2U(i) ^ \
+                          (l_castS2U(i) >> (sizeof(lua_Integer) * 4))))
+
+
+static unsigned int hashkey (const TValue *key) {
+  switch (ttype(key)) {
+    case LUA_TNUMINT:
+      return hashinteger(ivalue(key));
+    case LUA_TNUMFLT:
+      return mixhash(cast(unsigned int, l_hashfloat(fltvalue(key))));
+    case LUA_TSHRSTR:
+      return mixhash(tsvalue(key)->hash);
+    case LUA_TLNGSTR:
+      return mixhash(luaS_hashlongstr(tsvalue(key)));
+    case LUA_TBOOLEAN:
+      return mixhash(cast(unsigned int, bvalue(key)));
+    case LUA_TLIGHTUSERDATA:
+      return mixhash(point2uint(pvalue(key)));
+    case LUA_TLCF:
+      return mixhash(point2uint(fvalue(key)));
+    default:
+      lua_assert(!ttisdeadkey(key));
+      return mixhash(point2uint(gcvalue(key)));
+  }
+}
+
+
+/* first node probed for hash 'h' */
+#define probestart(t,h) \
+	(sizenode(t) <= GROUPSIZE ? 0 : H1(h) & (sizenode(t) - 1))
+
+/* size of the block with 'size' nodes plus their control bytes */
+#define sizehashpart(size) \
+	((size) * sizeof(Node) + ((size) + GROUPSIZE) * sizeof(lu_byte))
+
+
+static void setctrl (Table *t, unsigned int i, lu_byte c) {
+  unsigned int size = sizenode(t);
+  t->ctrl[i] = c;
+  if (size > GROUPSIZE && i < GROUPSIZE)
+    t->ctrl[size + i] = c;  /* keep the copy after the last node */
+}
+
+
+/*
+** Search the hash part of 't' for a node with hash 'h' whose key
+** satisfies 'eqk' (an expression on 'n'); 'n' ends with that node or
+** with NULL when there is none.
+*/
+#define searchnode(t,h,n,eqk) {  \
+  unsigned int mask_ = sizenode(t) - 1;  \
+  unsigned int pos_ = probestart(t, h), step_ = 0;  \
+  n = NULL;  \
+  if (!isdummy(t)) for (;;) {  \
+    const lu_byte *g_ = (t)->ctrl + pos_;  \
+    GroupMask m_;  \
+    for (m_ = matchbyte(g_, H2(h)); m_ != 0; m_ &= m_ - 1) {  \
+      n = gnode(t, (pos_ + firstmatch(m_)) & mask_);  \
+      if (eqk) break;  \
+      n = NULL;  \
+    }  \
+    if (n != NULL || matchbyte(g_, CTRL_EMPTY) != 0) break;  \
+    step_ += GROUPSIZE;  \
+    if (step_ > mask_) break;  /* visited all nodes */  \
+    pos_ = (pos_ + step_) & mask_;  \
+  } }
+
+
+/* mark all nodes of the hash part of 't' as free */
+static void resetctrl (Table *t) {
+  unsigned int size = sizenode(t);
+  memset(t->ctrl, CTRL_EMPTY, size);
+  memset(t->ctrl + size, (size > GROUPSIZE) ? CTRL_EMPTY : CTRL_PAD,
+         GROUPSIZE);
+  t->hfree = (size > GROUPSIZE) ? size - size / 8 : size;
+}
+
+
+/*
+** Take a free node for a new key with hash 'h' (in the first group of
+** its probe sequence with a free node); return NULL if the hash part
+** is as full as allowed.
+*/
+static Node *getfreenode (Table *t, unsigned int h) {
+  if (t->hfree > 0) {  /* (so there is at least one free node) */
+    unsigned int mask = sizenode(t) - 1;
+    unsigned int pos = probestart(t, h), step = 0;
+    for (;;) {
+      GroupMask m = matchbyte(t->ctrl + pos, CTRL_EMPTY);
+      if (m != 0) {
+        unsigned int i = (pos + firstmatch(m)) & mask;
+        setctrl(t, i, H2(h));
+        t->hfree--;
+        return gnode(t, i);
+      }
+      step += GROUPSIZE;
+      lua_assert(step <= mask);
+      pos = (pos + step) & mask;
+    }
+  }
+  return NULL;
+}
+
+/* }============================================================= */
+
+#endif
+
+
+#if !defined(LUAI_SWISSTABLE)
+
 /*
 ** returns the 'main' position of an element in a table (that is, the index
 ** of its hash value)
@@ -136,6 +362,8 @@ static Node *mainposition (const Table *t, const TValue *key) {
   }
 }
 
+#endif
+
 
 /*
 ** returns the index for 'key' if 'key' is an appropriate key to live in
@@ -151,10 +379,25 @@ static unsigned int arrayindex (const TValue *key) {
 }
 
 
+/*
+** Error for a key 'next' cannot continue from. It carries no position,
+** as when raised by the 'next' function itself: an inline loop step
+** ('forstdstep' in lvm.c) also gets here, but from a Lua frame.
+*/
+static l_noret invalidkey (lua_State *L) {
+  luaO_pushfstring(L, "invalid key to 'next'");
+  luaG_errormsg(L);
+}
+
+
 /*
 ** returns the index of a 'key' for table traversals. First goes all
 ** elements in the array part, then elements in the hash part. The
-** beginning of a traversal is signaled by 0.
+** beginning of a traversal is signaled by 0. 'nexthint' keeps the
+** index of the last hash key returned by 'luaH_next', so that a
+** traversal resumes from it without searching for the key. (A key
+** occupies a single node, so the hint is right whenever the node
+** there still holds 'key', even after a rehash.)
 */
 static unsigned int findindex (lua_State *L, Table *t, StkId key) {
   unsigned int i;
@@ -162,6 +405,11 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
   i = arrayindex(key);
   if (i != 0 && i <= t->sizearray)  /* is 'key' inside array part? */
     return i;  /* yes; that's the index */
+  i = t->nexthint - t->sizearray;  /* hinted position in hash part */
+  if (t->nexthint > t->sizearray && i <= cast(unsigned int, sizenode(t)) &&
+      luaV_rawequalobj(gkey(gnode(t, i - 1)), key))
+    return t->nexthint;  /* traversal continues from last key */
+#if !defined(LUAI_SWISSTABLE)
   else {
     int nx;
     Node *n = mainposition(t, key);
@@ -176,10 +424,25 @@ static unsigned int findindex (lua_State *L, Table *t, StkId key) {
       }
       nx = gnext(n);
       if (nx == 0)
-        luaG_runerror(L, "invalid key to 'next'");  /* key not found */
+        invalidkey(L);  /* key not found */
       else n += nx;
     }
   }
+#else
+  else {
+    Node *n;
+    unsigned int h = hashkey(key);
+    /* key may be dead already, but it is ok to use it in 'next' */
+    searchnode(t, h, n, luaV_rawequalobj(gkey(n), key) ||
+                        (ttisdeadkey(gkey(n)) && iscollectable(key) &&
+                         deadvalue(gkey(n)) == gcvalue(key)));
+    if (n == NULL)
+      invalidkey(L);  /* key not found */
+    i = cast_int(n - gnode(t, 0));  /* key index in hash table */
+    /* hash elements are numbered after array ones */
+    return (i + 1) + t->sizearray;
+  }
+#endif
 }
 
 
@@ -196,6 +459,7 @@ int luaH_next (lua_State *L, Table *t, StkId key) {
     if (!ttisnil(gval(gnode(t, i)))) {  /* a non-nil value? */
       setobj2s(L, key, gkey(gnode(t, i)));
       setobj2s(L, key+1, gval(gnode(t, i)));
+      t->nexthint = (i + 1) + t->sizearray;  /* resume here next time */
       return 1;
     }
   }
@@ -305,6 +569,8 @@ static void setarrayvector (lua_State *L, Table *t, unsigned int size) {
 }
 
 
+#if !defined(LUAI_SWISSTABLE)
+
 static void setnodevector (lua_State *L, Table *t, unsigned int size) {
   if (size == 0) {  /* no elements to hash part? */
     t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
@@ -317,7 +583,7 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
     if (lsize > MAXHBITS)
       luaG_runerror(L, "table overflow");
     size = twoto(lsize);
-    t->node = luaM_newvector(L, size, Node);
+    t->node = cast(Node *, luaM_newobject(L, LUA_KNODES, size * sizeof(Node)));
     for (i = 0; i < (int)size; i++) {
       Node *n = gnode(t, i);
       gnext(n) = 0;
@@ -330,6 +596,45 @@ static void setnodevector (lua_State *L, Table *t, unsigned int size) {
 }
 
 
+#define freenodevector(L,n,size)	luaM_freearray(L, n, cast(size_t, size))
+
+#else
+
+static void setnodevector (lua_State *L, Table *t, unsigned int size) {
+  if (size == 0) {  /* no elements to hash part? */
+    t->node = cast(Node *, dummynode);  /* use common 'dummynode' */
+    t->lsizenode = 0;
+    t->ctrl = NULL;  /* signal that it is using dummy node */
+    t->hfree = 0;
+  }
+  else {
+    int i;
+    int lsize;
+    if (size > GROUPSIZE)  /* not a single group? */
+      size += (size + 6) / 7;  /* add room to keep maximum load */
+    lsize = luaO_ceillog2(size);
+    if (lsize > MAXHBITS)
+      luaG_runerror(L, "table overflow");
+    size = twoto(lsize);
+    t->node = cast(Node *, luaM_newobject(L, LUA_KNODES, sizehashpart(size)));
+    t->ctrl = cast(lu_byte *, t->node + size);  /* control bytes follow */
+    for (i = 0; i < (int)size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = 0;
+      setnilvalue(wgkey(n));
+      setnilvalue(gval(n));
+    }
+    t->lsizenode = cast_byte(lsize);
+    resetctrl(t);
+  }
+}
+
+
+#define freenodevector(L,n,size)	luaM_freemem(L, n, sizehashpart(size))
+
+#endif
+
+
 void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                           unsigned int nhsize) {
   unsigned int i;
@@ -361,7 +666,7 @@ void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
     }
   }
   if (oldhsize > 0)  /* not the dummy node? */
-    luaM_freearray(L, nold, cast(size_t, oldhsize)); /* free old hash */
+    freenodevector(L, nold, oldhsize);  /* free old hash */
 }
 
 
@@ -406,6 +711,8 @@ Table *luaH_new (lua_State *L) {
   t->flags = cast_byte(~0);
   t->array = NULL;
   t->sizearray = 0;
+  t->lenhint = 0;
+  t->nexthint = 0;
   setnodevector(L, t, 0);
   return t;
 }
@@ -413,12 +720,40 @@ Table *luaH_new (lua_State *L) {
 
 void luaH_free (lua_State *L, Table *t) {
   if (!isdummy(t))
-    luaM_freearray(L, t->node, cast(size_t, sizenode(t)));
+    freenodevector(L, t->node, sizenode(t));
   luaM_freearray(L, t->array, t->sizearray);
   luaM_free(L, t);
 }
 
 
+/*
+** Remove all entries of 't' but keep the sizes of its parts (and its
+** metatable), so that it can be refilled without any reallocation.
+*/
+void luaH_clear (Table *t) {
+  unsigned int i;
+  for (i = 0; i < t->sizearray; i++)
+    setnilvalue(&t->array[i]);
+  t->lenhint = 0;
+  if (!isdummy(t)) {
+    unsigned int size = sizenode(t);
+    for (i = 0; i < size; i++) {
+      Node *n = gnode(t, i);
+      gnext(n) = 0;
+      setnilvalue(wgkey(n));
+      setnilvalue(gval(n));
+    }
+#if !defined(LUAI_SWISSTABLE)
+    t->lastfree = gnode(t, size);  /* all positions are free */
+#else
+    resetctrl(t);
+#endif
+  }
+}
+
+
+#if !defined(LUAI_SWISSTABLE)
+
 static Node *getfreepos (Table *t) {
   if (!isdummy(t)) {
     while (t->lastfree > t->node) {
@@ -430,6 +765,8 @@ static Node *getfreepos (Table *t) {
   return NULL;  /* could not find a free place */
 }
 
+#endif
+
 
 
 /*
@@ -445,13 +782,23 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
   if (ttisnil(key)) luaG_runerror(L, "table index is nil");
   else if (ttisfloat(key)) {
     lua_Integer k;
-    if (luaV_tointeger(key, &k, 0)) {  /* does index fit in an integer? */
+    if (luaV_tointeger(L, key, &k, 0)) {  /* does index fit in an integer? */
       setivalue(&aux, k);
       key = &aux;  /* insert it as an integer */
     }
     else if (luai_numisnan(fltvalue(key)))
       luaG_runerror(L, "table index is NaN");
   }
+  else if (ttislngstring(key) && !isflat(tsvalue(key)))
+    luaS_flatten(L, tsvalue(key));  /* keys are stored flat */
+#if defined(LUAI_SWISSTABLE)
+  mp = getfreenode(t, hashkey(key));
+  if (mp == NULL) {  /* hash part is full? */
+    rehash(L, t, key);  /* grow table */
+    /* whatever called 'newkey' takes care of TM cache */
+    return luaH_set(L, t, key);  /* insert key into grown table */
+  }
+#else
   mp = mainposition(t, key);
   if (!ttisnil(gval(mp)) || isdummy(t)) {  /* main position is taken? */
     Node *othern;
@@ -484,6 +831,7 @@ TValue *luaH_newkey (lua_State *L, Table *t, const TValue *key) {
       mp = f;
     }
   }
+#endif
   setnodekey(L, &mp->i_key, key);
   luaC_barrierback(L, t, key);
   lua_assert(ttisnil(gval(mp)));
@@ -499,6 +847,7 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
   if (l_castS2U(key) - 1 < t->sizearray)
     return &t->array[key - 1];
   else {
+#if !defined(LUAI_SWISSTABLE)
     Node *n = hashint(t, key);
     for (;;) {  /* check whether 'key' is somewhere in the chain */
       if (ttisinteger(gkey(n)) && ivalue(gkey(n)) == key)
@@ -510,6 +859,12 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
       }
     }
     return luaO_nilobject;
+#else
+    Node *n;
+    unsigned int h = hashinteger(key);
+    searchnode(t, h, n, ttisinteger(gkey(n)) && ivalue(gkey(n)) == key);
+    return (n != NULL) ? gval(n) : luaO_nilobject;
+#endif
   }
 }
 
@@ -518,6 +873,7 @@ const TValue *luaH_getint (Table *t, lua_Integer key) {
 ** search function for short strings
 */
 const TValue *luaH_getshortstr (Table *t, TString *key) {
+#if !defined(LUAI_SWISSTABLE)
   Node *n = hashstr(t, key);
   lua_assert(key->tt == LUA_TSHRSTR);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
@@ -531,6 +887,14 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
       n += nx;
     }
   }
+#else
+  Node *n;
+  unsigned int h = mixhash(key->hash);
+  lua_assert(key->tt == LUA_TSHRSTR);
+  searchnode(t, h, n, ttisshrstring(gkey(n)) &&
+                      eqshrstr(tsvalue(gkey(n)), key));
+  return (n != NULL) ? gval(n) : luaO_nilobject;
+#endif
 }
 
 
@@ -539,6 +903,7 @@ const TValue *luaH_getshortstr (Table *t, TString *key) {
 ** which may be in array part, nor for floats with integral values.)
 */
 static const TValue *getgeneric (Table *t, const TValue *key) {
+#if !defined(LUAI_SWISSTABLE)
   Node *n = mainposition(t, key);
   for (;;) {  /* check whether 'key' is somewhere in the chain */
     if (luaV_rawequalobj(gkey(n), key))
@@ -550,6 +915,12 @@ static const TValue *getgeneric (Table *t, const TValue *key) {
       n += nx;
     }
   }
+#else
+  Node *n;
+  unsigned int h = hashkey(key);
+  searchnode(t, h, n, luaV_rawequalobj(gkey(n), key));
+  return (n != NULL) ? gval(n) : luaO_nilobject;
+#endif
 }
 
 
@@ -574,7 +945,7 @@ const TValue *luaH_get (Table *t, const TValue *key) {
     case LUA_TNIL: return luaO_nilobject;
     case LUA_TNUMFLT: {
       lua_Integer k;
-      if (luaV_tointeger(key, &k, 0)) /* index is int? */
+      if (luaV_tointeger(NULL, key, &k, 0)) /* index is int? */
         return luaH_getint(t, k);  /* use specialized version */
       /* else... */
     }  /* FALLTHROUGH */
@@ -634,11 +1005,14 @@ static int unbound_search (Table *t, unsigned int j) {
 }
 
 
-/*
-** Try to find a boundary in table 't'. A 'boundary' is an integer index
-** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
-*/
-int luaH_getn (Table *t) {
+/* check whether 'j' is a boundary in table 't' */
+static int isboundary (Table *t, unsigned int j) {
+  return (j == 0 || !ttisnil(luaH_getint(t, j))) &&
+         ttisnil(luaH_getint(t, cast(lua_Integer, j) + 1));
+}
+
+
+static unsigned int findboundary (Table *t) {
   unsigned int j = t->sizearray;
   if (j > 0 && ttisnil(&t->array[j - 1])) {
     /* there is a boundary in the array part: (binary) search for it */
@@ -653,7 +1027,36 @@ int luaH_getn (Table *t) {
   /* else must find a boundary in hash part */
   else if (isdummy(t))  /* hash part is empty? */
     return j;  /* that is easy... */
-  else return unbound_search(t, j);
+  else {
+    unsigned int h = t->lenhint;  /* start from old boundary, if present */
+    if (h > j && h <= cast(unsigned int, MAX_INT)/2 &&
+        !ttisnil(luaH_getint(t, h)))
+      j = h;
+    return unbound_search(t, j);
+  }
+}
+
+
+/*
+** Try to find a boundary in table 't'. A 'boundary' is an integer index
+** such that t[i] is non-nil and t[i+1] is nil (and 0 if t[1] is nil).
+** The last boundary found is kept in 'lenhint' and checked first,
+** together with its neighbors, so that the length of a table used as
+** a stack ('t[#t + 1] = v', 't[#t] = nil') is found in constant time,
+** both in the array part and after it spills into the hash part.
+*/
+int luaH_getn (Table *t) {
+  unsigned int j = t->lenhint;
+  if (!isboundary(t, j)) {
+    if (j < cast(unsigned int, MAX_INT) && isboundary(t, j + 1))
+      j++;  /* an element was pushed */
+    else if (j > 0 && isboundary(t, j - 1))
+      j--;  /* an element was popped */
+    else
+      j = findboundary(t);
+    t->lenhint = j;
+  }
+  return cast_int(j);
 }
 
 
@@ -661,7 +1064,11 @@ int luaH_getn (Table *t) {
 #if defined(LUA_DEBUG)
 
 Node *luaH_mainposition (const Table *t, const TValue *key) {
+#if !defined(LUAI_SWISSTABLE)
   return mainposition(t, key);
+#else
+  return gnode(t, probestart(t, hashkey(key)));
+#endif
 }
 
 int luaH_isdummy (const Table *t) { return isdummy(t); }
@@ -28,7 +28,11 @@
 
 
 /* true when 't' is using 'dummynode' as its hash part */
+#if !defined(LUAI_SWISSTABLE)
 #define isdummy(t)		((t)->lastfree == NULL)
+#else
+#define isdummy(t)		((t)->ctrl == NULL)
+#endif
 
 
 /* allocated size for hash nodes */
@@ -53,6 +57,7 @@ LUAI_FUNC void luaH_resize (lua_State *L, Table *t, unsigned int nasize,
                                                     unsigned int nhsize);
 LUAI_FUNC void luaH_resizearray (lua_State *L, Table *t, unsigned int nasize);
 LUAI_FUNC void luaH_free (lua_State *L, Table *t);
+LUAI_FUNC void luaH_clear (Table *t);
 LUAI_FUNC int luaH_next (lua_State *L, Table *t, StkId key);
 LUAI_FUNC int luaH_getn (Table *t);
 
@@ -157,6 +157,31 @@ static int tmove (lua_State *L) {
 }
 
 
+/*
+** Create a table with preallocated space for 'narr' array elements and
+** 'nrec' other fields, avoiding the rehashes needed to grow it.
+*/
+static int tnew (lua_State *L) {
+  lua_Integer narr = luaL_optinteger(L, 1, 0);
+  lua_Integer nrec = luaL_optinteger(L, 2, 0);
+  luaL_argcheck(L, 0 <= narr && narr <= INT_MAX, 1, "out of range");
+  luaL_argcheck(L, 0 <= nrec && nrec <= INT_MAX, 2, "out of range");
+  lua_createtable(L, (int)narr, (int)nrec);
+  return 1;
+}
+
+
+/*
+** Remove all elements of a table, keeping its allocated space so that
+** it can be refilled without allocations.
+*/
+static int tclear (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+  lua_cleartable(L, 1);
+  return 0;
+}
+
+
 static void addfield (lua_State *L, luaL_Buffer *b, lua_Integer i) {
   lua_geti(L, 1, i);
   if (!lua_isstring(L, -1))
@@ -424,6 +449,8 @@ static int sort (lua_State *L) {
 
 
 static const luaL_Reg tab_funcs[] = {
+  {"new", tnew},
+  {"clear", tclear},
   {"concat", tconcat},
 #if defined(LUA_COMPAT_MAXN)
   {"maxn", maxn},
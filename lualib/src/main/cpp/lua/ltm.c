@@ -93,7 +93,7 @@ const char *luaT_objtypename (lua_State *L, const TValue *o) {
       (ttisfulluserdata(o) && (mt = uvalue(o)->metatable) != NULL)) {
     const TValue *name = luaH_getshortstr(mt, luaS_new(L, "__name"));
     if (ttisstring(name))  /* is '__name' a string? */
-      return getstr(tsvalue(name));  /* use it as type name */
+      return luaS_contents(L, tsvalue(name));  /* use it as type name */
   }
   return ttypename(ttnov(o));  /* else use standard type name */
 }
@@ -134,6 +134,7 @@ int luaT_callbinTM (lua_State *L, const TValue *p1, const TValue *p2,
 
 void luaT_trybinTM (lua_State *L, const TValue *p1, const TValue *p2,
                     StkId res, TMS event) {
+  luaE_vmslow(L, LUA_VMSLOW_BINTM);
   if (!luaT_callbinTM(L, p1, p2, res, event)) {
     switch (event) {
       case TM_CONCAT:
@@ -142,7 +143,7 @@ void luaT_trybinTM (lua_State *L, const TValue *p1, const TValue *p2,
       case TM_BAND: case TM_BOR: case TM_BXOR:
       case TM_SHL: case TM_SHR: case TM_BNOT: {
         lua_Number dummy;
-        if (tonumber(p1, &dummy) && tonumber(p2, &dummy))
+        if (tonumber(L, p1, &dummy) && tonumber(L, p2, &dummy))
           luaG_tointerror(L, p1, p2);
         else
           luaG_opinterror(L, p1, p2, "perform bitwise operation on");
@@ -157,6 +158,7 @@ void luaT_trybinTM (lua_State *L, const TValue *p1, const TValue *p2,
 
 int luaT_callorderTM (lua_State *L, const TValue *p1, const TValue *p2,
                       TMS event) {
+  luaE_vmslow(L, LUA_VMSLOW_ORDERTM);
   if (!luaT_callbinTM(L, p1, p2, L->top, event))
     return -1;  /* no metamethod */
   else
@@ -74,6 +74,16 @@ typedef struct lua_State lua_State;
 #define LUA_NUMTAGS		9
 
 
+/*
+** kinds of blocks (other than objects) given as 'osize' to the allocation
+** function when they are created
+*/
+#define LUA_KNODES		16	/* hash part of a table */
+#define LUA_KUPVAL		17	/* upvalue */
+#define LUA_KCALLINFO		18	/* call information */
+#define LUA_KSTACK		19	/* stack of a thread */
+
+
 
 /* minimum Lua stack available to a C function */
 #define LUA_MINSTACK	20
@@ -247,6 +257,7 @@ LUA_API int (lua_rawgeti) (lua_State *L, int idx, lua_Integer n);
 LUA_API int (lua_rawgetp) (lua_State *L, int idx, const void *p);
 
 LUA_API void  (lua_createtable) (lua_State *L, int narr, int nrec);
+LUA_API void  (lua_cleartable) (lua_State *L, int idx);
 LUA_API void *(lua_newuserdata) (lua_State *L, size_t sz);
 LUA_API int   (lua_getmetatable) (lua_State *L, int objindex);
 LUA_API int  (lua_getuservalue) (lua_State *L, int idx);
@@ -307,10 +318,59 @@ LUA_API int (lua_isyieldable) (lua_State *L);
 #define LUA_GCSTEP		5
 #define LUA_GCSETPAUSE		6
 #define LUA_GCSETSTEPMUL	7
+#define LUA_GCSETMAJORINC	8
 #define LUA_GCISRUNNING		9
+#define LUA_GCGEN		10
+#define LUA_GCINC		11
+#define LUA_GCSTEPTIME		12
+#define LUA_GCBGFREE		13
+#define LUA_GCPARMARK		14
+#define LUA_GCBULKCLOSE		15
+#define LUA_GCCYCLES		16
+#define LUA_GCSTATS		17
+#define LUA_GCALLOCSITES	18
+#define LUA_GCOPTIMIZE		19
+#define LUA_GCTHREADSAFE	20
 
 LUA_API int (lua_gc) (lua_State *L, int what, int data);
 
+/*
+** Telemetry of a finished collection cycle, kept after
+** lua_gc(L, LUA_GCSTATS, 1). Times are in nanoseconds of a monotonic
+** clock; phase times count only the collector's own work, not the time
+** the program runs between steps.
+*/
+typedef struct lua_GCCycle {
+  lua_Integer start;  /* time of the first step of the cycle */
+  lua_Integer end;  /* time when the cycle finished */
+  lua_Integer propagate;  /* time spent marking */
+  lua_Integer atomic;  /* time spent in the atomic phase */
+  lua_Integer sweep;  /* time spent sweeping */
+  lua_Integer finalizers;  /* time spent calling finalizers (__gc) */
+  lua_Integer maxstep;  /* longest single step (a pause of the program) */
+  lua_Integer before;  /* bytes in use when the cycle started */
+  lua_Integer after;  /* bytes in use when the cycle finished */
+  lua_Integer freed[LUA_NUMTAGS];  /* objects freed, per basic type */
+  int kind;  /* 0 incremental, 1 emergency, 2 generational */
+} lua_GCCycle;
+
+LUA_API int (lua_gccycle) (lua_State *L, int n, lua_GCCycle *c);
+
+/*
+** Allocation site, kept after lua_gc(L, LUA_GCALLOCSITES, 1): the
+** allocations (new blocks and growth of blocks) made while a line of Lua
+** code ran, including those of the C functions it called.
+*/
+typedef struct lua_AllocSite {
+  char source[LUA_IDSIZE];  /* chunk, as 'short_src'; "[C]" outside Lua */
+  int line;  /* line running the allocations (-1 if unknown) */
+  int linedefined;  /* line where its function is defined */
+  lua_Integer count;  /* number of allocations */
+  lua_Integer bytes;  /* bytes allocated */
+} lua_AllocSite;
+
+LUA_API int (lua_allocsites) (lua_State *L, lua_AllocSite *sites, int n);
+
 
 /*
 ** miscellaneous functions
@@ -320,6 +380,35 @@ LUA_API int   (lua_error) (lua_State *L);
 
 LUA_API int   (lua_next) (lua_State *L, int idx);
 
+/* standard iterators that the VM may run inline in generic 'for' loops */
+#define LUA_ITERNEXT		0
+#define LUA_ITERIPAIRS		1
+
+LUA_API void  (lua_setiterator) (lua_State *L, int what, lua_CFunction f);
+
+/*
+** VM execution counters, kept only when the core is built with
+** LUAI_VMSTATS (otherwise 'lua_vmstat' returns -1)
+*/
+#define LUA_VMOPCODES		0	/* executions of opcode 'a' */
+#define LUA_VMPAIRS		1	/* executions of opcode 'b' after 'a' */
+#define LUA_VMSLOWPATHS		2	/* fallbacks of kind 'a' */
+#define LUA_VMRESET		3	/* clears all counters */
+
+/* kinds of fallbacks to slow paths */
+#define LUA_VMSLOW_FINISHGET	0	/* indexing missed ('luaV_finishget') */
+#define LUA_VMSLOW_FINISHSET	1	/* assignment missed ('luaV_finishset') */
+#define LUA_VMSLOW_BINTM	2	/* arithmetic/bitwise/concat metamethod */
+#define LUA_VMSLOW_ORDERTM	3	/* '__lt'/'__le' metamethod */
+#define LUA_VMSLOW_EQTM		4	/* '__eq' metamethod */
+#define LUA_VMSLOW_CALLTM	5	/* '__call' metamethod */
+#define LUA_VMSLOW_STR2NUM	6	/* string coerced to a number */
+#define LUA_VMSLOW_NUM2STR	7	/* number coerced to a string */
+#define LUA_NUMVMSLOW		8
+
+LUA_API lua_Integer (lua_vmstat) (lua_State *L, int what, int a, int b);
+LUA_API const char *(lua_vmname) (int what, int a);
+
 LUA_API void  (lua_concat) (lua_State *L, int n);
 LUA_API void  (lua_len)    (lua_State *L, int idx);
 
@@ -438,6 +527,47 @@ LUA_API int (lua_gethookmask) (lua_State *L);
 LUA_API int (lua_gethookcount) (lua_State *L);
 
 
+/*
+** Heap walk: 'lua_heapwalk' calls the walker once for each collectable
+** object (LUA_HEAPOBJECT) and once for each reference between objects
+** (LUA_HEAPREF); references from the roots (registry, main thread,
+** metatables of basic types, fixed objects, objects being finalized)
+** have 'p' NULL and their 'name' (or, for metatables, the type in
+** 'index'). The walker must not call the Lua API on the state.
+*/
+#define LUA_HEAPOBJECT	0
+#define LUA_HEAPREF	1
+
+/* object types besides the basic ones */
+#define LUA_HEAPPROTO	LUA_NUMTAGS	/* function prototype */
+#define LUA_HEAPSTRTAB	(LUA_NUMTAGS+1)	/* the string table (not an object) */
+
+/* kinds of references */
+#define LUA_HEAPFIELD	0	/* table field with string key 'name' */
+#define LUA_HEAPINDEX	1	/* table field with integer key 'index' */
+#define LUA_HEAPVALUE	2	/* table field with any other key */
+#define LUA_HEAPKEY	3	/* table key */
+#define LUA_HEAPMETA	4	/* metatable */
+#define LUA_HEAPUPVAL	5	/* upvalue 'index' (named 'name') */
+#define LUA_HEAPINTERNAL	6	/* stack slots, constants, others */
+#define LUA_HEAPWEAK	8	/* flag: reference does not keep 'q' alive */
+
+typedef struct lua_HeapItem {
+  int what;  /* LUA_HEAPOBJECT or LUA_HEAPREF */
+  int type;  /* object type (LUA_T*, LUA_HEAP*) or kind of reference */
+  const void *p;  /* object, or origin of the reference */
+  const void *q;  /* target of the reference */
+  size_t size;  /* bytes used by the object */
+  const char *name;  /* string contents, function source, field name */
+  size_t len;  /* length of 'name' */
+  lua_Integer index;  /* integer key, upvalue, stack slot, line defined */
+} lua_HeapItem;
+
+typedef void (*lua_HeapWalker) (void *ud, const lua_HeapItem *item);
+
+LUA_API void (lua_heapwalk) (lua_State *L, lua_HeapWalker f, void *ud);
+
+
 struct lua_Debug {
   int event;
   const char *name;	/* (n) */
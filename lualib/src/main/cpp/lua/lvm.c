@@ -65,18 +65,34 @@
 
 
 
+/*
+** Try to convert a string to a number, putting the result in 'v'. 'L'
+** is needed only to flatten ropes, so it can be NULL when 'obj' is
+** known not to be a string.
+*/
+static int l_strton (lua_State *L, const TValue *obj, TValue *v) {
+  if (!cvt2num(obj))  /* is object not a string? */
+    return 0;
+  else {
+    TString *ts = tsvalue(obj);
+    lua_assert(L != NULL);
+    luaE_vmslow(L, LUA_VMSLOW_STR2NUM);
+    return (luaO_str2num(luaS_contents(L, ts), v) == tsslen(ts) + 1);
+  }
+}
+
+
 /*
 ** Try to convert a value to a float. The float case is already handled
 ** by the macro 'tonumber'.
 */
-int luaV_tonumber_ (const TValue *obj, lua_Number *n) {
+int luaV_tonumber_ (lua_State *L, const TValue *obj, lua_Number *n) {
   TValue v;
   if (ttisinteger(obj)) {
     *n = cast_num(ivalue(obj));
     return 1;
   }
-  else if (cvt2num(obj) &&  /* string convertible to number? */
-            luaO_str2num(svalue(obj), &v) == vslen(obj) + 1) {
+  else if (l_strton(L, obj, &v)) {  /* string convertible to number? */
     *n = nvalue(&v);  /* convert result of 'luaO_str2num' to a float */
     return 1;
   }
@@ -91,7 +107,8 @@ int luaV_tonumber_ (const TValue *obj, lua_Number *n) {
 ** mode == 1: takes the floor of the number
 ** mode == 2: takes the ceil of the number
 */
-int luaV_tointeger (const TValue *obj, lua_Integer *p, int mode) {
+int luaV_tointeger (lua_State *L, const TValue *obj, lua_Integer *p,
+                    int mode) {
   TValue v;
  again:
   if (ttisfloat(obj)) {
@@ -108,8 +125,7 @@ int luaV_tointeger (const TValue *obj, lua_Integer *p, int mode) {
     *p = ivalue(obj);
     return 1;
   }
-  else if (cvt2num(obj) &&
-            luaO_str2num(svalue(obj), &v) == vslen(obj) + 1) {
+  else if (l_strton(L, obj, &v)) {
     obj = &v;
     goto again;  /* convert result from 'luaO_str2num' to an integer */
   }
@@ -132,12 +148,12 @@ int luaV_tointeger (const TValue *obj, lua_Integer *p, int mode) {
 ** the extreme case when the initial value is LUA_MININTEGER, in which
 ** case the LUA_MININTEGER limit would still run the loop once.
 */
-static int forlimit (const TValue *obj, lua_Integer *p, lua_Integer step,
-                     int *stopnow) {
+static int forlimit (lua_State *L, const TValue *obj, lua_Integer *p,
+                     lua_Integer step, int *stopnow) {
   *stopnow = 0;  /* usually, let loops run */
-  if (!luaV_tointeger(obj, p, (step < 0 ? 2 : 1))) {  /* not fit in integer? */
+  if (!luaV_tointeger(L, obj, p, (step < 0 ? 2 : 1))) {  /* not fit in integer? */
     lua_Number n;  /* try to convert to float */
-    if (!tonumber(obj, &n)) /* cannot convert to float? */
+    if (!tonumber(L, obj, &n)) /* cannot convert to float? */
       return 0;  /* not a number */
     if (luai_numlt(0, n)) {  /* if true, float is larger than max integer */
       *p = LUA_MAXINTEGER;
@@ -161,6 +177,7 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
                       const TValue *slot) {
   int loop;  /* counter to avoid infinite loops */
   const TValue *tm;  /* metamethod */
+  luaE_vmslow(L, LUA_VMSLOW_FINISHGET);
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     if (slot == NULL) {  /* 't' is not a table? */
       lua_assert(!ttistable(t));
@@ -203,6 +220,7 @@ void luaV_finishget (lua_State *L, const TValue *t, TValue *key, StkId val,
 void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
                      StkId val, const TValue *slot) {
   int loop;  /* counter to avoid infinite loops */
+  luaE_vmslow(L, LUA_VMSLOW_FINISHSET);
   for (loop = 0; loop < MAXTAGLOOP; loop++) {
     const TValue *tm;  /* '__newindex' metamethod */
     if (slot != NULL) {  /* is 't' a table? */
@@ -245,10 +263,10 @@ void luaV_finishset (lua_State *L, const TValue *t, TValue *key,
 ** and it uses 'strcoll' (to respect locales) for each segments
 ** of the strings.
 */
-static int l_strcmp (const TString *ls, const TString *rs) {
-  const char *l = getstr(ls);
+static int l_strcmp (lua_State *L, TString *ls, TString *rs) {
+  const char *l = luaS_contents(L, ls);
   size_t ll = tsslen(ls);
-  const char *r = getstr(rs);
+  const char *r = luaS_contents(L, rs);
   size_t lr = tsslen(rs);
   for (;;) {  /* for each segment */
     int temp = strcoll(l, r);
@@ -366,7 +384,7 @@ int luaV_lessthan (lua_State *L, const TValue *l, const TValue *r) {
   if (ttisnumber(l) && ttisnumber(r))  /* both operands are numbers? */
     return LTnum(l, r);
   else if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) < 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) < 0;
   else if ((res = luaT_callorderTM(L, l, r, TM_LT)) < 0)  /* no metamethod? */
     luaG_ordererror(L, l, r);  /* error */
   return res;
@@ -386,7 +404,7 @@ int luaV_lessequal (lua_State *L, const TValue *l, const TValue *r) {
   if (ttisnumber(l) && ttisnumber(r))  /* both operands are numbers? */
     return LEnum(l, r);
   else if (ttisstring(l) && ttisstring(r))  /* both are strings? */
-    return l_strcmp(tsvalue(l), tsvalue(r)) <= 0;
+    return l_strcmp(L, tsvalue(l), tsvalue(r)) <= 0;
   else if ((res = luaT_callorderTM(L, l, r, TM_LE)) >= 0)  /* try 'le' */
     return res;
   else {  /* try 'lt': */
@@ -411,7 +429,7 @@ int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2) {
       return 0;  /* only numbers can be equal with different variants */
     else {  /* two numbers with different variants */
       lua_Integer i1, i2;  /* compare them as integers */
-      return (tointeger(t1, &i1) && tointeger(t2, &i2) && i1 == i2);
+      return (tointeger(L, t1, &i1) && tointeger(L, t2, &i2) && i1 == i2);
     }
   }
   /* values have same type and same variant */
@@ -445,6 +463,7 @@ int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2) {
   }
   if (tm == NULL)  /* no TM? */
     return 0;  /* objects are different */
+  luaE_vmslow(L, LUA_VMSLOW_EQTM);
   luaT_callTM(L, tm, t1, t2, L->top, 1);  /* call TM */
   return !l_isfalse(L->top);
 }
@@ -452,7 +471,8 @@ int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2) {
 
 /* macro used by 'luaV_concat' to ensure that element at 'o' is a string */
 #define tostring(L,o)  \
-	(ttisstring(o) || (cvt2str(o) && (luaO_tostring(L, o), 1)))
+	(ttisstring(o) || (cvt2str(o) && \
+	  (luaE_vmslow(L, LUA_VMSLOW_NUM2STR), luaO_tostring(L, o), 1)))
 
 #define isemptystr(o)	(ttisshrstring(o) && tsvalue(o)->shrlen == 0)
 
@@ -460,16 +480,41 @@ int luaV_equalobj (lua_State *L, const TValue *t1, const TValue *t2) {
 static void copy2buff (StkId top, int n, char *buff) {
   size_t tl = 0;  /* size already copied */
   do {
-    size_t l = vslen(top - n);  /* length of string being copied */
-    memcpy(buff + tl, svalue(top - n), l * sizeof(char));
+    TString *ts = tsvalue(top - n);
+    size_t l = tsslen(ts);  /* length of string being copied */
+    if (isflat(ts))
+      memcpy(buff + tl, getstr(ts), l * sizeof(char));
+    else  /* copy pieces of rope */
+      luaS_copyrope(ts, buff + tl);
     tl += l;
   } while (--n > 0);
 }
 
 
+/*
+** create a string with the contents of the 'n' strings in stack from
+** 'top - n' up to 'top - 1'; 'tl' is their total length
+*/
+static TString *joinstrs (lua_State *L, StkId top, int n, size_t tl) {
+  if (tl <= LUAI_MAXSHORTLEN) {  /* is result a short string? */
+    char buff[LUAI_MAXSHORTLEN];
+    copy2buff(top, n, buff);  /* copy strings to buffer */
+    return luaS_newlstr(L, buff, tl);
+  }
+  else {  /* long string; copy strings directly to final result */
+    TString *ts = luaS_createlngstrobj(L, tl);
+    copy2buff(top, n, getstr(ts));
+    return ts;
+  }
+}
+
+
 /*
 ** Main operation for concatenation: concat 'total' values in the stack,
-** from 'L->top - total' up to 'L->top - 1'.
+** from 'L->top - total' up to 'L->top - 1'. When the first string is
+** long and the result is large enough, the result is a rope that keeps
+** that string instead of copying it, so that loops like 's = s .. x'
+** do not copy 's' over and over.
 */
 void luaV_concat (lua_State *L, int total) {
   lua_assert(total >= 2);
@@ -494,15 +539,16 @@ void luaV_concat (lua_State *L, int total) {
           luaG_runerror(L, "string length overflow");
         tl += l;
       }
-      if (tl <= LUAI_MAXSHORTLEN) {  /* is result a short string? */
-        char buff[LUAI_MAXSHORTLEN];
-        copy2buff(top, n, buff);  /* copy strings to buffer */
-        ts = luaS_newlstr(L, buff, tl);
-      }
-      else {  /* long string; copy strings directly to final result */
-        ts = luaS_createlngstrobj(L, tl);
-        copy2buff(top, n, getstr(ts));
+      if (tl >= LUAI_MINROPELEN && ttislngstring(top - n)) {
+        TString *right = tsvalue(top - 1);
+        if (n > 2 || !isflat(right)) {  /* join the other strings */
+          right = joinstrs(L, top, n - 1, tl - vslen(top - n));
+          setsvalue2s(L, top - n + 1, right);  /* anchor it */
+        }
+        ts = luaS_newrope(L, tsvalue(top - n), right);
       }
+      else
+        ts = joinstrs(L, top, n, tl);
       setsvalue2s(L, top - n, ts);  /* create result */
     }
     total -= n-1;  /* got 'n' strings to create 1 new */
@@ -713,6 +759,44 @@ void luaV_finishOp (lua_State *L) {
 
 
 
+/*
+** Try to do one step of a generic 'for' loop whose iterator is the
+** standard 'next' or 'ipairs' iterator over a table without calling it:
+** put the 'nres' results in the call base, as the call would. Return 0
+** when the call is needed (other iterators, metamethods, call hooks).
+*/
+static int forstdstep (lua_State *L, StkId ra, int nres) {
+  lua_CFunction f = fvalue(ra);
+  Table *h = hvalue(ra + 1);
+  StkId cb = ra + 3;  /* call base */
+  int nset = 1;  /* number of results set */
+  if (L->hookmask & (LUA_MASKCALL | LUA_MASKRET))
+    return 0;  /* hooks must see the call */
+  else if (f == G(L)->stditer[LUA_ITERNEXT]) {
+    setobjs2s(L, cb, ra + 2);  /* previous key */
+    if (!luaH_next(L, h, cb))  /* no more elements? */
+      setnilvalue(cb);
+    else nset = 2;  /* key and value */
+  }
+  else if (f == G(L)->stditer[LUA_ITERIPAIRS] && ttisinteger(ra + 2)) {
+    lua_Integer n = intop(+, ivalue(ra + 2), 1);
+    const TValue *v = luaH_getint(h, n);
+    if (!ttisnil(v)) {
+      setivalue(cb, n);
+      setobj2s(L, cb + 1, v);
+      nset = 2;  /* index and value */
+    }
+    else if (fasttm(L, h->metatable, TM_INDEX) != NULL)
+      return 0;  /* absent value may come from '__index' */
+    else setnilvalue(cb);
+  }
+  else return 0;
+  for (; nset < nres; nset++)  /* complete missing results */
+    setnilvalue(cb + nset);
+  return 1;
+}
+
+
 /*
 ** {==================================================================
 ** Function 'luaV_execute': main interpreter loop
@@ -752,9 +836,27 @@ void luaV_finishOp (lua_State *L) {
            luai_threadyield(L); }
 
 
+/*
+** count executions of each dispatched opcode and of each pair of
+** consecutive ones ('vmprev' is the previous opcode, -1 at entry); the
+** jumps run by 'donextjump' are not dispatched and so not counted
+*/
+#if defined(LUAI_VMSTATS)
+#define vmcount(i)	{ \
+  int op_ = GET_OPCODE(i); \
+  G(L)->vmops[op_]++; \
+  if (vmprev >= 0) G(L)->vmpairs[vmprev][op_]++; \
+  vmprev = op_; \
+}
+#else
+#define vmcount(i)	((void)0)
+#endif
+
+
 /* fetch an instruction and prepare its execution */
 #define vmfetch()	{ \
   i = *(ci->u.l.savedpc++); \
+  vmcount(i); \
   if (L->hookmask & (LUA_MASKLINE | LUA_MASKCOUNT)) \
     Protect(luaG_traceexec(L)); \
   ra = RA(i); /* WARNING: any stack reallocation invalidates 'ra' */ \
@@ -788,6 +890,9 @@ void luaV_execute (lua_State *L) {
   LClosure *cl;
   TValue *k;
   StkId base;
+#if defined(LUAI_VMSTATS)
+  int vmprev = -1;  /* previous opcode, for 'vmcount' */
+#endif
   ci->callstatus |= CIST_FRESH;  /* fresh invocation of 'luaV_execute" */
  newframe:  /* reentry point when frame changes (call/return) */
   lua_assert(ci == L->ci);
@@ -894,7 +999,7 @@ void luaV_execute (lua_State *L) {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
           setivalue(ra, intop(+, ib, ic));
         }
-        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
+        else if (tonumber(L, rb, &nb) && tonumber(L, rc, &nc)) {
           setfltvalue(ra, luai_numadd(L, nb, nc));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_ADD)); }
@@ -908,7 +1013,7 @@ void luaV_execute (lua_State *L) {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
           setivalue(ra, intop(-, ib, ic));
         }
-        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
+        else if (tonumber(L, rb, &nb) && tonumber(L, rc, &nc)) {
           setfltvalue(ra, luai_numsub(L, nb, nc));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_SUB)); }
@@ -922,7 +1027,7 @@ void luaV_execute (lua_State *L) {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
           setivalue(ra, intop(*, ib, ic));
         }
-        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
+        else if (tonumber(L, rb, &nb) && tonumber(L, rc, &nc)) {
           setfltvalue(ra, luai_nummul(L, nb, nc));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_MUL)); }
@@ -932,7 +1037,7 @@ void luaV_execute (lua_State *L) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         lua_Number nb; lua_Number nc;
-        if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
+        if (tonumber(L, rb, &nb) && tonumber(L, rc, &nc)) {
           setfltvalue(ra, luai_numdiv(L, nb, nc));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_DIV)); }
@@ -942,7 +1047,7 @@ void luaV_execute (lua_State *L) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         lua_Integer ib; lua_Integer ic;
-        if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
+        if (tointeger(L, rb, &ib) && tointeger(L, rc, &ic)) {
           setivalue(ra, intop(&, ib, ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_BAND)); }
@@ -952,7 +1057,7 @@ void luaV_execute (lua_State *L) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         lua_Integer ib; lua_Integer ic;
-        if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
+        if (tointeger(L, rb, &ib) && tointeger(L, rc, &ic)) {
           setivalue(ra, intop(|, ib, ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_BOR)); }
@@ -962,7 +1067,7 @@ void luaV_execute (lua_State *L) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         lua_Integer ib; lua_Integer ic;
-        if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
+        if (tointeger(L, rb, &ib) && tointeger(L, rc, &ic)) {
           setivalue(ra, intop(^, ib, ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_BXOR)); }
@@ -972,7 +1077,7 @@ void luaV_execute (lua_State *L) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         lua_Integer ib; lua_Integer ic;
-        if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
+        if (tointeger(L, rb, &ib) && tointeger(L, rc, &ic)) {
           setivalue(ra, luaV_shiftl(ib, ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_SHL)); }
@@ -982,7 +1087,7 @@ void luaV_execute (lua_State *L) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         lua_Integer ib; lua_Integer ic;
-        if (tointeger(rb, &ib) && tointeger(rc, &ic)) {
+        if (tointeger(L, rb, &ib) && tointeger(L, rc, &ic)) {
           setivalue(ra, luaV_shiftl(ib, -ic));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_SHR)); }
@@ -996,7 +1101,7 @@ void luaV_execute (lua_State *L) {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
           setivalue(ra, luaV_mod(L, ib, ic));
         }
-        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
+        else if (tonumber(L, rb, &nb) && tonumber(L, rc, &nc)) {
           lua_Number m;
           luai_nummod(L, nb, nc, m);
           setfltvalue(ra, m);
@@ -1012,7 +1117,7 @@ void luaV_execute (lua_State *L) {
           lua_Integer ib = ivalue(rb); lua_Integer ic = ivalue(rc);
           setivalue(ra, luaV_div(L, ib, ic));
         }
-        else if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
+        else if (tonumber(L, rb, &nb) && tonumber(L, rc, &nc)) {
           setfltvalue(ra, luai_numidiv(L, nb, nc));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_IDIV)); }
@@ -1022,7 +1127,7 @@ void luaV_execute (lua_State *L) {
         TValue *rb = RKB(i);
         TValue *rc = RKC(i);
         lua_Number nb; lua_Number nc;
-        if (tonumber(rb, &nb) && tonumber(rc, &nc)) {
+        if (tonumber(L, rb, &nb) && tonumber(L, rc, &nc)) {
           setfltvalue(ra, luai_numpow(L, nb, nc));
         }
         else { Protect(luaT_trybinTM(L, rb, rc, ra, TM_POW)); }
@@ -1035,7 +1140,7 @@ void luaV_execute (lua_State *L) {
           lua_Integer ib = ivalue(rb);
           setivalue(ra, intop(-, 0, ib));
         }
-        else if (tonumber(rb, &nb)) {
+        else if (tonumber(L, rb, &nb)) {
           setfltvalue(ra, luai_numunm(L, nb));
         }
         else {
@@ -1046,7 +1151,7 @@ void luaV_execute (lua_State *L) {
       vmcase(OP_BNOT) {
         TValue *rb = RB(i);
         lua_Integer ib;
-        if (tointeger(rb, &ib)) {
+        if (tointeger(L, rb, &ib)) {
           setivalue(ra, intop(^, ~l_castS2U(0), ib));
         }
         else {
@@ -1218,7 +1323,7 @@ void luaV_execute (lua_State *L) {
         lua_Integer ilimit;
         int stopnow;
         if (ttisinteger(init) && ttisinteger(pstep) &&
-            forlimit(plimit, &ilimit, ivalue(pstep), &stopnow)) {
+            forlimit(L, plimit, &ilimit, ivalue(pstep), &stopnow)) {
           /* all values are integer */
           lua_Integer initv = (stopnow ? 0 : ivalue(init));
           setivalue(plimit, ilimit);
@@ -1226,13 +1331,13 @@ void luaV_execute (lua_State *L) {
         }
         else {  /* try making all values floats */
           lua_Number ninit; lua_Number nlimit; lua_Number nstep;
-          if (!tonumber(plimit, &nlimit))
+          if (!tonumber(L, plimit, &nlimit))
             luaG_runerror(L, "'for' limit must be a number");
           setfltvalue(plimit, nlimit);
-          if (!tonumber(pstep, &nstep))
+          if (!tonumber(L, pstep, &nstep))
             luaG_runerror(L, "'for' step must be a number");
           setfltvalue(pstep, nstep);
-          if (!tonumber(init, &ninit))
+          if (!tonumber(L, init, &ninit))
             luaG_runerror(L, "'for' initial value must be a number");
           setfltvalue(init, luai_numsub(L, ninit, nstep));
         }
@@ -1241,13 +1346,19 @@ void luaV_execute (lua_State *L) {
       }
       vmcase(OP_TFORCALL) {
         StkId cb = ra + 3;  /* call base */
-        setobjs2s(L, cb+2, ra+2);
-        setobjs2s(L, cb+1, ra+1);
-        setobjs2s(L, cb, ra);
-        L->top = cb + 3;  /* func. + 2 args (state and index) */
-        Protect(luaD_call(L, cb, GETARG_C(i)));
-        L->top = ci->top;
+        if (ttislcf(ra) && ttistable(ra + 1) &&
+            forstdstep(L, ra, GETARG_C(i)))
+          ;  /* 'pairs'/'ipairs' step done without a call */
+        else {
+          setobjs2s(L, cb+2, ra+2);
+          setobjs2s(L, cb+1, ra+1);
+          setobjs2s(L, cb, ra);
+          L->top = cb + 3;  /* func. + 2 args (state and index) */
+          Protect(luaD_call(L, cb, GETARG_C(i)));
+          L->top = ci->top;
+        }
         i = *(ci->u.l.savedpc++);  /* go to next instruction */
+        vmcount(i);
         ra = RA(i);
         lua_assert(GET_OPCODE(i) == OP_TFORLOOP);
         goto l_tforloop;
@@ -0,0 +1,199 @@
+#include "luaarena.h"
+#include <cstdlib>
+#include <cstring>
+#include <sys/mman.h>
+
+//header at the start of each chunk
+struct ArenaAllocator::Chunk
+{
+    Chunk* next;
+};
+
+//header of large blocks, linked so that release() can find them
+struct ArenaAllocator::Large
+{
+    Large* next;
+    Large* prev;
+};
+
+static const size_t kChunkHeader = (sizeof(void*) + 15) & ~static_cast<size_t>(15);
+static const size_t kLargeHeader = (2 * sizeof(void*) + 15) & ~static_cast<size_t>(15);
+
+static inline size_t sizeUnits(size_t size)
+{
+    return (size + 15) >> 4;
+}
+
+ArenaAllocator::ArenaAllocator() :
+        bump_(0),
+        end_(0),
+        chunk_list_(0),
+        spare_list_(0),
+        chunks_(0),
+        spares_(0),
+        large_list_(0),
+        large_bytes_(0)
+{
+    memset(free_, 0, sizeof(free_));
+}
+
+ArenaAllocator::~ArenaAllocator()
+{
+    release();
+    while (spare_list_)
+    {
+        Chunk* next = spare_list_->next;
+        munmap(spare_list_, kChunkSize);
+        spare_list_ = next;
+    }
+}
+
+void ArenaAllocator::release()
+{
+    Chunk* chunk = chunk_list_;
+    while (chunk)
+    {
+        Chunk* next = chunk->next;
+        if (spares_ < kSpareChunks)
+        {
+            chunk->next = spare_list_;
+            spare_list_ = chunk;
+            spares_++;
+        }
+        else
+        {
+            munmap(chunk, kChunkSize);
+        }
+        chunk = next;
+    }
+    Large* large = large_list_;
+    while (large)
+    {
+        Large* next = large->next;
+        free(large);
+        large = next;
+    }
+    bump_ = end_ = 0;
+    chunk_list_ = 0;
+    chunks_ = 0;
+    large_list_ = 0;
+    large_bytes_ = 0;
+    memset(free_, 0, sizeof(free_));
+}
+
+bool ArenaAllocator::newChunk()
+{
+    Chunk* chunk = spare_list_;
+    if (chunk)
+    {
+        spare_list_ = chunk->next;
+        spares_--;
+    }
+    else
+    {
+        void* mem = mmap(0, kChunkSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == mem)
+            return false;
+        chunk = static_cast<Chunk*>(mem);
+    }
+    chunk->next = chunk_list_;
+    chunk_list_ = chunk;
+    chunks_++;
+    bump_ = reinterpret_cast<char*>(chunk) + kChunkHeader;
+    end_ = reinterpret_cast<char*>(chunk) + kChunkSize;
+    return true;
+}
+
+void* ArenaAllocator::allocate(size_t size)
+{
+    if (size > kMaxSmall)
+    {
+        Large* large = static_cast<Large*>(malloc(kLargeHeader + size));
+        if (!large)
+            return 0;
+        large->prev = 0;
+        large->next = large_list_;
+        if (large_list_)
+            large_list_->prev = large;
+        large_list_ = large;
+        large_bytes_ += size;
+        return reinterpret_cast<char*>(large) + kLargeHeader;
+    }
+
+    size_t units = sizeUnits(size);
+    void* block = free_[units];
+    if (block)
+    {
+        free_[units] = *static_cast<void**>(block);
+        return block;
+    }
+    if (static_cast<size_t>(end_ - bump_) < units * 16 && !newChunk())
+        return 0;
+    block = bump_;
+    bump_ += units * 16;
+    return block;
+}
+
+void ArenaAllocator::deallocate(void* ptr, size_t size)
+{
+    if (size > kMaxSmall)
+    {
+        Large* large = reinterpret_cast<Large*>(static_cast<char*>(ptr) - kLargeHeader);
+        if (large->prev)
+            large->prev->next = large->next;
+        else
+            large_list_ = large->next;
+        if (large->next)
+            large->next->prev = large->prev;
+        large_bytes_ -= size;
+        free(large);
+        return;
+    }
+
+    size_t units = sizeUnits(size);
+    *static_cast<void**>(ptr) = free_[units];
+    free_[units] = ptr;
+}
+
+void* ArenaAllocator::reallocate(void* ptr, size_t osize, size_t nsize)
+{
+    if (osize <= kMaxSmall && nsize <= kMaxSmall && sizeUnits(osize) == sizeUnits(nsize))
+        return ptr;
+
+    if (osize > kMaxSmall && nsize > kMaxSmall)
+    {
+        //large block: let malloc move it and fix the links
+        Large* large = static_cast<Large*>(realloc(static_cast<char*>(ptr) - kLargeHeader, kLargeHeader + nsize));
+        if (!large)
+            return 0;
+        if (large->prev)
+            large->prev->next = large;
+        else
+            large_list_ = large;
+        if (large->next)
+            large->next->prev = large;
+        large_bytes_ = large_bytes_ - osize + nsize;
+        return reinterpret_cast<char*>(large) + kLargeHeader;
+    }
+
+    void* block = allocate(nsize);
+    if (!block)
+        return 0;
+    memcpy(block, ptr, osize < nsize ? osize : nsize);
+    deallocate(ptr, osize);
+    return block;
+}
+
+void* ArenaAllocator::alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+    ArenaAllocator* self = static_cast<ArenaAllocator*>(ud);
+    if (0 == nsize)
+    {
+        if (ptr)
+            self->deallocate(ptr, osize);
+        return 0;
+    }
+    if (!ptr)  //'osize' is the kind of the new block
+        return self->allocate(nsize);
+    return self->reallocate(ptr, osize, nsize);
+}
@@ -0,0 +1,60 @@
+#ifndef LUAARENA_H
+#define LUAARENA_H
+
+#include <cstddef>
+
+//region allocator for one lua_State, used as its lua_Alloc. blocks up to
+//kMaxSmall bytes are cut from large mmap'ed chunks and freed blocks are
+//kept in lists by size for reuse; larger blocks come from malloc. nothing
+//is given back to the system until release(), which drops all blocks at
+//once, so a state using it should be closed with lua_gc(L,
+//LUA_GCBULKCLOSE, 1): lua_close then runs the finalizers but does not free
+//the objects one by one. like SlabAllocator it is single-threaded: it
+//takes no locks, so a state using it is marked with lua_gc(L,
+//LUA_GCTHREADSAFE, 0) and background freeing, collectgarbage("bgfree"),
+//stays off.
+class ArenaAllocator
+{
+public:
+    static const size_t kChunkSize = 256 * 1024;
+    static const size_t kMaxSmall = 512;
+    static const size_t kSpareChunks = 16;  //chunks kept by release()
+
+    ArenaAllocator();
+    ~ArenaAllocator();
+
+    //lua_Alloc function, with the allocator as 'ud'
+    static void* alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+
+    //frees every block; up to kSpareChunks chunks are kept for the next state
+    void release();
+
+    inline size_t getChunkBytes() const { return chunks_ * kChunkSize; }
+    inline size_t getLargeBytes() const { return large_bytes_; }
+
+private:
+    struct Chunk;
+    struct Large;
+    static const size_t kUnits = kMaxSmall / 16 + 1;
+
+    void* allocate(size_t size);
+    void deallocate(void* ptr, size_t size);
+    void* reallocate(void* ptr, size_t osize, size_t nsize);
+    bool newChunk();
+
+private:
+    char* bump_;           //free space of the current chunk
+    char* end_;
+    Chunk* chunk_list_;    //chunks in use, newest first
+    Chunk* spare_list_;    //chunks kept by release()
+    size_t chunks_;
+    size_t spares_;
+    Large* large_list_;
+    size_t large_bytes_;
+    void* free_[kUnits];   //freed small blocks, by size in 16-byte units
+private:
+    ArenaAllocator(const ArenaAllocator&);
+    ArenaAllocator& operator=(const ArenaAllocator&);
+};
+
+#endif
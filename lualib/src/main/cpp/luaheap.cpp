@@ -0,0 +1,532 @@
+#include "luaheap.h"
+#include <cstdio>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+
+namespace
+{
+
+const char* typeName(int type)
+{
+    switch (type)
+    {
+    case LUA_TSTRING: return "string";
+    case LUA_TTABLE: return "table";
+    case LUA_TFUNCTION: return "function";
+    case LUA_TUSERDATA: return "userdata";
+    case LUA_TTHREAD: return "thread";
+    case LUA_HEAPPROTO: return "proto";
+    case LUA_HEAPSTRTAB: return "strtab";
+    default: return "root";
+    }
+}
+
+//"@file.lua" -> "file.lua", "=stdin" -> "stdin", code given as a string -> "[string]"
+std::string shortSource(const std::string& source)
+{
+    if (source.empty() || ('@' != source[0] && '=' != source[0]))
+        return "[string]";
+    return source.substr(1);
+}
+
+//printable string, bytes above 0x7f escaped for JSON as latin-1
+std::string jsonString(const std::string& str)
+{
+    std::string out("\"");
+    char escape[8];
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        unsigned char c = static_cast<unsigned char>(str[i]);
+        if ('"' == c || '\\' == c)
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (c < 0x20 || c > 0x7e)
+        {
+            snprintf(escape, sizeof(escape), "\\u%04x", c);
+            out += escape;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+size_t sizeClass(size_t size)
+{
+    size_t size_class = 1;
+    while (size_class < size)
+        size_class <<= 1;
+    return size_class;
+}
+
+}
+
+const size_t LuaHeap::kMaxName;
+
+LuaHeap::LuaHeap()
+{
+}
+
+LuaHeap::~LuaHeap()
+{
+}
+
+void LuaHeap::clear()
+{
+    nodes_.clear();
+    edges_.clear();
+}
+
+void LuaHeap::capture(lua_State* L)
+{
+    clear();
+    Node root;
+    root.p = 0;
+    root.type = LUA_TNONE;
+    root.size = 0;
+    root.index = 0;
+    nodes_.push_back(root);
+    lua_heapwalk(L, &LuaHeap::walk, this);
+    link();
+    dominate();
+}
+
+void LuaHeap::walk(void* ud, const lua_HeapItem* item)
+{
+    LuaHeap* heap = static_cast<LuaHeap*>(ud);
+    std::string name;
+    if (item->name)
+        name.assign(item->name, std::min(item->len, kMaxName));
+    if (LUA_HEAPOBJECT == item->what)
+    {
+        Node node;
+        node.p = item->p;
+        node.type = item->type;
+        node.size = item->size;
+        node.name.swap(name);
+        node.index = item->index;
+        heap->nodes_.push_back(node);
+    }
+    else
+    {
+        Edge edge;
+        edge.from = item->p;
+        edge.to = item->q;
+        edge.kind = item->type;
+        edge.name.swap(name);
+        edge.index = item->index;
+        heap->edges_.push_back(edge);
+    }
+}
+
+//resolves the ends of the references and groups them by origin
+void LuaHeap::link()
+{
+    std::unordered_map<const void*, int> ids;
+    ids.reserve(nodes_.size());
+    for (size_t i = 0; i < nodes_.size(); i++)
+        ids[nodes_[i].p] = static_cast<int>(i);
+
+    std::vector<Edge> edges;
+    edges.reserve(edges_.size());
+    for (size_t i = 0; i < edges_.size(); i++)
+    {
+        std::unordered_map<const void*, int>::const_iterator from = ids.find(edges_[i].from);
+        std::unordered_map<const void*, int>::const_iterator to = ids.find(edges_[i].to);
+        if (from == ids.end() || to == ids.end())
+            continue;
+        edges.push_back(edges_[i]);
+        edges.back().source = from->second;
+        edges.back().target = to->second;
+    }
+    std::stable_sort(edges.begin(), edges.end(),
+                     [](const Edge& a, const Edge& b) { return a.source < b.source; });
+    edges_.swap(edges);
+
+    for (size_t i = 0; i < nodes_.size(); i++)
+    {
+        nodes_[i].first_edge = 0;
+        nodes_[i].edge_count = 0;
+    }
+    for (size_t i = edges_.size(); i-- > 0; )
+    {
+        nodes_[edges_[i].source].first_edge = i;
+        nodes_[edges_[i].source].edge_count++;
+    }
+}
+
+//dominator tree of the strong references (Cooper, Harvey and Kennedy, "A
+//simple, fast dominance algorithm"), retained sizes and shortest paths
+void LuaHeap::dominate()
+{
+    size_t n = nodes_.size();
+    for (size_t i = 0; i < n; i++)
+    {
+        nodes_[i].retained = nodes_[i].size;
+        nodes_[i].idom = -1;
+        nodes_[i].parent = -1;
+        nodes_[i].parent_edge = -1;
+    }
+
+    //shortest paths
+    std::vector<int> queue(1, 0);
+    nodes_[0].parent = 0;
+    for (size_t head = 0; head < queue.size(); head++)
+    {
+        const Node& node = nodes_[queue[head]];
+        for (size_t e = node.first_edge; e < node.first_edge + node.edge_count; e++)
+        {
+            int target = edges_[e].target;
+            if (isStrong(edges_[e]) && nodes_[target].parent < 0)
+            {
+                nodes_[target].parent = queue[head];
+                nodes_[target].parent_edge = static_cast<int>(e);
+                queue.push_back(target);
+            }
+        }
+    }
+
+    //postorder of a depth-first search
+    std::vector<int> postorder(n, -1);
+    std::vector<int> order;
+    order.reserve(queue.size());
+    std::vector<char> seen(n, 0);
+    std::vector<std::pair<int, size_t> > stack(1, std::make_pair(0, nodes_[0].first_edge));
+    seen[0] = 1;
+    while (!stack.empty())
+    {
+        int v = stack.back().first;
+        size_t& e = stack.back().second;
+        const Node& node = nodes_[v];
+        if (e < node.first_edge + node.edge_count)
+        {
+            const Edge& edge = edges_[e++];
+            if (isStrong(edge) && !seen[edge.target])
+            {
+                seen[edge.target] = 1;
+                stack.push_back(std::make_pair(edge.target, nodes_[edge.target].first_edge));
+            }
+            continue;
+        }
+        postorder[v] = static_cast<int>(order.size());
+        order.push_back(v);
+        stack.pop_back();
+    }
+
+    //predecessors by strong references
+    std::vector<size_t> pred_first(n + 1, 0);
+    for (size_t e = 0; e < edges_.size(); e++)
+        if (isStrong(edges_[e]) && seen[edges_[e].source])
+            pred_first[edges_[e].target + 1]++;
+    for (size_t i = 0; i < n; i++)
+        pred_first[i + 1] += pred_first[i];
+    std::vector<int> preds(pred_first[n]);
+    std::vector<size_t> fill(pred_first.begin(), pred_first.end() - 1);
+    for (size_t e = 0; e < edges_.size(); e++)
+        if (isStrong(edges_[e]) && seen[edges_[e].source])
+            preds[fill[edges_[e].target]++] = edges_[e].source;
+
+    nodes_[0].idom = 0;
+    for (bool changed = true; changed; )
+    {
+        changed = false;
+        for (size_t k = order.size() - 1; k-- > 0; )  //reverse postorder, the root being last
+        {
+            int v = order[k];
+            int idom = -1;
+            for (size_t i = pred_first[v]; i < pred_first[v + 1]; i++)
+            {
+                int a = preds[i];
+                if (nodes_[a].idom < 0)
+                    continue;
+                if (idom < 0)
+                {
+                    idom = a;
+                    continue;
+                }
+                int b = idom;
+                while (a != b)
+                {
+                    while (postorder[a] < postorder[b])
+                        a = nodes_[a].idom;
+                    while (postorder[b] < postorder[a])
+                        b = nodes_[b].idom;
+                }
+                idom = a;
+            }
+            if (nodes_[v].idom != idom)
+            {
+                nodes_[v].idom = idom;
+                changed = true;
+            }
+        }
+    }
+
+    //an object comes before its dominators in postorder
+    for (size_t k = 0; k + 1 < order.size(); k++)
+        nodes_[nodes_[order[k]].idom].retained += nodes_[order[k]].retained;
+}
+
+size_t LuaHeap::getTotalSize() const
+{
+    size_t size = 0;
+    for (size_t i = 0; i < nodes_.size(); i++)
+        size += nodes_[i].size;
+    return size;
+}
+
+size_t LuaHeap::getReachableSize() const
+{
+    return nodes_.empty() ? 0 : nodes_[0].retained;
+}
+
+std::string LuaHeap::label(int node) const
+{
+    const Node& n = nodes_[node];
+    char line[32];
+    snprintf(line, sizeof(line), ":%lld)", n.index);
+    switch (n.type)
+    {
+    case LUA_TSTRING:
+        return n.name.empty() && n.size > 0 ? "(rope)" : jsonString(n.name);
+    case LUA_TFUNCTION:
+        if (n.index < 0)
+            return "C function";
+        if (0 == n.index)
+            return "main chunk (" + shortSource(n.name) + ")";
+        return "function (" + shortSource(n.name) + line;
+    case LUA_HEAPPROTO:
+        return "proto (" + shortSource(n.name) + line;
+    case LUA_HEAPSTRTAB:
+        return "(string table)";
+    case LUA_TNONE:
+        return "(roots)";
+    default:
+        return typeName(n.type);
+    }
+}
+
+std::string LuaHeap::edgeLabel(const Edge& edge) const
+{
+    char index[32];
+    snprintf(index, sizeof(index), "%lld", edge.index);
+    switch (edge.kind & ~LUA_HEAPWEAK)
+    {
+    case LUA_HEAPFIELD:
+        return edge.name;
+    case LUA_HEAPINDEX:
+        return std::string("[") + index + "]";
+    case LUA_HEAPVALUE:
+        return "[value]";
+    case LUA_HEAPKEY:
+        return "[key]";
+    case LUA_HEAPMETA:
+        return 0 == edge.source ? std::string("metatable of ") + typeName(static_cast<int>(edge.index)) : "metatable";
+    case LUA_HEAPUPVAL:
+        return edge.name.empty() ? std::string("upvalue ") + index : edge.name;
+    default:
+        return edge.name.empty() ? std::string("internal ") + index : edge.name;
+    }
+}
+
+//"registry[2].counter.cache", by the references of a shortest path
+std::string LuaHeap::path(int node) const
+{
+    if (nodes_[node].parent < 0)
+        return "(unreachable)";
+    std::vector<const Edge*> edges;
+    for (int v = node; v != 0; v = nodes_[v].parent)
+        edges.push_back(&edges_[nodes_[v].parent_edge]);
+    std::string out;
+    for (size_t i = edges.size(); i-- > 0; )
+    {
+        std::string part = edgeLabel(*edges[i]);
+        int kind = edges[i]->kind & ~LUA_HEAPWEAK;
+        if (LUA_HEAPUPVAL == kind)
+            part = "(upvalue " + part + ")";
+        if (!out.empty() && LUA_HEAPINDEX != kind)
+            out += LUA_HEAPFIELD == kind ? "." : " ";
+        out += part;
+    }
+    for (size_t i = 0; i < out.size(); i++)
+        if (static_cast<unsigned char>(out[i]) < 0x20 || static_cast<unsigned char>(out[i]) > 0x7e)
+            out[i] = '?';
+    return out;
+}
+
+std::string LuaHeap::getCensus() const
+{
+    struct Count
+    {
+        size_t objects;
+        size_t bytes;
+        size_t unreachable;
+    };
+    std::map<std::pair<int, size_t>, Count> census;
+    Count total = {0, 0, 0};
+    for (size_t i = 1; i < nodes_.size(); i++)
+    {
+        const Node& node = nodes_[i];
+        Count& count = census.insert(std::make_pair(std::make_pair(node.type, sizeClass(node.size)), total)).first->second;
+        count.objects++;
+        count.bytes += node.size;
+        count.unreachable += node.idom < 0 ? 1 : 0;
+    }
+    for (std::map<std::pair<int, size_t>, Count>::const_iterator it = census.begin(); it != census.end(); ++it)
+    {
+        total.objects += it->second.objects;
+        total.bytes += it->second.bytes;
+        total.unreachable += it->second.unreachable;
+    }
+
+    std::string out;
+    char line[128];
+    for (std::map<std::pair<int, size_t>, Count>::const_iterator it = census.begin(); it != census.end(); ++it)
+    {
+        snprintf(line, sizeof(line), "%-8s %10zu %10zu %12zu %10zu\n", typeName(it->first.first),
+                 it->first.second, it->second.objects, it->second.bytes, it->second.unreachable);
+        out += line;
+    }
+    snprintf(line, sizeof(line), "%-8s %10s %10zu %12zu %10zu\n", "total", "-",
+             total.objects, total.bytes, total.unreachable);
+    return out + line;
+}
+
+std::string LuaHeap::getRetainers(int top) const
+{
+    std::vector<std::pair<size_t, int> > retainers;
+    for (size_t i = 1; i < nodes_.size(); i++)
+        if (nodes_[i].idom >= 0)
+            retainers.push_back(std::make_pair(nodes_[i].retained, static_cast<int>(i)));
+    size_t count = std::min(retainers.size(), static_cast<size_t>(std::max(top, 0)));
+    std::partial_sort(retainers.begin(), retainers.begin() + count, retainers.end(),
+                      [](const std::pair<size_t, int>& a, const std::pair<size_t, int>& b) { return a.first > b.first; });
+
+    std::string out;
+    char sizes[64];
+    for (size_t i = 0; i < count; i++)
+    {
+        int node = retainers[i].second;
+        snprintf(sizes, sizeof(sizes), "%12zu %10zu ", nodes_[node].retained, nodes_[node].size);
+        out += sizes + label(node) + " " + path(node) + "\n";
+    }
+    return out;
+}
+
+//the layout written by V8 (and read by DevTools); nodes and edges are flat
+//arrays of numbers, names indices into the string array
+std::string LuaHeap::getHeapSnapshot() const
+{
+    enum { kHidden = 0, kArray = 1, kString = 2, kObject = 3, kCode = 4, kClosure = 5,
+           kNative = 8, kSynthetic = 9, kConsString = 10 };
+    enum { kContext = 0, kElement = 1, kProperty = 2, kInternal = 3, kHiddenEdge = 4, kWeak = 6 };
+    static const int kNodeFields = 6;
+
+    std::map<std::string, int> string_ids;
+    std::vector<const std::string*> strings;
+    struct Strings
+    {
+        std::map<std::string, int>& ids;
+        std::vector<const std::string*>& list;
+        int operator()(const std::string& str)
+        {
+            std::pair<std::map<std::string, int>::iterator, bool> it =
+                    ids.insert(std::make_pair(str, static_cast<int>(list.size())));
+            if (it.second)
+                list.push_back(&it.first->first);
+            return it.first->second;
+        }
+    } stringId = {string_ids, strings};
+
+    std::string out;
+    char number[96];
+    out += "{\"snapshot\":{\"meta\":{"
+           "\"node_fields\":[\"type\",\"name\",\"id\",\"self_size\",\"edge_count\",\"trace_node_id\"],"
+           "\"node_types\":[[\"hidden\",\"array\",\"string\",\"object\",\"code\",\"closure\",\"regexp\","
+           "\"number\",\"native\",\"synthetic\",\"concatenated string\",\"sliced string\",\"symbol\",\"bigint\"],"
+           "\"string\",\"number\",\"number\",\"number\",\"number\"],"
+           "\"edge_fields\":[\"type\",\"name_or_index\",\"to_node\"],"
+           "\"edge_types\":[[\"context\",\"element\",\"property\",\"internal\",\"hidden\",\"shortcut\",\"weak\"],"
+           "\"string_or_number\",\"node\"],"
+           "\"trace_function_info_fields\":[\"function_id\",\"name\",\"script_name\",\"script_id\",\"line\",\"column\"],"
+           "\"trace_node_fields\":[\"id\",\"function_info_index\",\"count\",\"size\",\"children\"],"
+           "\"sample_fields\":[\"timestamp_us\",\"last_assigned_id\"],"
+           "\"location_fields\":[\"object_index\",\"script_id\",\"line\",\"column\"]},";
+    snprintf(number, sizeof(number), "\"node_count\":%zu,\"edge_count\":%zu,\"trace_function_count\":0},\n",
+             nodes_.size(), edges_.size());
+    out += number;
+
+    out += "\"nodes\":[";
+    for (size_t i = 0; i < nodes_.size(); i++)
+    {
+        const Node& node = nodes_[i];
+        int type = kObject;
+        std::string name = label(static_cast<int>(i));
+        switch (node.type)
+        {
+        case LUA_TNONE: type = kSynthetic; break;
+        case LUA_TSTRING:
+            type = node.name.empty() && node.size > 0 ? kConsString : kString;
+            name = node.name;
+            break;
+        case LUA_TFUNCTION: type = kClosure; break;
+        case LUA_TUSERDATA: type = kNative; break;
+        case LUA_HEAPPROTO: type = kCode; break;
+        case LUA_HEAPSTRTAB: type = kArray; break;
+        }
+        snprintf(number, sizeof(number), "%s%d,%d,%zu,%zu,%zu,0", i > 0 ? ",\n" : "",
+                 type, stringId(name), 2 * i + 1, node.size, node.edge_count);
+        out += number;
+    }
+
+    out += "],\n\"edges\":[";
+    for (size_t i = 0; i < edges_.size(); i++)
+    {
+        const Edge& edge = edges_[i];
+        int type;
+        long long name_or_index;
+        switch (edge.kind & ~LUA_HEAPWEAK)
+        {
+        case LUA_HEAPINDEX: type = kElement; name_or_index = edge.index; break;
+        case LUA_HEAPFIELD: type = kProperty; name_or_index = stringId(edge.name); break;
+        case LUA_HEAPUPVAL: type = kContext; name_or_index = stringId(edgeLabel(edge)); break;
+        case LUA_HEAPINTERNAL:
+            //references from the roots are named
+            if (0 != edge.source)
+            {
+                type = kHiddenEdge;
+                name_or_index = edge.index;
+            }
+            else
+            {
+                type = kInternal;
+                name_or_index = stringId(edgeLabel(edge));
+            }
+            break;
+        default: type = kInternal; name_or_index = stringId(edgeLabel(edge)); break;
+        }
+        if (edge.kind & LUA_HEAPWEAK)
+        {
+            type = kWeak;
+            name_or_index = stringId(edgeLabel(edge));
+        }
+        snprintf(number, sizeof(number), "%s%d,%lld,%d", i > 0 ? ",\n" : "",
+                 type, name_or_index, edge.target * kNodeFields);
+        out += number;
+    }
+
+    out += "],\n\"trace_function_infos\":[],\"trace_tree\":[],\"samples\":[],\"locations\":[],\n\"strings\":[";
+    for (size_t i = 0; i < strings.size(); i++)
+    {
+        if (i > 0)
+            out += ",\n";
+        out += jsonString(*strings[i]);
+    }
+    out += "]}\n";
+    return out;
+}
@@ -0,0 +1,88 @@
+#ifndef LUAHEAP_H
+#define LUAHEAP_H
+
+#include <string>
+#include <vector>
+#include "lua/lua.hpp"
+
+//snapshot of the object graph of one state, taken with lua_heapwalk (which
+//finishes a sweep in progress, never more than the rest of one cycle, and
+//then reads the heap without running the collector). the graph is rooted
+//at a synthetic node holding the registry (and so the globals), the main
+//thread, the metatables of basic types and the objects being finalized.
+//the analysis gives a census of the objects by type and size class, the
+//retained size of each object (the bytes freed if it were collected, from
+//the dominator tree of the strong references) with a path from the roots,
+//and a V8 heap snapshot that the Memory tab of Chrome DevTools can load.
+//a snapshot holds no reference into the state; it outlives it.
+class LuaHeap
+{
+public:
+    //bytes of the contents of strings kept as their names
+    static const size_t kMaxName = 80;
+
+    LuaHeap();
+    ~LuaHeap();
+
+    void capture(lua_State* L);
+    void clear();
+
+    //objects, not counting the synthetic root
+    inline size_t getObjects() const { return nodes_.empty() ? 0 : nodes_.size() - 1; }
+    inline size_t getReferences() const { return edges_.size(); }
+    size_t getTotalSize() const;
+    //bytes of the objects reachable from the roots
+    size_t getReachableSize() const;
+
+    //"type size_class objects bytes unreachable_objects" lines, size classes
+    //being powers of two, plus a total line
+    std::string getCensus() const;
+    //"retained self label path" lines of the 'top' objects retaining most
+    std::string getRetainers(int top) const;
+    //V8 .heapsnapshot JSON
+    std::string getHeapSnapshot() const;
+
+private:
+    struct Node
+    {
+        const void* p;
+        int type;
+        size_t size;
+        std::string name;
+        long long index;        //line defined of functions and prototypes
+        size_t first_edge;
+        size_t edge_count;
+        size_t retained;
+        int idom;               //immediate dominator, -1 if unreachable
+        int parent;             //on a shortest path from the root
+        int parent_edge;
+    };
+
+    struct Edge
+    {
+        const void* from;
+        const void* to;
+        int kind;
+        std::string name;
+        long long index;
+        int source;
+        int target;
+    };
+
+    static void walk(void* ud, const lua_HeapItem* item);
+    void link();
+    void dominate();
+    std::string label(int node) const;
+    std::string edgeLabel(const Edge& edge) const;
+    std::string path(int node) const;
+    inline bool isStrong(const Edge& edge) const { return 0 == (edge.kind & LUA_HEAPWEAK) && edge.target >= 0; }
+
+private:
+    std::vector<Node> nodes_;
+    std::vector<Edge> edges_;
+private:
+    LuaHeap(const LuaHeap&);
+    LuaHeap& operator=(const LuaHeap&);
+};
+
+#endif
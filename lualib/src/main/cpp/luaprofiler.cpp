@@ -0,0 +1,168 @@
+#include "luaprofiler.h"
+#include <cstdio>
+#include <algorithm>
+
+LuaProfiler::LuaProfiler() :
+        mode_(kInstructions),
+        period_(0),
+        running_(false),
+        samples_(0),
+        due_(false)
+{
+}
+
+LuaProfiler::~LuaProfiler()
+{
+    stop();
+}
+
+bool LuaProfiler::start(Mode mode, int period)
+{
+    if (running_ || period <= 0)
+        return false;
+
+    mode_ = mode;
+    period_ = period;
+    due_ = false;
+    running_ = true;
+    if (kTimer == mode_)
+    {
+        try
+        {
+            timer_ = std::thread(&LuaProfiler::tick, this);
+        }
+        catch (...)
+        {
+            running_ = false;
+            return false;
+        }
+    }
+    return true;
+}
+
+void LuaProfiler::stop()
+{
+    if (!running_)
+        return;
+
+    if (timer_.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        stop_.notify_one();
+        timer_.join();
+    }
+    running_ = false;
+}
+
+void LuaProfiler::clear()
+{
+    samples_ = 0;
+    frame_ids_.clear();
+    labels_.clear();
+    stacks_.clear();
+    lines_.clear();
+}
+
+void LuaProfiler::tick()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (running_)
+    {
+        if (std::cv_status::timeout == stop_.wait_for(lock, std::chrono::microseconds(period_)))
+            due_ = true;
+    }
+}
+
+int LuaProfiler::frameId(lua_State* L, lua_Debug* ar)
+{
+    lua_getinfo(L, "Snf", ar);
+    const void* function = ar->linedefined >= 0 ? static_cast<const void*>(ar->source) :
+            reinterpret_cast<const void*>(lua_tocfunction(L, -1));
+    lua_pop(L, 1);
+
+    std::pair<const void*, int> key(function, ar->linedefined);
+    std::map<std::pair<const void*, int>, int>::const_iterator it = frame_ids_.find(key);
+    if (it != frame_ids_.end())
+        return it->second;
+
+    char label[LUA_IDSIZE + 64];
+    if (ar->linedefined < 0)
+        snprintf(label, sizeof(label), "%s [C]", ar->name ? ar->name : "?");
+    else if ('m' == *ar->what)
+        snprintf(label, sizeof(label), "main chunk (%s)", ar->short_src);
+    else
+        snprintf(label, sizeof(label), "%s (%s:%d)", ar->name ? ar->name : "function", ar->short_src, ar->linedefined);
+    std::string name(label);
+    std::replace(name.begin(), name.end(), ';', ':');  //';' separates the frames of collapsed stacks
+
+    int id = static_cast<int>(labels_.size());
+    labels_.push_back(name);
+    frame_ids_[key] = id;
+    return id;
+}
+
+void LuaProfiler::onHook(lua_State* L)
+{
+    if (!running_ || (kTimer == mode_ && !due_.exchange(false)))
+        return;
+
+    std::vector<int> stack;
+    lua_Debug ar;
+    int line = -1;
+    for (int level = 0; level < kMaxDepth && lua_getstack(L, level, &ar); level++)
+    {
+        if (0 == level)
+        {
+            lua_getinfo(L, "l", &ar);
+            line = ar.currentline;
+        }
+        stack.push_back(frameId(L, &ar));
+    }
+    if (stack.empty())
+        return;
+
+    std::reverse(stack.begin(), stack.end());
+    stacks_[stack]++;
+    lines_[std::make_pair(stack.back(), line)]++;
+    samples_++;
+}
+
+std::string LuaProfiler::getCollapsed() const
+{
+    std::string out;
+    char count[32];
+    for (std::map<std::vector<int>, size_t>::const_iterator it = stacks_.begin(); it != stacks_.end(); ++it)
+    {
+        const std::vector<int>& stack = it->first;
+        for (size_t i = 0; i < stack.size(); i++)
+        {
+            if (i > 0)
+                out += ';';
+            out += labels_[stack[i]];
+        }
+        snprintf(count, sizeof(count), " %zu\n", it->second);
+        out += count;
+    }
+    return out;
+}
+
+std::string LuaProfiler::getLines(int top) const
+{
+    std::vector<std::pair<size_t, std::pair<int, int> > > lines;
+    for (std::map<std::pair<int, int>, size_t>::const_iterator it = lines_.begin(); it != lines_.end(); ++it)
+        lines.push_back(std::make_pair(it->second, it->first));
+    std::sort(lines.rbegin(), lines.rend());
+
+    std::string out;
+    char line[LUA_IDSIZE + 96];
+    for (size_t i = 0; i < lines.size() && static_cast<int>(i) < top; i++)
+    {
+        snprintf(line, sizeof(line), "%zu %s:%d\n", lines[i].first,
+                 labels_[lines[i].second.first].c_str(), lines[i].second.second);
+        out += line;
+    }
+    return out;
+}
@@ -0,0 +1,74 @@
+#ifndef LUAPROFILER_H
+#define LUAPROFILER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "lua/lua.hpp"
+
+//sampling profiler of the Lua code of one state, driven by its count hook.
+//in kInstructions mode a sample is taken every 'period' VM instructions;
+//in kTimer mode a thread raises a flag every 'period' microseconds and the
+//next count hook (every kPollCount instructions) takes the sample, so time
+//spent in C functions is charged to the Lua code that called them.
+//a sample is the Lua call stack, aggregated by stack (collapsed-stack
+//output for flame graphs) and by function and line of the running one.
+//the hook must be installed by the owner (see LuaState::startProfiler);
+//coroutines created before that are not sampled.
+class LuaProfiler
+{
+public:
+    enum Mode
+    {
+        kInstructions = 0,
+        kTimer = 1
+    };
+
+    static const int kPollCount = 1000;
+    static const int kMaxDepth = 64;
+
+    LuaProfiler();
+    ~LuaProfiler();
+
+    bool start(Mode mode, int period);
+    void stop();
+    void clear();
+    inline bool isRunning() const { return running_; }
+    //instructions between two calls of the count hook
+    inline int getHookCount() const { return kTimer == mode_ ? kPollCount : period_; }
+    //to be called by the count hook
+    void onHook(lua_State* L);
+
+    inline size_t getSamples() const { return samples_; }
+    //one "frame;frame;...;frame count" line per stack, callers first
+    std::string getCollapsed() const;
+    //"count function:line" lines of the 'top' most sampled lines
+    std::string getLines(int top) const;
+
+private:
+    int frameId(lua_State* L, lua_Debug* ar);
+    void tick();
+
+private:
+    Mode mode_;
+    int period_;
+    bool running_;
+    size_t samples_;
+    std::map<std::pair<const void*, int>, int> frame_ids_;  //(source or C function, line defined)
+    std::vector<std::string> labels_;
+    std::map<std::vector<int>, size_t> stacks_;
+    std::map<std::pair<int, int>, size_t> lines_;           //(frame, current line)
+    std::atomic<bool> due_;                                 //set by the timer thread
+    std::thread timer_;
+    std::mutex mutex_;
+    std::condition_variable stop_;
+private:
+    LuaProfiler(const LuaProfiler&);
+    LuaProfiler& operator=(const LuaProfiler&);
+};
+
+#endif
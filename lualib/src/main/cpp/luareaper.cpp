@@ -0,0 +1,85 @@
+#include "luareaper.h"
+#include <thread>
+
+LuaReaper& LuaReaper::instance()
+{
+    //never deleted: the thread may still run while the process exits
+    static LuaReaper* reaper = new LuaReaper();
+    return *reaper;
+}
+
+LuaReaper::LuaReaper() :
+        pending_bytes_(0),
+        running_(0),
+        started_(false)
+{
+}
+
+void LuaReaper::reap(void* object, Destroy destroy, size_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool full = queue_.size() + running_ >= kMaxPending ||
+                (pending_bytes_ > 0 && pending_bytes_ + bytes > kMaxPendingBytes);
+        if (!full && !started_)
+        {
+            try
+            {
+                std::thread(&LuaReaper::run, this).detach();
+                started_ = true;
+            }
+            catch (...)
+            {
+                //no thread: destroy here
+            }
+        }
+        if (!full && started_)
+        {
+            Entry entry = {object, destroy, bytes};
+            queue_.push_back(entry);
+            pending_bytes_ += bytes;
+            work_.notify_one();
+            return;
+        }
+    }
+    destroy(object);
+}
+
+void LuaReaper::drain()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!queue_.empty() || running_ > 0)
+        done_.wait(lock);
+}
+
+size_t LuaReaper::getPendingBytes()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return pending_bytes_;
+}
+
+size_t LuaReaper::getPendingObjects()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return queue_.size() + running_;
+}
+
+void LuaReaper::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        while (queue_.empty())
+            work_.wait(lock);
+        Entry entry = queue_.front();
+        queue_.pop_front();
+        running_++;
+        lock.unlock();
+        entry.destroy(entry.object);
+        lock.lock();
+        running_--;
+        pending_bytes_ -= entry.bytes;
+        if (queue_.empty())
+            done_.notify_all();
+    }
+}
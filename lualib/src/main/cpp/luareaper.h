@@ -0,0 +1,58 @@
+#ifndef LUAREAPER_H
+#define LUAREAPER_H
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+//destroys objects (closed lua states) on a background thread, so that the
+//caller does not wait for lua_close. at most kMaxPending objects or
+//kMaxPendingBytes bytes wait in the queue; beyond that reap() destroys the
+//object on the caller thread. a queued state is no longer reachable from
+//its owner, so running its finalizers (__gc) on the reaper thread is safe
+//as long as they do not use thread-bound resources of the caller.
+class LuaReaper
+{
+public:
+    typedef void (*Destroy)(void* object);
+
+    static const size_t kMaxPending = 16;
+    static const size_t kMaxPendingBytes = 64 * 1024 * 1024;
+
+    //the process-wide reaper; its thread is started on first use
+    static LuaReaper& instance();
+
+    //destroys 'object' with 'destroy' later, 'bytes' is its memory size
+    void reap(void* object, Destroy destroy, size_t bytes);
+    //waits until all queued objects are destroyed
+    void drain();
+
+    size_t getPendingBytes();
+    size_t getPendingObjects();
+
+private:
+    struct Entry
+    {
+        void* object;
+        Destroy destroy;
+        size_t bytes;
+    };
+
+    LuaReaper();
+    void run();
+
+private:
+    std::mutex mutex_;
+    std::condition_variable work_;  //signaled when an entry is queued
+    std::condition_variable done_;  //signaled when the queue gets empty
+    std::deque<Entry> queue_;
+    size_t pending_bytes_;           //bytes of queued and running entries
+    size_t running_;                 //entries being destroyed (0 or 1)
+    bool started_;
+private:
+    LuaReaper(const LuaReaper&);
+    LuaReaper& operator=(const LuaReaper&);
+};
+
+#endif
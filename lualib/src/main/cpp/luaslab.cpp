@@ -0,0 +1,261 @@
+#include "luaslab.h"
+#include <cstdlib>
+#include <cstring>
+#include "lua/lua.hpp"
+
+//slot sizes of the size classes
+static const uint16_t kClassSize[] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512
+};
+
+//size class for each size in 16-byte units, (size + 15) / 16
+static const uint8_t kUnitClass[] = {
+    0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+    12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15
+};
+
+static inline int sizeClass(size_t size)
+{
+    return kUnitClass[(size + 15) >> 4];
+}
+
+//header at the start of each page; kind bytes of the slots follow it and
+//the slots follow them
+struct SlabAllocator::Page
+{
+    Page* next;      //in 'avail_' list of its class
+    Page* prev;
+    void* free;      //list of freed slots
+    char* bump;      //first slot never used
+    char* slots;
+    char* end;
+    uint32_t used;   //slots in use
+    uint16_t size;   //slot size
+    uint8_t cls;
+    uint8_t kinds[1];
+};
+
+//header of large blocks
+union LargeHeader
+{
+    uint8_t kind;
+    long double align_d;
+    void* align_p;
+};
+
+static inline SlabAllocator::KindStats& statsFor(SlabAllocator::KindStats* stats, int kind)
+{
+    return stats[(kind >= 0 && kind < SlabAllocator::kKinds) ? kind : 0];
+}
+
+SlabAllocator::SlabAllocator() :
+        pages_(0),
+        large_bytes_(0)
+{
+    memset(avail_, 0, sizeof(avail_));
+    memset(stats_, 0, sizeof(stats_));
+}
+
+SlabAllocator::~SlabAllocator()
+{
+    //pages still in use belong to an unclosed state; only free the spare ones
+    for (int i = 0; i < kClasses; i++)
+    {
+        Page* page = avail_[i];
+        while (page)
+        {
+            Page* next = page->next;
+            if (0 == page->used)
+                freePage(page);
+            page = next;
+        }
+    }
+}
+
+const char* SlabAllocator::kindName(int kind)
+{
+    switch (kind)
+    {
+        case LUA_TSTRING: return "string";
+        case LUA_TTABLE: return "table";
+        case LUA_TFUNCTION: return "closure";
+        case LUA_TUSERDATA: return "userdata";
+        case LUA_TTHREAD: return "thread";
+        case LUA_NUMTAGS: return "proto";
+        case LUA_KNODES: return "nodes";
+        case LUA_KUPVAL: return "upvalue";
+        case LUA_KCALLINFO: return "callinfo";
+        case LUA_KSTACK: return "stack";
+        default: return "other";
+    }
+}
+
+SlabAllocator::Page* SlabAllocator::newPage(int cls)
+{
+    void* mem = 0;
+    if (0 != posix_memalign(&mem, kPageSize, kPageSize))
+        return 0;
+
+    Page* page = static_cast<Page*>(mem);
+    size_t size = kClassSize[cls];
+    size_t header = offsetof(Page, kinds);
+    size_t nslots = (kPageSize - header - 16) / (size + 1);
+    uintptr_t slots = reinterpret_cast<uintptr_t>(page->kinds) + nslots;
+    slots = (slots + 15) & ~static_cast<uintptr_t>(15);
+    page->next = avail_[cls];
+    page->prev = 0;
+    if (page->next)
+        page->next->prev = page;
+    avail_[cls] = page;
+    page->free = 0;
+    page->slots = page->bump = reinterpret_cast<char*>(slots);
+    page->end = page->slots + nslots * size;
+    page->used = 0;
+    page->size = static_cast<uint16_t>(size);
+    page->cls = static_cast<uint8_t>(cls);
+    pages_++;
+    return page;
+}
+
+void SlabAllocator::freePage(Page* page)
+{
+    if (page->prev)
+        page->prev->next = page->next;
+    else
+        avail_[page->cls] = page->next;
+    if (page->next)
+        page->next->prev = page->prev;
+    pages_--;
+    free(page);
+}
+
+//pages are aligned to their size
+SlabAllocator::Page* SlabAllocator::pageOf(void* ptr)
+{
+    return reinterpret_cast<Page*>(reinterpret_cast<uintptr_t>(ptr) & ~static_cast<uintptr_t>(kPageSize - 1));
+}
+
+int SlabAllocator::blockKind(void* ptr, size_t size) const
+{
+    if (size > kMaxSmall)
+        return (reinterpret_cast<LargeHeader*>(ptr) - 1)->kind;
+
+    Page* page = pageOf(ptr);
+    return page->kinds[(static_cast<char*>(ptr) - page->slots) / page->size];
+}
+
+void* SlabAllocator::allocate(size_t size, int kind)
+{
+    void* block;
+    if (kind < 0 || kind >= kKinds)
+        kind = 0;
+
+    if (size > kMaxSmall)
+    {
+        LargeHeader* h = static_cast<LargeHeader*>(malloc(sizeof(LargeHeader) + size));
+        if (!h)
+            return 0;
+        h->kind = static_cast<uint8_t>(kind);
+        large_bytes_ += size;
+        block = h + 1;
+    }
+    else
+    {
+        int cls = sizeClass(size);
+        Page* page = avail_[cls];
+        if (!page && !(page = newPage(cls)))
+            return 0;
+        if (page->free)
+        {
+            block = page->free;
+            page->free = *static_cast<void**>(block);
+        }
+        else
+        {
+            block = page->bump;
+            page->bump += page->size;
+        }
+        page->kinds[(static_cast<char*>(block) - page->slots) / page->size] = static_cast<uint8_t>(kind);
+        if (++page->used * page->size == static_cast<size_t>(page->end - page->slots))
+        {
+            //page is full: remove it from the list of pages with free slots
+            avail_[cls] = page->next;
+            if (page->next)
+                page->next->prev = 0;
+            page->next = page->prev = 0;
+        }
+    }
+
+    KindStats& stats = stats_[kind];
+    stats.count++;
+    stats.bytes += size;
+    stats.allocs++;
+    return block;
+}
+
+void SlabAllocator::deallocate(void* ptr, size_t size)
+{
+    KindStats& stats = statsFor(stats_, blockKind(ptr, size));
+    stats.count--;
+    stats.bytes -= size;
+
+    if (size > kMaxSmall)
+    {
+        large_bytes_ -= size;
+        free(reinterpret_cast<LargeHeader*>(ptr) - 1);
+        return;
+    }
+
+    Page* page = pageOf(ptr);
+    bool was_full = page->used * page->size == static_cast<size_t>(page->end - page->slots);
+    *static_cast<void**>(ptr) = page->free;
+    page->free = ptr;
+    page->used--;
+    if (was_full)
+    {
+        //back to the list of pages with free slots
+        page->prev = 0;
+        page->next = avail_[page->cls];
+        if (page->next)
+            page->next->prev = page;
+        avail_[page->cls] = page;
+    }
+    else if (0 == page->used && (page->prev || page->next))
+    {
+        //empty page that is not the only one of its class
+        freePage(page);
+    }
+}
+
+void* SlabAllocator::reallocate(void* ptr, size_t osize, size_t nsize)
+{
+    if (osize <= kMaxSmall && nsize <= kMaxSmall && sizeClass(osize) == sizeClass(nsize))
+    {
+        //same slot
+        KindStats& stats = statsFor(stats_, blockKind(ptr, osize));
+        stats.bytes = stats.bytes - osize + nsize;
+        return ptr;
+    }
+
+    void* block = allocate(nsize, blockKind(ptr, osize));
+    if (!block)
+        return 0;
+    memcpy(block, ptr, osize < nsize ? osize : nsize);
+    statsFor(stats_, blockKind(block, nsize)).allocs--;  //a move, not a new block
+    deallocate(ptr, osize);
+    return block;
+}
+
+void* SlabAllocator::alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+    SlabAllocator* self = static_cast<SlabAllocator*>(ud);
+    if (0 == nsize)
+    {
+        if (ptr)
+            self->deallocate(ptr, osize);
+        return 0;
+    }
+    if (!ptr)  //'osize' is the kind of the new block
+        return self->allocate(nsize, static_cast<int>(osize));
+    return self->reallocate(ptr, osize, nsize);
+}
@@ -0,0 +1,61 @@
+#ifndef LUASLAB_H
+#define LUASLAB_H
+
+#include <cstddef>
+#include <stdint.h>
+
+//size-class slab allocator for one lua_State, used as its lua_Alloc.
+//blocks up to kMaxSmall bytes come from 64KB pages split into slots of one
+//size class; larger blocks come from malloc. it takes no locks, so it must
+//not be used by several threads at once: a state using it is marked with
+//lua_gc(L, LUA_GCTHREADSAFE, 0), and background freeing,
+//collectgarbage("bgfree"), then stays off.
+class SlabAllocator
+{
+public:
+    //block kinds: 0 (other), object types (LUA_TSTRING...) and LUA_K* kinds
+    static const int kKinds = 32;
+    static const size_t kMaxSmall = 512;
+    static const size_t kPageSize = 64 * 1024;
+
+    struct KindStats
+    {
+        size_t count;   //live blocks
+        size_t bytes;   //live bytes
+        size_t allocs;  //blocks created so far
+    };
+
+    SlabAllocator();
+    ~SlabAllocator();
+
+    //lua_Alloc function, with the allocator as 'ud'
+    static void* alloc(void* ud, void* ptr, size_t osize, size_t nsize);
+
+    inline const KindStats& getStats(int kind) const { return stats_[kind]; }
+    inline size_t getPageBytes() const { return pages_ * kPageSize; }
+    inline size_t getLargeBytes() const { return large_bytes_; }
+    static const char* kindName(int kind);
+
+private:
+    struct Page;
+    static const int kClasses = 16;
+
+    void* allocate(size_t size, int kind);
+    void deallocate(void* ptr, size_t size);
+    void* reallocate(void* ptr, size_t osize, size_t nsize);
+    Page* newPage(int cls);
+    void freePage(Page* page);
+    static Page* pageOf(void* ptr);
+    int blockKind(void* ptr, size_t size) const;
+
+private:
+    Page* avail_[kClasses];  //pages with free slots, by size class
+    size_t pages_;
+    size_t large_bytes_;
+    KindStats stats_[kKinds];
+private:
+    SlabAllocator(const SlabAllocator&);
+    SlabAllocator& operator=(const SlabAllocator&);
+};
+
+#endif
@@ -0,0 +1,545 @@
+#include "luastate.h"
+#include "luaheap.h"
+#include <cstdio>
+#include <cstdarg>
+#include <ctype.h>
+#include <algorithm>
+
+using namespace std;
+
+const size_t kBufSize = 4096;
+
+std::string strFormat(const char* fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    char buffer[kBufSize] = {0};
+    vsnprintf(buffer, kBufSize, fmt, ap);
+    va_end(ap);
+    return std::string(buffer);
+}
+
+LuaType luaGetType(lua_State* plua_state, int index)
+{
+    return (LuaType)lua_type(plua_state, index);
+}
+
+void luaPop(lua_State* plua_state, int count)
+{
+    lua_pop(plua_state, count);
+}
+
+int luaGetTop(lua_State* plua_state)
+{
+    return lua_gettop(plua_state);
+}
+
+void luaGetGlobal(lua_State* plua_state, const std::string& name)
+{
+    lua_getglobal(plua_state, name.c_str());
+}
+
+void luaSetGlobal(lua_State* plua_state, const std::string& name)
+{
+    lua_setglobal(plua_state, name.c_str());
+}
+
+int luaCallFunc(lua_State* plua_state, int nargs, int nrets)
+{
+    return lua_pcall(plua_state, nargs, nrets, 0);
+}
+
+void luaAssert(lua_State* plua_state, bool assertion, const std::string& str)
+{
+    if (!plua_state)
+        luaL_error(plua_state, "plua_state is null");
+
+    if (!assertion)
+        luaL_error(plua_state, "%s", str.c_str());
+}
+
+void luaError(lua_State* plua_state, const std::string& str)
+{
+    luaL_error(plua_state, "%s", str.c_str());
+}
+
+double luaToDouble(lua_State* plua_state, int index)
+{
+    return lua_tonumber(plua_state, index);
+}
+
+double luaToDouble(lua_State* plua_state, int index, double default_num)
+{
+    return lua_isnumber(plua_state, index) ? luaToDouble(plua_state, index) : default_num;
+}
+
+bool luaIsInteger(lua_State* plua_state, int index)
+{
+    return lua_isinteger(plua_state, index);
+}
+
+int luaToInteger(lua_State* plua_state, int index)
+{
+    return lua_tointeger(plua_state, index);
+}
+
+int luaToInteger(lua_State* plua_state, int index, int default_int)
+{
+    return lua_isinteger(plua_state, index) ? luaToInteger(plua_state, index) : default_int;
+}
+
+std::string luaToString(lua_State* plua_state, int index)
+{
+    const char* result = lua_tostring(plua_state, index);
+    if (!result)
+        luaError(plua_state, strFormat("luaToString from index %d failed.", index));
+
+    return std::string(lua_tostring(plua_state, index));
+}
+
+std::string luaToString(lua_State* plua_state, int index, const std::string& default_str)
+{
+    return lua_isstring(plua_state, index) ? luaToString(plua_state, index) : default_str.c_str();
+}
+
+bool luaToBoolean(lua_State* plua_state, int index)
+{
+    return (bool)lua_toboolean(plua_state, index);
+}
+
+bool luaToBoolean(lua_State* plua_state, int index, bool default_bool)
+{
+    return lua_isboolean(plua_state, index) ? luaToBoolean(plua_state, index) : default_bool;
+}
+
+void luaPushDouble(lua_State* plua_state, double double_val)
+{
+    lua_pushnumber(plua_state, double_val);
+}
+
+void luaPushInteger(lua_State* plua_state, int int_val)
+{
+    lua_pushinteger(plua_state, int_val);
+}
+
+void luaPushString(lua_State* plua_state, const std::string& str_val)
+{
+    lua_pushstring(plua_state, str_val.c_str());
+}
+
+void luaPushNil(lua_State* plua_state)
+{
+    lua_pushnil(plua_state);
+}
+
+void luaPushBoolean(lua_State* plua_state, bool boolean)
+{
+    lua_pushboolean(plua_state, boolean);
+}
+
+void luaNewTable(lua_State* plua_state, int narr, int nrec)
+{
+    lua_createtable(plua_state, narr, nrec);
+}
+
+bool luaClearTable(lua_State* plua_state, int index)
+{
+    if (!lua_istable(plua_state, index))
+        return false;
+
+    lua_cleartable(plua_state, index);
+    return true;
+}
+
+int luaGcStep(lua_State* plua_state, int budget_us)
+{
+    return lua_gc(plua_state, LUA_GCSTEPTIME, budget_us);
+}
+
+size_t luaGetMemory(lua_State* plua_state)
+{
+    return (size_t)lua_gc(plua_state, LUA_GCCOUNT, 0) * 1024 + lua_gc(plua_state, LUA_GCCOUNTB, 0);
+}
+
+bool luaSetGcStats(lua_State* plua_state, bool on)
+{
+    return 0 != lua_gc(plua_state, LUA_GCSTATS, on ? 1 : 0);
+}
+
+void luaGetGcCycles(lua_State* plua_state, std::vector<lua_GCCycle>& cycles)
+{
+    lua_GCCycle cycle;
+    int n = 0;
+    while (lua_gccycle(plua_state, n, &cycle))
+        n++;
+    cycles.resize(n);
+    for (int i = 0; i < n; i++)
+        lua_gccycle(plua_state, n - 1 - i, &cycles[i]);
+}
+
+bool luaSetAllocSites(lua_State* plua_state, bool on)
+{
+    return 0 != lua_gc(plua_state, LUA_GCALLOCSITES, on ? 1 : 0);
+}
+
+void luaGetAllocSites(lua_State* plua_state, int top, std::vector<lua_AllocSite>& sites)
+{
+    sites.resize(top > 0 ? top : 0);
+    sites.resize(sites.empty() ? 0 : lua_allocsites(plua_state, &sites[0], top));
+}
+
+bool luaSetOptimize(lua_State* plua_state, bool on)
+{
+    return 0 != lua_gc(plua_state, LUA_GCOPTIMIZE, on ? 1 : 0);
+}
+
+//"file.lua:12 in function <file.lua:10>", as in tracebacks
+std::string luaAllocSiteName(const lua_AllocSite& site)
+{
+    if (site.line < 0)
+        return site.source;
+    if (0 == site.linedefined)
+        return strFormat("%s:%d in main chunk", site.source, site.line);
+    return strFormat("%s:%d in function <%s:%d>", site.source, site.line, site.source, site.linedefined);
+}
+
+static bool compareCounts(const std::pair<std::string, long long>& a, const std::pair<std::string, long long>& b)
+{
+    return a.second > b.second;
+}
+
+bool luaGetVmStats(lua_State* plua_state, int what, LuaCounts& counts)
+{
+    counts.clear();
+    if (lua_vmstat(plua_state, LUA_VMOPCODES, 0, 0) < 0)
+        return false;
+
+    int names = LUA_VMSLOWPATHS == what ? LUA_VMSLOWPATHS : LUA_VMOPCODES;
+    for (int a = 0; lua_vmname(names, a); a++)
+    {
+        if (LUA_VMPAIRS != what)
+        {
+            long long count = lua_vmstat(plua_state, names, a, 0);
+            if (count > 0)
+                counts.push_back(std::make_pair(std::string(lua_vmname(names, a)), count));
+            continue;
+        }
+        for (int b = 0; lua_vmname(LUA_VMOPCODES, b); b++)
+        {
+            long long count = lua_vmstat(plua_state, LUA_VMPAIRS, a, b);
+            if (count > 0)
+                counts.push_back(std::make_pair(strFormat("%s %s", lua_vmname(LUA_VMOPCODES, a),
+                                                          lua_vmname(LUA_VMOPCODES, b)), count));
+        }
+    }
+    std::stable_sort(counts.begin(), counts.end(), compareCounts);
+    return true;
+}
+
+void luaResetVmStats(lua_State* plua_state)
+{
+    lua_vmstat(plua_state, LUA_VMRESET, 0, 0);
+}
+
+std::string luaGetHeapCensus(lua_State* plua_state, int top)
+{
+    LuaHeap heap;
+    heap.capture(plua_state);
+    return heap.getCensus() + heap.getRetainers(top);
+}
+
+bool luaWriteHeapSnapshot(lua_State* plua_state, const std::string& path)
+{
+    LuaHeap heap;
+    heap.capture(plua_state);
+    std::string snapshot = heap.getHeapSnapshot();
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    bool written = fwrite(snapshot.data(), 1, snapshot.size(), file) == snapshot.size();
+    return 0 == fclose(file) && written;
+}
+
+//same as the panic function installed by luaL_newstate
+int luaPanic(lua_State* plua_state)
+{
+    fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(plua_state, -1));
+    fflush(stderr);
+    return 0;
+}
+
+//luaGetError
+std::string luaGetError(lua_State* plua_state, int err)
+{
+    std::string error_str("");
+    if (0 == err)
+        return error_str;
+
+    std::string err_type;
+    switch (err)
+    {
+        case LUA_ERRSYNTAX: //compile-time error
+            err_type = "syntax error during pre-compilation";
+            break;
+        case LUA_ERRMEM: //memory error
+            err_type = "memory allocation error";
+            break;
+        case LUA_ERRRUN: //runtime-time error
+            err_type = "runtime error";
+            break;
+        case LUA_YIELD: //thread suspend error
+            err_type = "thread has been suspended";
+            break;
+        case LUA_ERRERR: //error while running
+            err_type = "error while running the error handler function";
+            break;
+        default:
+            err_type = "unknown";
+            break;
+    }
+
+    error_str = string("error(") + string(err_type.c_str()) + ") " + string(lua_tostring(plua_state, -1));
+    luaPop(plua_state, 1);
+
+    return error_str;
+}
+
+//luaParseLine
+int luaParseLine(lua_State* plua_state, const std::string& line, std::string& error_str)
+{
+    error_str = "";
+    if (0 == plua_state)
+        return -1;
+
+    int err = luaL_loadbuffer(plua_state, line.c_str(), line.length(), "line");
+    if (0 != err)
+    {
+        error_str = luaGetError(plua_state, err);
+        return err;
+    }
+
+    err = lua_pcall(plua_state, 0, 0, 0);
+    error_str = luaGetError(plua_state, err);
+
+    return err;
+}
+
+//luaParseFile
+int luaParseFile(lua_State* plua_state, const std::string& file, std::string& error_str)
+{
+    error_str = "";
+    if (0 == plua_state)
+        return -1;
+
+    int err = luaL_loadfile(plua_state, file.c_str());
+    if (0 != err)
+    {
+        error_str = luaGetError(plua_state, err);
+        return err;
+    }
+    err = lua_pcall(plua_state, 0, LUA_MULTRET, 0);
+    error_str = luaGetError(plua_state, err);
+    return err;
+}
+
+//LuaState implementation
+LuaState::LuaState() :
+        plua_state_(0),
+        slab_(0),
+        arena_(0),
+        profiler_(0),
+        tracer_(0)
+{
+    init();
+}
+
+LuaState::LuaState(Allocator allocator) :
+        plua_state_(0),
+        slab_(kSlab == allocator ? new SlabAllocator() : 0),
+        arena_(kArena == allocator ? new ArenaAllocator() : 0),
+        profiler_(0),
+        tracer_(0)
+{
+    init();
+}
+
+LuaState::~LuaState()
+{
+    cleanup();
+    delete profiler_;
+    delete tracer_;
+    delete slab_;
+    delete arena_;
+}
+
+bool LuaState::init()
+{
+    if (plua_state_)
+        return false;
+
+    if (slab_)
+    {
+        plua_state_ = lua_newstate(SlabAllocator::alloc, slab_);
+        if (plua_state_)
+        {
+            lua_atpanic(plua_state_, luaPanic);
+            //the slabs take no locks: no background freeing
+            lua_gc(plua_state_, LUA_GCTHREADSAFE, 0);
+        }
+    }
+    else if (arena_)
+    {
+        plua_state_ = lua_newstate(ArenaAllocator::alloc, arena_);
+        if (plua_state_)
+        {
+            lua_atpanic(plua_state_, luaPanic);
+            //the arena drops all blocks at once after lua_close
+            lua_gc(plua_state_, LUA_GCBULKCLOSE, 1);
+            //and takes no locks: no background freeing
+            lua_gc(plua_state_, LUA_GCTHREADSAFE, 0);
+        }
+    }
+    else
+    {
+        plua_state_ = luaL_newstate();
+    }
+    //the extra space is copied to every coroutine
+    if (plua_state_)
+        *static_cast<LuaState**>(lua_getextraspace(plua_state_)) = this;
+    loadLibs();
+
+    return true;
+}
+
+void LuaState::cleanup()
+{
+    if (profiler_)
+        profiler_->stop();
+    if (tracer_)
+        tracer_->stop();
+    if (plua_state_)
+        lua_close(plua_state_);
+    if (arena_)
+        arena_->release();
+
+    plua_state_ = 0;
+}
+
+bool LuaState::loadLibs()
+{
+    if (0 != plua_state_)
+    {
+        luaL_openlibs(plua_state_);
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+bool LuaState::reset()
+{
+    cleanup();
+    return init();
+}
+
+int LuaState::parseLine(const std::string& line)
+{
+    return luaParseLine(plua_state_, line, error_str);
+}
+
+int LuaState::parseFile(const std::string& file)
+{
+    return luaParseFile(plua_state_, file, error_str);
+}
+
+LuaState* LuaState::fromState(lua_State* plua_state)
+{
+    return *static_cast<LuaState**>(lua_getextraspace(plua_state));
+}
+
+void LuaState::hook(lua_State* plua_state, lua_Debug* ar)
+{
+    LuaState* state = fromState(plua_state);
+    if (!state)
+        return;
+    if (LUA_HOOKCOUNT == ar->event)
+    {
+        if (state->profiler_)
+            state->profiler_->onHook(plua_state);
+    }
+    else if (state->tracer_)
+    {
+        state->tracer_->onHook(plua_state, ar);
+    }
+}
+
+//one hook serves the profiler and the tracer
+void LuaState::updateHook()
+{
+    int mask = 0;
+    if (profiler_ && profiler_->isRunning())
+        mask |= LUA_MASKCOUNT;
+    if (tracer_ && tracer_->isRunning())
+        mask |= LUA_MASKCALL | LUA_MASKRET;
+    lua_sethook(plua_state_, mask ? hook : 0, mask, profiler_ ? profiler_->getHookCount() : 0);
+}
+
+bool LuaState::startProfiler(int mode, int period)
+{
+    if (!plua_state_)
+        return false;
+
+    if (!profiler_)
+        profiler_ = new LuaProfiler();
+    profiler_->stop();
+    profiler_->clear();
+    bool started = profiler_->start(LuaProfiler::kTimer == mode ? LuaProfiler::kTimer : LuaProfiler::kInstructions, period);
+    updateHook();
+    return started;
+}
+
+std::string LuaState::stopProfiler()
+{
+    if (!profiler_)
+        return "";
+
+    profiler_->stop();
+    if (plua_state_)
+        updateHook();
+    return profiler_->getCollapsed();
+}
+
+bool LuaState::startTracer(size_t capacity)
+{
+    if (!plua_state_)
+        return false;
+
+    if (!tracer_)
+        tracer_ = new LuaTracer();
+    tracer_->stop();
+    bool started = tracer_->start(plua_state_, capacity);
+    if (!started)
+    {
+        delete tracer_;
+        tracer_ = 0;
+    }
+    updateHook();
+    return started;
+}
+
+std::string LuaState::stopTracer()
+{
+    if (!tracer_)
+        return "";
+
+    tracer_->stop();
+    if (plua_state_)
+        updateHook();
+    return tracer_->getChromeTrace();
+}
+
+void LuaState::registerFunction(const std::string& func_name, LuaCFunc lua_reg_func) {
+    lua_register(plua_state_, func_name.c_str(), lua_reg_func);
+}
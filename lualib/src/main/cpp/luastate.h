@@ -0,0 +1,189 @@
+#ifndef LUASTATE_H
+#define LUASTATE_H
+
+#include <string>
+#include <vector>
+#include "lua/lua.hpp"
+#include "luaslab.h"
+#include "luaarena.h"
+#include "luaprofiler.h"
+#include "luatracer.h"
+
+#define DISALLOW_COPY_AND_ASSIGN(TypeName) TypeName(const TypeName&); TypeName& operator=(const TypeName&);
+typedef int (*LuaCFunc)(lua_State*);
+typedef std::vector<std::pair<std::string, long long> > LuaCounts;
+
+std::string strFormat(const char* fmt, ...);
+
+//lua utility functions
+enum LuaType
+{
+    LuaNone = -1,
+    LuaNil,
+    LuaBoolean,
+    LuaLightUserData,
+    LuaNumber,
+    LuaString,
+    LuaTable,
+    LuaFunction,
+    LuaUserData,
+    LuaThread,
+    LuaNumTags
+};
+
+LuaType luaGetType(lua_State* plua_state, int index);
+void luaPop(lua_State* plua_state, int count);
+int luaGetTop(lua_State* plua_state);
+void luaGetGlobal(lua_State* plua_state, const std::string& name);
+void luaSetGlobal(lua_State* plua_state, const std::string& name);
+int luaCallFunc(lua_State* plua_state, int nargs, int nrets);
+void luaAssert(lua_State* plua_state, bool assertion, const std::string& str);
+void luaError(lua_State* plua_state, const std::string& str);
+double luaToDouble(lua_State* plua_state, int index);
+double luaToDouble(lua_State* plua_state, int index, double default_num);
+bool luaIsInteger(lua_State* plua_state, int index);
+int luaToInteger(lua_State* plua_state, int index);
+int luaToInteger(lua_State* plua_state, int index, int default_int);
+std::string luaToString(lua_State* plua_state, int index);
+std::string luaToString(lua_State* plua_state, int index, const std::string& default_str);
+bool luaToBoolean(lua_State* plua_state, int index);
+bool luaToBoolean(lua_State* plua_state, int index, bool default_bool);
+void luaPushDouble(lua_State* plua_state, double double_val);
+void luaPushInteger(lua_State* plua_state, int int_val);
+void luaPushString(lua_State* plua_state, const std::string& str_val);
+void luaPushNil(lua_State* plua_state);
+void luaPushBoolean(lua_State* plua_state, bool boolean);
+void luaNewTable(lua_State* plua_state, int narr, int nrec);
+bool luaClearTable(lua_State* plua_state, int index);
+int luaGcStep(lua_State* plua_state, int budget_us);
+size_t luaGetMemory(lua_State* plua_state);
+bool luaSetGcStats(lua_State* plua_state, bool on);
+void luaGetGcCycles(lua_State* plua_state, std::vector<lua_GCCycle>& cycles);
+bool luaSetAllocSites(lua_State* plua_state, bool on);
+void luaGetAllocSites(lua_State* plua_state, int top, std::vector<lua_AllocSite>& sites);
+std::string luaAllocSiteName(const lua_AllocSite& site);
+bool luaSetOptimize(lua_State* plua_state, bool on);
+bool luaGetVmStats(lua_State* plua_state, int what, LuaCounts& counts);
+void luaResetVmStats(lua_State* plua_state);
+std::string luaGetHeapCensus(lua_State* plua_state, int top);
+bool luaWriteHeapSnapshot(lua_State* plua_state, const std::string& path);
+int luaPanic(lua_State* plua_state);
+std::string luaGetError(lua_State* plua_state, int err);
+int luaParseLine(lua_State* plua_state, const std::string& line, std::string& error_str);
+int luaParseFile(lua_State* plua_state, const std::string& file, std::string& error_str);
+
+//LuaState definition
+class LuaState
+{
+public:
+    //memory of the state: malloc, its own SlabAllocator or its own ArenaAllocator
+    enum Allocator
+    {
+        kMalloc = 0,
+        kSlab = 1,
+        kArena = 2
+    };
+
+    LuaState();
+    explicit LuaState(Allocator allocator);
+    ~LuaState();
+    inline lua_State* getState() const { return plua_state_; }
+    inline const SlabAllocator* getSlab() const { return slab_; }
+    inline const ArenaAllocator* getArena() const { return arena_; }
+    inline std::string getError() const { return error_str; }
+    void registerFunction(const std::string& func_name, LuaCFunc lua_reg_func);
+    int parseLine(const std::string& line);
+    int parseFile(const std::string& file);
+    bool reset();
+
+    //get operate
+    inline int getType(int index) { return (int)luaGetType(getState(), index); }
+    inline double toDouble(int index) { return luaToDouble(getState(), index); }
+    inline double toDouble(int index, double default_num) { return luaToDouble(getState(), index, default_num); }
+    inline bool isInteger(int index) { return luaIsInteger(getState(), index); }
+    inline int toInteger(int index) { return luaToInteger(getState(), index); }
+    inline int toInteger(int index, int default_int) { return luaToInteger(getState(), index, default_int); }
+    inline std::string toString(int index) { return luaToString(getState(), index); }
+    inline std::string toString(int index, const std::string& default_str) { return luaToString(getState(), index, default_str); }
+    inline bool toBoolean(int index) { return luaToBoolean(getState(), index); }
+    inline bool toBoolean(int index, bool default_bool) { return luaToBoolean(getState(), index, default_bool); }
+
+    //push operate
+    inline void pushDouble(double value) { luaPushDouble(getState(), value); }
+    inline void pushInteger(int value) { luaPushInteger(getState(), value); }
+    inline void pushString(const std::string& value) { luaPushString(getState(), value); }
+    inline void pushNil() { luaPushNil(getState()); }
+    inline void pushBoolean(bool value) { luaPushBoolean(getState(), value); }
+
+    //table operate
+    inline void newTable(int narr, int nrec) { luaNewTable(getState(), narr, nrec); }
+    inline bool clearTable(int index) { return luaClearTable(getState(), index); }
+
+    //gc operate
+    inline int gcStep(int budget_us) { return luaGcStep(getState(), budget_us); }
+    inline size_t getMemory() { return getState() ? luaGetMemory(getState()) : 0; }
+    //per-cycle telemetry of the collector: setGcStats(true) starts keeping it (returns whether it was on),
+    //getGcCycles gives the last finished cycles, oldest first
+    inline bool setGcStats(bool on) { return luaSetGcStats(getState(), on); }
+    inline void getGcCycles(std::vector<lua_GCCycle>& cycles) { luaGetGcCycles(getState(), cycles); }
+    //allocation sites: setAllocSites(true) starts charging every allocation to the line of Lua code running
+    //(returns whether it was on), getAllocSites gives the 'top' sites that allocated most bytes
+    inline bool setAllocSites(bool on) { return luaSetAllocSites(getState(), on); }
+    inline void getAllocSites(int top, std::vector<lua_AllocSite>& sites) { luaGetAllocSites(getState(), top, sites); }
+    //bytecode optimizer: with setOptimize(true), chunks compiled from source afterwards are optimized before
+    //they run (returns whether it was on)
+    inline bool setOptimize(bool on) { return luaSetOptimize(getState(), on); }
+
+    //vm counters operate, only when the core is built with LUAI_VMSTATS
+    //what is LUA_VMOPCODES, LUA_VMPAIRS or LUA_VMSLOWPATHS; counts are sorted by decreasing count
+    inline bool getVmStats(int what, LuaCounts& counts) { return luaGetVmStats(getState(), what, counts); }
+    inline void resetVmStats() { luaResetVmStats(getState()); }
+
+    //heap operate, see LuaHeap
+    //getHeapCensus gives the objects by type and size class, then the 'top' objects retaining most memory;
+    //writeHeapSnapshot writes the object graph as a .heapsnapshot file (Chrome DevTools, Memory tab)
+    inline std::string getHeapCensus(int top) { return luaGetHeapCensus(getState(), top); }
+    inline bool writeHeapSnapshot(const std::string& path) { return luaWriteHeapSnapshot(getState(), path); }
+
+    //profiler operate
+    //starts sampling every 'period' instructions (LuaProfiler::kInstructions)
+    //or microseconds (LuaProfiler::kTimer), dropping the previous samples
+    bool startProfiler(int mode, int period);
+    //stops sampling and returns the collapsed stacks
+    std::string stopProfiler();
+    inline const LuaProfiler* getProfiler() const { return profiler_; }
+
+    //tracer operate
+    //starts recording calls and returns into a ring buffer of 'capacity'
+    //events, dropping the previous ones
+    bool startTracer(size_t capacity);
+    //stops recording and returns the events as Chrome trace-event JSON
+    std::string stopTracer();
+    inline const LuaTracer* getTracer() const { return tracer_; }
+
+    //the LuaState of a state or of one of its coroutines
+    static LuaState* fromState(lua_State* plua_state);
+
+    //other operate
+    inline void pop(int index) { luaPop(getState(), index); }
+    inline int getTop() { return luaGetTop(getState()); }
+    inline void getGlobal(const std::string& name) { luaGetGlobal(getState(), name); }
+    inline void setGlobal(const std::string& name) { luaSetGlobal(getState(), name); }
+private:
+    bool init();
+    void cleanup();
+    bool loadLibs();
+    static void hook(lua_State* plua_state, lua_Debug* ar);
+    void updateHook();
+private:
+    lua_State* plua_state_;
+    SlabAllocator* slab_;
+    ArenaAllocator* arena_;
+    LuaProfiler* profiler_;
+    LuaTracer* tracer_;
+    std::string error_str;
+private:
+    DISALLOW_COPY_AND_ASSIGN(LuaState)
+};
+
+#endif
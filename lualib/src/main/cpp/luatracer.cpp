@@ -0,0 +1,204 @@
+#include "luatracer.h"
+#include <cstdio>
+#include <chrono>
+
+LuaTracer::LuaTracer() :
+        running_(false),
+        start_(0),
+        head_(0),
+        count_(0),
+        dropped_(0)
+{
+}
+
+LuaTracer::~LuaTracer()
+{
+}
+
+long long LuaTracer::now() const
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count() - start_;
+}
+
+bool LuaTracer::start(lua_State* L, size_t capacity)
+{
+    if (running_ || 0 == capacity)
+        return false;
+
+    events_.assign(capacity, Event());
+    head_ = count_ = dropped_ = 0;
+    frame_ids_.clear();
+    labels_.clear();
+    thread_ids_.clear();
+    threadId(L);
+    start_ = 0;
+    start_ = now();
+    running_ = true;
+    return true;
+}
+
+void LuaTracer::stop()
+{
+    running_ = false;
+}
+
+int LuaTracer::frameId(lua_State* L, lua_Debug* ar)
+{
+    lua_getinfo(L, "Sf", ar);
+    const void* function = ar->linedefined >= 0 ? static_cast<const void*>(ar->source) :
+            reinterpret_cast<const void*>(lua_tocfunction(L, -1));
+    lua_pop(L, 1);
+
+    std::pair<const void*, int> key(function, ar->linedefined);
+    std::map<std::pair<const void*, int>, int>::const_iterator it = frame_ids_.find(key);
+    if (it != frame_ids_.end())
+        return it->second;
+
+    lua_getinfo(L, "n", ar);
+    char label[LUA_IDSIZE + 64];
+    if (ar->linedefined < 0)
+        snprintf(label, sizeof(label), "%s [C]", ar->name ? ar->name : "?");
+    else if ('m' == *ar->what)
+        snprintf(label, sizeof(label), "main chunk (%s)", ar->short_src);
+    else
+        snprintf(label, sizeof(label), "%s (%s:%d)", ar->name ? ar->name : "function", ar->short_src, ar->linedefined);
+
+    int id = static_cast<int>(labels_.size());
+    labels_.push_back(label);
+    frame_ids_[key] = id;
+    return id;
+}
+
+int LuaTracer::threadId(lua_State* L)
+{
+    std::map<const lua_State*, int>::const_iterator it = thread_ids_.find(L);
+    if (it != thread_ids_.end())
+        return it->second;
+
+    int id = static_cast<int>(thread_ids_.size());
+    thread_ids_[L] = id;
+    return id;
+}
+
+void LuaTracer::onHook(lua_State* L, lua_Debug* ar)
+{
+    if (!running_)
+        return;
+
+    Event& event = events_[head_];
+    event.phase = LUA_HOOKRET == ar->event ? 'E' : 'B';
+    event.tail = LUA_HOOKTAILCALL == ar->event;
+    event.frame = frameId(L, ar);
+    event.thread = threadId(L);
+    event.time = now();
+
+    head_ = (head_ + 1) % events_.size();
+    if (count_ < events_.size())
+        count_++;
+    else
+        dropped_++;
+}
+
+static void appendJsonString(std::string& out, const std::string& str)
+{
+    out += '"';
+    for (size_t i = 0; i < str.size(); i++)
+    {
+        char c = str[i];
+        if ('"' == c || '\\' == c)
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else
+        {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+static void appendEvent(std::string& out, const std::string& name, char phase, long long time, int thread)
+{
+    char fields[96];
+    out += out.empty() ? "{\"traceEvents\":[\n" : ",\n";
+    out += "{\"name\":";
+    appendJsonString(out, name);
+    snprintf(fields, sizeof(fields), ",\"ph\":\"%c\",\"ts\":%lld.%03lld,\"pid\":1,\"tid\":%d}",
+             phase, time / 1000, time % 1000, thread);
+    out += fields;
+}
+
+std::string LuaTracer::getChromeTrace() const
+{
+    if (events_.empty() || 0 == count_)
+        return "{\"traceEvents\":[],\"displayTimeUnit\":\"ns\"}\n";
+
+    //open frames of each thread, with their tail flag
+    std::vector<std::vector<std::pair<int, bool> > > stacks(thread_ids_.size());
+    std::string out;
+    long long last = 0;
+    size_t first = (head_ + events_.size() - count_) % events_.size();
+    for (size_t i = 0; i < count_; i++)
+    {
+        const Event& event = events_[(first + i) % events_.size()];
+        std::vector<std::pair<int, bool> >& stack = stacks[event.thread];
+        last = event.time;
+        if ('B' == event.phase)
+        {
+            stack.push_back(std::make_pair(event.frame, event.tail));
+            appendEvent(out, labels_[event.frame], 'B', event.time, event.thread);
+            continue;
+        }
+
+        //a return closes its frame, the tail calls that ended in it, and the
+        //frames above it left by an error; returns of frames called before
+        //the oldest event are dropped
+        size_t depth = stack.size();
+        while (depth > 0 && stack[depth - 1].first != event.frame)
+            depth--;
+        if (0 == depth)
+            continue;
+        depth--;
+        while (depth > 0 && stack[depth].second)
+            depth--;
+        while (stack.size() > depth)
+        {
+            appendEvent(out, labels_[stack.back().first], 'E', event.time, event.thread);
+            stack.pop_back();
+        }
+    }
+
+    //frames still running when the trace stopped end with the last event
+    for (size_t thread = 0; thread < stacks.size(); thread++)
+    {
+        for (size_t depth = stacks[thread].size(); depth > 0; depth--)
+            appendEvent(out, labels_[stacks[thread][depth - 1].first], 'E', last, static_cast<int>(thread));
+    }
+
+    //track names
+    for (size_t thread = 0; thread < stacks.size(); thread++)
+    {
+        char name[32];
+        if (0 == thread)
+            snprintf(name, sizeof(name), "main");
+        else
+            snprintf(name, sizeof(name), "coroutine %zu", thread);
+        out += out.empty() ? "{\"traceEvents\":[\n" : ",\n";
+        out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":";
+        out += std::to_string(thread);
+        out += ",\"args\":{\"name\":";
+        appendJsonString(out, name);
+        out += "}}";
+    }
+    out += out.empty() ? "{\"traceEvents\":[" : "\n";
+    out += "],\"displayTimeUnit\":\"ns\"}\n";
+    return out;
+}
@@ -0,0 +1,65 @@
+#ifndef LUATRACER_H
+#define LUATRACER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "lua/lua.hpp"
+
+//records every call and return of Lua and C functions of one state, from
+//its call and return hooks, with a monotonic timestamp, into a ring buffer
+//of 'capacity' events (the oldest ones are overwritten), and exports them
+//as Chrome trace-event JSON (chrome://tracing, Perfetto), one track per
+//coroutine. frames left by an error are closed by the next return of one
+//of their callers. the hooks must be installed by the owner (see
+//LuaState::startTracer); coroutines created before that are not traced.
+class LuaTracer
+{
+public:
+    static const size_t kDefaultCapacity = 65536;
+
+    LuaTracer();
+    ~LuaTracer();
+
+    //'L' is the main thread of the state
+    bool start(lua_State* L, size_t capacity);
+    void stop();
+    inline bool isRunning() const { return running_; }
+    //to be called by the call and return hooks
+    void onHook(lua_State* L, lua_Debug* ar);
+
+    //events in the buffer, and events overwritten since start
+    inline size_t getEvents() const { return count_; }
+    inline size_t getDropped() const { return dropped_; }
+    std::string getChromeTrace() const;
+
+private:
+    struct Event
+    {
+        long long time;     //nanoseconds since start
+        int frame;
+        int thread;
+        char phase;         //'B' call, 'E' return
+        bool tail;          //tail call, which returns with its caller
+    };
+
+    int frameId(lua_State* L, lua_Debug* ar);
+    int threadId(lua_State* L);
+    long long now() const;
+
+private:
+    bool running_;
+    long long start_;
+    std::vector<Event> events_;
+    size_t head_;           //next event to write
+    size_t count_;
+    size_t dropped_;
+    std::map<std::pair<const void*, int>, int> frame_ids_;  //(source or C function, line defined)
+    std::vector<std::string> labels_;
+    std::map<const lua_State*, int> thread_ids_;
+private:
+    LuaTracer(const LuaTracer&);
+    LuaTracer& operator=(const LuaTracer&);
+};
+
+#endif
@@ -1,350 +1,20 @@
 #include <string>
 #include <jni.h>
-#include <cstdio>
-#include <cstdarg>
-#include <ctype.h>
-#include "lua/lua.hpp"
+#include "luastate.h"
+#include "luareaper.h"
 
 using namespace std;
 
-#define DISALLOW_COPY_AND_ASSIGN(TypeName) TypeName(const TypeName&); TypeName& operator=(const TypeName&);
-typedef int (*LuaCFunc)(lua_State*);
-const size_t kBufSize = 4096;
-
-std::string strFormat(const char* fmt, ...)
-{
-    va_list ap;
-    va_start(ap, fmt);
-    char buffer[kBufSize] = {0};
-    vsnprintf(buffer, kBufSize, fmt, ap);
-    va_end(ap);
-    return std::string(buffer);
-}
-
-//lua utility functions
-enum LuaType
-{
-    LuaNone = -1,
-    LuaNil,
-    LuaBoolean,
-    LuaLightUserData,
-    LuaNumber,
-    LuaString,
-    LuaTable,
-    LuaFunction,
-    LuaUserData,
-    LuaThread,
-    LuaNumTags
-};
-
-LuaType luaGetType(lua_State* plua_state, int index)
-{
-    return (LuaType)lua_type(plua_state, index);
-}
-
-void luaPop(lua_State* plua_state, int count)
-{
-    lua_pop(plua_state, count);
-}
-
-int luaGetTop(lua_State* plua_state)
-{
-    return lua_gettop(plua_state);
-}
-
-void luaGetGlobal(lua_State* plua_state, const std::string& name)
-{
-    lua_getglobal(plua_state, name.c_str());
-}
-
-void luaSetGlobal(lua_State* plua_state, const std::string& name)
-{
-    lua_setglobal(plua_state, name.c_str());
-}
-
-int luaCallFunc(lua_State* plua_state, int nargs, int nrets)
-{
-    return lua_pcall(plua_state, nargs, nrets, 0);
-}
-
-void luaAssert(lua_State* plua_state, bool assertion, const std::string& str)
-{
-    if (!plua_state)
-        luaL_error(plua_state, "plua_state is null");
-
-    if (!assertion)
-        luaL_error(plua_state, "%s", str.c_str());
-}
-
-void luaError(lua_State* plua_state, const std::string& str)
-{
-    luaL_error(plua_state, "%s", str.c_str());
-}
-
-double luaToDouble(lua_State* plua_state, int index)
-{
-    return lua_tonumber(plua_state, index);
-}
-
-double luaToDouble(lua_State* plua_state, int index, double default_num)
-{
-    return lua_isnumber(plua_state, index) ? luaToDouble(plua_state, index) : default_num;
-}
-
-bool luaIsInteger(lua_State* plua_state, int index)
-{
-    return lua_isinteger(plua_state, index);
-}
-
-int luaToInteger(lua_State* plua_state, int index)
-{
-    return lua_tointeger(plua_state, index);
-}
-
-int luaToInteger(lua_State* plua_state, int index, int default_int)
-{
-    return lua_isinteger(plua_state, index) ? luaToInteger(plua_state, index) : default_int;
-}
-
-std::string luaToString(lua_State* plua_state, int index)
-{
-    const char* result = lua_tostring(plua_state, index);
-    if (!result)
-        luaError(plua_state, strFormat("luaToString from index %d failed.", index));
-
-    return std::string(lua_tostring(plua_state, index));
-}
-
-std::string luaToString(lua_State* plua_state, int index, const std::string& default_str)
-{
-    return lua_isstring(plua_state, index) ? luaToString(plua_state, index) : default_str.c_str();
-}
-
-bool luaToBoolean(lua_State* plua_state, int index)
-{
-    return (bool)lua_toboolean(plua_state, index);
-}
-
-bool luaToBoolean(lua_State* plua_state, int index, bool default_bool)
-{
-    return lua_isboolean(plua_state, index) ? luaToBoolean(plua_state, index) : default_bool;
-}
-
-void luaPushDouble(lua_State* plua_state, double double_val)
-{
-    lua_pushnumber(plua_state, double_val);
-}
-
-void luaPushInteger(lua_State* plua_state, int int_val)
-{
-    lua_pushinteger(plua_state, int_val);
-}
-
-void luaPushString(lua_State* plua_state, const std::string& str_val)
-{
-    lua_pushstring(plua_state, str_val.c_str());
-}
-
-void luaPushNil(lua_State* plua_state)
-{
-    lua_pushnil(plua_state);
-}
-
-void luaPushBoolean(lua_State* plua_state, bool boolean)
-{
-    lua_pushboolean(plua_state, boolean);
-}
-
-//luaGetError
-std::string luaGetError(lua_State* plua_state, int err)
-{
-    std::string error_str("");
-    if (0 == err)
-        return error_str;
-
-    std::string err_type;
-    switch (err)
-    {
-        case LUA_ERRSYNTAX: //compile-time error
-            err_type = "syntax error during pre-compilation";
-            break;
-        case LUA_ERRMEM: //memory error
-            err_type = "memory allocation error";
-            break;
-        case LUA_ERRRUN: //runtime-time error
-            err_type = "runtime error";
-            break;
-        case LUA_YIELD: //thread suspend error
-            err_type = "thread has been suspended";
-            break;
-        case LUA_ERRERR: //error while running
-            err_type = "error while running the error handler function";
-            break;
-        default:
-            err_type = "unknown";
-            break;
-    }
-
-    error_str = string("error(") + string(err_type.c_str()) + ") " + string(lua_tostring(plua_state, -1));
-    luaPop(plua_state, 1);
-
-    return error_str;
-}
-
-//luaParseLine
-int luaParseLine(lua_State* plua_state, const std::string& line, std::string& error_str)
-{
-    error_str = "";
-    if (0 == plua_state)
-        return -1;
-
-    int err = luaL_loadbuffer(plua_state, line.c_str(), line.length(), "line");
-    if (0 != err)
-    {
-        error_str = luaGetError(plua_state, err);
-        return err;
-    }
-
-    err = lua_pcall(plua_state, 0, 0, 0);
-    error_str = luaGetError(plua_state, err);
-
-    return err;
-}
-
-//luaParseFile
-int luaParseFile(lua_State* plua_state, const std::string& file, std::string& error_str)
-{
-    error_str = "";
-    if (0 == plua_state)
-        return -1;
-
-    int err = luaL_loadfile(plua_state, file.c_str());
-    if (0 != err)
-    {
-        error_str = luaGetError(plua_state, err);
-        return err;
-    }
-    err = lua_pcall(plua_state, 0, LUA_MULTRET, 0);
-    error_str = luaGetError(plua_state, err);
-    return err;
-}
-
-//LuaState definition
-class LuaState
-{
-public:
-    LuaState();
-    ~LuaState();
-    inline lua_State* getState() const { return plua_state_; }
-    inline std::string getError() const { return error_str; }
-    void registerFunction(const std::string& func_name, LuaCFunc lua_reg_func);
-    int parseLine(const std::string& line);
-    int parseFile(const std::string& file);
-    bool reset();
-
-    //get operate
-    inline int getType(int index) { return (int)luaGetType(getState(), index); }
-    inline double toDouble(int index) { return luaToDouble(getState(), index); }
-    inline double toDouble(int index, double default_num) { return luaToDouble(getState(), index, default_num); }
-    inline bool isInteger(int index) { return luaIsInteger(getState(), index); }
-    inline int toInteger(int index) { return luaToInteger(getState(), index); }
-    inline int toInteger(int index, int default_int) { return luaToInteger(getState(), index, default_int); }
-    inline std::string toString(int index) { return luaToString(getState(), index); }
-    inline std::string toString(int index, const std::string& default_str) { return luaToString(getState(), index, default_str); }
-    inline bool toBoolean(int index) { return luaToBoolean(getState(), index); }
-    inline bool toBoolean(int index, bool default_bool) { return luaToBoolean(getState(), index, default_bool); }
-
-    //push operate
-    inline void pushDouble(double value) { luaPushDouble(getState(), value); }
-    inline void pushInteger(int value) { luaPushInteger(getState(), value); }
-    inline void pushString(const std::string& value) { luaPushString(getState(), value); }
-    inline void pushNil() { luaPushNil(getState()); }
-    inline void pushBoolean(bool value) { luaPushBoolean(getState(), value); }
-
-    //other operate
-    inline void pop(int index) { luaPop(getState(), index); }
-    inline int getTop() { return luaGetTop(getState()); }
-    inline void getGlobal(const std::string& name) { luaGetGlobal(getState(), name); }
-    inline void setGlobal(const std::string& name) { luaSetGlobal(getState(), name); }
-private:
-    bool init();
-    void cleanup();
-    bool loadLibs();
-private:
-    lua_State* plua_state_;
-    std::string error_str;
-private:
-    DISALLOW_COPY_AND_ASSIGN(LuaState)
-};
-
 string getStringFromJni(JNIEnv *env, jstring str);
 
-//LuaState implementation
-LuaState::LuaState() :
-        plua_state_(0)
-{
-    init();
-}
-
-LuaState::~LuaState()
-{
-    cleanup();
-}
-
-bool LuaState::init()
-{
-    if (plua_state_)
-        return false;
-
-    plua_state_ = luaL_newstate();
-    loadLibs();
-
-    return true;
-}
-
-void LuaState::cleanup()
-{
-    if (plua_state_)
-        lua_close(plua_state_);
-
-    plua_state_ = 0;
-}
-
-bool LuaState::loadLibs()
-{
-    if (0 != plua_state_)
-    {
-        luaL_openlibs(plua_state_);
-        return true;
-    }
-    else
-    {
-        return false;
-    }
-}
-
-bool LuaState::reset()
-{
-    cleanup();
-    return init();
-}
-
-int LuaState::parseLine(const std::string& line)
-{
-    return luaParseLine(plua_state_, line, error_str);
-}
+#ifdef __cplusplus
 
-int LuaState::parseFile(const std::string& file)
+//LuaReaper::Destroy of LuaState
+void destroyLuaState(void* state)
 {
-    return luaParseFile(plua_state_, file, error_str);
+    delete static_cast<LuaState*>(state);
 }
 
-void LuaState::registerFunction(const std::string& func_name, LuaCFunc lua_reg_func) {
-    lua_register(plua_state_, func_name.c_str(), lua_reg_func);
-}
-
-#ifdef __cplusplus
-
 string getStringFromJni(JNIEnv *env, jstring str) {
     const char *char_str = env->GetStringUTFChars(str, 0);
     string stdstring(char_str);
@@ -360,11 +30,27 @@ Java_com_jmengxy_lualib_Lua_newLuaState(JNIEnv *env, jclass type) {
     return reinterpret_cast<jlong>(new LuaState());
 }
 
+JNIEXPORT jlong JNICALL
+Java_com_jmengxy_lualib_Lua_newLuaStateWithAllocator(JNIEnv *env, jclass type, jint allocator) {
+    return reinterpret_cast<jlong>(new LuaState(static_cast<LuaState::Allocator>(allocator)));
+}
+
 JNIEXPORT void JNICALL
 Java_com_jmengxy_lualib_Lua_deleteLuaState(JNIEnv *env, jclass type, jlong luaStatePtr) {
     delete reinterpret_cast<LuaState*>(luaStatePtr);
 }
 
+JNIEXPORT void JNICALL
+Java_com_jmengxy_lualib_Lua_deleteLuaStateAsync(JNIEnv *env, jclass type, jlong luaStatePtr) {
+    LuaState* state = reinterpret_cast<LuaState*>(luaStatePtr);
+    LuaReaper::instance().reap(state, destroyLuaState, state->getMemory());
+}
+
+JNIEXPORT jlong JNICALL
+Java_com_jmengxy_lualib_Lua_luaPendingCloseBytes(JNIEnv *env, jclass type) {
+    return (jlong) LuaReaper::instance().getPendingBytes();
+}
+
 JNIEXPORT jint JNICALL
 Java_com_jmengxy_lualib_Lua_luaParseLine(JNIEnv *env, jclass type, jlong luaStatePtr,
                                          jstring file) {
@@ -452,6 +138,107 @@ Java_com_jmengxy_lualib_Lua_luaToDouble(JNIEnv *env, jclass type, jlong luaState
     return (jdouble) (reinterpret_cast<LuaState*>(luaStatePtr)->toDouble(index, defaultValue));
 }
 
+JNIEXPORT void JNICALL
+Java_com_jmengxy_lualib_Lua_luaNewTable(JNIEnv *env, jclass type, jlong luaStatePtr, jint narr, jint nrec) {
+    reinterpret_cast<LuaState*>(luaStatePtr)->newTable(narr, nrec);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_jmengxy_lualib_Lua_luaClearTable(JNIEnv *env, jclass type, jlong luaStatePtr, jint index) {
+    return (jboolean) reinterpret_cast<LuaState*>(luaStatePtr)->clearTable(index);
+}
+
+JNIEXPORT jint JNICALL
+Java_com_jmengxy_lualib_Lua_luaGcStep(JNIEnv *env, jclass type, jlong luaStatePtr, jint budgetUs) {
+    return (jint) reinterpret_cast<LuaState*>(luaStatePtr)->gcStep(budgetUs);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_jmengxy_lualib_Lua_luaSetGcStats(JNIEnv *env, jclass type, jlong luaStatePtr, jboolean on) {
+    return (jboolean) reinterpret_cast<LuaState*>(luaStatePtr)->setGcStats(on);
+}
+
+//the fields of each cycle, in the order of the Lua.GcCycle constructor
+JNIEXPORT jlongArray JNICALL
+Java_com_jmengxy_lualib_Lua_luaGetGcCycles(JNIEnv *env, jclass type, jlong luaStatePtr) {
+    vector<lua_GCCycle> cycles;
+    reinterpret_cast<LuaState*>(luaStatePtr)->getGcCycles(cycles);
+    const size_t count = 10 + LUA_NUMTAGS;
+    vector<jlong> fields;
+    for (size_t i = 0; i < cycles.size(); i++)
+    {
+        const lua_GCCycle& c = cycles[i];
+        jlong cycle[count] = {c.start, c.end, c.propagate, c.atomic, c.sweep, c.finalizers, c.maxstep, c.before, c.after};
+        for (int t = 0; t < LUA_NUMTAGS; t++)
+            cycle[9 + t] = c.freed[t];
+        cycle[9 + LUA_NUMTAGS] = c.kind;
+        fields.insert(fields.end(), cycle, cycle + count);
+    }
+    jsize size = static_cast<jsize>(fields.size());
+    jlongArray array = env->NewLongArray(size);
+    if (array && size > 0)
+        env->SetLongArrayRegion(array, 0, size, &fields[0]);
+    return array;
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_jmengxy_lualib_Lua_luaSetAllocSites(JNIEnv *env, jclass type, jlong luaStatePtr, jboolean on) {
+    return (jboolean) reinterpret_cast<LuaState*>(luaStatePtr)->setAllocSites(on);
+}
+
+//one "bytes count site" line per site, see luaAllocSiteName
+JNIEXPORT jstring JNICALL
+Java_com_jmengxy_lualib_Lua_luaGetAllocSites(JNIEnv *env, jclass type, jlong luaStatePtr, jint top) {
+    vector<lua_AllocSite> sites;
+    reinterpret_cast<LuaState*>(luaStatePtr)->getAllocSites(top, sites);
+    string lines;
+    for (size_t i = 0; i < sites.size(); i++)
+        lines += strFormat("%lld %lld %s\n", (long long) sites[i].bytes, (long long) sites[i].count,
+                           luaAllocSiteName(sites[i]).c_str());
+    return env->NewStringUTF(lines.c_str());
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_jmengxy_lualib_Lua_luaSetOptimize(JNIEnv *env, jclass type, jlong luaStatePtr, jboolean on) {
+    return (jboolean) reinterpret_cast<LuaState*>(luaStatePtr)->setOptimize(on);
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_jmengxy_lualib_Lua_luaStartProfiler(JNIEnv *env, jclass type, jlong luaStatePtr, jint mode, jint period) {
+    return (jboolean) reinterpret_cast<LuaState*>(luaStatePtr)->startProfiler(mode, period);
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_jmengxy_lualib_Lua_luaStopProfiler(JNIEnv *env, jclass type, jlong luaStatePtr) {
+    return env->NewStringUTF(reinterpret_cast<LuaState*>(luaStatePtr)->stopProfiler().c_str());
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_jmengxy_lualib_Lua_luaGetProfileLines(JNIEnv *env, jclass type, jlong luaStatePtr, jint top) {
+    const LuaProfiler* profiler = reinterpret_cast<LuaState*>(luaStatePtr)->getProfiler();
+    return env->NewStringUTF(profiler ? profiler->getLines(top).c_str() : "");
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_jmengxy_lualib_Lua_luaStartTracer(JNIEnv *env, jclass type, jlong luaStatePtr, jint capacity) {
+    return (jboolean) reinterpret_cast<LuaState*>(luaStatePtr)->startTracer(capacity > 0 ? capacity : 0);
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_jmengxy_lualib_Lua_luaStopTracer(JNIEnv *env, jclass type, jlong luaStatePtr) {
+    return env->NewStringUTF(reinterpret_cast<LuaState*>(luaStatePtr)->stopTracer().c_str());
+}
+
+JNIEXPORT jstring JNICALL
+Java_com_jmengxy_lualib_Lua_luaGetHeapCensus(JNIEnv *env, jclass type, jlong luaStatePtr, jint top) {
+    return env->NewStringUTF(reinterpret_cast<LuaState*>(luaStatePtr)->getHeapCensus(top).c_str());
+}
+
+JNIEXPORT jboolean JNICALL
+Java_com_jmengxy_lualib_Lua_luaWriteHeapSnapshot(JNIEnv *env, jclass type, jlong luaStatePtr, jstring path) {
+    return (jboolean) reinterpret_cast<LuaState*>(luaStatePtr)->writeHeapSnapshot(getStringFromJni(env, path));
+}
+
 #ifdef __cplusplus
 }
 #endif
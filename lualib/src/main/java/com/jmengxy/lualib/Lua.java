@@ -18,6 +18,52 @@ public final class Lua {
     public static final int LUA_TYPE_THREAD = 8;
     public static final int LUA_TYPE_NUMTAGS = 9;
 
+    public static final int ALLOCATOR_MALLOC = 0;
+    public static final int ALLOCATOR_SLAB = 1;
+    public static final int ALLOCATOR_ARENA = 2;
+
+    public static final int PROFILER_INSTRUCTIONS = 0;
+    public static final int PROFILER_TIMER = 1;
+
+    //telemetry of one collection cycle of the Lua garbage collector, see getGcCycles
+    public static final class GcCycle {
+        public static final int KIND_INCREMENTAL = 0;
+        public static final int KIND_EMERGENCY = 1;
+        public static final int KIND_GENERATIONAL = 2;
+
+        //times in nanoseconds of a monotonic clock; phase times count only the collector's own work
+        public final long startNs;
+        public final long endNs;
+        public final long propagateNs;
+        public final long atomicNs;
+        public final long sweepNs;
+        public final long finalizersNs;
+        public final long maxStepNs;
+        //memory in use when the cycle started and finished
+        public final long bytesBefore;
+        public final long bytesAfter;
+        //objects freed, indexed by LUA_TYPE_*
+        public final long[] freed;
+        public final int kind;
+
+        private GcCycle(long[] fields, int offset) {
+            startNs = fields[offset];
+            endNs = fields[offset + 1];
+            propagateNs = fields[offset + 2];
+            atomicNs = fields[offset + 3];
+            sweepNs = fields[offset + 4];
+            finalizersNs = fields[offset + 5];
+            maxStepNs = fields[offset + 6];
+            bytesBefore = fields[offset + 7];
+            bytesAfter = fields[offset + 8];
+            freed = new long[LUA_TYPE_NUMTAGS];
+            System.arraycopy(fields, offset + 9, freed, 0, LUA_TYPE_NUMTAGS);
+            kind = (int) fields[offset + 9 + LUA_TYPE_NUMTAGS];
+        }
+    }
+
+    private static final int GC_CYCLE_FIELDS = 10 + LUA_TYPE_NUMTAGS;
+
     private static final String ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED = "Lua local object is destroyed!";
 
     static {
@@ -30,10 +76,22 @@ public final class Lua {
         luaState = newLuaState();
     }
 
+    //allocator is one of ALLOCATOR_*: with ALLOCATOR_SLAB, small Lua objects are allocated from size-class slabs
+    //of this state instead of malloc; with ALLOCATOR_ARENA, from a region that close() drops at once
+    public Lua(int allocator) {
+        luaState = newLuaStateWithAllocator(allocator);
+    }
+
     private static native long newLuaState();
 
+    private static native long newLuaStateWithAllocator(int allocator);
+
     private static native void deleteLuaState(long luaStatePtr);
 
+    private static native void deleteLuaStateAsync(long luaStatePtr);
+
+    private static native long luaPendingCloseBytes();
+
     private static native int luaParseLine(long luaStatePtr, String line);
 
     private static native int luaParseFile(long luaStatePtr, String file);
@@ -66,6 +124,36 @@ public final class Lua {
 
     private static native double luaToDouble(long luaStatePtr, int index, double defaultValue);
 
+    private static native void luaNewTable(long luaStatePtr, int narr, int nrec);
+
+    private static native boolean luaClearTable(long luaStatePtr, int index);
+
+    private static native int luaGcStep(long luaStatePtr, int budgetUs);
+
+    private static native boolean luaSetGcStats(long luaStatePtr, boolean on);
+
+    private static native long[] luaGetGcCycles(long luaStatePtr);
+
+    private static native boolean luaSetAllocSites(long luaStatePtr, boolean on);
+
+    private static native String luaGetAllocSites(long luaStatePtr, int top);
+
+    private static native boolean luaSetOptimize(long luaStatePtr, boolean on);
+
+    private static native boolean luaStartProfiler(long luaStatePtr, int mode, int period);
+
+    private static native String luaStopProfiler(long luaStatePtr);
+
+    private static native String luaGetProfileLines(long luaStatePtr, int top);
+
+    private static native boolean luaStartTracer(long luaStatePtr, int capacity);
+
+    private static native String luaStopTracer(long luaStatePtr);
+
+    private static native String luaGetHeapCensus(long luaStatePtr, int top);
+
+    private static native boolean luaWriteHeapSnapshot(long luaStatePtr, String path);
+
     public Pair<Boolean, String> parseLine(String line) {
         if (0 == luaState) {
             throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
@@ -191,6 +279,157 @@ public final class Lua {
         luaSetGlobal(luaState, name);
     }
 
+    //create global table 'name' with room for narr array elements and nrec other fields
+    public void newTable(String name, int narr, int nrec) {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        luaNewTable(luaState, narr, nrec);
+        luaSetGlobal(luaState, name);
+    }
+
+    //remove all elements of global table 'name' keeping its space, return false if it is not a table
+    public boolean clearTable(String name) {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        luaGetGlobal(luaState, name);
+        boolean cleared = luaClearTable(luaState, 1);
+        luaPop(luaState, -1);
+        return cleared;
+    }
+
+    //do garbage collection work for about budgetUs microseconds, even if the collector is stopped,
+    //return the percentage of the current cycle still to be done (0 when the cycle is finished)
+    public int gcStep(int budgetUs) {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        return luaGcStep(luaState, budgetUs);
+    }
+
+    //keep the telemetry of the last collection cycles (on) or drop it (off), return whether it was on
+    public boolean setGcStats(boolean on) {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        return luaSetGcStats(luaState, on);
+    }
+
+    //the last collection cycles finished since setGcStats(true), oldest first
+    public GcCycle[] getGcCycles() {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        long[] fields = luaGetGcCycles(luaState);
+        GcCycle[] cycles = new GcCycle[fields.length / GC_CYCLE_FIELDS];
+        for (int i = 0; i < cycles.length; i++) {
+            cycles[i] = new GcCycle(fields, i * GC_CYCLE_FIELDS);
+        }
+        return cycles;
+    }
+
+    //charge every allocation of the state to the line of Lua code running (on), or stop and drop the sites (off);
+    //return whether it was on
+    public boolean setAllocSites(boolean on) {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        return luaSetAllocSites(luaState, on);
+    }
+
+    //"bytes count source:line in function <source:line>" lines of the top sites that allocated most bytes since
+    //setAllocSites(true)
+    public String getAllocSites(int top) {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        return luaGetAllocSites(luaState, top);
+    }
+
+    //optimize the bytecode of the chunks compiled from source afterwards (on), or run it as compiled (off);
+    //return whether it was on
+    public boolean setOptimize(boolean on) {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        return luaSetOptimize(luaState, on);
+    }
+
+    //start sampling the Lua call stack, every period VM instructions with PROFILER_INSTRUCTIONS or about every
+    //period microseconds with PROFILER_TIMER; the samples of a previous run are dropped
+    public boolean startProfiler(int mode, int period) {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        return luaStartProfiler(luaState, mode, period);
+    }
+
+    //stop sampling and return the samples as collapsed stacks ("caller;...;callee count" lines), the input of
+    //flame graph tools
+    public String stopProfiler() {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        return luaStopProfiler(luaState);
+    }
+
+    //the top most sampled lines of the last profiler run, one "count function:line" per line
+    public String getProfileLines(int top) {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        return luaGetProfileLines(luaState, top);
+    }
+
+    //start recording every call and return of Lua and C functions, keeping the last capacity events
+    public boolean startTracer(int capacity) {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        return luaStartTracer(luaState, capacity);
+    }
+
+    //stop recording and return the events as Chrome trace-event JSON, to open in chrome://tracing or Perfetto
+    public String stopTracer() {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        return luaStopTracer(luaState);
+    }
+
+    //census of the objects of the state by type and size class ("type size_class objects bytes unreachable"
+    //lines), followed by the top objects retaining most memory ("retained self object path" lines)
+    public String getHeapCensus(int top) {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        return luaGetHeapCensus(luaState, top);
+    }
+
+    //write the object graph of the state to path as a .heapsnapshot file, to load in the Memory tab of Chrome DevTools
+    public boolean writeHeapSnapshot(String path) {
+        if (0 == luaState) {
+            throw new RuntimeException(ERROR_LUA_LOCAL_OBJECT_IS_DESTROYED);
+        }
+
+        return luaWriteHeapSnapshot(luaState, path);
+    }
+
     public void close() {
         if (luaState != 0) {
             deleteLuaState(luaState);
@@ -198,9 +437,24 @@ public final class Lua {
         }
     }
 
+    //like close, but the state is closed later on a background thread, so the caller does not wait for it;
+    //__gc metamethods of the state run on that thread. when too many states are already waiting, the state
+    //is closed here
+    public void closeAsync() {
+        if (luaState != 0) {
+            deleteLuaStateAsync(luaState);
+            luaState = 0;
+        }
+    }
+
+    //memory of the states waiting to be closed by closeAsync, in bytes
+    public static long getPendingCloseBytes() {
+        return luaPendingCloseBytes();
+    }
+
     @Override
     protected void finalize() throws Throwable {
-        close();
+        closeAsync();
         super.finalize();
     }
 }